@@ -0,0 +1,193 @@
+	.file   "out.s"
+	.option nopic
+	.text
+	.align 1
+	.globl  f
+	.type   f, @function
+f:
+	.hword 0x1101	#addi sp,sp,-32	# c.addi sp,-32
+	.hword 0xcc06	#sw ra,24(sp)	# c.swsp ra,24(sp)
+	.hword 0xca22	#sw s0,20(sp)	# c.swsp s0,20(sp)
+	.hword 0xc826	#sw s1,16(sp)	# c.swsp s1,16(sp)
+	.hword 0xc64a	#sw s2,12(sp)	# c.swsp s2,12(sp)
+	.hword 0xc44e	#sw s3,8(sp)	# c.swsp s3,8(sp)
+	.hword 0x1000	#addi s0,sp,32	# c.addi4spn s0,32
+	.hword 0x648d	#lui s1,0x3	# c.lui s1,0x3
+	.word 0x56848493	#addi s1,s1,1384
+	.hword 0x6949	#lui s2,0x12	# c.lui s2,0x12
+	.word 0xd2890913	#addi s2,s2,-728
+	.hword 0x69c9	#lui s3,0x12	# c.lui s3,0x12
+	.word 0xd2c98993	#addi s3,s3,-724
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x0525	#addi a0,a0,9	# c.addi a0,9
+	.word 0x00a48023	#sb a0,0(s1)
+.L0B:
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0xc121	#beqz a0,6e <.L0E>	# c.beqz a0,6e <.L0E>
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x0521	#addi a0,a0,8	# c.addi a0,8
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x052d	#addi a0,a0,11	# c.addi a0,11
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x050d	#addi a0,a0,3	# c.addi a0,3
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x0505	#addi a0,a0,1	# c.addi a0,1
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x14f1	#addi s1,s1,-4	# c.addi s1,-4
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x157d	#addi a0,a0,-1	# c.addi a0,-1
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0xbf7d	#j 2a <.L0B>	# c.j 2a <.L0B>
+.L0E:
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x0509	#addi a0,a0,2	# c.addi a0,2
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x051d	#addi a0,a0,7	# c.addi a0,7
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x050d	#addi a0,a0,3	# c.addi a0,3
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x0515	#addi a0,a0,5	# c.addi a0,5
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.hword 0x14f9	#addi s1,s1,-2	# c.addi s1,-2
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x053d	#addi a0,a0,15	# c.addi a0,15
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x050d	#addi a0,a0,3	# c.addi a0,3
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x1569	#addi a0,a0,-6	# c.addi a0,-6
+	.word 0x00a48023	#sb a0,0(s1)
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x1561	#addi a0,a0,-8	# c.addi a0,-8
+	.word 0x00a48023	#sb a0,0(s1)
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x0505	#addi a0,a0,1	# c.addi a0,1
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x0505	#addi a0,a0,1	# c.addi a0,1
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x0525	#addi a0,a0,9	# c.addi a0,9
+	.word 0x00a48023	#sb a0,0(s1)
+.L1B:
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0xc121	#beqz a0,15c <.L1E>	# c.beqz a0,15c <.L1E>
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x0521	#addi a0,a0,8	# c.addi a0,8
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x052d	#addi a0,a0,11	# c.addi a0,11
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x050d	#addi a0,a0,3	# c.addi a0,3
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x0505	#addi a0,a0,1	# c.addi a0,1
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x14f1	#addi s1,s1,-4	# c.addi s1,-4
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x157d	#addi a0,a0,-1	# c.addi a0,-1
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0xbf7d	#j 118 <.L1B>	# c.j 118 <.L1B>
+.L1E:
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x0509	#addi a0,a0,2	# c.addi a0,2
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x051d	#addi a0,a0,7	# c.addi a0,7
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x050d	#addi a0,a0,3	# c.addi a0,3
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x0515	#addi a0,a0,5	# c.addi a0,5
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.hword 0x14f9	#addi s1,s1,-2	# c.addi s1,-2
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x053d	#addi a0,a0,15	# c.addi a0,15
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x050d	#addi a0,a0,3	# c.addi a0,3
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x1569	#addi a0,a0,-6	# c.addi a0,-6
+	.word 0x00a48023	#sb a0,0(s1)
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x1561	#addi a0,a0,-8	# c.addi a0,-8
+	.word 0x00a48023	#sb a0,0(s1)
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x0505	#addi a0,a0,1	# c.addi a0,1
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.hword 0x0485	#addi s1,s1,1	# c.addi s1,1
+	.word 0x0004c503	#lbu a0,0(s1)
+	.hword 0x0505	#addi a0,a0,1	# c.addi a0,1
+	.word 0x00a48023	#sb a0,0(s1)
+	.hword 0x9902	#jalr s2	# c.jalr s2
+	.hword 0x49a2	#lw s3,8(sp)	# c.lwsp s3,8(sp)
+	.hword 0x4932	#lw s2,12(sp)	# c.lwsp s2,12(sp)
+	.hword 0x44c2	#lw s1,16(sp)	# c.lwsp s1,16(sp)
+	.hword 0x4452	#lw s0,20(sp)	# c.lwsp s0,20(sp)
+	.hword 0x40e2	#lw ra,24(sp)	# c.lwsp ra,24(sp)
+	.hword 0x6105	#addi sp,sp,32	# c.addi16sp 32
+	.hword 0x8082	#ret 	# c.jr ra
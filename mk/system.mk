@@ -14,6 +14,11 @@ compute_size = $(shell echo "obase=16; ibase=10; $(1)*$(MiB)" | bc)
 ifeq ($(CONFIG_SYSTEM),y)
 
 CFLAGS += -Isrc/dtc/libfdt
+
+# MMU TLB geometry, see src/riscv_private.h
+TLB_ENTRIES ?= $(or $(CONFIG_TLB_ENTRIES),1024)
+TLB_WAYS ?= $(or $(CONFIG_TLB_WAYS),4)
+CFLAGS += -DTLB_ENTRIES=$(TLB_ENTRIES) -DTLB_WAYS=$(TLB_WAYS)
 LIBFDT_HACK := $(shell git submodule update --init src/dtc 2>/dev/null)
 
 DEV_SRC := src/devices
@@ -51,11 +56,18 @@ $(DEV_OUT)/%.o: $(DEV_SRC)/%.c $(EFFECTIVE_CONFIG_STAMP) | $(DEV_OUT)
 	$(VECHO) "  CC\t$@\n"
 	$(Q)$(CC) -o $@ $(CFLAGS) $(CFLAGS_emcc) -c -MMD -MF $@.d $<
 
+# O_DIRECT for the vblk 'direct' option
+$(DEV_OUT)/virtio-blk.o: CFLAGS += -D_GNU_SOURCE
+
 DEV_OBJS := $(patsubst $(DEV_SRC)/%.c, $(DEV_OUT)/%.o, $(wildcard $(DEV_SRC)/*.c))
 # Enable Goldfish RTC peripheral
 ifneq ($(CONFIG_GOLDFISH_RTC),y)
 DEV_OBJS := $(filter-out $(DEV_OUT)/rtc.o, $(DEV_OBJS))
 endif
+# The PLIC only routes interrupts to the harts of a kernel boot
+ifeq ($(CONFIG_ELF_LOADER),y)
+DEV_OBJS := $(filter-out $(DEV_OUT)/plic.o, $(DEV_OBJS))
+endif
 deps := $(DEV_OBJS:%.o=%.o.d)
 
 OBJS_EXT += system.o
@@ -66,6 +78,9 @@ OBJS_EXT += dtc/libfdt/fdt.o dtc/libfdt/fdt_ro.o dtc/libfdt/fdt_rw.o dtc/libfdt/
 # Memory configuration for kernel mode (ELF_LOADER=n)
 ifneq ($(CONFIG_ELF_LOADER),y)
 
+# secondary harts run on their own host threads
+LDFLAGS += -pthread
+
 MEM_START ?= 0
 MEM_SIZE ?= 512
 DTB_SIZE ?= 1
@@ -17,6 +17,14 @@ $(eval $(call test-framework,map,test-map.o mt19937.o,$(OUT)/map.o,))
 # Path test: tests path utility functions
 $(eval $(call test-framework,path,test-path.o,$(OUT)/utils.o,))
 
+# JIT index test: tests the T1 offset_map hash index and times its lookups
+$(eval $(call test-framework,jit-index,test-jit-index.o,$(OUT)/jit_index.o,))
+
+# Instances test: runs many user-mode emulators concurrently in one process
+ifneq ($(CONFIG_SYSTEM),y)
+$(eval $(call test-framework,instances,test-instances.o,$(filter-out $(OUT)/main.o,$(OBJS)),))
+endif
+
 # Test Runners
 
 # Cache test uses file comparison (input -> output -> compare with expected)
@@ -25,10 +33,22 @@ $(eval $(call run-test-compare,cache,cache-new cache-put cache-get cache-replace
 # Map and path tests use simple exit code checking
 $(eval $(call run-test-simple,map))
 $(eval $(call run-test-simple,path))
+$(eval $(call run-test-simple,jit-index))
+
+# Instances test compares concurrent runs of prebuilt guests with solo runs
+INSTANCES_ELF_FILES := hello chacha20 ieee754
+run-test-instances: $(instances_TEST_TARGET)
+	$(VECHO) "Running test-instances ... "
+	$(Q)$< $(addprefix $(OUT)/,$(addsuffix .elf,$(INSTANCES_ELF_FILES))) \
+	    && $(call notice, [OK]) || { $(PRINTF) "Failed.\n"; exit 1; }
 
 # Main Test Target
 
-tests: run-test-cache run-test-map run-test-path
+TEST_TARGETS := run-test-cache run-test-map run-test-path run-test-jit-index
+ifneq ($(CONFIG_SYSTEM),y)
+TEST_TARGETS += run-test-instances
+endif
+tests: $(TEST_TARGETS)
 
 # Integration Tests (run emulator with test programs)
 
@@ -79,9 +99,32 @@ check-rvv-smoke: $(BIN)
 	$(Q)$(CROSS_COMPILE)gcc -march=rv32imfv_zicsr -mabi=ilp32f -nostdlib -static \
 	    tests/rvv-smoke.S -o $(OUT)/rvv-smoke.elf
 	$(call check-test, , $(OUT)/rvv-smoke.elf, rvv-smoke.elf, tail -n 1,$(EXPECTED_rvv_smoke))
+
+# Hot vector loops: exercises the tier-1 vector path when the JIT is enabled
+EXPECTED_rvv_loop = RVV loop OK
+CHECK_TARGETS += check-rvv-loop
+
+check-rvv-loop: $(BIN)
+	$(Q)$(CROSS_COMPILE)gcc -march=rv32imfv_zicsr -mabi=ilp32f -nostdlib -static \
+	    tests/rvv-loop.S -o $(OUT)/rvv-loop.elf
+	$(call check-test, , $(OUT)/rvv-loop.elf, rvv-loop.elf, tail -n 1,$(EXPECTED_rvv_loop))
+endif
+
+# Run the same guest cold, then warm from the persistent T1 code cache
+ifeq ($(CONFIG_JIT)$(CONFIG_EXT_M),yy)
+CHECK_TARGETS += check-jit-cache
+
+check-jit-cache: $(BIN) artifact
+	$(Q)$(RM) -r $(OUT)/jit-cache
+	$(call check-test, -c $(OUT)/jit-cache, $(OUT)/riscv32/pi, pi (cold code cache), uniq,$(EXPECTED_pi))
+	$(call check-test, -c $(OUT)/jit-cache, $(OUT)/riscv32/pi, pi (warm code cache), uniq,$(EXPECTED_pi))
 endif
 check: $(CHECK_TARGETS)
 
+# Guest streaming stdin to stdout, timed by the "io" benchmark of tests/bench.py
+$(OUT)/io-copy.elf: tests/io-copy.S
+	$(Q)$(CROSS_COMPILE)gcc -march=rv32i -mabi=ilp32 -nostdlib -static $< -o $@
+
 # System tests
 EXPECTED_aes_sha1 = 89169ec034bec1c6bb2c556b26728a736d350ca3  -
 misalign: $(BIN) artifact
@@ -95,7 +138,8 @@ EXPECTED_mmu = Store page fault test passed!
 mmu-test: $(BIN)
 	$(call check-test, , tests/system/mmu/vm.elf, vm.elf, tail -n 1,$(EXPECTED_mmu))
 
-.PHONY: tests run-test-cache run-test-map run-test-path
+.PHONY: tests run-test-cache run-test-map run-test-path run-test-jit-index
+.PHONY: run-test-instances
 .PHONY: check $(CHECK_TARGETS) misalign misalign-in-blk-emu mmu-test
 
 endif # _MK_TESTS_INCLUDED
@@ -23,6 +23,8 @@ HIST_OBJS := \
 	syscall_sdl.o \
 	io.o \
 	log.o \
+	stats.o \
+	snapshot.o \
 	rv_histogram.o
 
 HIST_OBJS := $(addprefix $(OUT)/, $(HIST_OBJS))
@@ -4,6 +4,9 @@
  */
 
 #include <assert.h>
+#if RV32_HAS(T2C)
+#include <sched.h>
+#endif
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -16,11 +19,6 @@
 #include "riscv_private.h"
 #include "utils.h"
 
-static uint32_t cache_size, cache_size_bits;
-
-/* hash function for the cache */
-HASH_FUNC_IMPL(cache_hash, cache_size_bits, cache_size)
-
 struct hlist_head {
     struct hlist_node *first;
 };
@@ -43,6 +41,15 @@ typedef struct {
     struct hlist_head *ht_list_head;
 } hashtable_t;
 
+#if RV32_HAS(T2C)
+/* A value or an entry unlinked while readers may still be standing on it */
+typedef struct {
+    void *value;          /* value to pass to the reclaim function, or NULL */
+    cache_entry_t *entry; /* entry dropped from the hash map, or NULL */
+    uint64_t epoch;       /* epoch the writer was in when retiring it */
+} cache_retired_t;
+#endif
+
 /*
  * The cache utilizes the degenerated adaptive replacement cache (ARC), which
  * has only least-recently-used (LRU) and ignores least-frequently-used (LFU)
@@ -70,6 +77,7 @@ typedef struct cache {
     uint32_t size;
     uint32_t ghost_list_size;
     uint32_t capacity;
+    uint32_t size_bits; /* log2 of the number of hash buckets */
 #if RV32_HAS(JIT) && RV32_HAS(SYSTEM) && RV32_HAS(BLOCK_CHAINING)
     /* Page index for O(1) invalidation by virtual address.
      * Each bucket contains a linked list of blocks starting in that page.
@@ -80,8 +88,36 @@ typedef struct cache {
      */
     bool page_index_incomplete;
 #endif
+#if RV32_HAS(T2C)
+    uint64_t epoch; /* advanced by the writer on every retirement */
+    /* epoch each reader entered the cache in, 0 while outside of it */
+    uint64_t *readers;
+    uint32_t n_readers;
+    cache_retired_t *retired; /* in the order of retirement */
+    uint32_t n_retired, retired_cap;
+#endif
 } cache_t;
 
+/* hash function for the cache: the golden-ratio hash of HASH_FUNC_IMPL() in
+ * utils.h, sized per cache since several caches may coexist in a process
+ */
+FORCE_INLINE uint32_t cache_hash(const cache_t *cache, rv_hash_key_t key)
+{
+    const uint32_t bits = cache->size_bits;
+#if RV32_HAS(JIT) && RV32_HAS(SYSTEM)
+    return (key * 0x61c8864680b583ebull >> (64 - bits)) & ((1U << bits) - 1);
+#else
+    return (key * 0x61C88647 >> (32 - bits)) & ((1U << bits) - 1);
+#endif
+}
+
+/* the hash bucket @key belongs to */
+FORCE_INLINE struct hlist_head *cache_bucket(const cache_t *cache,
+                                             uint32_t key)
+{
+    return &cache->map.ht_list_head[cache_hash(cache, key)];
+}
+
 #if RV32_HAS(JIT) && RV32_HAS(SYSTEM) && RV32_HAS(BLOCK_CHAINING)
 /* Forward declarations for page index functions */
 static void page_index_insert(cache_t *cache, block_t *block);
@@ -96,21 +132,22 @@ static inline void INIT_HLIST_NODE(struct hlist_node *h)
     h->pprev = NULL;
 }
 
-static inline int hlist_empty(const struct hlist_head *h)
-{
-    return !h->first;
-}
-
-static inline void hlist_add_head(struct hlist_node *n, struct hlist_head *h)
+/* The hash chains are walked by readers while the writer changes them, the
+ * way the _rcu variants of the Linux hlist work: a node is linked only once it
+ * is complete, and an unlinked node keeps pointing into the chain for the
+ * readers still on it, so that it may be freed only after a grace period.
+ */
+static inline void hlist_add_head_rcu(struct hlist_node *n,
+                                      struct hlist_head *h)
 {
 #ifndef __clang_analyzer__
     struct hlist_node *first = h->first;
     n->next = first;
+    n->pprev = &h->first;
     if (first)
         first->pprev = &n->next;
 
-    h->first = n;
-    n->pprev = &h->first;
+    ATOMIC_STORE(&h->first, n, ATOMIC_RELEASE);
 #endif
 }
 
@@ -119,22 +156,18 @@ static inline bool hlist_unhashed(const struct hlist_node *h)
     return !h->pprev;
 }
 
-static inline void hlist_del(struct hlist_node *n)
+static inline void hlist_del_rcu(struct hlist_node *n)
 {
+    if (hlist_unhashed(n))
+        return;
+
     struct hlist_node *next = n->next;
     struct hlist_node **pprev = n->pprev;
 
-    *pprev = next;
+    ATOMIC_STORE(pprev, next, ATOMIC_RELAXED);
     if (next)
         next->pprev = pprev;
-}
-
-static inline void hlist_del_init(struct hlist_node *n)
-{
-    if (hlist_unhashed(n))
-        return;
-    hlist_del(n);
-    INIT_HLIST_NODE(n);
+    n->pprev = NULL;
 }
 
 #define hlist_entry(ptr, type, member) container_of(ptr, type, member)
@@ -160,6 +193,14 @@ static inline void hlist_del_init(struct hlist_node *n)
     for (pos = hlist_entry_safe((head)->first, typeof(*pos), member); \
          pos && ({ n = pos->member.next; 1; });                       \
          pos = hlist_entry_safe(n, typeof(*pos), member))
+
+#define hlist_for_each_entry_rcu(pos, head, member)                         \
+    for (pos = hlist_entry_safe(ATOMIC_LOAD(&(head)->first, ATOMIC_ACQUIRE), \
+                                typeof(*(pos)), member);                     \
+         pos;                                                                \
+         pos = hlist_entry_safe(ATOMIC_LOAD(&(pos)->member.next,             \
+                                            ATOMIC_ACQUIRE),                 \
+                                typeof(*(pos)), member))
 #else
 #define hlist_for_each_entry(pos, head, member, type)              \
     for (pos = hlist_entry_safe((head)->first, type, member); pos; \
@@ -169,6 +210,13 @@ static inline void hlist_del_init(struct hlist_node *n)
     for (pos = hlist_entry_safe((head)->first, type, member); \
          pos && ({ n = pos->member.next; 1; });               \
          pos = hlist_entry_safe(n, type, member))
+
+#define hlist_for_each_entry_rcu(pos, head, member, type)                    \
+    for (pos = hlist_entry_safe(ATOMIC_LOAD(&(head)->first, ATOMIC_ACQUIRE), \
+                                type, member);                               \
+         pos;                                                                \
+         pos = hlist_entry_safe(                                             \
+             ATOMIC_LOAD(&(pos)->member.next, ATOMIC_ACQUIRE), type, member))
 #endif
 /* clang-format on */
 
@@ -182,8 +230,8 @@ cache_t *cache_create(uint32_t size_bits)
     if (!cache)
         return NULL;
 
-    cache_size_bits = size_bits;
-    cache_size = 1 << size_bits;
+    uint32_t cache_size = 1 << size_bits;
+    cache->size_bits = size_bits;
 
     INIT_LIST_HEAD(&cache->list);
     INIT_LIST_HEAD(&cache->ghost_list);
@@ -208,6 +256,13 @@ cache_t *cache_create(uint32_t size_bits)
     memset(cache->page_index, 0, sizeof(cache->page_index));
     cache->page_index_incomplete = false;
 #endif
+#if RV32_HAS(T2C)
+    cache->epoch = 1;
+    cache->readers = NULL;
+    cache->n_readers = 0;
+    cache->retired = NULL;
+    cache->n_retired = cache->retired_cap = 0;
+#endif
 
     return cache;
 
@@ -221,16 +276,12 @@ void *cache_get(const cache_t *cache, uint32_t key, bool update)
     if (unlikely(!cache->capacity))
         return NULL;
 
-    if (hlist_empty(&cache->map.ht_list_head[cache_hash(key)]))
-        return NULL;
-
     cache_entry_t *entry = NULL;
 #ifdef __HAVE_TYPEOF
-    hlist_for_each_entry (entry, &cache->map.ht_list_head[cache_hash(key)],
-                          ht_list)
+    hlist_for_each_entry_rcu (entry, cache_bucket(cache, key), ht_list)
 #else
-    hlist_for_each_entry (entry, &cache->map.ht_list_head[cache_hash(key)],
-                          ht_list, cache_entry_t)
+    hlist_for_each_entry_rcu (entry, cache_bucket(cache, key),
+                              ht_list, cache_entry_t)
 #endif
     {
         if (entry->key == key)
@@ -238,7 +289,7 @@ void *cache_get(const cache_t *cache, uint32_t key, bool update)
     }
 
     /* return NULL if cache miss */
-    if (!entry || entry->key != key || !entry->alive)
+    if (!entry || !ATOMIC_LOAD(&entry->alive, ATOMIC_RELAXED))
         return NULL;
 
     /*
@@ -257,6 +308,23 @@ void *cache_get(const cache_t *cache, uint32_t key, bool update)
     return entry->value;
 }
 
+#if RV32_HAS(T2C)
+static bool cache_retire_entry(cache_t *cache,
+                               void *value,
+                               cache_entry_t *entry);
+#endif
+
+/* free an entry unlinked from the hash map, once no reader is left on it */
+static void cache_entry_free(cache_t *cache UNUSED, cache_entry_t *entry)
+{
+#if RV32_HAS(T2C)
+    if (cache_retire_entry(cache, NULL, entry))
+        return;
+    cache_synchronize(cache);
+#endif
+    free(entry);
+}
+
 /*
  * When the size of ghost list reaches the limit, the oldest history is going to
  * be dropped. The stored information will be lost forever.
@@ -269,10 +337,10 @@ FORCE_INLINE void cache_ghost_list_update(cache_t *cache)
     cache_entry_t *entry =
         list_last_entry(&cache->ghost_list, cache_entry_t, list);
     assert(!entry->alive);
-    hlist_del_init(&entry->ht_list);
+    hlist_del_rcu(&entry->ht_list);
     list_del_init(&entry->list);
     cache->ghost_list_size--;
-    free(entry);
+    cache_entry_free(cache, entry);
 }
 
 /*
@@ -287,10 +355,9 @@ void *cache_put(cache_t *cache, uint32_t key, void *value)
 
     cache_entry_t *replaced = NULL, *revived = NULL, *entry;
 #ifdef __HAVE_TYPEOF
-    hlist_for_each_entry (entry, &cache->map.ht_list_head[cache_hash(key)],
-                          ht_list)
+    hlist_for_each_entry (entry, cache_bucket(cache, key), ht_list)
 #else
-    hlist_for_each_entry (entry, &cache->map.ht_list_head[cache_hash(key)],
+    hlist_for_each_entry (entry, cache_bucket(cache, key),
                           ht_list, cache_entry_t)
 #endif
     {
@@ -326,7 +393,7 @@ void *cache_put(cache_t *cache, uint32_t key, void *value)
         if (replaced_value)
             page_index_remove(cache, (block_t *) replaced_value);
 #endif
-        replaced->alive = false;
+        ATOMIC_STORE(&replaced->alive, false, ATOMIC_RELAXED);
         list_del_init(&replaced->list);
         cache->size--;
         list_add(&replaced->list, &cache->ghost_list);
@@ -337,7 +404,7 @@ void *cache_put(cache_t *cache, uint32_t key, void *value)
     if (unlikely(!new_entry)) {
         /* Allocation failed - restore replaced entry if exists */
         if (replaced) {
-            replaced->alive = true;
+            ATOMIC_STORE(&replaced->alive, true, ATOMIC_RELAXED);
             list_del_init(&replaced->list);
             list_add(&replaced->list, &cache->list);
             cache->size++;
@@ -357,15 +424,14 @@ void *cache_put(cache_t *cache, uint32_t key, void *value)
         new_entry->freq = 1;
     } else {
         new_entry->freq = revived->freq + 1;
-        hlist_del_init(&revived->ht_list);
+        hlist_del_rcu(&revived->ht_list);
         list_del_init(&revived->list);
         cache->ghost_list_size--;
-        free(revived);
+        cache_entry_free(cache, revived);
     }
 
     list_add(&new_entry->list, &cache->list);
-    hlist_add_head(&new_entry->ht_list,
-                   &cache->map.ht_list_head[cache_hash(key)]);
+    hlist_add_head_rcu(&new_entry->ht_list, cache_bucket(cache, key));
 
     cache->size++;
 
@@ -412,6 +478,13 @@ void cache_free(cache_t *cache)
                               cache_entry_t)
 #endif
         free(entry);
+#if RV32_HAS(T2C)
+    /* the values were reclaimed by the owner, see cache_reclaim() */
+    for (uint32_t i = 0; i < cache->n_retired; i++)
+        free(cache->retired[i].entry);
+    free(cache->retired);
+    free(cache->readers);
+#endif
     free(cache->map.ht_list_head);
     free(cache);
 }
@@ -421,48 +494,120 @@ uint32_t cache_freq(const struct cache *cache, uint32_t key)
     if (unlikely(!cache->capacity))
         return 0;
 
-    if (hlist_empty(&cache->map.ht_list_head[cache_hash(key)]))
-        return 0;
-
     cache_entry_t *entry = NULL;
 #ifdef __HAVE_TYPEOF
-    hlist_for_each_entry (entry, &cache->map.ht_list_head[cache_hash(key)],
-                          ht_list)
+    hlist_for_each_entry_rcu (entry, cache_bucket(cache, key), ht_list)
 #else
-    hlist_for_each_entry (entry, &cache->map.ht_list_head[cache_hash(key)],
-                          ht_list, cache_entry_t)
+    hlist_for_each_entry_rcu (entry, cache_bucket(cache, key),
+                              ht_list, cache_entry_t)
 #endif
     {
-        if (entry->key == key && entry->alive)
+        if (entry->key == key && ATOMIC_LOAD(&entry->alive, ATOMIC_RELAXED))
             return entry->freq;
     }
     return 0;
 }
 
-#if RV32_HAS(JIT)
-bool cache_hot(const struct cache *cache, uint32_t key)
+#if RV32_HAS(T2C)
+bool cache_set_readers(cache_t *cache, uint32_t n)
 {
-    if (unlikely(!cache->capacity))
+    uint64_t *readers = calloc(n ? n : 1, sizeof(uint64_t));
+    if (!readers)
         return false;
+    free(cache->readers);
+    cache->readers = readers;
+    cache->n_readers = n;
+    return true;
+}
 
-    if (hlist_empty(&cache->map.ht_list_head[cache_hash(key)]))
-        return false;
+void cache_read_lock(cache_t *cache, uint32_t reader)
+{
+    assert(reader < cache->n_readers);
+    ATOMIC_STORE(&cache->readers[reader],
+                 ATOMIC_LOAD(&cache->epoch, ATOMIC_ACQUIRE), ATOMIC_RELAXED);
+    /* Pairs with the fence in cache_oldest_reader(): either the writer sees
+     * this reader, or the reader sees everything unlinked before the writer
+     * looked.
+     */
+    ATOMIC_THREAD_FENCE(ATOMIC_SEQ_CST);
+}
 
-    cache_entry_t *entry = NULL;
-#ifdef __HAVE_TYPEOF
-    hlist_for_each_entry (entry, &cache->map.ht_list_head[cache_hash(key)],
-                          ht_list)
-#else
-    hlist_for_each_entry (entry, &cache->map.ht_list_head[cache_hash(key)],
-                          ht_list, cache_entry_t)
-#endif
-    {
-        if (entry->key == key && entry->alive && entry->freq >= THRESHOLD) {
-            return true;
-        }
+void cache_read_unlock(cache_t *cache, uint32_t reader)
+{
+    ATOMIC_STORE(&cache->readers[reader], 0, ATOMIC_RELEASE);
+}
+
+/* the oldest epoch a reader is still in, UINT64_MAX if none is inside */
+static uint64_t cache_oldest_reader(const cache_t *cache)
+{
+    ATOMIC_THREAD_FENCE(ATOMIC_SEQ_CST);
+    uint64_t oldest = UINT64_MAX;
+    for (uint32_t i = 0; i < cache->n_readers; i++) {
+        uint64_t epoch = ATOMIC_LOAD(&cache->readers[i], ATOMIC_ACQUIRE);
+        if (epoch && epoch < oldest)
+            oldest = epoch;
+    }
+    return oldest;
+}
+
+static bool cache_retire_entry(cache_t *cache,
+                               void *value,
+                               cache_entry_t *entry)
+{
+    if (cache->n_retired == cache->retired_cap) {
+        uint32_t cap = cache->retired_cap ? cache->retired_cap * 2 : 64;
+        cache_retired_t *retired =
+            realloc(cache->retired, cap * sizeof(cache_retired_t));
+        if (unlikely(!retired))
+            return false;
+        cache->retired = retired;
+        cache->retired_cap = cap;
+    }
+    cache->retired[cache->n_retired++] =
+        (cache_retired_t){value, entry, cache->epoch};
+    /* readers entering from now on no longer find what was retired */
+    ATOMIC_STORE(&cache->epoch, cache->epoch + 1, ATOMIC_RELEASE);
+    return true;
+}
+
+bool cache_retire(cache_t *cache, void *value)
+{
+    return cache_retire_entry(cache, value, NULL);
+}
+
+void cache_synchronize(cache_t *cache)
+{
+    const uint64_t epoch = cache->epoch;
+    ATOMIC_STORE(&cache->epoch, epoch + 1, ATOMIC_RELEASE);
+    while (cache_oldest_reader(cache) <= epoch)
+        sched_yield();
+}
+
+/* Disable UBSAN function pointer type check for the indirect call, see
+ * clear_cache_hot().
+ */
+DISABLE_UBSAN_FUNC
+void cache_reclaim(cache_t *cache, reclaim_func_t func, void *arg)
+{
+    if (!cache->n_retired)
+        return;
+
+    const uint64_t oldest = cache_oldest_reader(cache);
+    uint32_t i = 0;
+    for (; i < cache->n_retired && cache->retired[i].epoch < oldest; i++) {
+        if (cache->retired[i].value)
+            func(arg, cache->retired[i].value);
+        free(cache->retired[i].entry);
     }
-    return false;
+    if (!i)
+        return;
+    cache->n_retired -= i;
+    memmove(cache->retired, cache->retired + i,
+            cache->n_retired * sizeof(cache_retired_t));
 }
+#endif
+
+#if RV32_HAS(JIT)
 void cache_profile(const struct cache *cache,
                    FILE *output_file,
                    prof_func_t func)
@@ -553,10 +698,10 @@ static void page_index_remove(cache_t *cache, block_t *block)
 #endif /* RV32_HAS(JIT) && RV32_HAS(SYSTEM) && RV32_HAS(BLOCK_CHAINING) */
 
 #if RV32_HAS(JIT) && RV32_HAS(SYSTEM)
-/* Thread safety note: These invalidation functions assume single-threaded
- * execution. The rv32emu JIT operates in a single-threaded model where
- * compilation and execution do not occur concurrently. If this assumption
- * changes, appropriate locking must be added around cache->list traversal.
+/* Thread safety note: like cache_put(), these invalidation functions run on
+ * the thread owning the cache only. The T2C workers never walk cache->list,
+ * and a block they are compiling while it gets invalidated keeps its memory
+ * until they leave the cache, see cache_read_lock().
  */
 
 uint32_t cache_invalidate_satp(cache_t *cache, uint32_t satp)
@@ -588,6 +733,44 @@ uint32_t cache_invalidate_satp(cache_t *cache, uint32_t satp)
     return count;
 }
 
+uint32_t cache_invalidate_pages(cache_t *cache,
+                                const uint32_t *pages,
+                                uint32_t n_pages)
+{
+    if (unlikely(!cache->capacity))
+        return 0;
+
+    uint32_t count = 0;
+    cache_entry_t *entry = NULL;
+#ifdef __HAVE_TYPEOF
+    list_for_each_entry (entry, &cache->list, list)
+#else
+    list_for_each_entry (entry, &cache->list, list, cache_entry_t)
+#endif
+    {
+        block_t *block = (block_t *) entry->value;
+        if (!block || block->invalidated)
+            continue;
+
+        /* a block spans two pages at most, see block_translate() */
+        bool hit = false;
+        for (int i = 0; i < 2; i++) {
+            const uint32_t page = block->code_page[i];
+            if (page < n_pages)
+                hit |= (pages[page / 32] >> (page % 32)) & 1;
+        }
+        if (hit) {
+            block->invalidated = true;
+#if RV32_HAS(T2C)
+            /* Reset hot2 to prevent T2C execution of invalidated blocks */
+            ATOMIC_STORE(&block->hot2, false, ATOMIC_RELEASE);
+#endif
+            count++;
+        }
+    }
+    return count;
+}
+
 uint32_t cache_invalidate_va(cache_t *cache, uint32_t va, uint32_t satp)
 {
     if (unlikely(!cache->capacity))
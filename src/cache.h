@@ -15,6 +15,18 @@
  */
 #define THRESHOLD 4096
 
+/* THRESHOLD is only the floor. Each eviction of T1 code doubles the
+ * threshold of the hart, up to THRESHOLD << HOT_SHIFT_MAX, and every
+ * HOT_CALM translations that fit without one halve it again.
+ */
+#define HOT_SHIFT_MAX 4
+#define HOT_CALM 64
+
+/* Back-edges that T1 code takes before it returns to the dispatcher, which
+ * then counts them as invocations of the loop head towards T2C.
+ */
+#define LOOP_BUDGET THRESHOLD
+
 struct cache;
 
 /** cache_create - create a new cache
@@ -49,14 +61,6 @@ void *cache_put(struct cache *cache, uint32_t key, void *value);
 void cache_free(struct cache *cache);
 
 #if RV32_HAS(JIT)
-/**
- * cache_hot - check whether the frequency of the cache entry exceeds the
- * threshold or not
- * @cache: a pointer points to target cache
- * @key: the key of the specified entry
- */
-bool cache_hot(const struct cache *cache, uint32_t key);
-
 typedef void (*prof_func_t)(void *, uint32_t, FILE *);
 void cache_profile(const struct cache *cache,
                    FILE *output_file,
@@ -65,6 +69,68 @@ typedef void (*clear_func_t)(void *);
 void clear_cache_hot(const struct cache *cache, clear_func_t func);
 #endif
 
+#if RV32_HAS(T2C)
+/* The thread that creates a cache is the only one to modify it, while the
+ * reader threads set up by cache_set_readers(), the T2C workers, may look
+ * entries up at the same time. Neither side ever waits for the other: a reader
+ * announces the epoch it entered the cache in, and whatever the writer unlinks
+ * from then on is retired rather than freed, until every reader that might
+ * still hold it has left.
+ */
+
+/**
+ * cache_set_readers - make room for the reader threads
+ * @cache: a pointer points to target cache
+ * @n: the number of reader threads
+ *
+ * Must be called before any reader enters the cache. Returns false if the
+ * epoch slots cannot be allocated.
+ */
+bool cache_set_readers(struct cache *cache, uint32_t n);
+
+/**
+ * cache_read_lock - enter a read-side critical section
+ * @cache: a pointer points to target cache
+ * @reader: the index of the reading thread, below the count given to
+ *          cache_set_readers()
+ *
+ * Values returned by cache_get() stay allocated until cache_read_unlock(),
+ * even if they are evicted in the meantime.
+ */
+void cache_read_lock(struct cache *cache, uint32_t reader);
+
+/**
+ * cache_read_unlock - leave a read-side critical section
+ * @cache: a pointer points to target cache
+ * @reader: the index passed to cache_read_lock()
+ */
+void cache_read_unlock(struct cache *cache, uint32_t reader);
+
+/**
+ * cache_retire - defer freeing a value the cache no longer holds
+ * @cache: a pointer points to target cache
+ * @value: the value replaced by cache_put()
+ * @return: false if the value could not be recorded, in which case the
+ *          caller has to cache_synchronize() before freeing it itself
+ */
+bool cache_retire(struct cache *cache, void *value);
+
+/**
+ * cache_synchronize - wait until no reader can hold a retired value
+ * @cache: a pointer points to target cache
+ */
+void cache_synchronize(struct cache *cache);
+
+/**
+ * cache_reclaim - free the retired values no reader can hold any more
+ * @cache: a pointer points to target cache
+ * @func: a function freeing a value, called with @arg and the value
+ * @arg: the first argument of @func
+ */
+typedef void (*reclaim_func_t)(void *, void *);
+void cache_reclaim(struct cache *cache, reclaim_func_t func, void *arg);
+#endif
+
 uint32_t cache_freq(const struct cache *cache, uint32_t key);
 
 #if RV32_HAS(JIT) && RV32_HAS(SYSTEM)
@@ -94,6 +160,20 @@ uint32_t cache_invalidate_satp(struct cache *cache, uint32_t satp);
  */
 uint32_t cache_invalidate_va(struct cache *cache, uint32_t va, uint32_t satp);
 
+/**
+ * cache_invalidate_pages - invalidate blocks fetched from physical pages
+ * @cache: a pointer to target cache
+ * @pages: bitmap of the 4 KiB physical pages, one bit per page
+ * @n_pages: number of pages in the bitmap
+ * @return: number of blocks invalidated
+ *
+ * This is used by FENCE.I to invalidate the blocks of all address spaces
+ * whose code was written since it was translated.
+ */
+uint32_t cache_invalidate_pages(struct cache *cache,
+                                const uint32_t *pages,
+                                uint32_t n_pages);
+
 #if RV32_HAS(BLOCK_CHAINING)
 /* Page index for O(1) cache invalidation by virtual address.
  * With page-bounded blocks, each block fits entirely within one 4KB page,
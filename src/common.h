@@ -260,6 +260,10 @@ static inline uint8_t ilog2(uint32_t x)
 #define ATOMIC_STORE(ptr, val, order) __atomic_store_n(ptr, val, order)
 #define ATOMIC_FETCH_ADD(ptr, val, order) __atomic_fetch_add(ptr, val, order)
 #define ATOMIC_FETCH_SUB(ptr, val, order) __atomic_fetch_sub(ptr, val, order)
+#define ATOMIC_FETCH_AND(ptr, val, order) __atomic_fetch_and(ptr, val, order)
+#define ATOMIC_FETCH_OR(ptr, val, order) __atomic_fetch_or(ptr, val, order)
+#define ATOMIC_FETCH_XOR(ptr, val, order) __atomic_fetch_xor(ptr, val, order)
+#define ATOMIC_THREAD_FENCE(order) __atomic_thread_fence(order)
 #define ATOMIC_EXCHANGE(ptr, val, order) __atomic_exchange_n(ptr, val, order)
 #define ATOMIC_COMPARE_EXCHANGE_WEAK(ptr, expected, desired, succ, fail) \
     __atomic_compare_exchange_n(ptr, expected, desired, 1, succ, fail)
@@ -286,6 +290,13 @@ static inline uint8_t ilog2(uint32_t x)
     atomic_fetch_add_explicit((_Atomic __typeof__(*(ptr)) *) (ptr), val, order)
 #define ATOMIC_FETCH_SUB(ptr, val, order) \
     atomic_fetch_sub_explicit((_Atomic __typeof__(*(ptr)) *) (ptr), val, order)
+#define ATOMIC_FETCH_AND(ptr, val, order) \
+    atomic_fetch_and_explicit((_Atomic __typeof__(*(ptr)) *) (ptr), val, order)
+#define ATOMIC_FETCH_OR(ptr, val, order) \
+    atomic_fetch_or_explicit((_Atomic __typeof__(*(ptr)) *) (ptr), val, order)
+#define ATOMIC_FETCH_XOR(ptr, val, order) \
+    atomic_fetch_xor_explicit((_Atomic __typeof__(*(ptr)) *) (ptr), val, order)
+#define ATOMIC_THREAD_FENCE(order) atomic_thread_fence(order)
 #define ATOMIC_EXCHANGE(ptr, val, order) \
     atomic_exchange_explicit((_Atomic __typeof__(*(ptr)) *) (ptr), val, order)
 #define ATOMIC_COMPARE_EXCHANGE_WEAK(ptr, expected, desired, succ, fail) \
@@ -318,6 +329,11 @@ static inline uint8_t ilog2(uint32_t x)
     ((*(ptr) += (val)) - (val)) /* return old value */
 #define ATOMIC_FETCH_SUB(ptr, val, order) \
     ((*(ptr) -= (val)) + (val)) /* return old value */
+/* The bitwise forms return the NEW value as well. */
+#define ATOMIC_FETCH_AND(ptr, val, order) (*(ptr) &= (val))
+#define ATOMIC_FETCH_OR(ptr, val, order) (*(ptr) |= (val))
+#define ATOMIC_FETCH_XOR(ptr, val, order) (*(ptr) ^= (val))
+#define ATOMIC_THREAD_FENCE(order) ((void) 0)
 /* ATOMIC_EXCHANGE cannot return old value without statement expressions.
  * This returns NEW value - callers must not rely on return value. */
 #define ATOMIC_EXCHANGE(ptr, val, order) (*(ptr) = (val))
@@ -1009,6 +1009,7 @@ static inline bool op_system(rv_insn_t *ir, const uint32_t insn)
     case 0:
         if ((insn >> 25) == 0b0001001) { /* SFENCE.VMA */
             ir->opcode = rv_insn_sfencevma;
+            ir->rs2 = decode_rs2(insn);
             break;
         }
 
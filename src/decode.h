@@ -77,7 +77,7 @@ enum op_field {
     _(ecall, 1, 4, 1, ENC(rs1, rd))                    \
     _(ebreak, 1, 4, 1, ENC(rs1, rd))                   \
     /* RISC-V Privileged Instruction */                \
-    _(wfi, 0, 4, 0, ENC(rs1, rd))                      \
+    _(wfi, 1, 4, 0, ENC(rs1, rd))                      \
     _(uret, 0, 4, 0, ENC(rs1, rd))                     \
     IIF(RV32_HAS(SYSTEM))(                             \
         _(sret, 1, 4, 0, ENC(rs1, rd))                 \
@@ -155,46 +155,46 @@ enum op_field {
     )                                                  \
     /* RV32A Standard Extension */                     \
     IIF(RV32_HAS(EXT_A))(                              \
-        _(lrw, 0, 4, 0, ENC(rs1, rs2, rd))             \
-        _(scw, 0, 4, 0, ENC(rs1, rs2, rd))             \
-        _(amoswapw, 0, 4, 0, ENC(rs1, rs2, rd))        \
-        _(amoaddw, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(amoxorw, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(amoandw, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(amoorw, 0, 4, 0, ENC(rs1, rs2, rd))          \
-        _(amominw, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(amomaxw, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(amominuw, 0, 4, 0, ENC(rs1, rs2, rd))        \
-        _(amomaxuw, 0, 4, 0, ENC(rs1, rs2, rd))        \
+        _(lrw, 0, 4, 1, ENC(rs1, rs2, rd))             \
+        _(scw, 0, 4, 1, ENC(rs1, rs2, rd))             \
+        _(amoswapw, 0, 4, 1, ENC(rs1, rs2, rd))        \
+        _(amoaddw, 0, 4, 1, ENC(rs1, rs2, rd))         \
+        _(amoxorw, 0, 4, 1, ENC(rs1, rs2, rd))         \
+        _(amoandw, 0, 4, 1, ENC(rs1, rs2, rd))         \
+        _(amoorw, 0, 4, 1, ENC(rs1, rs2, rd))          \
+        _(amominw, 0, 4, 1, ENC(rs1, rs2, rd))         \
+        _(amomaxw, 0, 4, 1, ENC(rs1, rs2, rd))         \
+        _(amominuw, 0, 4, 1, ENC(rs1, rs2, rd))        \
+        _(amomaxuw, 0, 4, 1, ENC(rs1, rs2, rd))        \
     )                                                  \
     /* RV32F Standard Extension */                     \
     IIF(RV32_HAS(EXT_F))(                              \
-        _(flw, 0, 4, 0, ENC(rs1, rd))                  \
-        _(fsw, 0, 4, 0, ENC(rs1, rs2))                 \
-        _(fmadds, 0, 4, 0, ENC(rs1, rs2, rs3, rd))     \
-        _(fmsubs, 0, 4, 0, ENC(rs1, rs2, rs3, rd))     \
-        _(fnmsubs, 0, 4, 0, ENC(rs1, rs2, rs3, rd))    \
-        _(fnmadds, 0, 4, 0, ENC(rs1, rs2, rs3, rd))    \
-        _(fadds, 0, 4, 0, ENC(rs1, rs2, rd))           \
-        _(fsubs, 0, 4, 0, ENC(rs1, rs2, rd))           \
-        _(fmuls, 0, 4, 0, ENC(rs1, rs2, rd))           \
-        _(fdivs, 0, 4, 0, ENC(rs1, rs2, rd))           \
-        _(fsqrts, 0, 4, 0, ENC(rs1, rs2, rd))          \
-        _(fsgnjs, 0, 4, 0, ENC(rs1, rs2, rd))          \
-        _(fsgnjns, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(fsgnjxs, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(fmins, 0, 4, 0, ENC(rs1, rs2, rd))           \
-        _(fmaxs, 0, 4, 0, ENC(rs1, rs2, rd))           \
-        _(fcvtws, 0, 4, 0, ENC(rs1, rs2, rd))          \
-        _(fcvtwus, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(fmvxw, 0, 4, 0, ENC(rs1, rs2, rd))           \
-        _(feqs, 0, 4, 0, ENC(rs1, rs2, rd))            \
-        _(flts, 0, 4, 0, ENC(rs1, rs2, rd))            \
-        _(fles, 0, 4, 0, ENC(rs1, rs2, rd))            \
-        _(fclasss, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(fcvtsw, 0, 4, 0, ENC(rs1, rs2, rd))          \
-        _(fcvtswu, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(fmvwx, 0, 4, 0, ENC(rs1, rs2, rd))           \
+        _(flw, 0, 4, 1, ENC(rs1, rd))                  \
+        _(fsw, 0, 4, 1, ENC(rs1, rs2))                 \
+        _(fmadds, 0, 4, 1, ENC(rs1, rs2, rs3, rd))     \
+        _(fmsubs, 0, 4, 1, ENC(rs1, rs2, rs3, rd))     \
+        _(fnmsubs, 0, 4, 1, ENC(rs1, rs2, rs3, rd))    \
+        _(fnmadds, 0, 4, 1, ENC(rs1, rs2, rs3, rd))    \
+        _(fadds, 0, 4, 1, ENC(rs1, rs2, rd))           \
+        _(fsubs, 0, 4, 1, ENC(rs1, rs2, rd))           \
+        _(fmuls, 0, 4, 1, ENC(rs1, rs2, rd))           \
+        _(fdivs, 0, 4, 1, ENC(rs1, rs2, rd))           \
+        _(fsqrts, 0, 4, 1, ENC(rs1, rs2, rd))          \
+        _(fsgnjs, 0, 4, 1, ENC(rs1, rs2, rd))          \
+        _(fsgnjns, 0, 4, 1, ENC(rs1, rs2, rd))         \
+        _(fsgnjxs, 0, 4, 1, ENC(rs1, rs2, rd))         \
+        _(fmins, 0, 4, 1, ENC(rs1, rs2, rd))           \
+        _(fmaxs, 0, 4, 1, ENC(rs1, rs2, rd))           \
+        _(fcvtws, 0, 4, 1, ENC(rs1, rs2, rd))          \
+        _(fcvtwus, 0, 4, 1, ENC(rs1, rs2, rd))         \
+        _(fmvxw, 0, 4, 1, ENC(rs1, rs2, rd))           \
+        _(feqs, 0, 4, 1, ENC(rs1, rs2, rd))            \
+        _(flts, 0, 4, 1, ENC(rs1, rs2, rd))            \
+        _(fles, 0, 4, 1, ENC(rs1, rs2, rd))            \
+        _(fclasss, 0, 4, 1, ENC(rs1, rs2, rd))         \
+        _(fcvtsw, 0, 4, 1, ENC(rs1, rs2, rd))          \
+        _(fcvtswu, 0, 4, 1, ENC(rs1, rs2, rd))         \
+        _(fmvwx, 0, 4, 1, ENC(rs1, rs2, rd))           \
     )                                                  \
     /* RV32C Standard Extension */                     \
     IIF(RV32_HAS(EXT_C))(                              \
@@ -236,13 +236,13 @@ enum op_field {
     /* Vector Extension */                             \
     IIF(RV32_HAS(EXT_V))(                              \
         /* Configuration-setting Instructions */       \
-        _(vsetvli, 0, 4, 0, ENC(rs1, rd))              \
-        _(vsetivli, 0, 4, 0, ENC(rs1, rd))             \
+        _(vsetvli, 0, 4, 1, ENC(rs1, rd))              \
+        _(vsetivli, 0, 4, 1, ENC(rs1, rd))             \
         _(vsetvl, 0, 4, 0, ENC(rs1, rd))               \
         /* Vector Load instructions */                 \
-        _(vle8_v, 0, 4, 0, ENC(rs1, vd))               \
-        _(vle16_v, 0, 4, 0, ENC(rs1, vd))              \
-        _(vle32_v, 0, 4, 0, ENC(rs1, vd))              \
+        _(vle8_v, 0, 4, 1, ENC(rs1, vd))               \
+        _(vle16_v, 0, 4, 1, ENC(rs1, vd))              \
+        _(vle32_v, 0, 4, 1, ENC(rs1, vd))              \
         _(vle64_v, 0, 4, 0, ENC(rs1, vd))              \
         _(vlseg2e8_v, 0, 4, 0, ENC(rs1, vd))           \
         _(vlseg3e8_v, 0, 4, 0, ENC(rs1, vd))           \
@@ -418,9 +418,9 @@ enum op_field {
         _(vloxseg7ei64_v, 0, 4, 0, ENC(rs1, vd))       \
         _(vloxseg8ei64_v, 0, 4, 0, ENC(rs1, vd))       \
         /* Vector store instructions */                \
-        _(vse8_v, 0, 4, 0, ENC(rs1, vd))               \
-        _(vse16_v, 0, 4, 0, ENC(rs1, vd))              \
-        _(vse32_v, 0, 4, 0, ENC(rs1, vd))              \
+        _(vse8_v, 0, 4, 1, ENC(rs1, vd))               \
+        _(vse16_v, 0, 4, 1, ENC(rs1, vd))              \
+        _(vse32_v, 0, 4, 1, ENC(rs1, vd))              \
         _(vse64_v, 0, 4, 0, ENC(rs1, vd))              \
         _(vsseg2e8_v, 0, 4, 0, ENC(rs1, vd))           \
         _(vsseg3e8_v, 0, 4, 0, ENC(rs1, vd))           \
@@ -553,11 +553,11 @@ enum op_field {
         _(vsoxseg8ei64_v, 0, 4, 0, ENC(rs1, vd))       \
         /* Vector Arithmetic instructions */           \
         /* OPI */                                      \
-        _(vadd_vv, 0, 4, 0, ENC(rs1, rs2, vd))         \
-        _(vadd_vx, 0, 4, 0, ENC(rs1, rs2, vd))         \
-        _(vadd_vi, 0, 4, 0, ENC(rs2, rd))              \
-        _(vsub_vv, 0, 4, 0, ENC(rs1, rs2, vd))         \
-        _(vsub_vx, 0, 4, 0, ENC(rs1, rs2, vd))         \
+        _(vadd_vv, 0, 4, 1, ENC(rs1, rs2, vd))         \
+        _(vadd_vx, 0, 4, 1, ENC(rs1, rs2, vd))         \
+        _(vadd_vi, 0, 4, 1, ENC(rs2, rd))              \
+        _(vsub_vv, 0, 4, 1, ENC(rs1, rs2, vd))         \
+        _(vsub_vx, 0, 4, 1, ENC(rs1, rs2, vd))         \
         _(vrsub_vx, 0, 4, 0, ENC(rs1, rs2, vd))        \
         _(vrsub_vi, 0, 4, 0, ENC(rs2, rd))             \
         _(vminu_vv, 0, 4, 0, ENC(rs1, rs2, vd))        \
@@ -599,8 +599,8 @@ enum op_field {
         _(vmerge_vxm, 0, 4, 0, ENC(rs1, rs2, vd))       \
         _(vmerge_vim, 0, 4, 0, ENC(rs2, rd))            \
         _(vmv_v_v, 0, 4, 0, ENC(rs1, rs2, vd))          \
-        _(vmv_v_x, 0, 4, 0, ENC(rs1, rs2, vd))          \
-        _(vmv_v_i, 0, 4, 0, ENC(rs2, rd))               \
+        _(vmv_v_x, 0, 4, 1, ENC(rs1, rs2, vd))          \
+        _(vmv_v_i, 0, 4, 1, ENC(rs2, rd))               \
         _(vmseq_vv, 0, 4, 0, ENC(rs1, rs2, vd))        \
         _(vmseq_vx, 0, 4, 0, ENC(rs1, rs2, vd))        \
         _(vmseq_vi, 0, 4, 0, ENC(rs2, rd))             \
@@ -663,7 +663,7 @@ enum op_field {
         _(vwredsumu_vs, 0, 4, 0, ENC(rs1, rs2, vd))    \
         _(vwredsum_vs, 0, 4, 0, ENC(rs1, rs2, vd))     \
         /* OPM */                                         \
-        _(vredsum_vs, 0, 4, 0, ENC(rs1, rs2, vd))         \
+        _(vredsum_vs, 0, 4, 1, ENC(rs1, rs2, vd))         \
         _(vredand_vs, 0, 4, 0, ENC(rs1, rs2, vd))         \
         _(vredor_vs, 0, 4, 0, ENC(rs1, rs2, vd))          \
         _(vredxor_vs, 0, 4, 0, ENC(rs1, rs2, vd))         \
@@ -700,8 +700,8 @@ enum op_field {
         _(vrem_vx, 0, 4, 0, ENC(rs1, rs2, vd))            \
         _(vmulhu_vv, 0, 4, 0, ENC(rs1, rs2, vd))          \
         _(vmulhu_vx, 0, 4, 0, ENC(rs1, rs2, vd))          \
-        _(vmul_vv, 0, 4, 0, ENC(rs1, rs2, vd))            \
-        _(vmul_vx, 0, 4, 0, ENC(rs1, rs2, vd))            \
+        _(vmul_vv, 0, 4, 1, ENC(rs1, rs2, vd))            \
+        _(vmul_vx, 0, 4, 1, ENC(rs1, rs2, vd))            \
         _(vmulhsu_vv, 0, 4, 0, ENC(rs1, rs2, vd))         \
         _(vmulhsu_vx, 0, 4, 0, ENC(rs1, rs2, vd))         \
         _(vmulh_vv, 0, 4, 0, ENC(rs1, rs2, vd))           \
@@ -743,8 +743,8 @@ enum op_field {
         _(vwmaccus_vx, 0, 4, 0, ENC(rs1, rs2, vd))        \
         _(vwmaccsu_vv, 0, 4, 0, ENC(rs1, rs2, vd))        \
         _(vwmaccsu_vx, 0, 4, 0, ENC(rs1, rs2, vd))        \
-        _(vmv_s_x, 0, 4, 0, ENC(rs1, rs2, vd))            \
-        _(vmv_x_s, 0, 4, 0, ENC(rs1, rs2, vd))            \
+        _(vmv_s_x, 0, 4, 1, ENC(rs1, rs2, vd))            \
+        _(vmv_x_s, 0, 4, 1, ENC(rs1, rs2, vd))            \
         _(vcpop_m, 0, 4, 0, ENC(rs1, rs2, vd))            \
         _(vfirst_m, 0, 4, 0, ENC(rs1, rs2, vd))            \
         _(vmsbf_m, 0, 4, 0, ENC(rs1, rs2, vd))            \
@@ -989,6 +989,12 @@ typedef struct {
 #if RV32_HAS(SYSTEM)
     uint32_t satp[HISTORY_SIZE]; /**< SATP for address space matching */
 #endif
+    uint32_t ras_hits;   /**< interpreted returns the RAS predicted */
+    uint32_t ras_misses; /**< and those it did not */
+#endif
+#if RV32_HAS(SUPERBLOCK)
+    uint32_t taken;   /**< interpreted runs of a conditional branch taken */
+    uint32_t untaken; /**< and those falling through */
 #endif
 } branch_history_table_t;
 
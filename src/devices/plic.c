@@ -12,28 +12,69 @@
 
 void plic_update_interrupts(plic_t *plic)
 {
-    riscv_t *rv = (riscv_t *) plic->rv;
+    riscv_t *rv = plic->rv;
+    vm_attr_t *attr = PRIV(rv);
 
     /* Update pending interrupts */
     plic->ip |= plic->active & ~plic->masked;
     plic->masked |= plic->active;
-    /* Send interrupt to target */
-    if (plic->ip & plic->ie)
-        rv->csr_sip |= SIP_SEIP;
-    else
-        rv->csr_sip &= ~SIP_SEIP;
+    /* Send interrupt to targets. The harts may be running on other threads,
+     * so only their external interrupt line is driven here; each hart folds
+     * it into SIP at its next interrupt check.
+     */
+    for (uint32_t ctx = 0; ctx < attr->n_harts; ctx++) {
+        bool pending = plic->ip & plic->ie[ctx];
+        ATOMIC_STORE(&attr->harts[ctx]->seip, pending, ATOMIC_RELEASE);
+        if (pending)
+            rv_hart_kick(attr->harts[ctx]);
+    }
+}
+
+void plic_send_ipi(plic_t *plic, uint32_t hart)
+{
+    riscv_t *rv = plic->rv;
+    vm_attr_t *attr = PRIV(rv);
+
+    assert(hart < attr->n_harts);
+    ATOMIC_STORE(&attr->harts[hart]->ipi_pending, true, ATOMIC_RELEASE);
+    rv_hart_kick(attr->harts[hart]);
+}
+
+/* Split @addr into the register of context 0 it corresponds to and the
+ * context it belongs to. Returns false if that context has no hart.
+ */
+static bool plic_decode(plic_t *plic,
+                        uint32_t addr,
+                        uint32_t *reg,
+                        uint32_t *ctx)
+{
+    *ctx = 0;
+    if (addr >= PLIC_INTR_PRIORITY_THRESHOLD)
+        *ctx = (addr - PLIC_INTR_PRIORITY_THRESHOLD) / PLIC_CONTEXT_STRIDE;
+    else if (addr >= PLIC_INTR_ENABLE)
+        *ctx = (addr - PLIC_INTR_ENABLE) / PLIC_ENABLE_STRIDE;
+
+    *reg = addr - *ctx * (addr >= PLIC_INTR_PRIORITY_THRESHOLD
+                              ? PLIC_CONTEXT_STRIDE
+                              : PLIC_ENABLE_STRIDE);
+    riscv_t *rv = plic->rv;
+    return *ctx < PRIV(rv)->n_harts;
 }
 
 uint32_t plic_read(plic_t *plic, const uint32_t addr)
 {
     uint32_t plic_read_val = 0;
+    uint32_t reg, ctx;
 
-    switch (addr) {
+    if (!plic_decode(plic, addr, &reg, &ctx))
+        return 0;
+
+    switch (reg) {
     case PLIC_INTR_PENDING:
         plic_read_val = plic->ip;
         break;
     case PLIC_INTR_ENABLE:
-        plic_read_val = plic->ie;
+        plic_read_val = plic->ie[ctx];
         break;
     case PLIC_INTR_PRIORITY_THRESHOLD:
         /* no priority support: target priority threshold hardwired to 0 */
@@ -42,7 +83,7 @@ uint32_t plic_read(plic_t *plic, const uint32_t addr)
     case PLIC_INTR_CLAIM_OR_COMPLETE:
         /* claim */
         {
-            uint32_t intr_candidate = plic->ip & plic->ie;
+            uint32_t intr_candidate = plic->ip & plic->ie[ctx];
             if (intr_candidate) {
                 plic_read_val = rv_ctz(intr_candidate);
                 plic->ip &= ~(1U << (plic_read_val));
@@ -58,16 +99,21 @@ uint32_t plic_read(plic_t *plic, const uint32_t addr)
 
 void plic_write(plic_t *plic, const uint32_t addr, uint32_t value)
 {
-    switch (addr) {
+    uint32_t reg, ctx;
+
+    if (!plic_decode(plic, addr, &reg, &ctx))
+        return;
+
+    switch (reg) {
     case PLIC_INTR_ENABLE:
-        plic->ie = (value & ~1);
+        plic->ie[ctx] = (value & ~1);
         break;
     case PLIC_INTR_PRIORITY_THRESHOLD:
         /* no priority support: target priority threshold hardwired to 0 */
         break;
     case PLIC_INTR_CLAIM_OR_COMPLETE:
         /* completion */
-        if (plic->ie & (1U << value))
+        if (plic->ie[ctx] & (1U << value))
             plic->masked &= ~(1U << value);
         break;
     default:
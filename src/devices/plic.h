@@ -7,6 +7,12 @@
 
 #include <stdint.h>
 
+/* one S-mode context per hart */
+#define PLIC_MAX_CONTEXTS 8
+
+/* registers of context 0, the following contexts are placed at the strides
+ * below as on the SiFive PLIC
+ */
 enum PLIC_REG {
     PLIC_INTR_PENDING = 0x1000,
     PLIC_INTR_ENABLE = 0x2000,
@@ -14,20 +20,28 @@ enum PLIC_REG {
     PLIC_INTR_CLAIM_OR_COMPLETE = 0x200004,
 };
 
+#define PLIC_ENABLE_STRIDE 0x80
+#define PLIC_CONTEXT_STRIDE 0x1000
+
 /* PLIC */
 typedef struct {
     uint32_t masked;
     uint32_t ip;
-    uint32_t ie;
+    uint32_t ie[PLIC_MAX_CONTEXTS];
     /* state of input interrupt lines (level-triggered), set by environment */
     uint32_t active;
-    /* RISC-V instance to receive PLIC interrupt */
+    /* boot hart of the machine, context N targets hart N of PRIV(rv)->harts */
     void *rv;
 } plic_t;
 
 /* update PLIC status */
 void plic_update_interrupts(plic_t *plic);
 
+/* raise the supervisor software interrupt of hart @hart, the inter-processor
+ * interrupt path behind SBI IPI
+ */
+void plic_send_ipi(plic_t *plic, uint32_t hart);
+
 /* read a word from PLIC */
 uint32_t plic_read(plic_t *plic, const uint32_t addr);
 
@@ -5,6 +5,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -86,6 +87,155 @@ void u8250_put_rx_char(uint8_t c)
 }
 #endif
 
+#if !defined(__EMSCRIPTEN__)
+static uint32_t u8250_rx_count(u8250_state_t *uart)
+{
+    return ATOMIC_LOAD(&uart->rx_head, ATOMIC_ACQUIRE) - uart->rx_tail;
+}
+
+/* take the next byte of rx_buf, which must not be empty */
+static uint8_t u8250_rx_pop(u8250_state_t *uart)
+{
+    uint8_t value = uart->rx_buf[uart->rx_tail & (U8250_RX_BUF_SIZE - 1)];
+    ATOMIC_STORE(&uart->rx_tail, uart->rx_tail + 1, ATOMIC_RELEASE);
+    return value;
+}
+
+static void u8250_rx_signal(u8250_state_t *uart)
+{
+    /* a full pipe already holds a wakeup */
+    if (write(uart->rx_event[1], "", 1) < 0 && errno != EAGAIN)
+        rv_log_error("Failed to signal UART input: %s", strerror(errno));
+}
+
+/* Read host input into rx_buf until the end of input or u8250_delete().
+ * Each read() takes in as much as is available and fits.
+ */
+static void *u8250_rx_thread(void *arg)
+{
+    u8250_state_t *uart = arg;
+    struct pollfd pfd[2] = {
+        {uart->rx_stop[0], POLLIN, 0},
+        {uart->in_fd, POLLIN, 0},
+    };
+
+    for (;;) {
+        uint32_t head = uart->rx_head;
+        uint32_t space = U8250_RX_BUF_SIZE -
+                         (head - ATOMIC_LOAD(&uart->rx_tail, ATOMIC_ACQUIRE));
+        /* with rx_buf full, look again once the guest had time to drain it */
+        if (poll(pfd, space ? 2 : 1, space ? -1 : 10) < 0) {
+            if (errno == EINTR)
+                continue;
+            rv_log_error("Failed to poll UART input: %s", strerror(errno));
+            break;
+        }
+        if (pfd[0].revents)
+            break;
+        if (!space || !pfd[1].revents)
+            continue;
+
+        /* the free part of rx_buf up to its end */
+        uint32_t off = head & (U8250_RX_BUF_SIZE - 1);
+        uint32_t len = U8250_RX_BUF_SIZE - off;
+        if (len > space)
+            len = space;
+        ssize_t n = read(uart->in_fd, uart->rx_buf + off, len);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            rv_log_error("Failed to read UART input: %s", strerror(errno));
+            break;
+        }
+        if (!n) /* end of input */
+            break;
+        ATOMIC_STORE(&uart->rx_head, head + (uint32_t) n, ATOMIC_RELEASE);
+        u8250_rx_signal(uart);
+    }
+
+    ATOMIC_STORE(&uart->rx_closed, true, ATOMIC_RELEASE);
+    u8250_rx_signal(uart);
+    return NULL;
+}
+
+static void u8250_rx_start(u8250_state_t *uart)
+{
+    if (pipe(uart->rx_event) == -1)
+        goto fail;
+    if (pipe(uart->rx_stop) == -1)
+        goto fail_stop;
+    fcntl(uart->rx_event[0], F_SETFL, O_NONBLOCK);
+    fcntl(uart->rx_event[1], F_SETFL, O_NONBLOCK);
+    if (pthread_create(&uart->rx_thread, NULL, u8250_rx_thread, uart))
+        goto fail_thread;
+    uart->rx_thread_running = true;
+    return;
+
+fail_thread:
+    close(uart->rx_stop[0]);
+    close(uart->rx_stop[1]);
+fail_stop:
+    close(uart->rx_event[0]);
+    close(uart->rx_event[1]);
+fail:
+    rv_log_warn("Failed to start the UART input thread, polling instead");
+}
+
+static void u8250_rx_stop(u8250_state_t *uart)
+{
+    if (!uart->rx_thread_running)
+        return;
+
+    if (write(uart->rx_stop[1], "", 1) < 0)
+        rv_log_error("Failed to stop UART input: %s", strerror(errno));
+    pthread_join(uart->rx_thread, NULL);
+    close(uart->rx_stop[0]);
+    close(uart->rx_stop[1]);
+    close(uart->rx_event[0]);
+    close(uart->rx_event[1]);
+    uart->rx_thread_running = false;
+}
+
+void u8250_set_input(u8250_state_t *uart, int in_fd)
+{
+    u8250_rx_stop(uart);
+    uart->in_fd = in_fd;
+    uart->in_ready = false;
+    uart->rx_head = uart->rx_tail = 0;
+    uart->rx_closed = false;
+    if (in_fd >= 0)
+        u8250_rx_start(uart);
+}
+
+/* drop the wakeups for input that has already been seen */
+static void u8250_rx_drain_event(u8250_state_t *uart)
+{
+    char buf[16];
+    while (read(uart->rx_event[0], buf, sizeof(buf)) > 0)
+        ;
+}
+
+/* Block until the next byte of host input and return it, or EOF at the end
+ * of input.
+ */
+static int u8250_wait_in(u8250_state_t *uart)
+{
+    if (!uart->rx_thread_running) {
+        uint8_t value;
+        return read(uart->in_fd, &value, 1) == 1 ? value : EOF;
+    }
+
+    while (!u8250_rx_count(uart)) {
+        if (ATOMIC_LOAD(&uart->rx_closed, ATOMIC_ACQUIRE))
+            return EOF;
+        struct pollfd pfd = {uart->rx_event[0], POLLIN, 0};
+        poll(&pfd, 1, -1);
+        u8250_rx_drain_event(uart);
+    }
+    return u8250_rx_pop(uart);
+}
+#endif
+
 void u8250_check_ready(u8250_state_t *uart)
 {
     if (uart->in_ready)
@@ -95,6 +245,11 @@ void u8250_check_ready(u8250_state_t *uart)
     if (input_buf_size)
         uart->in_ready = true;
 #else
+    if (uart->rx_thread_running) {
+        uart->in_ready = u8250_rx_count(uart);
+        return;
+    }
+
     struct pollfd pfd = {uart->in_fd, POLLIN, 0};
     poll(&pfd, 1, 0);
     if (pfd.revents & POLLIN)
@@ -102,10 +257,44 @@ void u8250_check_ready(u8250_state_t *uart)
 #endif
 }
 
+int u8250_event_fd(u8250_state_t *uart)
+{
+#if defined(__EMSCRIPTEN__)
+    (void) uart;
+    return -1;
+#else
+    if (!uart->rx_thread_running)
+        return uart->in_fd;
+
+    u8250_rx_drain_event(uart);
+    return uart->rx_event[0];
+#endif
+}
+
+void u8250_flush(u8250_state_t *uart)
+{
+    uint32_t done = 0;
+    while (done < uart->tx_len) {
+        ssize_t n = write(uart->out_fd, uart->tx_buf + done,
+                          uart->tx_len - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            rv_log_error("Failed to write UART output: %s", strerror(errno));
+            break;
+        }
+        done += n;
+    }
+    uart->tx_len = 0;
+}
+
 static void u8250_handle_out(u8250_state_t *uart, uint8_t value)
 {
-    if (write(uart->out_fd, &value, 1) < 1)
-        rv_log_error("Failed to write UART output: %s", strerror(errno));
+    if (uart->tx_watch)
+        uart->tx_watch(uart->tx_opaque, value);
+    uart->tx_buf[uart->tx_len++] = value;
+    if (value == '\n' || uart->tx_len == U8250_TX_BUF_SIZE)
+        u8250_flush(uart);
 }
 
 static uint8_t u8250_handle_in(u8250_state_t *uart)
@@ -121,14 +310,22 @@ static uint8_t u8250_handle_in(u8250_state_t *uart)
         input_buf_start = 0;
     input_buf_size--;
 #else
-    if (read(uart->in_fd, &value, 1) < 0)
+    if (uart->rx_thread_running)
+        value = u8250_rx_pop(uart);
+    else if (read(uart->in_fd, &value, 1) < 0)
         rv_log_error("Failed to read UART input: %s", strerror(errno));
 #endif
     uart->in_ready = false;
 
     if (value == 1) { /* start of heading (Ctrl-a) */
+#if defined(__EMSCRIPTEN__)
         u8250_check_ready(uart);
-        if (getchar() == 120) { /* keyboard x */
+        int next = getchar();
+#else
+        int next = u8250_wait_in(uart);
+#endif
+        if (next == 120) { /* keyboard x */
+            u8250_flush(uart);
             rv_log_info("RISC-V emulator is destroyed");
             exit(EXIT_SUCCESS);
         }
@@ -212,15 +409,24 @@ void u8250_write(u8250_state_t *uart, uint32_t addr, uint32_t value)
     }
 }
 
-u8250_state_t *u8250_new()
+u8250_state_t *u8250_new(int in_fd, int out_fd)
 {
     u8250_state_t *uart = calloc(1, sizeof(u8250_state_t));
     assert(uart);
 
+    uart->in_fd = in_fd;
+    uart->out_fd = out_fd;
+#if !defined(__EMSCRIPTEN__)
+    u8250_rx_start(uart);
+#endif
     return uart;
 }
 
 void u8250_delete(u8250_state_t *uart)
 {
+    u8250_flush(uart);
+#if !defined(__EMSCRIPTEN__)
+    u8250_rx_stop(uart);
+#endif
     free(uart);
 }
@@ -5,6 +5,9 @@
 
 #pragma once
 
+#if !defined(__EMSCRIPTEN__)
+#include <pthread.h>
+#endif
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -22,6 +25,10 @@ enum UART_REG {
     U8250_SR,
 };
 
+/* sizes of the host input and output buffers, powers of two */
+#define U8250_RX_BUF_SIZE 1024
+#define U8250_TX_BUF_SIZE 256
+
 typedef struct {
     uint8_t dll, dlh;                    /* divisor (ignored) */
     uint8_t lcr;                         /* UART config */
@@ -30,6 +37,28 @@ typedef struct {
     uint8_t mcr;       /* other output signals, loopback mode (ignored) */
     int in_fd, out_fd; /* I/O handling */
     bool in_ready;
+
+#if !defined(__EMSCRIPTEN__)
+    /* Host input is read by a thread of its own into rx_buf, a single
+     * producer, single consumer ring: the thread advances rx_head, the hart
+     * holding device_lock advances rx_tail. The thread writes to rx_event[1]
+     * after adding input and stops when rx_stop[1] is written to.
+     */
+    uint8_t rx_buf[U8250_RX_BUF_SIZE];
+    uint32_t rx_head, rx_tail;
+    int rx_event[2], rx_stop[2];
+    bool rx_thread_running;
+    bool rx_closed; /* the thread saw the end of input and quit */
+    pthread_t rx_thread;
+#endif
+
+    /* guest output, written to out_fd at newlines and by u8250_flush() */
+    uint8_t tx_buf[U8250_TX_BUF_SIZE];
+    uint32_t tx_len;
+
+    /* told of each byte the guest writes, if set */
+    void (*tx_watch)(void *opaque, uint8_t value);
+    void *tx_opaque;
 } u8250_state_t;
 
 /* update UART status */
@@ -38,14 +67,32 @@ void u8250_update_interrupts(u8250_state_t *uart);
 /* poll UART status */
 void u8250_check_ready(u8250_state_t *uart);
 
+/* write out the buffered guest output */
+void u8250_flush(u8250_state_t *uart);
+
+/* File descriptor that becomes readable when host input arrives, or -1 if
+ * there is none to wait on. Call u8250_check_ready() afterwards, since input
+ * that came in before this call does not make it readable.
+ */
+int u8250_event_fd(u8250_state_t *uart);
+
+#if !defined(__EMSCRIPTEN__)
+/* Take host input from @in_fd from now on, or none if it is -1, dropping what
+ * was read ahead from the previous one. Without input, no thread is left
+ * behind, so that the UART survives fork() with the input set again in the
+ * child.
+ */
+void u8250_set_input(u8250_state_t *uart, int in_fd);
+#endif
+
 /* read a word from UART */
 uint32_t u8250_read(u8250_state_t *uart, uint32_t addr);
 
 /* write a word to UART */
 void u8250_write(u8250_state_t *uart, uint32_t addr, uint32_t value);
 
-/* create a UART instance */
-u8250_state_t *u8250_new();
+/* create a UART instance reading from @in_fd and writing to @out_fd */
+u8250_state_t *u8250_new(int in_fd, int out_fd);
 
 /* delete a UART instance */
 void u8250_delete(u8250_state_t *uart);
@@ -7,6 +7,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,8 +15,14 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
 /*
  * The /dev/ block devices cannot be embedded to the part of the wasm.
  * Thus, accessing /dev/ block devices is not supported for wasm.
@@ -30,6 +37,12 @@
 
 #include "virtio.h"
 
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#define VBLK_HAVE_IO_URING 1
+#else
+#define VBLK_HAVE_IO_URING 0
+#endif
+
 #define DISK_BLK_SIZE 512
 
 #define VBLK_FEATURES_0 0
@@ -38,6 +51,10 @@
 #define VBLK_QUEUE (vblk->queues[vblk->queue_sel])
 
 #define VBLK_PRIV(x) ((struct virtio_blk_config *) x->priv)
+#define VBLK_AIO(x) ((vblk_aio_t *) x->aio)
+
+/* buffer alignment for O_DIRECT transfers */
+#define VBLK_DIRECT_ALIGN 4096
 
 PACKED(struct virtio_blk_config {
     uint64_t capacity;
@@ -85,6 +102,530 @@ static void virtio_blk_set_fail(virtio_blk_state_t *vblk)
         vblk->interrupt_status |= VIRTIO_INT_CONF_CHANGE;
 }
 
+/* Asynchronous backend
+ *
+ * With VBLK_OPT_ASYNC the disk image is not mapped. A queue notification only
+ * parses the new requests and hands their reads, writes and flushes to the
+ * host, which moves the data between the image file and guest memory while
+ * the guest keeps running. The boot hart calls virtio_blk_poll() along with
+ * the other device checks, and that is where completed requests enter the
+ * used ring and raise the interrupt.
+ *
+ * Where the kernel provides io_uring, every request of the queues can be in
+ * flight at once. Otherwise a host thread serves them in order with pread()
+ * and pwrite().
+ */
+typedef struct vblk_req {
+    struct vblk_req *next;
+    uint32_t type;
+    uint16_t queue;    /* index of the virtqueue the request came from */
+    uint16_t desc_idx; /* head of the descriptor chain, the used element id */
+    uint64_t offset;   /* byte offset in the disk image */
+    uint8_t *data;     /* guest buffer */
+    uint32_t len;
+    uint8_t *status; /* guest status byte */
+    uint8_t *bounce; /* aligned copy of the data for O_DIRECT, or NULL */
+    struct iovec iov;
+    int64_t res; /* bytes transferred, or -errno */
+} vblk_req_t;
+
+#if VBLK_HAVE_IO_URING
+typedef struct {
+    int fd;
+    uint32_t *sq_tail, *sq_mask, *sq_array;
+    uint32_t *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+} vblk_uring_t;
+#endif
+
+typedef struct {
+    int fd;
+    bool direct;
+    bool readonly;
+    /* requests handed to the host and not posted to the used ring yet, only
+     * touched under the device lock of the emulator
+     */
+    uint32_t in_flight;
+#if VBLK_HAVE_IO_URING
+    bool use_uring;
+    vblk_uring_t ring;
+#endif
+    /* thread backend */
+    pthread_t worker;
+    bool has_worker;
+    pthread_mutex_t lock;
+    pthread_cond_t cond; /* new requests for the worker, or completions */
+    vblk_req_t *todo, **todo_tail;
+    vblk_req_t *done; /* completed, most recent first */
+    bool has_done;
+    bool stop;
+    int event[2]; /* readable while completions wait, for idle harts */
+} vblk_aio_t;
+
+/* Transfer @req with blocking calls, retrying short counts */
+static int64_t vblk_aio_transfer(vblk_aio_t *aio, vblk_req_t *req)
+{
+    if (req->type == VIRTIO_BLK_T_FLUSH)
+        return fsync(aio->fd) ? -errno : 0;
+
+    uint8_t *buf = req->bounce ? req->bounce : req->data;
+    size_t size = req->iov.iov_len, done = 0;
+    while (done < size) {
+        ssize_t n = req->type == VIRTIO_BLK_T_IN
+                        ? pread(aio->fd, buf + done, size - done,
+                                req->offset + done)
+                        : pwrite(aio->fd, buf + done, size - done,
+                                 req->offset + done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (!n) /* end of the image */
+            break;
+        done += n;
+    }
+    return done;
+}
+
+static void *vblk_aio_worker(void *arg)
+{
+    vblk_aio_t *aio = arg;
+
+    pthread_mutex_lock(&aio->lock);
+    while (true) {
+        while (!aio->todo && !aio->stop)
+            pthread_cond_wait(&aio->cond, &aio->lock);
+        if (!aio->todo)
+            break;
+
+        vblk_req_t *req = aio->todo;
+        aio->todo = req->next;
+        if (!aio->todo)
+            aio->todo_tail = &aio->todo;
+        pthread_mutex_unlock(&aio->lock);
+
+        req->res = vblk_aio_transfer(aio, req);
+
+        pthread_mutex_lock(&aio->lock);
+        req->next = aio->done;
+        aio->done = req;
+        ATOMIC_STORE(&aio->has_done, true, ATOMIC_RELEASE);
+        pthread_cond_broadcast(&aio->cond);
+        if (!req->next && write(aio->event[1], "", 1) < 0 && errno != EAGAIN)
+            rv_log_error("Failed to signal I/O completion: %s",
+                         strerror(errno));
+    }
+    pthread_mutex_unlock(&aio->lock);
+    return NULL;
+}
+
+#if VBLK_HAVE_IO_URING
+static int vblk_uring_enter(vblk_uring_t *ring,
+                            uint32_t to_submit,
+                            uint32_t min_complete)
+{
+    int ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete,
+                      min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+static void vblk_uring_exit(vblk_uring_t *ring)
+{
+    if (ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != MAP_FAILED)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring != MAP_FAILED)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+static bool vblk_uring_init(vblk_uring_t *ring, uint32_t entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0)
+        return false;
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    ring->cq_ring_size =
+        p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED ||
+        ring->sqes == MAP_FAILED) {
+        vblk_uring_exit(ring);
+        return false;
+    }
+
+    uint8_t *sq = ring->sq_ring, *cq = ring->cq_ring;
+    ring->sq_tail = (uint32_t *) (sq + p.sq_off.tail);
+    ring->sq_mask = (uint32_t *) (sq + p.sq_off.ring_mask);
+    ring->sq_array = (uint32_t *) (sq + p.sq_off.array);
+    ring->cq_head = (uint32_t *) (cq + p.cq_off.head);
+    ring->cq_tail = (uint32_t *) (cq + p.cq_off.tail);
+    ring->cq_mask = (uint32_t *) (cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    return true;
+}
+
+static void vblk_uring_submit(vblk_aio_t *aio, vblk_req_t *req)
+{
+    vblk_uring_t *ring = &aio->ring;
+    uint32_t tail = *ring->sq_tail;
+    uint32_t idx = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = aio->fd;
+    sqe->user_data = (uintptr_t) req;
+    if (req->type == VIRTIO_BLK_T_FLUSH) {
+        /* a flush covers every write submitted before it */
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->flags = IOSQE_IO_DRAIN;
+    } else {
+        sqe->opcode = req->type == VIRTIO_BLK_T_IN ? IORING_OP_READV
+                                                   : IORING_OP_WRITEV;
+        sqe->addr = (uintptr_t) &req->iov;
+        sqe->len = 1;
+        sqe->off = req->offset;
+    }
+    ring->sq_array[idx] = idx;
+    ATOMIC_STORE(ring->sq_tail, tail + 1, ATOMIC_RELEASE);
+
+    if (vblk_uring_enter(ring, 1, 0) < 0)
+        rv_log_error("io_uring_enter failed: %s", strerror(errno));
+}
+#endif
+
+static vblk_aio_t *vblk_aio_new(int fd, bool direct, bool readonly)
+{
+    vblk_aio_t *aio = calloc(1, sizeof(vblk_aio_t));
+    assert(aio);
+    aio->fd = fd;
+    aio->direct = direct;
+    aio->readonly = readonly;
+    aio->todo_tail = &aio->todo;
+    pthread_mutex_init(&aio->lock, NULL);
+    pthread_cond_init(&aio->cond, NULL);
+
+#if VBLK_HAVE_IO_URING
+    /* The completion ring is twice as large, which holds every descriptor of
+     * both virtqueues.
+     */
+    if (vblk_uring_init(&aio->ring, VBLK_QUEUE_NUM_MAX)) {
+        aio->use_uring = true;
+        return aio;
+    }
+    rv_log_info("io_uring is not available, using an I/O thread");
+#endif
+
+    if (pipe(aio->event) == -1)
+        goto fail_pipe;
+    fcntl(aio->event[0], F_SETFL, O_NONBLOCK);
+    fcntl(aio->event[1], F_SETFL, O_NONBLOCK);
+    if (pthread_create(&aio->worker, NULL, vblk_aio_worker, aio))
+        goto fail_thread;
+    aio->has_worker = true;
+    return aio;
+
+fail_thread:
+    close(aio->event[0]);
+    close(aio->event[1]);
+fail_pipe:
+    pthread_cond_destroy(&aio->cond);
+    pthread_mutex_destroy(&aio->lock);
+    free(aio);
+    return NULL;
+}
+
+static void vblk_aio_submit(vblk_aio_t *aio, vblk_req_t *req)
+{
+    aio->in_flight++;
+#if VBLK_HAVE_IO_URING
+    if (aio->use_uring)
+        return vblk_uring_submit(aio, req);
+#endif
+    pthread_mutex_lock(&aio->lock);
+    req->next = NULL;
+    *aio->todo_tail = req;
+    aio->todo_tail = &req->next;
+    pthread_cond_broadcast(&aio->cond);
+    pthread_mutex_unlock(&aio->lock);
+}
+
+/* Take the completed requests, oldest first */
+static vblk_req_t *vblk_aio_reap(vblk_aio_t *aio)
+{
+    vblk_req_t *list = NULL;
+
+#if VBLK_HAVE_IO_URING
+    if (aio->use_uring) {
+        vblk_uring_t *ring = &aio->ring;
+        vblk_req_t **last = &list;
+        uint32_t head = *ring->cq_head;
+        uint32_t tail = ATOMIC_LOAD(ring->cq_tail, ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            vblk_req_t *req = (vblk_req_t *) (uintptr_t) cqe->user_data;
+            req->res = cqe->res;
+            req->next = NULL;
+            *last = req;
+            last = &req->next;
+        }
+        ATOMIC_STORE(ring->cq_head, head, ATOMIC_RELEASE);
+        return list;
+    }
+#endif
+
+    if (!ATOMIC_LOAD(&aio->has_done, ATOMIC_ACQUIRE))
+        return NULL;
+    pthread_mutex_lock(&aio->lock);
+    vblk_req_t *req = aio->done;
+    aio->done = NULL;
+    ATOMIC_STORE(&aio->has_done, false, ATOMIC_RELAXED);
+    char buf[16];
+    while (read(aio->event[0], buf, sizeof(buf)) > 0)
+        ;
+    pthread_mutex_unlock(&aio->lock);
+
+    while (req) {
+        vblk_req_t *next = req->next;
+        req->next = list;
+        list = req;
+        req = next;
+    }
+    return list;
+}
+
+/* Block until at least one request has completed */
+static void vblk_aio_wait(vblk_aio_t *aio)
+{
+#if VBLK_HAVE_IO_URING
+    if (aio->use_uring) {
+        vblk_uring_enter(&aio->ring, 0, 1);
+        return;
+    }
+#endif
+    pthread_mutex_lock(&aio->lock);
+    while (!aio->done)
+        pthread_cond_wait(&aio->cond, &aio->lock);
+    pthread_mutex_unlock(&aio->lock);
+}
+
+static void vblk_req_free(vblk_req_t *req)
+{
+    free(req->bounce);
+    free(req);
+}
+
+/* Wait for the requests in flight and drop them, as the rings they belong to
+ * are going away.
+ */
+static void vblk_aio_drain(vblk_aio_t *aio)
+{
+    while (aio->in_flight) {
+        vblk_req_t *req = vblk_aio_reap(aio);
+        if (!req)
+            vblk_aio_wait(aio);
+        while (req) {
+            vblk_req_t *next = req->next;
+            vblk_req_free(req);
+            aio->in_flight--;
+            req = next;
+        }
+    }
+}
+
+static void vblk_aio_delete(vblk_aio_t *aio)
+{
+    vblk_aio_drain(aio);
+    if (aio->has_worker) {
+        pthread_mutex_lock(&aio->lock);
+        aio->stop = true;
+        pthread_cond_broadcast(&aio->cond);
+        pthread_mutex_unlock(&aio->lock);
+        pthread_join(aio->worker, NULL);
+        close(aio->event[0]);
+        close(aio->event[1]);
+    }
+#if VBLK_HAVE_IO_URING
+    if (aio->use_uring)
+        vblk_uring_exit(&aio->ring);
+#endif
+    pthread_cond_destroy(&aio->cond);
+    pthread_mutex_destroy(&aio->lock);
+
+    /* writes went straight to the image, only syncing it is left */
+    if (!aio->readonly && fsync(aio->fd) == -1)
+        rv_log_error("fsync block device failed: %s", strerror(errno));
+    close(aio->fd);
+    free(aio);
+}
+
+/* Append the used element of the descriptor chain @desc_idx */
+static void virtio_blk_push_used(virtio_blk_state_t *vblk,
+                                 const virtio_blk_queue_t *queue,
+                                 uint16_t desc_idx,
+                                 uint32_t len)
+{
+    uint32_t *ram = vblk->ram;
+    uint16_t new_used = ram[queue->queue_used] >> 16; /* virtq_used.idx */
+
+    /* Write used element information (`struct virtq_used_elem`) to the used
+     * queue */
+    uint32_t vq_used_addr =
+        queue->queue_used + 1 + (new_used % queue->queue_num) * 2;
+    ram[vq_used_addr] = desc_idx; /* virtq_used_elem.id  (le32) */
+    ram[vq_used_addr + 1] = len;  /* virtq_used_elem.len (le32) */
+    new_used++;
+
+    /* Check le32 len field of `struct virtq_used_elem` on the spec  */
+    ram[queue->queue_used] &= MASK(16); /* Reset low 16 bits to zero */
+    ram[queue->queue_used] |= ((uint32_t) new_used) << 16; /* len */
+}
+
+static void virtio_blk_notify_used(virtio_blk_state_t *vblk,
+                                   const virtio_blk_queue_t *queue)
+{
+    /* Send interrupt, unless VIRTQ_AVAIL_F_NO_INTERRUPT is set */
+    if (!(vblk->ram[queue->queue_avail] & 1))
+        vblk->interrupt_status |= VIRTIO_INT_USED_RING;
+}
+
+/* Hand a read, write or flush over to the host */
+static int vblk_aio_queue(virtio_blk_state_t *vblk,
+                          int queue,
+                          uint16_t desc_idx,
+                          uint32_t type,
+                          uint64_t sector,
+                          const struct virtq_desc *data,
+                          uint8_t *status)
+{
+    vblk_aio_t *aio = VBLK_AIO(vblk);
+    vblk_req_t *req = calloc(1, sizeof(vblk_req_t));
+    if (!req)
+        return -1;
+
+    req->type = type;
+    req->queue = queue;
+    req->desc_idx = desc_idx;
+    req->status = status;
+    if (type != VIRTIO_BLK_T_FLUSH) {
+        req->offset = sector * DISK_BLK_SIZE;
+        req->data = (uint8_t *) vblk->ram + data->addr;
+        req->len = data->len;
+        req->iov.iov_base = req->data;
+        req->iov.iov_len = req->len;
+        if (aio->direct) {
+            /* O_DIRECT wants aligned buffers and whole sectors */
+            size_t size = (req->len + DISK_BLK_SIZE - 1) & ~(DISK_BLK_SIZE - 1);
+            if (posix_memalign((void **) &req->bounce, VBLK_DIRECT_ALIGN,
+                               size)) {
+                free(req);
+                return -1;
+            }
+            if (type == VIRTIO_BLK_T_OUT) {
+                memcpy(req->bounce, req->data, req->len);
+                memset(req->bounce + req->len, 0, size - req->len);
+            }
+            req->iov.iov_base = req->bounce;
+            req->iov.iov_len = size;
+        }
+    }
+
+    vblk_aio_submit(aio, req);
+    return 1;
+}
+
+/* let the environment know that the device wrote @len bytes of RAM at @addr,
+ * which may hold code the harts translated
+ */
+static void virtio_blk_ram_written(virtio_blk_state_t *vblk,
+                                   uint64_t addr,
+                                   uint32_t len)
+{
+    if (vblk->ram_written)
+        vblk->ram_written(vblk->ram_opaque, addr, len);
+}
+
+static void vblk_aio_complete(virtio_blk_state_t *vblk, vblk_req_t *req)
+{
+    uint32_t len = 0;
+
+    if (req->res < 0 ||
+        (req->type == VIRTIO_BLK_T_OUT && req->res < req->len)) {
+        rv_log_error("virtio-blk I/O failed: %s",
+                     req->res < 0 ? strerror(-req->res) : "short write");
+        *req->status = VIRTIO_BLK_S_IOERR;
+    } else {
+        if (req->type == VIRTIO_BLK_T_IN) {
+            uint32_t n = req->res < req->len ? req->res : req->len;
+            if (req->bounce)
+                memcpy(req->data, req->bounce, n);
+            /* the image may end inside the last sector */
+            memset(req->data + n, 0, req->len - n);
+            virtio_blk_ram_written(vblk, req->data - (uint8_t *) vblk->ram,
+                                   req->len);
+        }
+        len = req->len;
+        *req->status = VIRTIO_BLK_S_OK;
+    }
+    virtio_blk_push_used(vblk, &vblk->queues[req->queue], req->desc_idx, len);
+}
+
+int virtio_blk_event_fd(virtio_blk_state_t *vblk)
+{
+    vblk_aio_t *aio = VBLK_AIO(vblk);
+    if (!aio || !aio->in_flight)
+        return -1;
+#if VBLK_HAVE_IO_URING
+    /* the ring polls readable while completions are queued */
+    if (aio->use_uring)
+        return aio->ring.fd;
+#endif
+    return aio->event[0];
+}
+
+bool virtio_blk_poll(virtio_blk_state_t *vblk)
+{
+    vblk_aio_t *aio = VBLK_AIO(vblk);
+    if (!aio || !aio->in_flight)
+        return false;
+
+    vblk_req_t *req = vblk_aio_reap(aio);
+    if (!req)
+        return false;
+
+    uint32_t queues = 0;
+    while (req) {
+        vblk_req_t *next = req->next;
+        vblk_aio_complete(vblk, req);
+        queues |= 1U << req->queue;
+        aio->in_flight--;
+        vblk_req_free(req);
+        req = next;
+    }
+    for (uint32_t i = 0; i < ARRAY_SIZE(vblk->queues); i++) {
+        if (queues & (1U << i))
+            virtio_blk_notify_used(vblk, &vblk->queues[i]);
+    }
+    return true;
+}
+
 static inline uint32_t vblk_preprocess(virtio_blk_state_t *vblk UNUSED,
                                        uint32_t addr)
 {
@@ -110,12 +651,17 @@ static void virtio_blk_update_status(virtio_blk_state_t *vblk, uint32_t status)
         return;
 
     /* Reset */
+    if (vblk->aio)
+        vblk_aio_drain(VBLK_AIO(vblk));
     uint32_t device_features = vblk->device_features;
     uint32_t *ram = vblk->ram;
     uint32_t *disk = vblk->disk;
     uint64_t disk_size = vblk->disk_size;
     int disk_fd = vblk->disk_fd;
+    void (*ram_written)(void *, uint32_t, uint32_t) = vblk->ram_written;
+    void *ram_opaque = vblk->ram_opaque;
     void *priv = vblk->priv;
+    void *aio = vblk->aio;
     uint32_t capacity = VBLK_PRIV(vblk)->capacity;
     memset(vblk, 0, sizeof(*vblk));
     vblk->device_features = device_features;
@@ -123,7 +669,10 @@ static void virtio_blk_update_status(virtio_blk_state_t *vblk, uint32_t status)
     vblk->disk = disk;
     vblk->disk_size = disk_size;
     vblk->disk_fd = disk_fd;
+    vblk->ram_written = ram_written;
+    vblk->ram_opaque = ram_opaque;
     vblk->priv = priv;
+    vblk->aio = aio;
     VBLK_PRIV(vblk)->capacity = capacity;
 }
 
@@ -146,10 +695,31 @@ static void virtio_blk_read_handler(virtio_blk_state_t *vblk,
     const void *src =
         (void *) ((uintptr_t) vblk->disk + sector * DISK_BLK_SIZE);
     memcpy(dest, src, len);
+    virtio_blk_ram_written(vblk, desc_addr, len);
 }
 
+static uint8_t virtio_blk_flush_handler(virtio_blk_state_t *vblk)
+{
+    if (vblk->device_features & VIRTIO_BLK_F_RO)
+        return VIRTIO_BLK_S_OK;
+
+    /* mmap_fallback keeps the disk on the heap until rv_fsync_device() */
+    if (vblk->disk_fd != -1)
+        return VIRTIO_BLK_S_OK;
+#if HAVE_MMAP
+    if (msync(vblk->disk, VBLK_PRIV(vblk)->disk_size, MS_SYNC) == -1) {
+        rv_log_error("Fail to flush the block device: %s", strerror(errno));
+        return VIRTIO_BLK_S_IOERR;
+    }
+#endif
+    return VIRTIO_BLK_S_OK;
+}
+
+/* Returns 0 when the request has completed, 1 when it was handed to the
+ * asynchronous backend and -1 when the device has to be reset.
+ */
 static int virtio_blk_desc_handler(virtio_blk_state_t *vblk,
-                                   const virtio_blk_queue_t *queue,
+                                   int queue_idx,
                                    uint16_t desc_idx,
                                    uint32_t *plen)
 {
@@ -162,30 +732,37 @@ static int virtio_blk_desc_handler(virtio_blk_state_t *vblk,
      *   u8 data[][512]
      * the third descriptor contains:
      *   u8 status
+     * A flush carries no data and comes with only the first and the last.
      */
+    const virtio_blk_queue_t *queue = &vblk->queues[queue_idx];
+    const uint16_t head_idx = desc_idx;
     struct virtq_desc vq_desc[3];
+    int n_desc = 0;
 
     /* Collect the descriptors */
-    for (int i = 0; i < 3; i++) {
+    while (true) {
         /* The size of the `struct virtq_desc` is 4 words */
         const struct virtq_desc *desc =
             (struct virtq_desc *) &vblk->ram[queue->queue_desc + desc_idx * 4];
 
         /* Retrieve the fields of current descriptor */
-        vq_desc[i].addr = desc->addr;
-        vq_desc[i].len = desc->len;
-        vq_desc[i].flags = desc->flags;
+        vq_desc[n_desc].addr = desc->addr;
+        vq_desc[n_desc].len = desc->len;
+        vq_desc[n_desc].flags = desc->flags;
         desc_idx = desc->next;
-    }
+        n_desc++;
 
-    /* The next flag for the first and second descriptors should be set,
-     * whereas for the third descriptor is should not be set
-     */
-    if (!(vq_desc[0].flags & VIRTIO_DESC_F_NEXT) ||
-        !(vq_desc[1].flags & VIRTIO_DESC_F_NEXT) ||
-        (vq_desc[2].flags & VIRTIO_DESC_F_NEXT)) {
-        /* since the descriptor list is abnormal, we don't write the status
-         * back here */
+        /* The next flag should be set on all but the last descriptor */
+        if (!(desc->flags & VIRTIO_DESC_F_NEXT))
+            break;
+        if (n_desc == 3) {
+            /* since the descriptor list is abnormal, we don't write the
+             * status back here */
+            virtio_blk_set_fail(vblk);
+            return -1;
+        }
+    }
+    if (n_desc < 2) {
         virtio_blk_set_fail(vblk);
         return -1;
     }
@@ -195,7 +772,9 @@ static int virtio_blk_desc_handler(virtio_blk_state_t *vblk,
         (struct vblk_req_header *) ((uintptr_t) vblk->ram + vq_desc[0].addr);
     uint32_t type = header->type;
     uint64_t sector = header->sector;
-    uint8_t *status = (uint8_t *) ((uintptr_t) vblk->ram + vq_desc[2].addr);
+    const struct virtq_desc *data = n_desc == 3 ? &vq_desc[1] : NULL;
+    uint8_t *status =
+        (uint8_t *) ((uintptr_t) vblk->ram + vq_desc[n_desc - 1].addr);
 
     /* Check sector index is valid */
     if (sector > (VBLK_PRIV(vblk)->capacity - 1)) {
@@ -203,19 +782,38 @@ static int virtio_blk_desc_handler(virtio_blk_state_t *vblk,
         return -1;
     }
 
+    /* Reads and writes need a data buffer that stays within the disk */
+    if ((type == VIRTIO_BLK_T_IN || type == VIRTIO_BLK_T_OUT) &&
+        (!data || data->len > (VBLK_PRIV(vblk)->capacity - sector) *
+                                  DISK_BLK_SIZE)) {
+        *status = VIRTIO_BLK_S_IOERR;
+        return -1;
+    }
+
+    if (type == VIRTIO_BLK_T_OUT &&
+        (vblk->device_features & VIRTIO_BLK_F_RO)) { /* readonly */
+        rv_log_error("Fail to write on a read only block device");
+        *status = VIRTIO_BLK_S_IOERR;
+        return -1;
+    }
+
+    if (vblk->aio && (type == VIRTIO_BLK_T_IN || type == VIRTIO_BLK_T_OUT ||
+                      type == VIRTIO_BLK_T_FLUSH))
+        return vblk_aio_queue(vblk, queue_idx, head_idx, type, sector, data,
+                              status);
+
     /* Process the data */
     switch (type) {
     case VIRTIO_BLK_T_IN:
-        virtio_blk_read_handler(vblk, sector, vq_desc[1].addr, vq_desc[1].len);
+        virtio_blk_read_handler(vblk, sector, data->addr, data->len);
         break;
     case VIRTIO_BLK_T_OUT:
-        if (vblk->device_features & VIRTIO_BLK_F_RO) { /* readonly */
-            rv_log_error("Fail to write on a read only block device");
-            *status = VIRTIO_BLK_S_IOERR;
-            return -1;
-        }
-        virtio_blk_write_handler(vblk, sector, vq_desc[1].addr, vq_desc[1].len);
+        virtio_blk_write_handler(vblk, sector, data->addr, data->len);
         break;
+    case VIRTIO_BLK_T_FLUSH:
+        *status = virtio_blk_flush_handler(vblk);
+        *plen = 0;
+        return 0;
     default:
         rv_log_error("Unsupported virtio-blk operation");
         *status = VIRTIO_BLK_S_UNSUPP;
@@ -224,7 +822,7 @@ static int virtio_blk_desc_handler(virtio_blk_state_t *vblk,
 
     /* Return the device status */
     *status = VIRTIO_BLK_S_OK;
-    *plen = vq_desc[1].len;
+    *plen = data->len;
 
     return 0;
 }
@@ -250,8 +848,7 @@ static void virtio_queue_notify_handler(virtio_blk_state_t *vblk, int index)
         return;
 
     /* Process them */
-    uint16_t new_used =
-        ram[queue->queue_used] >> 16; /* virtq_used.idx (le16) */
+    bool used = false;
     while (queue->last_avail != new_avail) {
         /* Obtain the index in the ring buffer */
         uint16_t queue_idx = queue->last_avail % queue->queue_num;
@@ -266,30 +863,23 @@ static void virtio_queue_notify_handler(virtio_blk_state_t *vblk, int index)
                               (16 * (queue_idx % 2));
 
         /* Consume request from the available queue and process the data in the
-         * descriptor list.
+         * descriptor list. Requests handed to the asynchronous backend reach
+         * the used queue in virtio_blk_poll().
          */
         uint32_t len = 0;
-        int result = virtio_blk_desc_handler(vblk, queue, buffer_idx, &len);
-        if (result != 0)
+        int result = virtio_blk_desc_handler(vblk, index, buffer_idx, &len);
+        if (result < 0)
             return virtio_blk_set_fail(vblk);
 
-        /* Write used element information (`struct virtq_used_elem`) to the used
-         * queue */
-        uint32_t vq_used_addr =
-            queue->queue_used + 1 + (new_used % queue->queue_num) * 2;
-        ram[vq_used_addr] = buffer_idx; /* virtq_used_elem.id  (le32) */
-        ram[vq_used_addr + 1] = len;    /* virtq_used_elem.len (le32) */
         queue->last_avail++;
-        new_used++;
+        if (result == 0) {
+            virtio_blk_push_used(vblk, queue, buffer_idx, len);
+            used = true;
+        }
     }
 
-    /* Check le32 len field of `struct virtq_used_elem` on the spec  */
-    vblk->ram[queue->queue_used] &= MASK(16); /* Reset low 16 bits to zero */
-    vblk->ram[queue->queue_used] |= ((uint32_t) new_used) << 16; /* len */
-
-    /* Send interrupt, unless VIRTQ_AVAIL_F_NO_INTERRUPT is set */
-    if (!(ram[queue->queue_avail] & 1))
-        vblk->interrupt_status |= VIRTIO_INT_USED_RING;
+    if (used)
+        virtio_blk_notify_used(vblk, queue);
 }
 
 uint32_t virtio_blk_read(virtio_blk_state_t *vblk, uint32_t addr)
@@ -400,8 +990,13 @@ void virtio_blk_write(virtio_blk_state_t *vblk, uint32_t addr, uint32_t value)
 
 uint32_t *virtio_blk_init(virtio_blk_state_t *vblk,
                           char *disk_file,
-                          bool readonly)
+                          uint32_t opts)
 {
+    const bool readonly = opts & VBLK_OPT_READONLY;
+    const bool direct = opts & VBLK_OPT_DIRECT;
+    const bool async = direct || (opts & VBLK_OPT_ASYNC);
+    const bool private = opts & VBLK_OPT_PRIVATE;
+
     /*
      * For mmap_fallback, if vblk is not specified, disk_fd should remain -1 and
      * no fsync should be performed on exit.
@@ -422,7 +1017,26 @@ uint32_t *virtio_blk_init(virtio_blk_state_t *vblk,
     }
 
     /* Open disk file */
-    int disk_fd = open(disk_file, readonly ? O_RDONLY : O_RDWR);
+    int open_flags = readonly || private ? O_RDONLY : O_RDWR;
+#if defined(O_DIRECT)
+    if (direct)
+        open_flags |= O_DIRECT;
+#endif
+    int disk_fd = open(disk_file, open_flags);
+#if defined(O_DIRECT)
+    if (disk_fd < 0 && direct && errno == EINVAL) {
+        /* e.g. tmpfs does not support direct I/O */
+        rv_log_warn("%s does not support direct I/O, using the page cache",
+                    disk_file);
+        disk_fd = open(disk_file, open_flags & ~O_DIRECT);
+    }
+#elif defined(F_NOCACHE)
+    if (disk_fd >= 0 && direct)
+        fcntl(disk_fd, F_NOCACHE, 1);
+#else
+    if (direct)
+        rv_log_warn("Direct I/O is not supported on this host");
+#endif
     if (disk_fd < 0) {
         rv_log_error("Could not open %s: %s", disk_file, strerror(errno));
         goto fail;
@@ -471,15 +1085,35 @@ uint32_t *virtio_blk_init(virtio_blk_state_t *vblk,
         disk_size = st.st_size;
     }
     VBLK_PRIV(vblk)->disk_size = disk_size;
+    VBLK_PRIV(vblk)->capacity = (disk_size - 1) / DISK_BLK_SIZE + 1;
+    vblk->device_features = VIRTIO_BLK_F_FLUSH;
+    if (readonly)
+        vblk->device_features |= VIRTIO_BLK_F_RO;
+
+    /* Requests go to the image file itself, nothing is mapped */
+    if (async && private) {
+        rv_log_error("%s cannot be both asynchronous and private", disk_file);
+        goto disk_size_fail;
+    }
+    if (async) {
+        vblk->aio = vblk_aio_new(disk_fd, direct, readonly);
+        if (!vblk->aio) {
+            rv_log_error("Could not start the I/O backend of %s", disk_file);
+            goto disk_size_fail;
+        }
+        vblk->disk_size = disk_size;
+        return NULL;
+    }
 
     /* Set up the disk memory */
     uint32_t *disk_mem;
 #if HAVE_MMAP
     disk_mem = mmap(NULL, VBLK_PRIV(vblk)->disk_size,
-                    readonly ? PROT_READ : (PROT_READ | PROT_WRITE), MAP_SHARED,
-                    disk_fd, 0);
+                    readonly ? PROT_READ : (PROT_READ | PROT_WRITE),
+                    private ? MAP_PRIVATE : MAP_SHARED, disk_fd, 0);
     if (disk_mem == MAP_FAILED) {
-        if (errno != EINVAL)
+        /* the heap copy would be written back */
+        if (errno != EINVAL || private)
             goto disk_mem_err;
         /*
          * On Apple platforms, mmap() on block devices appears to be unsupported
@@ -503,6 +1137,10 @@ mmap_fallback:
         goto disk_mem_err;
     vblk->disk_fd = disk_fd;
     vblk->disk_size = disk_size;
+    /* The heap copy is written back as a whole at exit, doing so on every
+     * flush would be far too slow, so flushes are not offered.
+     */
+    vblk->device_features &= ~VIRTIO_BLK_F_FLUSH;
     if (pread(disk_fd, disk_mem, disk_size, 0) == -1) {
         rv_log_error("pread block device failed: %s", strerror(errno));
         goto disk_mem_err;
@@ -512,11 +1150,6 @@ disk_mem_ok:
     assert(!(((uintptr_t) disk_mem) & 0b11));
 
     vblk->disk = disk_mem;
-    VBLK_PRIV(vblk)->capacity =
-        (VBLK_PRIV(vblk)->disk_size - 1) / DISK_BLK_SIZE + 1;
-
-    if (readonly)
-        vblk->device_features = VIRTIO_BLK_F_RO;
 
     return disk_mem;
 
@@ -539,8 +1172,10 @@ virtio_blk_state_t *vblk_new()
 
 void vblk_delete(virtio_blk_state_t *vblk)
 {
+    if (vblk->aio)
+        vblk_aio_delete(VBLK_AIO(vblk));
     /* mmap_fallback is used */
-    if (vblk->disk_fd != -1)
+    else if (vblk->disk_fd != -1)
         free(vblk->disk);
 #if HAVE_MMAP
     else
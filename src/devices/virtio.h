@@ -35,6 +35,7 @@
 
 /* TODO: support more features */
 #define VIRTIO_BLK_F_RO (1 << 5)
+#define VIRTIO_BLK_F_FLUSH (1 << 9)
 
 #define VIRTIO_RNG_DEV_ID 4
 
@@ -107,17 +108,41 @@ typedef struct {
     uint32_t *disk;
     uint64_t disk_size;
     int disk_fd;
+    /* told of the guest RAM a read request filled, if set */
+    void (*ram_written)(void *opaque, uint32_t addr, uint32_t len);
+    void *ram_opaque;
     /* implementation-specific */
     void *priv;
+    /* host I/O backend of an asynchronous device, NULL otherwise */
+    void *aio;
 } virtio_blk_state_t;
 
+/* options for virtio_blk_init() */
+#define VBLK_OPT_READONLY (1 << 0)
+/* complete requests on a host I/O backend instead of in the MMIO write */
+#define VBLK_OPT_ASYNC (1 << 1)
+/* bypass the host page cache (O_DIRECT), implies VBLK_OPT_ASYNC */
+#define VBLK_OPT_DIRECT (1 << 2)
+/* map the image copy-on-write, the writes of the guest never reach it */
+#define VBLK_OPT_PRIVATE (1 << 3)
+
 uint32_t virtio_blk_read(virtio_blk_state_t *vblk, uint32_t addr);
 
 void virtio_blk_write(virtio_blk_state_t *vblk, uint32_t addr, uint32_t value);
 
 uint32_t *virtio_blk_init(virtio_blk_state_t *vblk,
                           char *disk_file,
-                          bool readonly);
+                          uint32_t opts);
+
+/* Post the requests the asynchronous backend has completed to the used ring.
+ * Returns true if the interrupt status may have changed.
+ */
+bool virtio_blk_poll(virtio_blk_state_t *vblk);
+
+/* A file descriptor that polls readable once virtio_blk_poll() has work, or
+ * -1 if no request is in flight.
+ */
+int virtio_blk_event_fd(virtio_blk_state_t *vblk);
 
 virtio_blk_state_t *vblk_new();
 
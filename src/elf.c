@@ -56,6 +56,9 @@ struct elf_internal {
     const struct Elf32_Ehdr *hdr;
     uint32_t raw_size;
     uint8_t *raw_data;
+#if HAVE_MMAP
+    int fd; /* kept open for elf_load() to map the segments from */
+#endif
 
     /* symbol table map: uint32_t -> (const char *) */
     map_t symbols;
@@ -76,6 +79,9 @@ elf_t *elf_new(void)
     e->raw_size = 0;
     e->symbols = map_init(int, char *, map_cmp_uint);
     e->raw_data = NULL;
+#if HAVE_MMAP
+    e->fd = -1;
+#endif
     return e;
 }
 
@@ -88,6 +94,8 @@ void elf_delete(elf_t *e)
 #if HAVE_MMAP
     if (e->raw_data)
         munmap(e->raw_data, e->raw_size);
+    if (e->fd >= 0)
+        close(e->fd);
 #else
     free(e->raw_data);
 #endif
@@ -97,7 +105,11 @@ void elf_delete(elf_t *e)
 /* release a loaded ELF file */
 static void release(elf_t *e)
 {
-#if !HAVE_MMAP
+#if HAVE_MMAP
+    if (e->fd >= 0)
+        close(e->fd);
+    e->fd = -1;
+#else
     free(e->raw_data);
 #endif
 
@@ -272,11 +284,17 @@ bool elf_load(elf_t *e, memory_t *mem)
         if (phdr->p_type != PT_LOAD)
             continue;
 
-        /* memcpy required range */
+        /* map or copy required range */
         const int to_copy = min(phdr->p_memsz, phdr->p_filesz);
+#if HAVE_MMAP
+        if (to_copy && !memory_load_file(mem, phdr->p_vaddr, e->fd,
+                                         phdr->p_offset, to_copy))
+            return false;
+#else
         if (to_copy && !memory_write(mem, phdr->p_vaddr,
                                      e->raw_data + phdr->p_offset, to_copy))
             return false;
+#endif
 
         /* zero fill required range */
         const int to_zero = max(phdr->p_memsz, phdr->p_filesz) - to_copy;
@@ -313,7 +331,7 @@ bool elf_open(elf_t *e, const char *input)
     e->raw_data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     if (e->raw_data == MAP_FAILED)
         goto free_fd;
-    close(fd);
+    e->fd = fd;
 
 #else  /* fallback to standard I/O text stream */
     FILE *f = fopen(path, "rb");
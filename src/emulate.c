@@ -10,6 +10,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#if RV32_HAS(SYSTEM_MMIO) && !defined(__EMSCRIPTEN__)
+#include <poll.h>
+#endif
 
 #if RV32_HAS(EXT_F)
 #include <math.h>
@@ -43,16 +46,6 @@ extern struct target_ops gdbstub_ops;
 #define IF_rs2(i, r) (i->rs2 == rv_reg_##r)
 #define IF_imm(i, v) (i->imm == v)
 
-#if RV32_HAS(SYSTEM)
-#if !RV32_HAS(JIT)
-static bool need_clear_block_map = false;
-#endif
-static uint32_t reloc_enable_mmu_jalr_addr;
-static bool reloc_enable_mmu = false;
-bool need_retranslate = false;
-bool need_handle_signal = false;
-#endif
-
 /* Emulate misaligned load/store operations.
  * Only used in non-SYSTEM builds for userspace misaligned access emulation.
  * In SYSTEM mode, misaligned access traps are handled by the guest OS.
@@ -241,6 +234,26 @@ static inline void check_tohost_write(riscv_t *rv,
         return false;                                                        \
     }
 
+#if RV32_HAS(SYSTEM_MMIO)
+/* Harts advance their cycle counters at different speeds, so the TIME values
+ * derived from them drift apart. Each read publishes the furthest value seen
+ * so far in time_base and pulls a hart lagging behind it forward, which keeps
+ * TIME monotonic across harts as the guest clocksource expects.
+ */
+static void hart_sync_time(riscv_t *rv)
+{
+    vm_attr_t *attr = PRIV(rv);
+    uint64_t base = ATOMIC_LOAD(&attr->time_base, ATOMIC_RELAXED);
+    while (rv->timer > base) {
+        if (ATOMIC_COMPARE_EXCHANGE_WEAK(&attr->time_base, &base, rv->timer,
+                                         ATOMIC_RELAXED, ATOMIC_RELAXED))
+            return;
+    }
+    rv->timer_offset += base - rv->timer;
+    rv->timer = base;
+}
+#endif
+
 /* FIXME: use more precise methods for updating time, e.g., RTC */
 #if RV32_HAS(Zicsr)
 static inline void update_time(riscv_t *rv)
@@ -255,6 +268,10 @@ static inline void update_time(riscv_t *rv)
      * Timer is computed on-demand rather than incremented per-instruction.
      */
     rv->timer = rv->csr_cycle + rv->timer_offset;
+#if RV32_HAS(SYSTEM_MMIO)
+    if (PRIV(rv)->n_harts > 1)
+        hart_sync_time(rv);
+#endif
 #endif
     rv->csr_time[0] = rv->timer & 0xFFFFFFFF;
     rv->csr_time[1] = rv->timer >> 32;
@@ -349,6 +366,45 @@ static inline void rvv_csr_write(riscv_t *rv, uint32_t csr, uint32_t val)
 }
 #endif
 
+#if RV32_HAS(EXT_F)
+/* fflags and frm are views of bits 4:0 and 7:5 of fcsr */
+static inline bool fp_csr_read(riscv_t *rv, uint32_t csr, uint32_t *out)
+{
+    switch (csr & 0xFFF) {
+    case CSR_FFLAGS:
+        *out = rv->csr_fcsr & FFLAG_MASK;
+        return true;
+    case CSR_FRM:
+        *out = (rv->csr_fcsr >> 5) & 0x7;
+        return true;
+    case CSR_FCSR:
+        *out = rv->csr_fcsr & 0xff;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static inline void fp_csr_write(riscv_t *rv, uint32_t csr, uint32_t val)
+{
+    switch (csr & 0xFFF) {
+    case CSR_FFLAGS:
+        rv->csr_fcsr = (rv->csr_fcsr & ~FFLAG_MASK) | (val & FFLAG_MASK);
+        break;
+    case CSR_FRM:
+        rv->csr_fcsr = (rv->csr_fcsr & FFLAG_MASK) | (val & 0x7) << 5;
+        break;
+    default:
+        rv->csr_fcsr = val & 0xff;
+        break;
+    }
+#if RV32_HAS(JIT)
+    /* the guest may clear fflags: let T1 code report every flag anew */
+    jit_fp_reset(rv);
+#endif
+}
+#endif
+
 /* get a pointer to a CSR */
 static uint32_t *csr_get_ptr(riscv_t *rv, uint32_t csr)
 {
@@ -394,12 +450,6 @@ static uint32_t *csr_get_ptr(riscv_t *rv, uint32_t csr)
         return (uint32_t *) (&rv->csr_cycle);
     case CSR_INSTRETH: /* Upper 32 bits of instructions retired */
         return &((uint32_t *) &rv->csr_cycle)[1];
-#if RV32_HAS(EXT_F)
-    case CSR_FFLAGS:
-        return (uint32_t *) (&rv->csr_fcsr);
-    case CSR_FCSR:
-        return (uint32_t *) (&rv->csr_fcsr);
-#endif
     case CSR_SSTATUS:
         return (uint32_t *) (&rv->csr_sstatus);
     case CSR_SIE:
@@ -468,16 +518,19 @@ static uint32_t csr_csrrw(riscv_t *rv,
         rvv_csr_write(rv, csr, val);
         return rvv_out;
     }
+#endif
+#if RV32_HAS(EXT_F)
+    uint32_t fp_out;
+    if (fp_csr_read(rv, csr, &fp_out)) {
+        fp_csr_write(rv, csr, val);
+        return fp_out;
+    }
 #endif
     uint32_t *c = csr_get_ptr(rv, csr);
     if (!c)
         return 0;
 
     uint32_t out = *c;
-#if RV32_HAS(EXT_F)
-    if (csr == CSR_FFLAGS)
-        out &= FFLAG_MASK;
-#endif
 
 #if RV32_HAS(SYSTEM)
     uint32_t old_satp = *c;
@@ -485,9 +538,9 @@ static uint32_t csr_csrrw(riscv_t *rv,
     *c = val;
 
 #if RV32_HAS(SYSTEM)
-    /* Flush TLB when SATP actually changes: address space changed */
+    /* Retag or flush the TLBs when SATP actually changes */
     if (c == &rv->csr_satp && *c != old_satp)
-        mmu_tlb_flush_all(rv);
+        mmu_tlb_switch(rv, old_satp);
 #if !RV32_HAS(JIT)
     /*
      * guestOS's process might have same VA, so block map cannot be reused
@@ -499,7 +552,7 @@ static uint32_t csr_csrrw(riscv_t *rv,
      * accessing a NULL ir.
      */
     if (c == &rv->csr_satp)
-        need_clear_block_map = true;
+        rv->need_clear_block_map = true;
 #endif
 #endif
 
@@ -531,16 +584,20 @@ static uint32_t csr_csrrs(riscv_t *rv,
         }
         return rvv_out;
     }
+#endif
+#if RV32_HAS(EXT_F)
+    uint32_t fp_out;
+    if (fp_csr_read(rv, csr, &fp_out)) {
+        if (val)
+            fp_csr_write(rv, csr, fp_out | val);
+        return fp_out;
+    }
 #endif
     uint32_t *c = csr_get_ptr(rv, csr);
     if (!c)
         return 0;
 
     uint32_t out = *c;
-#if RV32_HAS(EXT_F)
-    if (csr == CSR_FFLAGS)
-        out &= FFLAG_MASK;
-#endif
 
 #if RV32_HAS(SYSTEM)
     uint32_t old_satp = *c;
@@ -548,9 +605,9 @@ static uint32_t csr_csrrs(riscv_t *rv,
     *c |= val;
 
 #if RV32_HAS(SYSTEM)
-    /* Flush TLB when SATP actually changes */
+    /* Retag or flush the TLBs when SATP actually changes */
     if (c == &rv->csr_satp && *c != old_satp)
-        mmu_tlb_flush_all(rv);
+        mmu_tlb_switch(rv, old_satp);
 #endif
 
     return out;
@@ -579,16 +636,20 @@ static uint32_t csr_csrrc(riscv_t *rv,
         }
         return rvv_out;
     }
+#endif
+#if RV32_HAS(EXT_F)
+    uint32_t fp_out;
+    if (fp_csr_read(rv, csr, &fp_out)) {
+        if (val)
+            fp_csr_write(rv, csr, fp_out & ~val);
+        return fp_out;
+    }
 #endif
     uint32_t *c = csr_get_ptr(rv, csr);
     if (!c)
         return 0;
 
     uint32_t out = *c;
-#if RV32_HAS(EXT_F)
-    if (csr == CSR_FFLAGS)
-        out &= FFLAG_MASK;
-#endif
 
 #if RV32_HAS(SYSTEM)
     uint32_t old_satp = *c;
@@ -596,9 +657,9 @@ static uint32_t csr_csrrc(riscv_t *rv,
     *c &= ~val;
 
 #if RV32_HAS(SYSTEM)
-    /* Flush TLB when SATP actually changes */
+    /* Retag or flush the TLBs when SATP actually changes */
     if (c == &rv->csr_satp && *c != old_satp)
-        mmu_tlb_flush_all(rv);
+        mmu_tlb_switch(rv, old_satp);
 #endif
 
     return out;
@@ -652,12 +713,13 @@ static block_t *block_alloc(riscv_t *rv)
     block->hot2 = false;
     block->has_loops = false;
     block->n_invoke = 0;
+    block->run_cycles = 0;
     block->func = NULL;
     INIT_LIST_HEAD(&block->list);
 #if RV32_HAS(T2C)
     block->compiled = false;
-    block->is_compiling = false;
-    block->should_free = false;
+    block->claimed = false;
+    block->linked = false;
     block->llvm_engine = NULL;
 #endif
 #endif
@@ -690,6 +752,7 @@ static void block_insert(block_map_t *map, riscv_t *rv, const block_t *block)
         }
     }
     map->size++;
+    ((block_t *) block)->referenced = true;
 
     /* update L1 cache for fast subsequent lookups */
     block_l1_update(rv, (block_t *) block);
@@ -714,6 +777,29 @@ static block_t *block_find(const block_map_t *map, const uint32_t addr)
     return NULL;
 }
 
+/* Remove the entry in slot @i of the block map. The entries that follow it in
+ * the probe sequence are shifted back, rather than leaving a tombstone, so
+ * that lookups keep stopping at the first empty slot.
+ */
+static void block_remove(block_map_t *map, uint32_t i)
+{
+    const uint32_t mask = map->block_capacity - 1;
+    for (uint32_t j = i;;) {
+        j = (j + 1) & mask;
+        block_t *block = map->map[j];
+        if (!block)
+            break;
+        /* a block whose home slot lies in (i, j] must stay behind slot i */
+        const uint32_t home = map_hash(block->pc_start) & mask;
+        if (((j - home) & mask) < ((j - i) & mask))
+            continue;
+        map->map[i] = block;
+        i = j;
+    }
+    map->map[i] = NULL;
+    map->size--;
+}
+
 /* Fast block lookup using L1 direct-mapped cache.
  * Falls back to hash table on L1 miss.
  * This is the hot path - optimized for tight loops.
@@ -725,8 +811,11 @@ static inline block_t *block_lookup_or_find(riscv_t *rv, uint32_t pc)
 {
     /* L1 cache lookup - check tag first (avoids loading pointer on miss) */
     uint32_t idx = (pc >> BLOCK_L1_INDEX_SHIFT) & BLOCK_L1_MASK;
-    if (likely(rv->block_l1.tags[idx] == pc))
-        return rv->block_l1.ptrs[idx];
+    if (likely(rv->block_l1.tags[idx] == pc)) {
+        block_t *block = rv->block_l1.ptrs[idx];
+        block->referenced = true;
+        return block;
+    }
 
     /* L1 miss - fall back to hash table lookup */
     block_t *block = block_find(&rv->block_map, pc);
@@ -735,6 +824,7 @@ static inline block_t *block_lookup_or_find(riscv_t *rv, uint32_t pc)
     if (block) {
         rv->block_l1.tags[idx] = pc;
         rv->block_l1.ptrs[idx] = block;
+        block->referenced = true;
     }
 
     return block;
@@ -771,37 +861,192 @@ enum {
 #define RVOP_NO_NEXT(ir) (!ir->next IIF(RV32_HAS(SYSTEM))(| rv->is_trapped, ))
 #endif
 
-/* record whether the branch is taken or not during emulation */
-static bool is_branch_taken = false;
-
-/* record the program counter of the previous block */
-static uint32_t last_pc = 0;
-static block_t *prev = NULL;
+/* Whether the interpreter may go into @block straight from the IR of another
+ * block, by chaining or through the branch history table or return address
+ * stack. A block still profiling its last branch is only entered through
+ * rv_step(), where superblock_due() sees it.
+ */
+FORCE_INLINE bool block_chainable(const block_t *block UNUSED)
+{
+#if RV32_HAS(SUPERBLOCK)
+    return !block->profiling;
+#else
+    return true;
+#endif
+}
 
 #if RV32_HAS(JIT)
-static set_t pc_set;
-static bool has_loops = false;
+/* Frequency that makes a block hot enough for T1, see HOT_SHIFT_MAX */
+static inline uint32_t hot_threshold(const riscv_t *rv)
+{
+    return THRESHOLD << rv->hot_shift;
+}
+
+/* The interpreter asks this at a chained branch to @next, the block at @pc,
+ * and returns to rv_step() instead of running @next if it says so, letting
+ * the dispatcher switch to T1 code in the middle of a run:
+ * - when @next has T1 code, e.g. translated since the run began;
+ * - when the branch closes a loop for the first time: runtime_profiler()
+ *   then translates the loop head on its next entry, rather than after
+ *   the head alone was interpreted for the threshold of iterations;
+ * - when the frequency of @next passed the threshold otherwise.
+ */
+static bool jit_chain_exit(riscv_t *rv, block_t *next, uint32_t pc)
+{
+    if (!set_add(&rv->pc_set, pc)) {
+        rv->has_loops = true;
+        if (next && next->translatable && !next->has_loops) {
+            next->has_loops = true;
+            return true;
+        }
+    }
+    if (!next)
+        return false;
+    return next->hot || cache_freq(rv->block_cache, pc) >= hot_threshold(rv);
+}
 #endif
 
-void reset_rv_run_state()
+void reset_rv_run_state(riscv_t *rv)
 {
-    prev = NULL;
-    is_branch_taken = false;
-    last_pc = 0;
+    rv->prev_block = NULL;
+    rv->is_branch_taken = false;
+    rv->last_pc = 0;
 #if RV32_HAS(JIT)
-    set_reset(&pc_set);
-    has_loops = false;
+    set_reset(&rv->pc_set);
+    rv->has_loops = false;
 #endif
 #if RV32_HAS(SYSTEM)
-    need_retranslate = false;
-    need_handle_signal = false;
+    rv->need_retranslate = false;
+    rv->need_handle_signal = false;
+#endif
+#if RV32_HAS(SYSTEM_MMIO)
+    rv->peripheral_update_ctr = 64;
 #endif
 }
 
 #if RV32_HAS(SYSTEM_MMIO)
 extern void emu_update_uart_interrupts(riscv_t *rv);
 extern void emu_update_rtc_interrupts(riscv_t *rv);
-static uint32_t peripheral_update_ctr = 64;
+extern void emu_update_vblk_interrupts(riscv_t *rv);
+
+/* TIME ticks per second, the timebase-frequency of minimal.dts */
+#define RV_TIMEBASE_FREQ 65000000ULL
+/* idle periods shorter than this are skipped rather than slept through */
+#define WFI_MIN_SLEEP_NS 50000ULL
+/* bound on one sleep, should a wakeup source go unnoticed */
+#define WFI_MAX_SLEEP_NS 100000000ULL
+
+/* Whether another thread posted something for the hart to act on */
+static bool hart_has_requests(riscv_t *rv)
+{
+    return ATOMIC_LOAD(&rv->ipi_pending, ATOMIC_RELAXED) ||
+           ATOMIC_LOAD(&rv->seip, ATOMIC_RELAXED) ||
+           ATOMIC_LOAD(&rv->fence_pending, ATOMIC_RELAXED) ||
+           ATOMIC_LOAD(&rv->halt, ATOMIC_RELAXED);
+}
+
+/* WFI: park the host thread until an interrupt may have become pending.
+ *
+ * The wakeups are the supervisor timer deadline and, on the boot hart, the
+ * RTC alarm, UART input and block requests completing on the host. Other
+ * harts posting an IPI, an external interrupt, a fence or a halt write to
+ * the wake pipe of the hart. TIME then moves forward by the time spent
+ * asleep, but never past the timer deadline, so the guest sees the same
+ * clock it would have seen spinning through its idle loop.
+ */
+static void rv_wfi(riscv_t *rv)
+{
+#if !defined(__EMSCRIPTEN__)
+    vm_attr_t *attr = PRIV(rv);
+    if (rv->wake_fd[0] < 0 || (rv->csr_sip & rv->csr_sie))
+        return;
+
+    /* TIME ticks to the timer deadline */
+    uint64_t ticks = UINT64_MAX;
+    if (rv->csr_sie & RV_INT_STI) {
+        uint64_t now = rv->csr_cycle + rv->timer_offset;
+        if (rv->sbi_timer <= now)
+            return;
+        ticks = rv->sbi_timer - now;
+    }
+    uint64_t timeout_ns = WFI_MAX_SLEEP_NS;
+    bool timer_first = false; /* nothing else is due before the timer */
+    if (ticks < WFI_MAX_SLEEP_NS * RV_TIMEBASE_FREQ / 1000000000) {
+        timeout_ns = ticks * 1000000000 / RV_TIMEBASE_FREQ;
+        timer_first = true;
+    }
+
+    struct pollfd pfd[2 + attr->vblk_cnt];
+    nfds_t nfds = 0;
+    pfd[nfds++] = (struct pollfd) {rv->wake_fd[0], POLLIN, 0};
+    pthread_mutex_lock(&attr->device_lock);
+    /* the guest may be waiting for a prompt it just printed */
+    u8250_flush(attr->uart);
+    if (rv->hart_id == 0) {
+#if RV32_HAS(GOLDFISH_RTC)
+        if (attr->rtc->irq_enabled) {
+            uint64_t alarm = ((uint64_t) attr->rtc->alarm_high << 32) |
+                             attr->rtc->alarm_low;
+            uint64_t now_nsec = rtc_get_now_nsec(attr->rtc);
+            uint64_t left = alarm > now_nsec ? alarm - now_nsec : 0;
+            if (left < timeout_ns) {
+                timeout_ns = left;
+                timer_first = false;
+            }
+        }
+#endif
+        if (!attr->uart->in_ready) {
+            int fd = u8250_event_fd(attr->uart);
+            /* input that came in since the devices were last polled */
+            u8250_check_ready(attr->uart);
+            if (attr->uart->in_ready) {
+                timeout_ns = 0;
+                timer_first = false;
+            } else if (fd >= 0) {
+                pfd[nfds++] = (struct pollfd) {fd, POLLIN, 0};
+            }
+        }
+        for (int i = 0; i < attr->vblk_cnt; i++) {
+            int fd = virtio_blk_event_fd(attr->vblk[i]);
+            if (fd >= 0)
+                pfd[nfds++] = (struct pollfd) {fd, POLLIN, 0};
+        }
+    }
+    pthread_mutex_unlock(&attr->device_lock);
+
+    if (timeout_ns < WFI_MIN_SLEEP_NS) {
+        if (timer_first)
+            rv->timer_offset += ticks;
+        else if (rv->hart_id == 0)
+            rv->peripheral_update_ctr = 0;
+        return;
+    }
+
+    ATOMIC_STORE(&rv->wfi_parked, true, ATOMIC_RELAXED);
+    /* pairs with the fence in rv_hart_kick() */
+    ATOMIC_THREAD_FENCE(ATOMIC_SEQ_CST);
+    uint64_t start = rv_stats_now();
+    if (!hart_has_requests(rv))
+        poll(pfd, nfds, (timeout_ns + 999999) / 1000000);
+    uint64_t slept = rv_stats_now() - start;
+    ATOMIC_STORE(&rv->wfi_parked, false, ATOMIC_RELAXED);
+
+    char buf[16];
+    while (read(rv->wake_fd[0], buf, sizeof(buf)) > 0)
+        ;
+
+    uint64_t elapsed = slept * RV_TIMEBASE_FREQ / 1000000000;
+    rv->timer_offset += elapsed < ticks ? elapsed : ticks;
+    rv->stats.wfi_sleeps++;
+    rv->stats.idle_ns += slept;
+
+    /* look at the devices at the next interrupt check */
+    if (rv->hart_id == 0)
+        rv->peripheral_update_ctr = 0;
+#else
+    (void) rv;
+#endif
+}
 #endif
 
 /* Interpreter-based execution path.
@@ -908,57 +1153,192 @@ FORCE_INLINE bool insn_is_branch(uint16_t opcode)
     MUST_TAIL return (target)->impl(rv, target, cycle, PC)
 #endif
 
-#define RVOP(inst, code)                                                   \
-    static PRESERVE_NONE bool do_##inst(riscv_t *rv, const rv_insn_t *ir,  \
-                                        uint64_t cycle, uint32_t PC)       \
-    {                                                                      \
-        RVOP_SYNC_PC(rv, PC);                                              \
-        cycle++;                                                           \
-        code;                                                              \
-        IIF(RV32_HAS(SYSTEM))(                                             \
-            if (need_handle_signal) {                                      \
-                need_handle_signal = false;                                \
-                return true;                                               \
-            }, ) nextop : PC += __rv_insn_##inst##_len;                    \
-        IIF(RV32_HAS(SYSTEM))(IIF(RV32_HAS(JIT))(                          \
-                                  , if (unlikely(need_clear_block_map)) {  \
-                                      block_map_clear(rv);                 \
-                                      need_clear_block_map = false;        \
-                                      rv->csr_cycle = cycle;               \
-                                      rv->PC = PC;                         \
-                                      return false;                        \
-                                  }), );                                   \
-        if (unlikely(RVOP_NO_NEXT(ir)))                                    \
-            goto end_op;                                                   \
-        const rv_insn_t *next = ir->next;                                  \
-        RVOP_TAIL_INTRA(rv, next, cycle, PC); /* Fast path: intra-block */ \
-    end_op:                                                                \
-        IIF(RV32_HAS(BLOCK_CHAINING))(                                     \
-            {                                                              \
-                /* Page-terminated block fallthrough: if branch_taken is   \
-                 * set AND this is NOT a branch instruction, tail-call     \
-                 * to next block. Branch instructions use branch_taken     \
-                 * for the taken path, not fallthrough.                    \
-                 */                                                        \
-                if (!insn_is_branch(ir->opcode)) {                         \
-                    struct rv_insn *taken = ir->branch_taken;              \
-                    if (taken) {                                           \
-                        IIF(RV32_HAS(SYSTEM))(                             \
-                            if (!rv->is_trapped) {                         \
-                                last_pc = PC;                              \
-                                RVOP_TAIL(rv, taken, cycle, PC);           \
-                            },                                             \
-                            {                                              \
-                                last_pc = PC;                              \
-                                RVOP_TAIL(rv, taken, cycle, PC);           \
-                            });                                            \
-                    }                                                      \
-                }                                                          \
-            }, );                                                          \
-        rv->csr_cycle = cycle;                                             \
-        rv->PC = PC;                                                       \
-        return true;                                                       \
+#if RV32_HAS(SUPERBLOCK)
+/* A branch that block_translate() followed is not the last instruction of its
+ * block: carry on with the next IR if the branch went its way, or leave the
+ * block through a side exit to rv_step() if it did not.
+ */
+#define RVOP_SUPERBLOCK_NEXT(rv, ir, cycle, PC)                              \
+    do {                                                                     \
+        if ((ir)->next) {                                                    \
+            if (unlikely((ir)->next->pc != (PC) || RVOP_NO_NEXT(ir)))        \
+                goto end_op;                                                 \
+            RVOP_TAIL_INTRA(rv, (ir)->next, cycle, PC);                      \
+        }                                                                    \
+    } while (0)
+
+/* The same for a conditional branch that fell through, @len bytes long */
+#define RVOP_SUPERBLOCK_FALLTHROUGH(rv, ir, cycle, PC, len) \
+    do {                                                    \
+        if ((ir)->next) {                                   \
+            PC += (len);                                    \
+            RVOP_SUPERBLOCK_NEXT(rv, ir, cycle, PC);        \
+        }                                                   \
+    } while (0)
+
+/* Count the way a conditional branch went, for superblock_lean(). A branch
+ * single-stepped by rv_step_debug() has no table.
+ */
+#define RVOP_SUPERBLOCK_COUNT(ir, field)   \
+    do {                                   \
+        if (likely((ir)->branch_table))    \
+            (ir)->branch_table->field++;   \
+    } while (0)
+#else
+#define RVOP_SUPERBLOCK_NEXT(rv, ir, cycle, PC) \
+    do {                                        \
+    } while (0)
+#define RVOP_SUPERBLOCK_FALLTHROUGH(rv, ir, cycle, PC, len) \
+    do {                                                    \
+    } while (0)
+#define RVOP_SUPERBLOCK_COUNT(ir, field) \
+    do {                                 \
+    } while (0)
+#endif
+
+#define RVOP(inst, code)                                                      \
+    static PRESERVE_NONE bool do_##inst(riscv_t *rv, const rv_insn_t *ir,     \
+                                        uint64_t cycle, uint32_t PC)          \
+    {                                                                         \
+        RVOP_SYNC_PC(rv, PC);                                                 \
+        cycle++;                                                              \
+        code;                                                                 \
+        IIF(RV32_HAS(SYSTEM))(                                                \
+            if (rv->need_handle_signal) {                                     \
+                rv->need_handle_signal = false;                               \
+                return true;                                                  \
+            }, ) nextop : PC += __rv_insn_##inst##_len;                       \
+        IIF(RV32_HAS(SYSTEM))(IIF(RV32_HAS(JIT))(                             \
+                                  , if (unlikely(rv->need_clear_block_map)) { \
+                                      block_map_clear(rv);                    \
+                                      rv->need_clear_block_map = false;       \
+                                      rv->csr_cycle = cycle;                  \
+                                      rv->PC = PC;                            \
+                                      return false;                           \
+                                  }), );                                      \
+        if (unlikely(RVOP_NO_NEXT(ir)))                                       \
+            goto end_op;                                                      \
+        const rv_insn_t *next = ir->next;                                     \
+        RVOP_TAIL_INTRA(rv, next, cycle, PC); /* Fast path: intra-block */    \
+    end_op:                                                                   \
+        IIF(RV32_HAS(BLOCK_CHAINING))(                                        \
+            {                                                                 \
+                /* Page-terminated block fallthrough: if branch_taken is      \
+                 * set AND this is NOT a branch instruction, tail-call        \
+                 * to next block. Branch instructions use branch_taken        \
+                 * for the taken path, not fallthrough.                       \
+                 */                                                           \
+                if (!insn_is_branch(ir->opcode)) {                            \
+                    struct rv_insn *taken = ir->branch_taken;                 \
+                    if (taken) {                                              \
+                        IIF(RV32_HAS(SYSTEM))(                                \
+                            if (!rv->is_trapped) {                            \
+                                rv->last_pc = PC;                             \
+                                RVOP_TAIL(rv, taken, cycle, PC);              \
+                            },                                                \
+                            {                                                 \
+                                rv->last_pc = PC;                             \
+                                RVOP_TAIL(rv, taken, cycle, PC);              \
+                            });                                               \
+                    }                                                         \
+                }                                                             \
+            }, );                                                             \
+        rv->csr_cycle = cycle;                                                \
+        rv->PC = PC;                                                          \
+        return true;                                                          \
+    }
+
+#if RV32_HAS(EXT_A)
+#if RV32_HAS(SYSTEM_MMIO)
+/* Carry out an RV32A instruction on guest RAM with host atomics, so that it
+ * stays atomic with respect to harts running on other host threads. LR.W
+ * records the physical address and the value it observed, and SC.W succeeds
+ * only if a compare-and-swap against that value does.
+ *
+ * Returns false if the word is not RAM: the caller then emulates the
+ * instruction with plain MMIO accesses, which the device lock serializes.
+ * A page fault leaves need_handle_signal set and rd untouched.
+ */
+static bool rv_atomic_on_host(riscv_t *rv, const rv_insn_t *ir, uint32_t addr)
+{
+    /* LR.W needs read permission, SC.W and AMOs write permission */
+    const bool is_read = ir->opcode == rv_insn_lrw;
+    const uint32_t paddr = rv->io.mem_translate(rv, addr, is_read);
+    if (rv->need_handle_signal)
+        return true;
+    if (!GUEST_RAM_CONTAINS(PRIV(rv)->mem, paddr, 4))
+        return false;
+
+    if (!is_read)
+        mmu_code_store(rv, paddr, 4);
+    uint32_t *ptr = (uint32_t *) (PRIV(rv)->mem->mem_base + paddr);
+    const uint32_t val = rv->X[ir->rs2];
+    uint32_t old;
+    switch (ir->opcode) {
+    case rv_insn_lrw:
+        old = ATOMIC_LOAD(ptr, ATOMIC_SEQ_CST);
+        rv->lr_valid = true;
+        rv->lr_addr = paddr;
+        rv->lr_val = old;
+        break;
+    case rv_insn_scw: {
+        /* rd is 0 on success; a weak CAS may fail spuriously like SC.W */
+        uint32_t expected = rv->lr_val;
+        old = !(rv->lr_valid && rv->lr_addr == paddr &&
+                ATOMIC_COMPARE_EXCHANGE_WEAK(ptr, &expected, val,
+                                             ATOMIC_SEQ_CST, ATOMIC_RELAXED));
+        rv->lr_valid = false;
+        break;
+    }
+    case rv_insn_amoswapw:
+        old = ATOMIC_EXCHANGE(ptr, val, ATOMIC_SEQ_CST);
+        break;
+    case rv_insn_amoaddw:
+        old = ATOMIC_FETCH_ADD(ptr, val, ATOMIC_SEQ_CST);
+        break;
+    case rv_insn_amoxorw:
+        old = ATOMIC_FETCH_XOR(ptr, val, ATOMIC_SEQ_CST);
+        break;
+    case rv_insn_amoandw:
+        old = ATOMIC_FETCH_AND(ptr, val, ATOMIC_SEQ_CST);
+        break;
+    case rv_insn_amoorw:
+        old = ATOMIC_FETCH_OR(ptr, val, ATOMIC_SEQ_CST);
+        break;
+    default: {
+        /* AMOMIN/AMOMAX and their unsigned forms */
+        uint32_t res;
+        old = ATOMIC_LOAD(ptr, ATOMIC_RELAXED);
+        do {
+            switch (ir->opcode) {
+            case rv_insn_amominw:
+                res = (int32_t) old < (int32_t) val ? old : val;
+                break;
+            case rv_insn_amomaxw:
+                res = (int32_t) old > (int32_t) val ? old : val;
+                break;
+            case rv_insn_amominuw:
+                res = old < val ? old : val;
+                break;
+            default:
+                res = old > val ? old : val;
+                break;
+            }
+        } while (!ATOMIC_COMPARE_EXCHANGE_WEAK(ptr, &old, res, ATOMIC_SEQ_CST,
+                                               ATOMIC_RELAXED));
+        break;
     }
+    }
+
+    if (ir->rd)
+        rv->X[ir->rd] = old;
+    return true;
+}
+#else
+/* a single hart runs on one thread, plain read-modify-write is atomic */
+#define rv_atomic_on_host(rv, ir, addr) false
+#endif
+#endif /* RV32_HAS(EXT_A) */
 
 #include "rv32_template.c"
 #undef RVOP
@@ -977,17 +1357,17 @@ static PRESERVE_NONE bool fuse_next_or_stop(riscv_t *rv,
                                             uint32_t PC)
 {
 #if RV32_HAS(SYSTEM)
-    if (need_handle_signal) {
-        need_handle_signal = false;
+    if (rv->need_handle_signal) {
+        rv->need_handle_signal = false;
         /* Match RVOP: return without saving cycle/PC. The signal handler
          * will determine the appropriate PC from rv->PC (unchanged).
          */
         return true;
     }
 #if !RV32_HAS(JIT)
-    if (unlikely(need_clear_block_map)) {
+    if (unlikely(rv->need_clear_block_map)) {
         block_map_clear(rv);
-        need_clear_block_map = false;
+        rv->need_clear_block_map = false;
         rv->csr_cycle = cycle;
         rv->PC = PC;
         return false;
@@ -1294,38 +1674,53 @@ static PRESERVE_NONE bool do_fuse12(riscv_t *rv,
 
     if (rv->X[ir->rd] != 0) {
         /* Branch taken */
-        is_branch_taken = true;
+        rv->is_branch_taken = true;
         PC += 4 + ir->imm2; /* ADDI len + branch offset */
         struct rv_insn *taken = ir->branch_taken;
         if (taken) {
+#if RV32_HAS(JIT)
+            /* A countdown loop chains back to itself: leave through the
+             * dispatcher once it is hot so that it gets promoted to T1.
+             */
+            block_t *next = cache_get(rv->block_cache, PC, true);
+            if (next
+#if RV32_HAS(SYSTEM)
+                && next->satp == rv->csr_satp && !next->invalidated
+#endif
+                && jit_chain_exit(rv, next, PC))
+                goto end_op;
+#endif
 #if RV32_HAS(SYSTEM)
             if (!rv->is_trapped) {
-                last_pc = PC;
+                rv->last_pc = PC;
                 MUST_TAIL return taken->impl(rv, taken, cycle, PC);
             }
 #else
-            last_pc = PC;
+            rv->last_pc = PC;
             MUST_TAIL return taken->impl(rv, taken, cycle, PC);
 #endif
         }
     } else {
         /* Branch not taken */
-        is_branch_taken = false;
+        rv->is_branch_taken = false;
         PC += 8; /* Skip both ADDI and BNE */
         struct rv_insn *untaken = ir->branch_untaken;
         if (untaken) {
 #if RV32_HAS(SYSTEM)
             if (!rv->is_trapped) {
-                last_pc = PC;
+                rv->last_pc = PC;
                 MUST_TAIL return untaken->impl(rv, untaken, cycle, PC);
             }
 #else
-            last_pc = PC;
+            rv->last_pc = PC;
             MUST_TAIL return untaken->impl(rv, untaken, cycle, PC);
 #endif
         }
     }
 
+#if RV32_HAS(JIT)
+end_op:
+#endif
     rv->csr_cycle = cycle;
     rv->PC = PC;
     return true;
@@ -1345,9 +1740,17 @@ static const void *dispatch_table[] = {
 /* clang-format on */
 
 #if RV32_HAS(JIT)
-FORCE_INLINE bool insn_is_translatable(uint16_t opcode)
+FORCE_INLINE bool insn_is_translatable(const rv_insn_t *ir)
 {
-    switch (opcode) {
+    switch (ir->opcode) {
+#if RV32_HAS(Zicsr)
+    case rv_insn_csrrs:
+    case rv_insn_csrrc:
+    case rv_insn_csrrwi:
+    case rv_insn_csrrsi:
+    case rv_insn_csrrci:
+        return jit_csr_translatable(ir);
+#endif
 #define _(inst, can_branch, insn_len, translatable, reg_mask) \
     IIF(translatable)(case rv_insn_##inst:, )
         RV_INSN_LIST
@@ -1356,6 +1759,37 @@ FORCE_INLINE bool insn_is_translatable(uint16_t opcode)
     }
     return false;
 }
+
+uint32_t jit_insn_handler(riscv_t *rv,
+                          uint32_t opcode,
+                          uint32_t operands,
+                          uint32_t pc)
+{
+    rv_insn_t ir;
+    memset(&ir, 0, sizeof(rv_insn_t));
+    jit_insn_unpack(&ir, opcode, operands);
+
+    /* Run the interpreter handler as a one-instruction block. Unlike
+     * jit_fp_handler(), keep the cycle it retires: see emit_csr() for why
+     * counter reads from T1 code have to.
+     */
+    ir.pc = pc;
+    ir.impl = dispatch_table[opcode];
+    rv->PC = pc; /* the exception PC if the instruction traps */
+    bool ok = ir.impl(rv, &ir, rv->csr_cycle, pc);
+#if RV32_HAS(SYSTEM)
+    ok = ok && !rv->is_trapped;
+#endif
+    return ok;
+}
+#endif
+
+#if RV32_HAS(JIT) && RV32_HAS(EXT_V)
+#include "rv32_v_jit.c"
+#endif
+
+#if RV32_HAS(JIT) && RV32_HAS(EXT_F)
+#include "rv32_f_jit.c"
 #endif
 
 #if RV32_HAS(BLOCK_CHAINING)
@@ -1367,6 +1801,7 @@ FORCE_INLINE bool insn_is_unconditional_branch(uint16_t opcode)
     case rv_insn_jal:
     case rv_insn_jalr:
     case rv_insn_mret:
+    case rv_insn_wfi:
 #if RV32_HAS(Zicsr)
     case rv_insn_csrrw:
 #endif
@@ -1385,7 +1820,9 @@ FORCE_INLINE bool insn_is_unconditional_branch(uint16_t opcode)
         return false;
     }
 }
+#endif
 
+#if RV32_HAS(BLOCK_CHAINING) || RV32_HAS(SUPERBLOCK)
 FORCE_INLINE bool insn_is_direct_branch(uint16_t opcode)
 {
     switch (opcode) {
@@ -1415,69 +1852,275 @@ FORCE_INLINE bool insn_is_indirect_branch(uint16_t opcode)
     }
 }
 
-static bool block_translate(riscv_t *rv, block_t *block)
+#if RV32_HAS(SUPERBLOCK)
+/* Upper bound on the branches one superblock follows */
+#define SUPERBLOCK_MAX_BRANCHES 4
+
+/* Interpreted runs of the conditional branch that ends a block before
+ * superblock_reform() decides which way it leans
+ */
+#define SUPERBLOCK_SAMPLES 256
+
+/* A conditional branch leans one way if it goes the other way at most once in
+ * this many runs
+ */
+#define SUPERBLOCK_BIAS 16
+
+FORCE_INLINE bool insn_is_conditional_branch(uint16_t opcode)
 {
-retranslate:
-    block->pc_start = block->pc_end = rv->PC;
-#if RV32_HAS(BLOCK_CHAINING)
-    block->page_terminated = false;
+    switch (opcode) {
+    case rv_insn_beq:
+    case rv_insn_bne:
+    case rv_insn_blt:
+    case rv_insn_bge:
+    case rv_insn_bltu:
+    case rv_insn_bgeu:
+#if RV32_HAS(EXT_C)
+    case rv_insn_cbeqz:
+    case rv_insn_cbnez:
 #endif
+        return true;
+    default:
+        return false;
+    }
+}
 
-    rv_insn_t *prev_ir = NULL;
-    rv_insn_t *ir = mpool_calloc(rv->block_ir_mp);
-    if (unlikely(!ir))
+/* Find where the conditional branch @ir leads most of the time, from the
+ * counts of the same branch in the block @prof. @fallthrough is the address
+ * after @ir. Return false if @prof has too few runs of it, or it leans
+ * neither way.
+ */
+static bool superblock_lean(const block_t *prof,
+                            const rv_insn_t *ir,
+                            uint32_t fallthrough,
+                            uint32_t *target)
+{
+    if (!prof)
+        return false;
+    const rv_insn_t *p = prof->ir_head;
+    while (p && p->pc != ir->pc)
+        p = p->next;
+    if (!p || !insn_is_conditional_branch(p->opcode))
         return false;
-    block->ir_head = ir;
 
-    /* translate the basic block */
-    while (true) {
-        if (prev_ir)
-            prev_ir->next = ir;
+    const uint64_t taken = p->branch_table->taken;
+    const uint64_t untaken = p->branch_table->untaken;
+    if (taken + untaken < SUPERBLOCK_SAMPLES)
+        return false;
+    if (untaken * SUPERBLOCK_BIAS <= taken + untaken)
+        *target = ir->pc + ir->imm;
+    else if (taken * SUPERBLOCK_BIAS <= taken + untaken)
+        *target = fallthrough;
+    else
+        return false;
+    return true;
+}
 
-        /* fetch the next instruction */
-        uint32_t insn = rv->io.mem_ifetch(rv, block->pc_end);
+/* Whether block_translate() may continue @block at the target of the branch
+ * @ir rather than end the block there, and if so, where to. That is the
+ * target of a direct jump or call, or the way a conditional branch leans in
+ * the profile @prof. @trace holds the address ranges already in the block as
+ * n_trace [start, end) pairs, the last of them still open at @ir.
+ *
+ * The target must lie in the page the block starts in, so that invalidating
+ * blocks by page keeps working, and must not be in the block already, which
+ * would only unroll a loop. In user mode the block also stops in front of the
+ * exit routine, whose entry rv_step() watches for.
+ */
+static bool superblock_follows(riscv_t *rv UNUSED,
+                               const block_t *block,
+                               const rv_insn_t *ir,
+                               const block_t *prof,
+                               const uint32_t *trace,
+                               uint32_t n_trace,
+                               uint32_t *target)
+{
+    if (n_trace > SUPERBLOCK_MAX_BRANCHES)
+        return false;
+    if (insn_is_direct_branch(ir->opcode))
+        *target = ir->pc + ir->imm;
+    else if (!insn_is_conditional_branch(ir->opcode) ||
+             !superblock_lean(prof, ir, block->pc_end, target))
+        return false;
 
-#if RV32_HAS(SYSTEM)
-        if (!insn && need_retranslate) {
-            memset(block, 0, sizeof(block_t));
-            need_retranslate = false;
-            goto retranslate;
-        }
+    const uint32_t page = block->pc_start & ~(RV_PG_SIZE - 1);
+    if ((ir->pc & ~(RV_PG_SIZE - 1)) != page ||
+        (*target & ~(RV_PG_SIZE - 1)) != page)
+        return false;
+#if !RV32_HAS(EXT_C)
+    if (*target & 3)
+        return false; /* leave the misaligned jump to the interpreter */
+#endif
+#if !RV32_HAS(SYSTEM)
+    if (*target == PRIV(rv)->exit_addr)
+        return false;
 #endif
+    for (uint32_t i = 0; i < n_trace; i++) {
+        const uint32_t end = i == n_trace - 1 ? block->pc_end : trace[2 * i + 1];
+        if (*target >= trace[2 * i] && *target < end)
+            return false;
+    }
+    return true;
+}
 
-        /* If instruction fetch failed due to trap (page fault, etc.), break.
-         * The caller checks rv->is_trapped and invokes trap handler.
-         * Note: insn==0 alone is ambiguous; we verify trap state explicitly.
-         */
-        if (!insn)
-            break;
+/* Whether @block is where the last instruction of @prev leads, given the way
+ * the branch went, rather than where a side exit of the superblock @prev does.
+ * A side exit leaves @prev with PC at a branch target its last instruction
+ * does not have, which must not be chained to that instruction.
+ */
+static bool superblock_exits_at_tail(const block_t *prev,
+                                     const block_t *block,
+                                     bool taken)
+{
+    const rv_insn_t *last_ir = prev->ir_tail;
+    if (last_ir == prev->ir_head)
+        return true;
+    if (insn_is_direct_branch(last_ir->opcode) ||
+        (insn_is_conditional_branch(last_ir->opcode) && taken))
+        return block->pc_start == last_ir->pc + last_ir->imm;
+    return block->pc_start == prev->pc_end;
+}
 
-        /* decode the instruction */
-        if (!rv_decode(ir, insn)) {
-            rv->compressed = is_compressed(insn);
-            SET_CAUSE_AND_TVAL_THEN_TRAP(rv, ILLEGAL_INSN, insn);
-            break;
-        }
-        ir->impl = dispatch_table[ir->opcode];
-        ir->pc = block->pc_end; /* compute the end of pc */
-        block->pc_end += is_compressed(insn) ? 2 : 4;
-        block->n_insn++;
-        prev_ir = ir;
-#if RV32_HAS(JIT)
-        if (!insn_is_translatable(ir->opcode))
-            block->translatable = false;
+/* The block that profiled the branches from @pc on: @prof if it ran the code
+ * there as well, else the block starting at @pc, if there is one.
+ */
+static const block_t *superblock_profile(riscv_t *rv,
+                                         const block_t *prof,
+                                         uint32_t pc)
+{
+    for (const rv_insn_t *ir = prof ? prof->ir_head : NULL; ir; ir = ir->next) {
+        if (ir->pc == pc)
+            return prof;
+    }
+#if !RV32_HAS(JIT)
+    return block_find(&rv->block_map, pc);
+#else
+    const block_t *block = cache_get(rv->block_cache, pc, false);
+#if RV32_HAS(SYSTEM)
+    if (block && (block->satp != rv->csr_satp || block->invalidated))
+        return NULL;
+#endif
+    return block;
+#endif
+}
+#else
+FORCE_INLINE bool superblock_exits_at_tail(const block_t *prev UNUSED,
+                                           const block_t *block UNUSED,
+                                           bool taken UNUSED)
+{
+    return true;
+}
+#endif
+
+/* Make room for @n IRs, and as many fuse entries, in the translation buffers.
+ * Fused instructions never take more entries than the instructions they
+ * replace, so the fuse buffer cannot run out before the IR buffer.
+ */
+static bool ir_buf_reserve(riscv_t *rv, uint32_t n)
+{
+    if (likely(n <= rv->ir_buf_cap))
+        return true;
+
+    uint32_t cap = rv->ir_buf_cap ? rv->ir_buf_cap * 2 : 64;
+    rv_insn_t *irs = realloc(rv->ir_buf, cap * sizeof(rv_insn_t));
+    if (unlikely(!irs))
+        return false;
+    rv->ir_buf = irs;
+    opcode_fuse_t *fuse = realloc(rv->fuse_buf, cap * sizeof(opcode_fuse_t));
+    if (unlikely(!fuse))
+        return false;
+    rv->fuse_buf = fuse;
+    rv->ir_buf_cap = cap;
+    return true;
+}
+
+/* Decode a block into the translation buffers. block_seal() moves it into
+ * memory of its own once the optimizations are done with it. A superblock
+ * follows the conditional branches the way the blocks that ran them before,
+ * @prof first, saw them go; @prof is NULL for a block never run.
+ */
+static bool block_translate(riscv_t *rv,
+                            block_t *block,
+                            const block_t *prof UNUSED)
+{
+retranslate:
+    block->pc_start = block->pc_end = rv->PC;
+#if RV32_HAS(SUPERBLOCK)
+    uint32_t trace[2 * (SUPERBLOCK_MAX_BRANCHES + 1)] = {rv->PC};
+    uint32_t n_trace = 1;
+    const block_t *profile = prof;
+#endif
+#if RV32_HAS(JIT)
+    block->digest = jit_digest_step(0xcbf29ce484222325ULL, block->pc_start);
+#endif
+#if RV32_HAS(BLOCK_CHAINING)
+    block->page_terminated = false;
+#endif
+
+    /* translate the basic block */
+    while (true) {
+        if (unlikely(!ir_buf_reserve(rv, block->n_insn + 1)))
+            return false;
+        rv_insn_t *ir = &rv->ir_buf[block->n_insn];
+        memset(ir, 0, sizeof(rv_insn_t));
+
+        /* fetch the next instruction */
+        uint32_t insn = rv->io.mem_ifetch(rv, block->pc_end);
+
+#if RV32_HAS(SYSTEM)
+        if (!insn && rv->need_retranslate) {
+            memset(block, 0, sizeof(block_t));
+            rv->need_retranslate = false;
+            goto retranslate;
+        }
+#endif
+
+        /* If instruction fetch failed due to trap (page fault, etc.), break.
+         * The caller checks rv->is_trapped and invokes trap handler.
+         * Note: insn==0 alone is ambiguous; we verify trap state explicitly.
+         */
+        if (!insn)
+            break;
+
+        /* decode the instruction */
+        if (!rv_decode(ir, insn)) {
+            rv->compressed = is_compressed(insn);
+            SET_CAUSE_AND_TVAL_THEN_TRAP(rv, ILLEGAL_INSN, insn);
+            break;
+        }
+        ir->impl = dispatch_table[ir->opcode];
+#if RV32_HAS(JIT) && RV32_HAS(SYSTEM)
+        /* the physical pages FENCE.I finds the block by */
+        if (!block->n_insn)
+            block->code_page[0] = rv->ifetch_page;
+        block->code_page[1] = rv->ifetch_page;
+#endif
+        ir->pc = block->pc_end; /* compute the end of pc */
+        block->pc_end += is_compressed(insn) ? 2 : 4;
+        block->n_insn++;
+#if RV32_HAS(JIT)
+        block->digest = jit_digest_step(
+            block->digest, is_compressed(insn) ? insn & 0xffff : insn);
+        if (!insn_is_translatable(ir))
+            block->translatable = false;
 #endif
         /* stop on branch */
         if (insn_is_branch(ir->opcode)) {
-            if (insn_is_indirect_branch(ir->opcode)) {
-                ir->branch_table = calloc(1, sizeof(branch_history_table_t));
-                if (unlikely(!ir->branch_table))
-                    return false;
-                assert(ir->branch_table);
-                memset(ir->branch_table->PC, -1,
-                       sizeof(uint32_t) * HISTORY_SIZE);
-            }
+#if RV32_HAS(SUPERBLOCK)
+            uint32_t target;
+            if (!superblock_follows(rv, block, ir, profile, trace, n_trace,
+                                    &target))
+                break;
+            /* go on translating at the jump target, or the likely side of
+             * the branch, along with the profile of the code there
+             */
+            profile = superblock_profile(rv, profile, target);
+            trace[2 * n_trace - 1] = block->pc_end;
+            block->pc_end = target;
+            trace[2 * n_trace++] = block->pc_end;
+#else
             break;
+#endif
         }
 
 #if RV32_HAS(BLOCK_CHAINING)
@@ -1494,29 +2137,21 @@ retranslate:
             }
         }
 #endif
-
-        ir = mpool_calloc(rv->block_ir_mp);
-        if (unlikely(!ir))
-            return false;
     }
 
     /* If no instructions were successfully decoded (e.g., first instruction
-     * was illegal), free the allocated IR and return failure.
+     * was illegal), there is no block.
      */
-    if (unlikely(!prev_ir)) {
-        mpool_free(rv->block_ir_mp, block->ir_head);
+    if (unlikely(!block->n_insn))
         return false;
-    }
-
-    /* Free orphaned IR that was allocated at end of previous iteration but not
-     * used due to early break (fetch fail, decode fail, etc.).
-     * This IR was linked at prev_ir->next but never became prev_ir.
-     */
-    if (prev_ir->next)
-        mpool_free(rv->block_ir_mp, prev_ir->next);
 
-    block->ir_tail = prev_ir;
+    for (uint32_t i = 0; i < block->n_insn - 1; i++)
+        rv->ir_buf[i].next = &rv->ir_buf[i + 1];
+    block->ir_head = rv->ir_buf;
+    block->ir_tail = &rv->ir_buf[block->n_insn - 1];
     block->ir_tail->next = NULL;
+    block->fuse_free = rv->fuse_buf;
+    block->n_fuse_free = block->n_insn;
     /* Set cycle cost before macro-op fusion. This intentionally counts
      * original instructions for accurate timing - fused operations still
      * represent the same logical work as unfused sequences.
@@ -1525,17 +2160,84 @@ retranslate:
     return true;
 }
 
+/* Whether block_seal() gives @ir a branch history table */
+FORCE_INLINE bool block_needs_table(const rv_insn_t *ir)
+{
+#if RV32_HAS(SUPERBLOCK)
+    if (insn_is_conditional_branch(ir->opcode))
+        return true;
+#endif
+    return insn_is_indirect_branch(ir->opcode);
+}
+
+/* Move a translated block out of the translation buffers into a single
+ * allocation: its IRs in execution order, the branch history tables of its
+ * indirect jumps, and with superblocks of its conditional branches too, then
+ * its fuse entries, with room left for the fusion of its lazy fusion
+ * candidates. The IRs dropped by fusion are left behind, so that the
+ * interpreter walks through the block linearly.
+ */
+static bool block_seal(block_t *block)
+{
+    uint32_t n_tables = 0, n_fuse = 0, n_lazy = 0;
+    for (rv_insn_t *ir = block->ir_head; ir; ir = ir->next) {
+        n_tables += block_needs_table(ir);
+        if (ir->fuse)
+            n_fuse += ir->imm2;
+    }
+#if RV32_HAS(SYSTEM_MMIO) && RV32_HAS(MOP_FUSION)
+    for (uint8_t i = 0; i < block->n_lazy_candidates; i++)
+        n_lazy += block->lazy_candidates[i].count;
+#endif
+
+    const size_t size = block->n_insn * sizeof(rv_insn_t) +
+                        n_tables * sizeof(branch_history_table_t) +
+                        (n_fuse + n_lazy) * sizeof(opcode_fuse_t);
+    rv_insn_t *irs = malloc(size);
+    if (unlikely(!irs))
+        return false;
+
+    branch_history_table_t *table =
+        (branch_history_table_t *) (irs + block->n_insn);
+    opcode_fuse_t *fuse = (opcode_fuse_t *) (table + n_tables);
+    uint32_t i = 0;
+    for (rv_insn_t *ir = block->ir_head; ir; ir = ir->next, i++) {
+        rv_insn_t *dst = &irs[i];
+        *dst = *ir;
+        dst->next = ir->next ? dst + 1 : NULL;
+        if (ir->fuse) {
+            memcpy(fuse, ir->fuse, ir->imm2 * sizeof(opcode_fuse_t));
+            dst->fuse = fuse;
+            fuse += ir->imm2;
+        }
+        if (block_needs_table(ir)) {
+            memset(table, 0, sizeof(branch_history_table_t));
+            memset(table->PC, -1, sizeof(uint32_t) * HISTORY_SIZE);
+            dst->branch_table = table++;
+        }
+#if RV32_HAS(SYSTEM_MMIO) && RV32_HAS(MOP_FUSION)
+        for (uint8_t j = 0; j < block->n_lazy_candidates; j++) {
+            if (block->lazy_candidates[j].ir == ir)
+                block->lazy_candidates[j].ir = dst;
+        }
+#endif
+    }
+    assert(i == block->n_insn);
+
+    block->ir_head = irs;
+    block->ir_tail = &irs[block->n_insn - 1];
+    block->fuse_free = fuse;
+    block->n_fuse_free = n_lazy;
+    return true;
+}
+
 #if RV32_HAS(MOP_FUSION)
-static inline void remove_next_nth_ir(const riscv_t *rv,
-                                      rv_insn_t *ir,
+static inline void remove_next_nth_ir(rv_insn_t *ir,
                                       block_t *block,
                                       uint8_t n)
 {
-    for (uint8_t i = 0; i < n; i++) {
-        rv_insn_t *next = ir->next;
+    for (uint8_t i = 0; i < n; i++)
         ir->next = ir->next->next;
-        mpool_free(rv->block_ir_mp, next);
-    }
     if (!ir->next)
         block->ir_tail = ir;
     block->n_insn -= n;
@@ -1576,11 +2278,10 @@ static inline int count_consecutive_shift(rv_insn_t *ir)
 }
 
 /* Allocate and rewrite a fused sequence.
- * Returns true on success, false on allocation failure (graceful degradation).
- * Uses pooled allocation for fuse arrays up to FUSE_MAX_ENTRIES.
+ * Returns true on success, false if the block has no fuse entries left for it
+ * (graceful degradation).
  */
-static inline bool try_fuse_sequence(riscv_t *rv,
-                                     block_t *block,
+static inline bool try_fuse_sequence(block_t *block,
                                      rv_insn_t *ir,
                                      int count,
                                      uint16_t fuse_opcode)
@@ -1588,17 +2289,18 @@ static inline bool try_fuse_sequence(riscv_t *rv,
     if (count <= 1)
         return false;
 
-    /* Reject sequences exceeding pool slot size - rare case with diminishing
-     * returns. This also handles the overflow check implicitly.
+    /* Reject sequences exceeding FUSE_MAX_ENTRIES - rare case with
+     * diminishing returns. This also handles the overflow check implicitly.
      */
     if (unlikely(count > FUSE_MAX_ENTRIES))
         return false;
 
-    opcode_fuse_t *fuse_data = mpool_alloc(rv->fuse_mp);
-    if (unlikely(!fuse_data))
+    if (unlikely((uint32_t) count > block->n_fuse_free))
         return false;
 
-    ir->fuse = fuse_data;
+    ir->fuse = block->fuse_free;
+    block->fuse_free += count;
+    block->n_fuse_free -= count;
     /* Copy original instruction BEFORE changing opcode (preserves original
      * opcode in fuse[0] for handlers like shift_func that need it) */
     memcpy(ir->fuse, ir, sizeof(opcode_fuse_t));
@@ -1610,7 +2312,7 @@ static inline bool try_fuse_sequence(riscv_t *rv,
     for (int j = 1; j < count; j++, next_ir = next_ir->next)
         memcpy(ir->fuse + j, next_ir, sizeof(opcode_fuse_t));
 
-    remove_next_nth_ir(rv, ir, block, count - 1);
+    remove_next_nth_ir(ir, block, count - 1);
     return true;
 }
 
@@ -1694,7 +2396,7 @@ static bool lazy_fusion_safe_base_regs(uint32_t modified_regs_before,
  * Strategies are being devised to increase the number of instructions that
  * match the pattern, including possible instruction reordering.
  */
-static void match_pattern(riscv_t *rv, block_t *block)
+static void match_pattern(riscv_t *rv UNUSED, block_t *block)
 {
     uint32_t i;
     rv_insn_t *ir;
@@ -1728,7 +2430,7 @@ static void match_pattern(riscv_t *rv, block_t *block)
                     ir->rs1 =
                         (ir->rd == next_ir->rs2) ? next_ir->rs1 : next_ir->rs2;
                     ir->impl = dispatch_table[ir->opcode];
-                    remove_next_nth_ir(rv, ir, block, 1);
+                    remove_next_nth_ir(ir, block, 1);
                 }
                 break;
             case rv_insn_addi:
@@ -1744,7 +2446,7 @@ static void match_pattern(riscv_t *rv, block_t *block)
                     ir->imm2 = next_ir->imm;
                     ir->opcode = rv_insn_fuse8;
                     ir->impl = dispatch_table[ir->opcode];
-                    remove_next_nth_ir(rv, ir, block, 1);
+                    remove_next_nth_ir(ir, block, 1);
                 }
                 break;
             case rv_insn_lw:
@@ -1761,7 +2463,7 @@ static void match_pattern(riscv_t *rv, block_t *block)
                     ir->rs2 = next_ir->rd;   /* lw destination */
                     ir->opcode = rv_insn_fuse9;
                     ir->impl = dispatch_table[ir->opcode];
-                    remove_next_nth_ir(rv, ir, block, 1);
+                    remove_next_nth_ir(ir, block, 1);
 #if RV32_HAS(SYSTEM_MMIO)
                     /* Track rs2 (lw dest) for lazy fusion safety */
                     if (ir->rs2 != 0)
@@ -1786,7 +2488,7 @@ static void match_pattern(riscv_t *rv, block_t *block)
                     ir->rs1 = next_ir->rs2;  /* sw source (data to store) */
                     ir->opcode = rv_insn_fuse10;
                     ir->impl = dispatch_table[ir->opcode];
-                    remove_next_nth_ir(rv, ir, block, 1);
+                    remove_next_nth_ir(ir, block, 1);
                 }
                 break;
             case rv_insn_lui:
@@ -1802,7 +2504,7 @@ static void match_pattern(riscv_t *rv, block_t *block)
                     }
                 }
 #endif
-                try_fuse_sequence(rv, block, ir, count, rv_insn_fuse1);
+                try_fuse_sequence(block, ir, count, rv_insn_fuse1);
                 break;
             }
             break;
@@ -1837,7 +2539,7 @@ static void match_pattern(riscv_t *rv, block_t *block)
                 }
             }
 #else
-            try_fuse_sequence(rv, block, ir, count, rv_insn_fuse3);
+            try_fuse_sequence(block, ir, count, rv_insn_fuse3);
 #endif
             break;
         case rv_insn_lw:
@@ -1854,7 +2556,7 @@ static void match_pattern(riscv_t *rv, block_t *block)
                 ir->imm2 = next_ir->imm; /* increment step */
                 ir->opcode = rv_insn_fuse11;
                 ir->impl = dispatch_table[ir->opcode];
-                remove_next_nth_ir(rv, ir, block, 1);
+                remove_next_nth_ir(ir, block, 1);
 #if RV32_HAS(SYSTEM_MMIO)
                 /* Track both rd (lw dest) and rs1 (post-increment) */
                 if (ir->rd != 0)
@@ -1891,7 +2593,7 @@ static void match_pattern(riscv_t *rv, block_t *block)
                 }
             }
 #else
-            try_fuse_sequence(rv, block, ir, count, rv_insn_fuse4);
+            try_fuse_sequence(block, ir, count, rv_insn_fuse4);
 #endif
             break;
             /* TODO: mixture of SW and LW */
@@ -1911,7 +2613,7 @@ static void match_pattern(riscv_t *rv, block_t *block)
                 }
             }
 #endif
-            try_fuse_sequence(rv, block, ir, count, rv_insn_fuse5);
+            try_fuse_sequence(block, ir, count, rv_insn_fuse5);
             break;
         case rv_insn_addi:
             next_ir = ir->next;
@@ -1921,7 +2623,7 @@ static void match_pattern(riscv_t *rv, block_t *block)
                 IF_insn(next_ir, ecall)) {
                 ir->opcode = rv_insn_fuse6;
                 ir->impl = dispatch_table[ir->opcode];
-                remove_next_nth_ir(rv, ir, block, 1);
+                remove_next_nth_ir(ir, block, 1);
                 break;
             }
 #endif
@@ -1938,7 +2640,7 @@ static void match_pattern(riscv_t *rv, block_t *block)
                 /* Copy branch targets for block chaining */
                 ir->branch_taken = next_ir->branch_taken;
                 ir->branch_untaken = next_ir->branch_untaken;
-                remove_next_nth_ir(rv, ir, block, 1);
+                remove_next_nth_ir(ir, block, 1);
                 break;
             }
             /* Multiple ADDI fusion (fuse7) */
@@ -1953,7 +2655,7 @@ static void match_pattern(riscv_t *rv, block_t *block)
                 }
             }
 #endif
-            try_fuse_sequence(rv, block, ir, count, rv_insn_fuse7);
+            try_fuse_sequence(block, ir, count, rv_insn_fuse7);
             break;
         }
 #if RV32_HAS(SYSTEM_MMIO)
@@ -2030,7 +2732,7 @@ static void try_lazy_fusion(riscv_t *rv, block_t *block)
             /* Attempt fusion - may fail due to allocation */
             uint16_t fuse_opcode =
                 (cand->opcode == rv_insn_lw) ? rv_insn_fuse4 : rv_insn_fuse3;
-            if (try_fuse_sequence(rv, block, cand->ir, cand->count,
+            if (try_fuse_sequence(block, cand->ir, cand->count,
                                   fuse_opcode)) {
                 cand->verified = true;
             } else {
@@ -2052,6 +2754,19 @@ typedef struct {
     uint32_t const_val[N_RV_REGS];
 } constopt_info_t;
 
+/* Turn the conditional branch @ir, found to always go to its pc + @imm, into
+ * the jump @opcode. A branch a superblock followed the other way stays as it
+ * is, since its next IR is where it rarely goes.
+ */
+static void constopt_fold_branch(rv_insn_t *ir, int32_t imm, uint16_t opcode)
+{
+    if (ir->next && ir->next->pc != ir->pc + imm)
+        return;
+    ir->imm = imm;
+    ir->opcode = opcode;
+    ir->impl = dispatch_table[ir->opcode];
+}
+
 #define CONSTOPT(inst, code)                                  \
     static void constopt_##inst(rv_insn_t *ir UNUSED,         \
                                 constopt_info_t *info UNUSED) \
@@ -2080,84 +2795,163 @@ static void optimize_constant(riscv_t *rv UNUSED, block_t *block)
         ((constopt_func_t) constopt_table[ir->opcode])(ir, &info);
 }
 
-static block_t *block_find_or_translate(riscv_t *rv)
+#if RV32_HAS(JIT)
+/* free an evicted block along with its IRs and its T2C code */
+static void block_free(void *arg, void *value)
 {
-#if !RV32_HAS(JIT)
-    block_map_t *map = &rv->block_map;
-    /* lookup the next block using L1 cache with hash table fallback */
-    block_t *next_blk = block_lookup_or_find(rv, rv->PC);
-#else
-    /* lookup the next block in the block cache */
-    block_t *next_blk = (block_t *) cache_get(rv->block_cache, rv->PC, true);
-#if RV32_HAS(SYSTEM)
-    /* discard cache if satp mismatch or block was invalidated by SFENCE.VMA */
-    if (next_blk && (next_blk->satp != rv->csr_satp || next_blk->invalidated))
-        next_blk = NULL;
-#endif
+    riscv_t *rv = arg;
+    block_t *block = value;
+    free(block->ir_head);
+#if RV32_HAS(T2C)
+    /* the engine owns the memory block->func points to */
+    t2c_dispose_engine(block->llvm_engine);
 #endif
+    mpool_free(rv->block_mp, block);
+}
 
-    if (next_blk) {
-#if RV32_HAS(SYSTEM_MMIO) && RV32_HAS(MOP_FUSION)
-        /* On cache hit (second execution onwards), attempt lazy fusion
-         * for LW/SW sequences after verifying addresses are RAM.
-         */
-        try_lazy_fusion(rv, next_blk);
+#if RV32_HAS(T2C)
+void rv_reclaim_blocks(riscv_t *rv)
+{
+    cache_reclaim(rv->block_cache, block_free, rv);
+}
+#endif
 #endif
-        return next_blk;
-    }
 
 #if !RV32_HAS(JIT)
-    /* clear block list if it is going to be filled */
-    if (map->size * 1.25 > map->block_capacity) {
-        block_map_clear(rv);
-        prev = NULL;
+/* Drop the chaining, branch history and return address pointers into the
+ * blocks about to be freed, whose first IR has its handler cleared. Those
+ * pointers live in the last IR of a block, since only a branch or the end of
+ * a page ends it.
+ */
+static void block_map_unlink(riscv_t *rv)
+{
+    block_map_t *map = &rv->block_map;
+    for (uint32_t i = 0; i < map->block_capacity; i++) {
+        block_t *block = map->map[i];
+        if (!block)
+            continue;
+        rv_insn_t *last_ir = block->ir_tail;
+        if (last_ir->branch_taken && !last_ir->branch_taken->impl)
+            last_ir->branch_taken = NULL;
+        if (last_ir->branch_untaken && !last_ir->branch_untaken->impl)
+            last_ir->branch_untaken = NULL;
+        if (!last_ir->branch_table)
+            continue;
+        for (int j = 0; j < HISTORY_SIZE; j++) {
+            rv_insn_t *target = last_ir->branch_table->target[j];
+            if (target && !target->impl)
+                last_ir->branch_table->target[j] = NULL;
+        }
+    }
+    ras_forget(rv);
+}
+
+/* Upper bound on the blocks one eviction sweep drops */
+#define BLOCK_EVICT_MAX (1 << (BLOCK_MAP_CAPACITY_BITS - 2))
+
+/* Make room in a full block map by evicting a quarter of its capacity. A
+ * clock hand sweeps the slots: a block looked up since the hand last passed
+ * it loses its referenced bit and stays, any other is evicted. Before the
+ * evicted blocks are freed, block_map_unlink() drops the pointers into them,
+ * so the cost of a sweep grows with the number of blocks and not with the size
+ * of the translated code.
+ */
+static void block_map_evict(riscv_t *rv)
+{
+    block_map_t *map = &rv->block_map;
+    const uint32_t mask = map->block_capacity - 1;
+    block_t *victims[BLOCK_EVICT_MAX];
+    uint32_t n_victims = 0;
+
+    const uint32_t n_evict = map->block_capacity >> 2;
+    assert(n_evict <= BLOCK_EVICT_MAX);
+    while (n_victims < n_evict && map->size) {
+        const uint32_t i = map->hand & mask;
+        block_t *block = map->map[i];
+        if (block && !block->referenced) {
+            /* the hand stays, block_remove() may have moved a block here */
+            block_remove(map, i);
+            block->ir_head->impl = NULL;
+            victims[n_victims++] = block;
+            continue;
+        }
+        if (block)
+            block->referenced = false;
+        map->hand++;
+    }
+
+    block_map_unlink(rv);
+
+    for (uint32_t i = 0; i < n_victims; i++) {
+        block_t *block = victims[i];
+        const uint32_t idx =
+            (block->pc_start >> BLOCK_L1_INDEX_SHIFT) & BLOCK_L1_MASK;
+        if (rv->block_l1.ptrs[idx] == block) {
+            rv->block_l1.tags[idx] = BLOCK_L1_INVALID_TAG;
+            rv->block_l1.ptrs[idx] = NULL;
+        }
+        if (rv->prev_block == block)
+            rv->prev_block = NULL;
+        free(block->ir_head);
+        mpool_free(rv->block_mp, block);
     }
+    rv->stats.map_sweeps++;
+    rv->stats.map_evicted_blocks += n_victims;
+}
 #endif
-    /* allocate a new block */
-    next_blk = block_alloc(rv);
-    if (unlikely(!next_blk))
+
+/* Translate the block at rv->PC, following the branches @prof saw lean one
+ * way if superblocks are enabled, and optimize it into memory of its own.
+ */
+static block_t *block_build(riscv_t *rv, const block_t *prof)
+{
+    block_t *block = block_alloc(rv);
+    if (unlikely(!block))
         return NULL;
 
-    if (unlikely(!block_translate(rv, next_blk)))
+    if (unlikely(!block_translate(rv, block, prof))) {
+        mpool_free(rv->block_mp, block);
         return NULL;
+    }
 
 #if RV32_HAS(JIT) && RV32_HAS(SYSTEM)
     /*
      * May be an ifetch fault which changes satp, Do not do this
      * in "block_alloc()"
      */
-    next_blk->satp = rv->csr_satp;
-    next_blk->invalidated = false;
+    block->satp = rv->csr_satp;
+    block->invalidated = false;
 #endif
 
-    optimize_constant(rv, next_blk);
+    optimize_constant(rv, block);
 #if RV32_HAS(MOP_FUSION)
     /* macro operation fusion */
-    match_pattern(rv, next_blk);
+    match_pattern(rv, block);
 #endif
-
-#if !RV32_HAS(JIT)
-    /* insert the block into block map and L1 cache */
-    block_insert(&rv->block_map, rv, next_blk);
-#else
-    list_add(&next_blk->list, &rv->block_list);
-
-#if RV32_HAS(T2C)
-    pthread_mutex_lock(&rv->cache_lock);
+    if (unlikely(!block_seal(block))) {
+        mpool_free(rv->block_mp, block);
+        return NULL;
+    }
+#if RV32_HAS(SUPERBLOCK)
+    block->profiling = insn_is_conditional_branch(block->ir_tail->opcode);
 #endif
+    return block;
+}
+
+#if RV32_HAS(JIT)
+/* Put @block into the block cache, and retire the block it replaces */
+static void block_cache_put(riscv_t *rv, block_t *block)
+{
+    list_add(&block->list, &rv->block_list);
 
     /* insert the block into block cache */
-    block_t *replaced_blk = cache_put(rv->block_cache, rv->PC, next_blk);
+    block_t *replaced_blk = cache_put(rv->block_cache, block->pc_start, block);
 
-    if (!replaced_blk) {
-#if RV32_HAS(T2C)
-        pthread_mutex_unlock(&rv->cache_lock);
-#endif
-        return next_blk;
-    }
+    if (!replaced_blk)
+        return;
 
-    if (prev == replaced_blk)
-        prev = NULL;
+    if (rv->prev_block == replaced_blk)
+        rv->prev_block = NULL;
 
     /* remove the connection from parents */
     rv_insn_t *replaced_blk_entry = replaced_blk->ir_head;
@@ -2187,50 +2981,8 @@ static block_t *block_find_or_translate(riscv_t *rv)
     }
 
 #if RV32_HAS(T2C)
-    /* Check if T2C thread is currently using this block.
-     * If so, mark for delayed freeing and skip immediate destruction.
-     * The T2C thread will free it upon completion.
-     */
-    if (replaced_blk->is_compiling) {
-        replaced_blk->should_free = true;
-
-        /* Clear jit_cache to prevent new executions, but don't dispose engine
-         * or free memory yet. T2C thread owns the engine and block memory.
-         */
-#if RV32_HAS(SYSTEM)
-        uint64_t key = (uint64_t) replaced_blk->pc_start |
-                       ((uint64_t) replaced_blk->satp << 32);
-#else
-        uint64_t key = (uint64_t) replaced_blk->pc_start;
-#endif
-        if (replaced_blk->func) {
-            jit_cache_update(rv->jit_cache, key, NULL);
-        }
-        inline_cache_clear_key(rv->inline_cache, key);
-
-        /* Remove from global block list so it's not found/traversed */
-        list_del_init(&replaced_blk->list);
-
-        pthread_mutex_unlock(&rv->cache_lock);
-        return next_blk;
-    }
-#endif
-
-    /* free IRs in replaced block */
-    for (rv_insn_t *ir = replaced_blk->ir_head, *next_ir; ir != NULL;
-         ir = next_ir) {
-        next_ir = ir->next;
-        free(ir->branch_table);
-        if (ir->fuse)
-            mpool_free(rv->fuse_mp, ir->fuse);
-
-        mpool_free(rv->block_ir_mp, ir);
-    }
-
-#if RV32_HAS(T2C)
-    /* Clear jit_cache entry before disposing LLVM engine to prevent stale
-     * function pointers. The jit_cache key includes SATP for system mode.
-     * cache_lock is already held by caller.
+    /* Make the T2C code unreachable now, but leave the block and the engine
+     * alone until no T2C worker can be tracing or compiling it any more.
      */
 #if RV32_HAS(SYSTEM)
     uint64_t key = (uint64_t) replaced_blk->pc_start |
@@ -2238,27 +2990,134 @@ static block_t *block_find_or_translate(riscv_t *rv)
 #else
     uint64_t key = (uint64_t) replaced_blk->pc_start;
 #endif
-    if (replaced_blk->func) {
+    if (replaced_blk->linked)
         jit_cache_update(rv->jit_cache, key, NULL);
-    }
     inline_cache_clear_key(rv->inline_cache, key);
-    /* Dispose LLVM execution engine before freeing the block.
-     * The engine owns the memory where block->func points.
-     */
-    t2c_dispose_engine(replaced_blk->llvm_engine);
+    list_del_init(&replaced_blk->list);
+    if (unlikely(!cache_retire(rv->block_cache, replaced_blk))) {
+        cache_synchronize(rv->block_cache);
+        block_free(rv, replaced_blk);
+    }
+    rv_reclaim_blocks(rv);
+#else
+    list_del_init(&replaced_blk->list);
+    block_free(rv, replaced_blk);
+#endif
+}
 #endif
 
-    list_del_init(&replaced_blk->list);
-    mpool_free(rv->block_mp, replaced_blk);
-#if RV32_HAS(T2C)
-    pthread_mutex_unlock(&rv->cache_lock);
+static block_t *block_find_or_translate(riscv_t *rv)
+{
+#if !RV32_HAS(JIT)
+    block_map_t *map = &rv->block_map;
+    /* lookup the next block using L1 cache with hash table fallback */
+    block_t *next_blk = block_lookup_or_find(rv, rv->PC);
+#else
+    /* lookup the next block in the block cache */
+    block_t *next_blk = (block_t *) cache_get(rv->block_cache, rv->PC, true);
+#if RV32_HAS(SYSTEM)
+    /* discard cache if satp mismatch or block was invalidated by SFENCE.VMA */
+    if (next_blk && (next_blk->satp != rv->csr_satp || next_blk->invalidated))
+        next_blk = NULL;
+#endif
+#endif
+
+    if (next_blk) {
+#if RV32_HAS(SYSTEM_MMIO) && RV32_HAS(MOP_FUSION)
+        /* On cache hit (second execution onwards), attempt lazy fusion
+         * for LW/SW sequences after verifying addresses are RAM.
+         */
+        try_lazy_fusion(rv, next_blk);
 #endif
+        return next_blk;
+    }
+
+#if !RV32_HAS(JIT)
+    /* evict blocks if the block map is going to be filled */
+    if (map->size * 1.25 > map->block_capacity)
+        block_map_evict(rv);
+#endif
+    /* allocate and translate a new block */
+    next_blk = block_build(rv, NULL);
+    if (unlikely(!next_blk))
+        return NULL;
+    rv->stats.promoted[RV_TIER_INTERP]++;
+
+#if !RV32_HAS(JIT)
+    /* insert the block into block map and L1 cache */
+    block_insert(&rv->block_map, rv, next_blk);
+#else
+    /* reuse machine code reloaded from the persistent code cache */
+    if (next_blk->translatable && jit_persist_attach(rv->jit_state, next_blk))
+        rv->stats.promoted[RV_TIER_T1]++;
+
+    block_cache_put(rv, next_blk);
 #endif
 
     assert(next_blk);
     return next_blk;
 }
 
+#if RV32_HAS(SUPERBLOCK)
+/* Whether the conditional branch that ends @block ran often enough in the
+ * interpreter for superblock_reform() to tell which way it leans.
+ */
+FORCE_INLINE bool superblock_due(const block_t *block)
+{
+    if (likely(!block->profiling))
+        return false;
+#if RV32_HAS(JIT)
+    if (block->hot)
+        return false;
+#endif
+    const branch_history_table_t *bt = block->ir_tail->branch_table;
+    return bt->taken + bt->untaken >= SUPERBLOCK_SAMPLES;
+}
+
+/* Translate @block again now that its last branch has been profiled, this
+ * time carrying on along the side the branch leans to, and along the biased
+ * branches after it. Return the block to run at rv->PC: the superblock that
+ * replaces @block, or @block itself if the branch leans neither way.
+ */
+static block_t *superblock_reform(riscv_t *rv, block_t *block)
+{
+    block->profiling = false;
+    block_t *super = block_build(rv, block);
+    if (unlikely(!super))
+        return block;
+    if (super->ir_tail->pc == block->ir_tail->pc) {
+        /* no branch followed, @block is as good */
+        free(super->ir_head);
+        mpool_free(rv->block_mp, super);
+        return block;
+    }
+    super->profiling = false;
+    rv->stats.superblocks++;
+
+#if !RV32_HAS(JIT)
+    block_map_t *map = &rv->block_map;
+    const uint32_t mask = map->block_capacity - 1;
+    uint32_t i = map_hash(block->pc_start);
+    while (map->map[i & mask] != block)
+        i++;
+    block_remove(map, i & mask);
+    block_insert(map, rv, super);
+
+    /* drop the pointers into @block before freeing it */
+    block->ir_head->impl = NULL;
+    block_map_unlink(rv);
+    if (rv->prev_block == block)
+        rv->prev_block = NULL;
+    free(block->ir_head);
+    mpool_free(rv->block_mp, block);
+#else
+    super->has_loops = block->has_loops;
+    block_cache_put(rv, super);
+#endif
+    return super;
+}
+#endif
+
 /* We disable profiler to make sure every guest instructions be translated by
  * JIT compiler in architecture test.
  */
@@ -2268,6 +3127,11 @@ static bool runtime_profiler(riscv_t *rv, block_t *block)
 #if RV32_HAS(SYSTEM)
     if (block->satp != rv->csr_satp)
         return false;
+#endif
+#if RV32_HAS(SUPERBLOCK)
+    /* T1 code would no longer profile its last branch, see superblock_due() */
+    if (block->profiling)
+        return false;
 #endif
     /* Based on our observations, a significant number of true hotspots are
      * characterized by high usage frequency and including loop. Consequently,
@@ -2278,13 +3142,54 @@ static bool runtime_profiler(riscv_t *rv, block_t *block)
     /* To profile a block after chaining, it must first be executed. */
     if (unlikely(freq >= 2 && block->has_loops))
         return true;
-    /* using frequency exceeds predetermined threshold */
-    if (unlikely(freq >= THRESHOLD))
+    /* using frequency exceeds the threshold, raised under code cache churn */
+    const uint32_t threshold = hot_threshold(rv);
+    if (unlikely(freq >= threshold))
+        return true;
+    /* A block whose entries lead into long interpreted runs, e.g. through a
+     * loop pc_set did not catch, counts its work in units of its own size
+     * rather than in entries.
+     */
+    if (unlikely(block->run_cycles / block->n_insn >= threshold))
         return true;
     return false;
 }
 #endif
 
+#if RV32_HAS(T2C)
+/* Invocations that make a T1 block worth T2C. A long compile queue raises the
+ * bar, so that workers busy with a backlog are handed only the hottest code.
+ */
+static uint32_t t2c_threshold(riscv_t *rv)
+{
+    uint32_t shift = 0;
+    for (uint32_t depth = ATOMIC_LOAD(&rv->wait_queue_len, ATOMIC_RELAXED) / 16;
+         depth && shift < HOT_SHIFT_MAX; depth >>= 1)
+        shift++;
+    return THRESHOLD << shift;
+}
+
+/* T1 code ran out of loop_budget at a back-edge to rv->PC. Credit the loop
+ * head with the back-edges, each as good as an invocation, so that a loop
+ * that never leaves T1 code still reaches the T2C threshold: rv_step()
+ * dispatches the head next, which queues it, and enters its T2C code at a
+ * later back-edge once that is ready. The budget is shared by all loops, so
+ * the head it runs out at is a sample weighted by how often each loops.
+ */
+static void loop_credit(riscv_t *rv)
+{
+    rv->loop_budget = LOOP_BUDGET;
+    block_t *head = cache_get(rv->block_cache, rv->PC, false);
+    if (!head
+#if RV32_HAS(SYSTEM)
+        || head->satp != rv->csr_satp
+#endif
+    )
+        return;
+    ATOMIC_FETCH_ADD(&head->n_invoke, LOOP_BUDGET, ATOMIC_RELAXED);
+}
+#endif
+
 #if RV32_HAS(SYSTEM_MMIO)
 static bool rv_has_plic_trap(riscv_t *rv)
 {
@@ -2292,19 +3197,48 @@ static bool rv_has_plic_trap(riscv_t *rv)
             (rv->csr_sip & rv->csr_sie));
 }
 
+void rv_apply_remote_fences(riscv_t *rv)
+{
+    const uint32_t fences = ATOMIC_LOAD(&rv->fence_pending, ATOMIC_ACQUIRE);
+
+    /* same effect as a global SFENCE.VMA or a FENCE.I run by the hart */
+    if (fences & RV_FENCE_VMA)
+        mmu_tlb_flush_all(rv);
+#if RV32_HAS(JIT)
+    cache_invalidate_satp(rv->block_cache, rv->csr_satp);
+#if RV32_HAS(T2C)
+    jit_cache_clear(rv->jit_cache);
+    inline_cache_clear(rv->inline_cache);
+#endif
+#endif
+
+    /* acknowledge: the requesting hart waits for these bits to clear */
+    ATOMIC_FETCH_AND(&rv->fence_pending, ~fences, ATOMIC_RELEASE);
+}
+
 static void rv_check_interrupt(riscv_t *rv)
 {
     vm_attr_t *attr = PRIV(rv);
-    if (peripheral_update_ctr-- == 0) {
-        peripheral_update_ctr = 64;
+    /* the boot hart polls the devices on behalf of all harts */
+    if (rv->hart_id == 0 && rv->peripheral_update_ctr-- == 0) {
+        rv->peripheral_update_ctr = 64;
 
 #if defined(__EMSCRIPTEN__)
     escape_seq:
 #endif
+        pthread_mutex_lock(&attr->device_lock);
+        u8250_flush(PRIV(rv)->uart);
         u8250_check_ready(PRIV(rv)->uart);
         if (PRIV(rv)->uart->in_ready)
             emu_update_uart_interrupts(rv);
 
+        /* requests completed by asynchronous block devices */
+        bool vblk_done = false;
+        for (int i = 0; i < attr->vblk_cnt; i++)
+            vblk_done |= virtio_blk_poll(attr->vblk[i]);
+        if (vblk_done)
+            emu_update_vblk_interrupts(rv);
+
 #if RV32_HAS(GOLDFISH_RTC)
         if (PRIV(rv)->rtc->irq_enabled) {
             uint64_t now_nsec = rtc_get_now_nsec(PRIV(rv)->rtc);
@@ -2315,13 +3249,28 @@ static void rv_check_interrupt(riscv_t *rv)
             }
         }
 #endif /* RV32_HAS(GOLDFISH_RTC) */
+        pthread_mutex_unlock(&attr->device_lock);
     }
 
+    /* Fold in what other threads posted: an IPI sets SSIP, which the guest
+     * clears itself, while SEIP follows the PLIC line of this hart.
+     */
+    if (ATOMIC_LOAD(&rv->ipi_pending, ATOMIC_ACQUIRE)) {
+        ATOMIC_STORE(&rv->ipi_pending, false, ATOMIC_RELAXED);
+        rv->csr_sip |= SIP_SSIP;
+    }
+    if (ATOMIC_LOAD(&rv->seip, ATOMIC_ACQUIRE))
+        rv->csr_sip |= SIP_SEIP;
+    else
+        rv->csr_sip &= ~SIP_SEIP;
+    if (unlikely(ATOMIC_LOAD(&rv->fence_pending, ATOMIC_RELAXED)))
+        rv_apply_remote_fences(rv);
+
     /* Derive current timer from cycle counter for interrupt comparison.
      * Timer is no longer incremented per-instruction; instead computed here.
      */
     uint64_t current_timer = rv->csr_cycle + rv->timer_offset;
-    if (current_timer > attr->timer)
+    if (current_timer > rv->sbi_timer)
         rv->csr_sip |= RV_INT_STI;
     else
         rv->csr_sip &= ~RV_INT_STI;
@@ -2375,20 +3324,21 @@ void rv_step(void *arg)
             const rv_insn_t *ir = rv->next_insn;
             rv->next_insn = NULL;
             if (unlikely(!ir->impl(rv, ir, rv->csr_cycle, rv->PC))) {
-                prev = NULL;
+                rv->prev_block = NULL;
                 break;
             }
-            prev = NULL; /* Reset to avoid mis-chaining across unwind */
+            /* Reset to avoid mis-chaining across unwind */
+            rv->prev_block = NULL;
             continue;
         }
 #endif
 
-        if (prev && prev->pc_start != last_pc) {
+        if (rv->prev_block && rv->prev_block->pc_start != rv->last_pc) {
             /* update previous block */
 #if !RV32_HAS(JIT)
-            prev = block_lookup_or_find(rv, last_pc);
+            rv->prev_block = block_lookup_or_find(rv, rv->last_pc);
 #else
-            prev = cache_get(rv->block_cache, last_pc, false);
+            rv->prev_block = cache_get(rv->block_cache, rv->last_pc, false);
 #endif
         }
         /* lookup the next block in block map or translate a new block,
@@ -2403,7 +3353,7 @@ void rv_step(void *arg)
              */
             if (rv->is_trapped) {
                 trap_handler(rv);
-                prev = NULL;
+                rv->prev_block = NULL;
                 continue;
             }
 #endif
@@ -2413,6 +3363,10 @@ void rv_step(void *arg)
             return;
         }
         assert(block);
+#if RV32_HAS(SUPERBLOCK)
+        if (unlikely(superblock_due(block)))
+            block = superblock_reform(rv, block);
+#endif
 
 #if RV32_HAS(JIT) && RV32_HAS(SYSTEM)
         assert(block->satp == rv->csr_satp && !block->invalidated);
@@ -2431,35 +3385,37 @@ void rv_step(void *arg)
          */
 
 #if RV32_HAS(BLOCK_CHAINING)
-        if (prev
+        if (rv->prev_block
 #if RV32_HAS(JIT) && RV32_HAS(SYSTEM)
-            && prev->satp == rv->csr_satp && !prev->invalidated
+            && rv->prev_block->satp == rv->csr_satp &&
+            !rv->prev_block->invalidated
 #endif
+            && block_chainable(block)
         ) {
-            rv_insn_t *last_ir = prev->ir_tail;
+            rv_insn_t *last_ir = rv->prev_block->ir_tail;
+            rv_insn_t **chain = NULL;
             /* chain block */
-            if (prev->page_terminated) {
+            if (rv->prev_block->page_terminated) {
                 /* Page-terminated block: always falls through to next address.
                  * Use branch_taken for fallthrough (like unconditional jump).
                  */
-                if (!last_ir->branch_taken)
-                    last_ir->branch_taken = block->ir_head;
+                chain = &last_ir->branch_taken;
             } else if (!insn_is_unconditional_branch(last_ir->opcode)) {
                 /* Conditional branch: chain based on taken/untaken path */
-                if (is_branch_taken && !last_ir->branch_taken) {
-                    last_ir->branch_taken = block->ir_head;
-                } else if (!is_branch_taken && !last_ir->branch_untaken) {
-                    last_ir->branch_untaken = block->ir_head;
-                }
+                chain = rv->is_branch_taken ? &last_ir->branch_taken
+                                            : &last_ir->branch_untaken;
             } else if (insn_is_direct_branch(last_ir->opcode)) {
                 /* Unconditional direct branch: always use branch_taken */
-                if (!last_ir->branch_taken) {
-                    last_ir->branch_taken = block->ir_head;
-                }
+                chain = &last_ir->branch_taken;
             }
+            /* a superblock left through a side exit has nothing to chain */
+            if (chain && !*chain &&
+                superblock_exits_at_tail(rv->prev_block, block,
+                                         rv->is_branch_taken))
+                *chain = block->ir_head;
         }
 #endif
-        last_pc = rv->PC;
+        rv->last_pc = rv->PC;
 #if RV32_HAS(JIT)
 #if RV32_HAS(T2C)
         /* executed through the tier-2 JIT compiler */
@@ -2476,33 +3432,51 @@ void rv_step(void *arg)
              */
             if (unlikely(!block->func)) {
                 /* Block was invalidated, fall through to interpreter */
-                prev = NULL;
+                rv->prev_block = NULL;
                 continue;
             }
+            /* The worker only published the code. The hart is the sole
+             * writer of jit_cache, so it links the code on the first entry.
+             */
+            if (unlikely(!block->linked)) {
+#if RV32_HAS(SYSTEM)
+                uint64_t key = (uint64_t) block->pc_start |
+                               ((uint64_t) block->satp << 32);
+#else
+                uint64_t key = (uint64_t) block->pc_start;
+#endif
+                jit_cache_update(rv->jit_cache, key, block->func);
+                block->linked = true;
+            }
+            uint64_t cycle = rv->csr_cycle;
             ((exec_t2c_func_t) block->func)(rv);
-            prev = NULL;
+            rv->stats.insn[RV_TIER_T2C] += rv->csr_cycle - cycle;
+            rv->prev_block = NULL;
             continue;
         } /* check if invoking times of t1 generated code exceed threshold */
-        else if (!ATOMIC_LOAD(&block->compiled, ATOMIC_RELAXED) &&
-                 ATOMIC_LOAD(&block->n_invoke, ATOMIC_RELAXED) >= THRESHOLD) {
-            ATOMIC_STORE(&block->compiled, true, ATOMIC_RELAXED);
-            queue_entry_t *entry = malloc(sizeof(queue_entry_t));
-            if (unlikely(!entry)) {
-                /* Malloc failed - reset compiled flag to allow retry later */
-                ATOMIC_STORE(&block->compiled, false, ATOMIC_RELAXED);
-                continue;
-            }
-            /* Store cache key instead of pointer to prevent use-after-free */
+        else {
+            uint32_t n_invoke = ATOMIC_LOAD(&block->n_invoke, ATOMIC_RELAXED);
+            /* Queue cache key instead of pointer to prevent use-after-free */
 #if RV32_HAS(SYSTEM)
-            entry->key =
+            uint64_t key =
                 (uint64_t) block->pc_start | ((uint64_t) block->satp << 32);
 #else
-            entry->key = (uint64_t) block->pc_start;
-#endif
-            pthread_mutex_lock(&rv->wait_queue_lock);
-            list_add(&entry->list, &rv->wait_queue);
-            pthread_cond_signal(&rv->wait_queue_cond);
-            pthread_mutex_unlock(&rv->wait_queue_lock);
+            uint64_t key = (uint64_t) block->pc_start;
+#endif
+            if (!ATOMIC_LOAD(&block->compiled, ATOMIC_RELAXED)) {
+                if (n_invoke >= t2c_threshold(rv)) {
+                    ATOMIC_STORE(&block->compiled, true, ATOMIC_RELAXED);
+                    /* Allocation failed - reset compiled flag to retry later */
+                    if (unlikely(!t2c_enqueue(rv, key, n_invoke)))
+                        ATOMIC_STORE(&block->compiled, false, ATOMIC_RELAXED);
+                }
+            } else if (n_invoke > THRESHOLD && !(n_invoke & (n_invoke - 1))) {
+                /* Still waiting for a worker: each time the invocation count
+                 * doubles, re-rank the pending request so that blocks which
+                 * kept heating up overtake colder ones queued earlier.
+                 */
+                t2c_enqueue(rv, key, n_invoke);
+            }
         }
 #endif
         /* executed through the tier-1 JIT compiler */
@@ -2521,19 +3495,27 @@ void rv_step(void *arg)
 #if defined(__aarch64__)
             /* Ensure instruction cache coherency before executing JIT code */
             __asm__ volatile("isb" ::: "memory");
+#endif
+#if RV32_HAS(EXT_F)
+            jit_fp_sync(rv);
 #endif
             ((exec_block_func_t) state->buf)(
                 rv, (uintptr_t) (state->buf + block->offset));
             rv->csr_cycle += block->cycle_cost;
+            rv->stats.insn[RV_TIER_T1] += block->cycle_cost;
+#if RV32_HAS(T2C)
+            if (unlikely(!rv->loop_budget))
+                loop_credit(rv);
+#endif
 #if RV32_HAS(SYSTEM)
             /* Handle trap if one occurred during JIT block execution */
             if (rv->is_trapped) {
                 trap_handler(rv);
-                prev = NULL;
+                rv->prev_block = NULL;
                 continue;
             }
 #endif
-            prev = NULL;
+            rv->prev_block = NULL;
             continue;
         } /* check if the execution path is potential hotspot */
         if (block->translatable
@@ -2545,24 +3527,32 @@ void rv_step(void *arg)
 #if defined(__aarch64__)
                 /* Ensure icache coherency before executing JIT */
                 __asm__ volatile("isb" ::: "memory");
+#endif
+#if RV32_HAS(EXT_F)
+                jit_fp_sync(rv);
 #endif
                 ((exec_block_func_t) state->buf)(
                     rv, (uintptr_t) (state->buf + block->offset));
                 rv->csr_cycle += block->cycle_cost;
+                rv->stats.insn[RV_TIER_T1] += block->cycle_cost;
+#if RV32_HAS(T2C)
+                if (unlikely(!rv->loop_budget))
+                    loop_credit(rv);
+#endif
 #if RV32_HAS(SYSTEM)
                 /* Handle trap if one occurred during JIT block execution */
                 if (rv->is_trapped) {
                     trap_handler(rv);
-                    prev = NULL;
+                    rv->prev_block = NULL;
                     continue;
                 }
 #endif
-                prev = NULL;
+                rv->prev_block = NULL;
                 continue;
             }
         }
-        set_reset(&pc_set);
-        has_loops = false;
+        set_reset(&rv->pc_set);
+        rv->has_loops = false;
 #endif
         /* execute the block by interpreter.
          * Per-instruction cycle counting is used to support block chaining,
@@ -2571,30 +3561,47 @@ void rv_step(void *arg)
          */
         const rv_insn_t *ir = block->ir_head;
         uint64_t cycle = rv->csr_cycle;
-        if (unlikely(!ir->impl(rv, ir, cycle, rv->PC))) {
+        bool ok = ir->impl(rv, ir, cycle, rv->PC);
+        const uint64_t run = rv->csr_cycle - cycle;
+        rv->stats.insn[RV_TIER_INTERP] += run;
+        if (unlikely(!ok)) {
             /* block should not be extended if exception handler invoked */
-            prev = NULL;
+            rv->prev_block = NULL;
             break;
         }
 #if RV32_HAS(JIT)
-        if (has_loops && !block->has_loops)
+        if (rv->has_loops && !block->has_loops)
             block->has_loops = true;
+        /* saturates, runtime_profiler() only compares it with a threshold */
+        block->run_cycles = run < UINT32_MAX - block->run_cycles
+                                ? block->run_cycles + run
+                                : UINT32_MAX;
 #endif
-        prev = block;
+        rv->prev_block = block;
     }
 
     /* Incremental memory maintenance: reclaim unused pages periodically.
      * Using a 16-bit counter, this runs every 65536 rv_step() calls.
      */
-    static uint16_t gc_counter = 0;
-    if (unlikely(++gc_counter == 0))
-        memory_gc();
+    if (unlikely(++rv->gc_counter == 0)
+#if RV32_HAS(SYSTEM_MMIO)
+        /* another hart could dirty a chunk between the zero scan and its
+         * reprotection, so reclaiming is limited to a single hart
+         */
+        && attr->n_harts == 1
+#endif
+    )
+        memory_gc(attr->mem);
+
+    if (unlikely(rv_stats_pending(&rv->stats)) &&
+        (attr->run_flag & RV_RUN_STATS))
+        rv_dump_stats(rv);
 
 #ifdef __EMSCRIPTEN__
     if (rv_has_halted(rv)) {
         bool stop_requested = indirect_rv_stop_requested();
         emscripten_cancel_main_loop();
-        reset_rv_run_state();
+        reset_rv_run_state(rv);
         indirect_rv_cleanup();
         rv_log_info("RISC-V emulator is destroyed");
         if (!stop_requested)
@@ -2627,8 +3634,8 @@ retranslate:
     /* fetch the next instruction */
     uint32_t insn = rv->io.mem_ifetch(rv, rv->PC);
 #if RV32_HAS(SYSTEM)
-    if (!insn && need_retranslate) {
-        need_retranslate = false;
+    if (!insn && rv->need_retranslate) {
+        rv->need_retranslate = false;
         goto retranslate;
     }
 #endif
@@ -2662,8 +3669,7 @@ retranslate:
 #if RV32_HAS(SYSTEM)
 static void __trap_handler(riscv_t *rv)
 {
-    rv_insn_t *ir = mpool_calloc(rv->block_ir_mp);
-    assert(ir);
+    rv_insn_t trap_ir = {0}, *ir = &trap_ir;
 
     /* set to false by sret implementation */
     while (rv->is_trapped && !rv_has_halted(rv)) {
@@ -2676,8 +3682,8 @@ static void __trap_handler(riscv_t *rv)
          * the fetch. This matches the pattern in block_translate and rv_step
          * for handling MMU enable during trap handling.
          */
-        if (!insn && need_retranslate) {
-            need_retranslate = false;
+        if (!insn && rv->need_retranslate) {
+            rv->need_retranslate = false;
             goto retry_fetch;
         }
 
@@ -2690,15 +3696,14 @@ static void __trap_handler(riscv_t *rv)
             break;
 
         rv_decode(ir, insn);
-        reloc_enable_mmu_jalr_addr = rv->PC;
+        rv->reloc_enable_mmu_jalr_addr = rv->PC;
 
         ir->impl = dispatch_table[ir->opcode];
         rv->compressed = is_compressed(insn);
         ir->impl(rv, ir, rv->csr_cycle, rv->PC);
     }
 
-    mpool_free(rv->block_ir_mp, ir);
-    prev = NULL;
+    rv->prev_block = NULL;
 }
 #endif /* RV32_HAS(SYSTEM) */
 
@@ -134,6 +134,11 @@
 #define RV32_FEATURE_BLOCK_CHAINING 1
 #endif
 
+/* Superblocks across direct jumps */
+#ifndef RV32_FEATURE_SUPERBLOCK
+#define RV32_FEATURE_SUPERBLOCK 1
+#endif
+
 /* Logging with color */
 #ifndef RV32_FEATURE_LOG_COLOR
 #define RV32_FEATURE_LOG_COLOR 1
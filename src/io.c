@@ -4,6 +4,7 @@
  */
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -15,15 +16,16 @@
 #include <signal.h>
 #include <stdatomic.h>
 #include <sys/mman.h>
-#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
 #endif
+#include <errno.h>
+#include <unistd.h>
 
 #include "io.h"
 #include "log.h"
 
-static uint8_t *data_memory_base;
-static uint64_t data_memory_size;
-
 #if HAVE_MMAP
 /* Demand Paging Memory Management
  *
@@ -42,36 +44,110 @@ static uint64_t data_memory_size;
 
 /* Maximum chunks for 4GB address space: 4GB / 64KB = 65536 */
 #define MAX_CHUNKS (0x100000000ULL >> CHUNK_SHIFT)
-#define BITMAP_SIZE (MAX_CHUNKS / 8)
-
-/* Bitmap tracking which chunks are activated */
-static uint8_t chunk_bitmap[BITMAP_SIZE];
 
-/* GC state: circular scan index */
-static uint32_t gc_scan_idx;
-
-/* Statistics: current and peak number of activated chunks (atomic for signal
- * safety) */
-static atomic_uint_fast32_t active_chunks;
-static atomic_uint_fast32_t peak_chunks;
+/* Several emulator instances may live in one process, each with its own
+ * guest memory, while SIGSEGV and SIGBUS have one handler per process. Every
+ * memory owns a paging slot the handler finds it by. A slot is reassigned
+ * under paging_lock, and its sequence count is odd meanwhile so that the
+ * handler, which cannot take locks, retries rather than reading a torn range.
+ */
+#define MAX_PAGED_MEMORIES 1024
+
+typedef struct {
+    atomic_uint seq;
+    _Atomic uintptr_t base; /* 0 if the slot is free */
+    _Atomic uint64_t size;
+    /* bitmap tracking which chunks are activated */
+    _Atomic uint8_t *_Atomic bitmap;
+    /* chunks holding file pages, see memory_load_file(); NULL if none */
+    uint8_t *pinned;
+    /* GC state: circular scan index */
+    uint32_t gc_scan_idx;
+    /* Statistics: current and peak number of activated chunks (atomic for
+     * signal safety) */
+    atomic_uint_fast32_t active_chunks;
+    atomic_uint_fast32_t peak_chunks;
+} paging_slot_t;
+
+static paging_slot_t paging_slots[MAX_PAGED_MEMORIES];
+/* slots ever handed out, the handler scans no further */
+static atomic_uint n_paging_slots;
+/* memories alive, the signal handlers are installed while non-zero */
+static uint32_t n_paged_memories;
+static pthread_mutex_t paging_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* Previous signal handlers to chain */
 static struct sigaction prev_sigsegv_handler;
 static struct sigaction prev_sigbus_handler;
 
-static inline bool bitmap_test(uint32_t idx)
+static inline bool bitmap_test(_Atomic uint8_t *bitmap, uint32_t idx)
 {
-    return (chunk_bitmap[idx >> 3] & (1 << (idx & 7))) != 0;
+    return (atomic_load_explicit(&bitmap[idx >> 3], memory_order_relaxed) &
+            (1 << (idx & 7))) != 0;
 }
 
-static inline void bitmap_set(uint32_t idx)
+/* set the bit of @idx and return whether it was already set */
+static inline bool bitmap_test_and_set(_Atomic uint8_t *bitmap, uint32_t idx)
 {
-    chunk_bitmap[idx >> 3] |= (1 << (idx & 7));
+    return (atomic_fetch_or_explicit(&bitmap[idx >> 3], 1 << (idx & 7),
+                                     memory_order_relaxed) &
+            (1 << (idx & 7))) != 0;
 }
 
-static inline void bitmap_clear(uint32_t idx)
+static inline void bitmap_clear(_Atomic uint8_t *bitmap, uint32_t idx)
 {
-    chunk_bitmap[idx >> 3] &= ~(1 << (idx & 7));
+    atomic_fetch_and_explicit(&bitmap[idx >> 3], (uint8_t) ~(1 << (idx & 7)),
+                              memory_order_relaxed);
+}
+
+/* Find the paging slot whose memory contains @addr (async-signal-safe) */
+static paging_slot_t *paging_slot_find(uintptr_t addr,
+                                       uintptr_t *base,
+                                       uint64_t *size)
+{
+    uint32_t n = atomic_load_explicit(&n_paging_slots, memory_order_acquire);
+    for (uint32_t i = 0; i < n; i++) {
+        paging_slot_t *slot = &paging_slots[i];
+        unsigned seq;
+        uintptr_t b;
+        uint64_t sz;
+        do {
+            seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+            b = atomic_load_explicit(&slot->base, memory_order_relaxed);
+            sz = atomic_load_explicit(&slot->size, memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+        } while ((seq & 1) ||
+                 seq != atomic_load_explicit(&slot->seq, memory_order_relaxed));
+
+        if (b && addr >= b && addr - b < sz) {
+            *base = b;
+            *size = sz;
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+/* Count chunk @idx of @slot as activated, unless it already is */
+static void chunk_activate(paging_slot_t *slot, uint32_t idx)
+{
+    _Atomic uint8_t *bitmap =
+        atomic_load_explicit(&slot->bitmap, memory_order_relaxed);
+    if (bitmap_test_and_set(bitmap, idx))
+        return;
+
+    uint_fast32_t current =
+        atomic_fetch_add_explicit(&slot->active_chunks, 1,
+                                  memory_order_relaxed) +
+        1;
+    uint_fast32_t peak =
+        atomic_load_explicit(&slot->peak_chunks, memory_order_relaxed);
+    while (current > peak) {
+        if (atomic_compare_exchange_weak_explicit(&slot->peak_chunks, &peak,
+                                                  current, memory_order_relaxed,
+                                                  memory_order_relaxed))
+            break;
+    }
 }
 
 /* Check if a memory region is all zeros (for reclaim decision).
@@ -92,17 +168,19 @@ static bool is_region_zero(const uint8_t *ptr, size_t size)
  * Signal safety notes:
  * - mprotect() is async-signal-safe per POSIX.1-2008 and later
  * - Atomic operations with memory_order_relaxed are signal-safe
- * - Bitmap operations are on static memory with no locks
+ * - Paging slots and bitmaps are read with atomics only, no locks
  * - No heap allocation or stdio calls in the handler
  */
 static void memory_fault_handler(int sig, siginfo_t *si, void *context UNUSED)
 {
     uintptr_t fault_addr = (uintptr_t) si->si_addr;
-    uintptr_t base = (uintptr_t) data_memory_base;
-    uintptr_t end = base + data_memory_size;
+    uintptr_t base;
+    uint64_t size;
+    paging_slot_t *slot = paging_slot_find(fault_addr, &base, &size);
 
-    /* Check if fault is within our guest memory range */
-    if (fault_addr >= base && fault_addr < end) {
+    /* Check if fault is within the memory of one of our instances */
+    if (slot) {
+        uintptr_t end = base + size;
         /* Calculate chunk boundaries relative to base address */
         uintptr_t offset = fault_addr - base;
         uintptr_t aligned_offset = offset & CHUNK_MASK;
@@ -120,21 +198,7 @@ static void memory_fault_handler(int sig, siginfo_t *si, void *context UNUSED)
         if (mprotect((void *) chunk_start, chunk_len, PROT_READ | PROT_WRITE) ==
             0) {
             /* Only count if not already active (handles re-fault edge cases) */
-            if (!bitmap_test(chunk_idx)) {
-                bitmap_set(chunk_idx);
-                uint_fast32_t current =
-                    atomic_fetch_add_explicit(&active_chunks, 1,
-                                              memory_order_relaxed) +
-                    1;
-                uint_fast32_t peak =
-                    atomic_load_explicit(&peak_chunks, memory_order_relaxed);
-                while (current > peak) {
-                    if (atomic_compare_exchange_weak_explicit(
-                            &peak_chunks, &peak, current, memory_order_relaxed,
-                            memory_order_relaxed))
-                        break;
-                }
-            }
+            chunk_activate(slot, chunk_idx);
             return; /* Resume execution */
         }
     }
@@ -185,9 +249,169 @@ static void restore_signal_handlers(void)
     sigaction(SIGSEGV, &prev_sigsegv_handler, NULL);
     sigaction(SIGBUS, &prev_sigbus_handler, NULL);
 }
+
+/* Bind @mem to a free paging slot, installing the signal handlers for the
+ * first memory of the process. Returns false if no slot is left.
+ */
+static bool paging_attach(memory_t *mem, _Atomic uint8_t *bitmap)
+{
+    pthread_mutex_lock(&paging_lock);
+    if (!n_paged_memories && !install_signal_handlers()) {
+        pthread_mutex_unlock(&paging_lock);
+        return false;
+    }
+
+    uint32_t n = atomic_load_explicit(&n_paging_slots, memory_order_relaxed);
+    uint32_t i = 0;
+    while (i < n && atomic_load_explicit(&paging_slots[i].base,
+                                         memory_order_relaxed))
+        i++;
+    if (i == MAX_PAGED_MEMORIES) {
+        rv_log_error("Too many guest memories for demand paging (max %d)",
+                     MAX_PAGED_MEMORIES);
+        if (!n_paged_memories)
+            restore_signal_handlers();
+        pthread_mutex_unlock(&paging_lock);
+        return false;
+    }
+
+    paging_slot_t *slot = &paging_slots[i];
+    atomic_fetch_add_explicit(&slot->seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&slot->bitmap, bitmap, memory_order_relaxed);
+    slot->pinned = NULL;
+    slot->gc_scan_idx = 0;
+    atomic_store_explicit(&slot->active_chunks, 0, memory_order_relaxed);
+    atomic_store_explicit(&slot->peak_chunks, 0, memory_order_relaxed);
+    atomic_store_explicit(&slot->size, mem->mem_size, memory_order_relaxed);
+    atomic_store_explicit(&slot->base, (uintptr_t) mem->mem_base,
+                          memory_order_relaxed);
+    atomic_fetch_add_explicit(&slot->seq, 1, memory_order_release);
+    if (i == n)
+        atomic_store_explicit(&n_paging_slots, n + 1, memory_order_release);
+
+    mem->paging_slot = i;
+    n_paged_memories++;
+    pthread_mutex_unlock(&paging_lock);
+    return true;
+}
+
+/* Release the paging slot of @mem and return its chunk bitmap */
+static _Atomic uint8_t *paging_detach(memory_t *mem)
+{
+    pthread_mutex_lock(&paging_lock);
+    paging_slot_t *slot = &paging_slots[mem->paging_slot];
+    _Atomic uint8_t *bitmap =
+        atomic_load_explicit(&slot->bitmap, memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&slot->seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&slot->base, 0, memory_order_relaxed);
+    atomic_fetch_add_explicit(&slot->seq, 1, memory_order_release);
+
+    /* Restore handlers last to prevent use-after-free in signal handler */
+    if (!--n_paged_memories)
+        restore_signal_handlers();
+    pthread_mutex_unlock(&paging_lock);
+    return bitmap;
+}
+
+/* Huge page backends
+ *
+ * Demand paging costs a signal and an mprotect() on the first touch of every
+ * chunk, and leaves the guest memory on base pages, so a guest that roams a
+ * large working set misses the host TLB all the time. The huge page backends
+ * map the guest memory read-write from the start: the kernel populates it on
+ * first touch by itself, or up front with prefault, and memory_gc() has
+ * nothing to reclaim.
+ */
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+/* Map @size bytes, a multiple of the huge page size, aligned to a huge page
+ * so that THP can back all of it.
+ */
+static uint8_t *map_thp(uint64_t size)
+{
+    uint8_t *raw = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED)
+        return NULL;
+
+    uint8_t *base = (uint8_t *) (((uintptr_t) raw + HUGE_PAGE_SIZE - 1) &
+                                 ~(HUGE_PAGE_SIZE - 1));
+    if (base > raw)
+        munmap(raw, base - raw);
+    if (raw + HUGE_PAGE_SIZE > base)
+        munmap(base + size, raw + HUGE_PAGE_SIZE - base);
+#ifdef MADV_HUGEPAGE
+    if (madvise(base, size, MADV_HUGEPAGE))
+        rv_log_warn("Transparent huge pages are not available");
+#endif
+    return base;
+}
+
+/* Map @size bytes, a multiple of the huge page size, from the hugetlbfs
+ * pool. Unlike
+ * THP, the pages are reserved here: mmap() fails if the pool is too small.
+ */
+static uint8_t *map_hugetlb(uint64_t size)
+{
+#ifdef MAP_HUGETLB
+    uint8_t *base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                         MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+    return base == MAP_FAILED ? NULL : base;
+#else
+    (void) size;
+    return NULL;
+#endif
+}
+
+/* Prefer the NUMA node the calling thread runs on for the pages of
+ * [@base, @base + @size) faulted in from now on. The policy is not binding,
+ * the kernel falls back to other nodes when this one is full.
+ */
+static void memory_place_local(uint8_t *base, uint64_t size)
+{
+#if defined(__linux__) && defined(SYS_getcpu) && defined(SYS_mbind)
+#define NUMA_MAX_NODES 1024
+#define MPOL_PREFERRED 1
+    unsigned cpu, node;
+    unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) || node >= NUMA_MAX_NODES) {
+        rv_log_warn("Cannot tell the NUMA node of the emulator thread");
+        return;
+    }
+    const unsigned bits = 8 * sizeof(unsigned long);
+    mask[node / bits] |= 1UL << (node % bits);
+    if (syscall(SYS_mbind, base, size, MPOL_PREFERRED, mask,
+                NUMA_MAX_NODES + 1, 0))
+        rv_log_warn("Failed to place guest memory on NUMA node %u", node);
+#undef MPOL_PREFERRED
+#undef NUMA_MAX_NODES
+#else
+    (void) base;
+    (void) size;
+    rv_log_warn("NUMA placement is not supported on this host");
+#endif
+}
+
+/* Fault in every page of [@base, @base + @size) */
+static void memory_prefault(uint8_t *base, uint64_t size)
+{
+#ifdef MADV_POPULATE_WRITE
+    if (!madvise(base, size, MADV_POPULATE_WRITE))
+        return;
+#endif
+    /* Older kernels: a write per base page. Huge pages are faulted in whole
+     * on their first write and cost a store per base page from then on.
+     */
+    const long page = sysconf(_SC_PAGESIZE);
+    for (uint64_t off = 0; off < size; off += page)
+        ((volatile uint8_t *) base)[off] = 0;
+}
 #endif /* HAVE_MMAP */
 
-memory_t *memory_new(uint64_t size)
+memory_t *memory_new(uint64_t size, const memory_opts_t *opts)
 {
     if (!size)
         return NULL;
@@ -203,8 +427,45 @@ memory_t *memory_new(uint64_t size)
         return NULL;
 
 #if HAVE_MMAP
-    /* Install signal handlers for demand paging */
-    if (!install_signal_handlers()) {
+    const memory_opts_t defaults = {.backend = MEMORY_PAGED};
+    if (!opts)
+        opts = &defaults;
+
+    mem->mem_base = NULL;
+    mem->mem_size = size;
+    mem->map_size = size;
+    mem->backend = opts->backend;
+    if (mem->backend != MEMORY_PAGED)
+        mem->map_size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    if (mem->backend == MEMORY_HUGETLB) {
+        mem->mem_base = map_hugetlb(mem->map_size);
+        if (!mem->mem_base) {
+            rv_log_warn("Not enough hugetlbfs pages for %" PRIu64
+                        " MiB of guest memory, using transparent huge pages",
+                        mem->map_size >> 20);
+            mem->backend = MEMORY_THP;
+        }
+    }
+    if (mem->backend == MEMORY_THP) {
+        mem->mem_base = map_thp(mem->map_size);
+        if (!mem->mem_base) {
+            free(mem);
+            return NULL;
+        }
+    }
+
+    if (mem->backend != MEMORY_PAGED) {
+        if (opts->numa)
+            memory_place_local(mem->mem_base, mem->map_size);
+        if (opts->prefault)
+            memory_prefault(mem->mem_base, mem->map_size);
+        return mem;
+    }
+
+    /* one bit per chunk, for this memory only */
+    _Atomic uint8_t *bitmap =
+        calloc((((size + CHUNK_SIZE - 1) >> CHUNK_SHIFT) + 7) / 8, 1);
+    if (!bitmap) {
         free(mem);
         return NULL;
     }
@@ -216,19 +477,26 @@ memory_t *memory_new(uint64_t size)
 #ifndef MAP_NORESERVE
 #define MAP_NORESERVE 0
 #endif
-    data_memory_base = mmap(NULL, size, PROT_NONE,
-                            MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
-    if (data_memory_base == MAP_FAILED) {
-        restore_signal_handlers();
+    mem->mem_base = mmap(NULL, size, PROT_NONE,
+                         MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    if (mem->mem_base == MAP_FAILED) {
+        free((void *) bitmap);
+        free(mem);
+        return NULL;
+    }
+    /* The policy applies to the chunks as they get activated */
+    if (opts->numa)
+        memory_place_local(mem->mem_base, size);
+    if (opts->prefault)
+        rv_log_warn("Prefault needs a huge page memory backend, ignored");
+
+    /* Register with the signal handlers for demand paging */
+    if (!paging_attach(mem, bitmap)) {
+        munmap(mem->mem_base, size);
+        free((void *) bitmap);
         free(mem);
         return NULL;
     }
-
-    data_memory_size = size;
-    memset(chunk_bitmap, 0, sizeof(chunk_bitmap));
-    gc_scan_idx = 0;
-    atomic_store_explicit(&active_chunks, 0, memory_order_relaxed);
-    atomic_store_explicit(&peak_chunks, 0, memory_order_relaxed);
 #else
     /* Fallback for systems without mmap (e.g., Windows, Emscripten).
      * Cannot use demand paging - physical memory is allocated upfront.
@@ -240,28 +508,34 @@ memory_t *memory_new(uint64_t size)
         free(mem);
         return NULL;
     }
-    data_memory_base = malloc(size);
-    if (!data_memory_base) {
+    mem->mem_base = malloc(size);
+    if (!mem->mem_base) {
         free(mem);
         return NULL;
     }
     /* Zero-initialize for consistent behavior */
-    memset(data_memory_base, 0, size);
-    data_memory_size = size;
+    memset(mem->mem_base, 0, size);
+    mem->mem_size = size; /* Use actual allocated size */
+    (void) opts;
 #undef MALLOC_MAX_SIZE
 #endif
 
-    mem->mem_base = data_memory_base;
-    mem->mem_size = data_memory_size; /* Use actual allocated size */
     return mem;
 }
 
 void memory_delete(memory_t *mem)
 {
 #if HAVE_MMAP
-    /* Restore handlers first to prevent use-after-free in signal handler */
-    restore_signal_handlers();
+    if (mem->backend != MEMORY_PAGED) {
+        munmap(mem->mem_base, mem->map_size);
+        free(mem);
+        return;
+    }
+    free(paging_slots[mem->paging_slot].pinned);
+    /* Unregister first to prevent use-after-free in signal handler */
+    _Atomic uint8_t *bitmap = paging_detach(mem);
     munmap(mem->mem_base, mem->mem_size);
+    free((void *) bitmap);
 #else
     free(mem->mem_base);
 #endif
@@ -270,38 +544,63 @@ void memory_delete(memory_t *mem)
 
 /* Return peak physical memory usage in bytes.
  * With MMAP: Returns actual physical memory allocated via demand paging.
- * Without MMAP: Returns total allocated size (no demand paging available).
+ * Without MMAP or on huge pages: Returns total allocated size (no demand
+ * paging available).
  */
-uint64_t memory_get_usage(void)
+uint64_t memory_get_usage(const memory_t *mem)
 {
 #if HAVE_MMAP
+    if (mem->backend != MEMORY_PAGED)
+        return mem->mem_size;
+    const paging_slot_t *slot = &paging_slots[mem->paging_slot];
     /* Clamp to actual memory size to prevent overflow */
-    uint32_t max_chunks = (data_memory_size + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
+    uint32_t max_chunks = (mem->mem_size + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
     uint_fast32_t peak =
-        atomic_load_explicit(&peak_chunks, memory_order_relaxed);
+        atomic_load_explicit(&slot->peak_chunks, memory_order_relaxed);
     uint32_t chunks = (peak < max_chunks) ? peak : max_chunks;
     return (uint64_t) chunks * CHUNK_SIZE;
 #else
-    return data_memory_size;
+    return mem->mem_size;
 #endif
 }
 
+bool memory_is_mapped(const memory_t *mem, uint32_t addr)
+{
+#if HAVE_MMAP
+    if (mem->backend == MEMORY_PAGED) {
+        paging_slot_t *slot = &paging_slots[mem->paging_slot];
+        return bitmap_test(
+            atomic_load_explicit(&slot->bitmap, memory_order_relaxed),
+            addr >> CHUNK_SHIFT);
+    }
+#else
+    (void) mem;
+    (void) addr;
+#endif
+    return true;
+}
+
 /* Incremental garbage collection - scans one chunk per call.
  * Reclaims zeroed chunks by releasing physical pages (madvise)
  * and re-arming the fault handler (mprotect PROT_NONE).
  */
-void memory_gc(void)
+void memory_gc(memory_t *mem)
 {
 #if HAVE_MMAP
-    uint32_t idx = gc_scan_idx;
+    if (mem->backend != MEMORY_PAGED)
+        return;
+    paging_slot_t *slot = &paging_slots[mem->paging_slot];
+    _Atomic uint8_t *bitmap =
+        atomic_load_explicit(&slot->bitmap, memory_order_relaxed);
+    uint32_t idx = slot->gc_scan_idx;
 
     /* Only process chunks within our actual memory size */
-    uint32_t max_idx = (data_memory_size + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
+    uint32_t max_idx = (mem->mem_size + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
     if (max_idx > MAX_CHUNKS)
         max_idx = MAX_CHUNKS;
 
     if (idx >= max_idx) {
-        gc_scan_idx = 0;
+        slot->gc_scan_idx = 0;
         return;
     }
 
@@ -312,15 +611,18 @@ void memory_gc(void)
     sigaddset(&block_set, SIGBUS);
     sigprocmask(SIG_BLOCK, &block_set, &old_set);
 
-    /* Check if this chunk is activated */
-    if (bitmap_test(idx)) {
-        uint8_t *chunk_ptr =
-            data_memory_base + ((uintptr_t) idx << CHUNK_SHIFT);
+    /* Check if this chunk is activated. A chunk holding file pages is left
+     * alone: discarding a page of a private file mapping brings back the file
+     * contents, not zeros.
+     */
+    if (bitmap_test(bitmap, idx) &&
+        !(slot->pinned && (slot->pinned[idx >> 3] & (1 << (idx & 7))))) {
+        uint8_t *chunk_ptr = mem->mem_base + ((uintptr_t) idx << CHUNK_SHIFT);
 
         /* Calculate chunk size (may be partial for last chunk) */
         size_t chunk_len = CHUNK_SIZE;
         uintptr_t chunk_end = (uintptr_t) chunk_ptr + CHUNK_SIZE;
-        uintptr_t mem_end = (uintptr_t) data_memory_base + data_memory_size;
+        uintptr_t mem_end = (uintptr_t) mem->mem_base + mem->mem_size;
         if (chunk_end > mem_end)
             chunk_len = mem_end - (uintptr_t) chunk_ptr;
 
@@ -332,11 +634,11 @@ void memory_gc(void)
             if (mprotect(chunk_ptr, chunk_len, PROT_NONE) == 0) {
                 /* Release physical pages back to OS (advisory) */
                 madvise(chunk_ptr, chunk_len, MADV_DONTNEED);
-                bitmap_clear(idx);
-                uint_fast32_t current =
-                    atomic_load_explicit(&active_chunks, memory_order_relaxed);
+                bitmap_clear(bitmap, idx);
+                uint_fast32_t current = atomic_load_explicit(
+                    &slot->active_chunks, memory_order_relaxed);
                 if (current > 0)
-                    atomic_fetch_sub_explicit(&active_chunks, 1,
+                    atomic_fetch_sub_explicit(&slot->active_chunks, 1,
                                               memory_order_relaxed);
             }
         }
@@ -346,10 +648,116 @@ void memory_gc(void)
     sigprocmask(SIG_SETMASK, &old_set, NULL);
 
     /* Advance to next chunk (circular) */
-    gc_scan_idx = (idx + 1) % max_idx;
+    slot->gc_scan_idx = (idx + 1) % max_idx;
+#else
+    (void) mem;
 #endif
 }
 
+/* Read @size bytes at @offset of @fd into @dst */
+static bool read_file(int fd, uint8_t *dst, uint64_t offset, size_t size)
+{
+    while (size) {
+        ssize_t n = pread(fd, dst, size, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        dst += n;
+        offset += n;
+        size -= n;
+    }
+    return true;
+}
+
+#if HAVE_MMAP
+/* Activate the chunks of [@addr, @addr + @size) in demand paged memory, and
+ * pin them if @pin. System calls get EFAULT on memory that is not accessible,
+ * rather than raising the signal the guest accesses fault the chunks in with.
+ */
+static bool chunks_activate(memory_t *mem,
+                            uint32_t addr,
+                            uint32_t size,
+                            bool pin)
+{
+    paging_slot_t *slot = &paging_slots[mem->paging_slot];
+    _Atomic uint8_t *bitmap =
+        atomic_load_explicit(&slot->bitmap, memory_order_relaxed);
+    if (pin && !slot->pinned) {
+        slot->pinned = calloc(
+            (((mem->mem_size + CHUNK_SIZE - 1) >> CHUNK_SHIFT) + 7) / 8, 1);
+        if (!slot->pinned)
+            return false;
+    }
+
+    if (!size)
+        return true;
+    const uint32_t first = addr >> CHUNK_SHIFT;
+    const uint32_t last = ((uint64_t) addr + size - 1) >> CHUNK_SHIFT;
+    for (uint32_t idx = first; idx <= last; idx++) {
+        uint64_t chunk = (uint64_t) idx << CHUNK_SHIFT;
+        uint64_t chunk_len = CHUNK_SIZE;
+        if (chunk + chunk_len > mem->mem_size)
+            chunk_len = mem->mem_size - chunk;
+        if (!bitmap_test(bitmap, idx) &&
+            mprotect(mem->mem_base + chunk, chunk_len, PROT_READ | PROT_WRITE))
+            return false;
+        chunk_activate(slot, idx);
+        if (pin)
+            slot->pinned[idx >> 3] |= 1 << (idx & 7);
+    }
+    return true;
+}
+#endif
+
+bool memory_load_file(memory_t *mem,
+                      uint32_t addr,
+                      int fd,
+                      uint64_t offset,
+                      uint32_t size)
+{
+    if (addr >= mem->mem_size || size > mem->mem_size - addr)
+        return false;
+
+#if HAVE_MMAP
+    if (mem->backend == MEMORY_PAGED) {
+        if (!chunks_activate(mem, addr, size, false))
+            return false;
+
+        /* File pages can only be mapped where the offset agrees with the
+         * address modulo the page size, as it does for the segments of a
+         * linked ELF file. The head and tail around them are read.
+         */
+        const uint32_t page = sysconf(_SC_PAGESIZE);
+        const uint32_t head = -addr & (page - 1);
+        const uint32_t len = size > head ? (size - head) & ~(page - 1) : 0;
+        if (len && !((addr - offset) & (page - 1)) &&
+            chunks_activate(mem, addr + head, len, true) &&
+            mmap(mem->mem_base + addr + head, len, PROT_READ | PROT_WRITE,
+                 MAP_FIXED | MAP_PRIVATE, fd, offset + head) != MAP_FAILED) {
+            const uint32_t tail = head + len;
+            return read_file(fd, mem->mem_base + addr, offset, head) &&
+                   read_file(fd, mem->mem_base + addr + tail, offset + tail,
+                             size - tail);
+        }
+    }
+#endif
+    return read_file(fd, mem->mem_base + addr, offset, size);
+}
+
+uint8_t *memory_host_range(memory_t *mem, uint32_t addr, uint32_t size)
+{
+    if (addr >= mem->mem_size || size > mem->mem_size - addr)
+        return NULL;
+
+#if HAVE_MMAP
+    if (mem->backend == MEMORY_PAGED &&
+        !chunks_activate(mem, addr, size, false))
+        return NULL;
+#endif
+    return mem->mem_base + addr;
+}
+
 /* Fast memory access functions - no bounds checking for performance.
  * Callers must validate addresses. With MMAP, out-of-bounds access
  * triggers SIGSEGV that chains to the default handler.
@@ -363,33 +771,35 @@ void memory_read(const memory_t *mem,
     memcpy(dst, mem->mem_base + addr, size);
 }
 
-uint32_t memory_ifetch(uint32_t addr)
+uint32_t memory_ifetch(const memory_t *mem, uint32_t addr)
 {
-    if ((uint64_t) addr + sizeof(uint32_t) > data_memory_size)
+    if ((uint64_t) addr + sizeof(uint32_t) > mem->mem_size)
         return 0;
     uint32_t val;
-    memcpy(&val, data_memory_base + addr, sizeof(val));
+    memcpy(&val, mem->mem_base + addr, sizeof(val));
     return val;
 }
 
 /* Safe unaligned memory access using memcpy (compiler optimizes to load/store)
  */
-#define MEM_READ_IMPL(size, type)                            \
-    type memory_read_##size(uint32_t addr)                   \
-    {                                                        \
-        type val;                                            \
-        memcpy(&val, data_memory_base + addr, sizeof(type)); \
-        return val;                                          \
+#define MEM_READ_IMPL(size, type)                               \
+    type memory_read_##size(const memory_t *mem, uint32_t addr) \
+    {                                                           \
+        type val;                                               \
+        memcpy(&val, mem->mem_base + addr, sizeof(type));       \
+        return val;                                             \
     }
 
 MEM_READ_IMPL(w, uint32_t)
 MEM_READ_IMPL(s, uint16_t)
 MEM_READ_IMPL(b, uint8_t)
 
-#define MEM_WRITE_IMPL(size, type)                              \
-    void memory_write_##size(uint32_t addr, const uint8_t *src) \
-    {                                                           \
-        memcpy(data_memory_base + addr, src, sizeof(type));     \
+#define MEM_WRITE_IMPL(size, type)                       \
+    void memory_write_##size(memory_t *mem,              \
+                             uint32_t addr,              \
+                             const uint8_t *src)         \
+    {                                                    \
+        memcpy(mem->mem_base + addr, src, sizeof(type)); \
     }
 
 MEM_WRITE_IMPL(w, uint32_t)
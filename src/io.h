@@ -5,13 +5,32 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 
+/* host memory backing the guest memory, see io.c */
+typedef enum {
+    MEMORY_PAGED,   /* demand paging in 64 KiB chunks (default) */
+    MEMORY_THP,     /* anonymous mapping on transparent huge pages */
+    MEMORY_HUGETLB, /* explicit huge pages from the hugetlbfs pool */
+} memory_backend_t;
+
+typedef struct {
+    memory_backend_t backend;
+    bool prefault; /* populate the whole memory up front */
+    bool numa;     /* prefer the NUMA node of the creating thread */
+} memory_opts_t;
+
 /* main memory */
 typedef struct {
     uint8_t *mem_base;
     uint64_t mem_size;
+#if HAVE_MMAP
+    memory_backend_t backend;
+    uint64_t map_size;    /* length of the host mapping */
+    uint32_t paging_slot; /* demand paging state, see io.c */
+#endif
 } memory_t;
 
 /* Check if address range [addr, addr+size) is within guest RAM.
@@ -22,32 +41,38 @@ typedef struct {
     ((uint64_t) (addr) < (mem)->mem_size && \
      (uint64_t) (size) <= (mem)->mem_size - (uint64_t) (addr))
 
-/* create a memory instance */
-memory_t *memory_new(uint64_t size);
+/* create a memory instance, with the default options if @opts is NULL */
+memory_t *memory_new(uint64_t size, const memory_opts_t *opts);
 
 /* delete a memory instance */
 void memory_delete(memory_t *m);
 
 /* reclaim unused memory pages (incremental GC) */
-void memory_gc(void);
+void memory_gc(memory_t *m);
 
 /* get peak physical memory usage in bytes
  * With MMAP: actual physical memory via demand paging
  * Without MMAP: total allocated size (capped at 512MB)
  */
-uint64_t memory_get_usage(void);
+uint64_t memory_get_usage(const memory_t *m);
+
+/* Whether guest memory at @addr is backed by host memory. Demand paging
+ * hands out memory in chunks as the guest touches it, and memory that is not
+ * backed reads as zeros.
+ */
+bool memory_is_mapped(const memory_t *m, uint32_t addr);
 
 /* read an instruction from memory */
-uint32_t memory_ifetch(uint32_t addr);
+uint32_t memory_ifetch(const memory_t *m, uint32_t addr);
 
 /* read a word from memory */
-uint32_t memory_read_w(uint32_t addr);
+uint32_t memory_read_w(const memory_t *m, uint32_t addr);
 
 /* read a short from memory */
-uint16_t memory_read_s(uint32_t addr);
+uint16_t memory_read_s(const memory_t *m, uint32_t addr);
 
 /* read a byte from memory */
-uint8_t memory_read_b(uint32_t addr);
+uint8_t memory_read_b(const memory_t *m, uint32_t addr);
 
 /* read a length of data from memory */
 void memory_read(const memory_t *m, uint8_t *dst, uint32_t addr, uint32_t size);
@@ -65,14 +90,32 @@ static inline bool memory_write(memory_t *m,
     return true;
 }
 
+/* Load @size bytes of the file @fd, starting at @offset, into memory at
+ * @addr. With demand paging, the pages of the file that land on whole pages of
+ * memory are mapped copy-on-write instead of copied, and only the unaligned
+ * head and tail are read.
+ */
+bool memory_load_file(memory_t *m,
+                      uint32_t addr,
+                      int fd,
+                      uint64_t offset,
+                      uint32_t size);
+
+/* Host address of [@addr, @addr + @size) of memory, for system calls to
+ * read into or write from in place, or NULL if the range is out of memory.
+ * With demand paging, the chunks of the range are mapped in first: a system
+ * call gets EFAULT on them instead of the signal that maps them.
+ */
+uint8_t *memory_host_range(memory_t *m, uint32_t addr, uint32_t size);
+
 /* write a word to memory */
-void memory_write_w(uint32_t addr, const uint8_t *src);
+void memory_write_w(memory_t *m, uint32_t addr, const uint8_t *src);
 
 /* write a short to memory */
-void memory_write_s(uint32_t addr, const uint8_t *src);
+void memory_write_s(memory_t *m, uint32_t addr, const uint8_t *src);
 
 /* write a byte to memory */
-void memory_write_b(uint32_t addr, const uint8_t *src);
+void memory_write_b(memory_t *m, uint32_t addr, const uint8_t *src);
 
 /* write a length of certain value to memory */
 static inline bool memory_fill(memory_t *m,
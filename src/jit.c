@@ -24,15 +24,22 @@
 #endif
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #if defined(__APPLE__)
 #include <libkern/OSCacheControl.h>
+#include <mach-o/dyld.h>
 #if defined(__aarch64__)
 #include <pthread.h>
 #endif
@@ -59,7 +66,11 @@
  * bytes. These mirror the structures in riscv_private.h and io.h.
  *
  * The fast path also assumes:
- *   - TLB_SIZE is a power of two so VPN -> index is a simple AND.
+ *   - TLB_SETS and TLB_WAYS are powers of two so VPN -> set is a simple AND
+ *     and a shift. Only way 0, the most recently used entry of the set, is
+ *     probed inline; the other ways are searched by dtlb_lookup().
+ *   - The tag compared is vpn | tlb_asid_tag, which is loaded from just
+ *     before dtlb.
  *   - T1 handles both TLB_PAGE_LEVEL_4K and TLB_PAGE_LEVEL_SUPER inline:
  *     the offset mask is chosen by CSEL (aarch64) / CMOVcc (x86-64) based on
  *     the level byte (12 bits for 4 KiB, 22 bits for 4 MiB).  T2C still
@@ -71,7 +82,7 @@
  *     on the slow path.
  */
 _Static_assert(sizeof(tlb_entry_t) == 16, "tlb_entry_t must be 16 bytes");
-_Static_assert(offsetof(tlb_entry_t, vpn) == 0, "tlb_entry_t.vpn offset");
+_Static_assert(offsetof(tlb_entry_t, tag) == 0, "tlb_entry_t.tag offset");
 _Static_assert(offsetof(tlb_entry_t, ppn) == 4, "tlb_entry_t.ppn offset");
 _Static_assert(offsetof(tlb_entry_t, pte_addr) == 8,
                "tlb_entry_t.pte_addr offset");
@@ -79,17 +90,11 @@ _Static_assert(offsetof(tlb_entry_t, perm) == 12, "tlb_entry_t.perm offset");
 _Static_assert(offsetof(tlb_entry_t, valid) == 13, "tlb_entry_t.valid offset");
 _Static_assert(offsetof(tlb_entry_t, dirty) == 14, "tlb_entry_t.dirty offset");
 _Static_assert(offsetof(tlb_entry_t, level) == 15, "tlb_entry_t.level offset");
-_Static_assert((TLB_SIZE & (TLB_SIZE - 1)) == 0,
-               "TLB_SIZE must be a power of two");
-/* The x86-64 fast path masks the VPN with `and esi, TLB_SIZE - 1` using opcode
- * 0x83 /4, whose 8-bit immediate is sign-extended to 32 bits.  TLB_SIZE - 1
- * must therefore fit in a signed 8-bit value (<= 127); otherwise the mask
- * becomes negative and the dTLB index calculation is wrong.  If you ever need
- * a larger TLB, switch that single instruction to the imm32 form (0x81 /4).
- */
-_Static_assert(TLB_SIZE <= 128,
-               "TLB_SIZE > 128 needs imm32 AND encoding in the x86-64 "
-               "fast path");
+_Static_assert((TLB_SETS & (TLB_SETS - 1)) == 0 &&
+                   (TLB_WAYS & (TLB_WAYS - 1)) == 0 && TLB_WAYS <= TLB_ENTRIES,
+               "TLB sets and ways must be powers of two");
+_Static_assert(offsetof(riscv_t, tlb_asid_tag) + 4 == offsetof(riscv_t, dtlb),
+               "tlb_asid_tag must directly precede dtlb");
 _Static_assert(RV_PG_SHIFT == 12, "fast path assumes 4 KiB pages");
 _Static_assert(offsetof(memory_t, mem_base) == 0, "memory_t.mem_base offset");
 _Static_assert(offsetof(memory_t, mem_size) == 8, "memory_t.mem_size offset");
@@ -120,6 +125,9 @@ _Static_assert(PTE_W == 0x04, "PTE_W must be bit 2");
  */
 #define MAX_JUMPS 65536
 #define MAX_BLOCKS 8192
+#define OFFSET_INDEX_BITS 14
+static_assert((1 << OFFSET_INDEX_BITS) >= 2 * MAX_BLOCKS,
+              "offset_index must stay at most half full");
 #define IN_JUMP_THRESHOLD 256
 
 /* Worst-case jump targets per instruction.  Under SYSTEM_MMIO with the
@@ -322,7 +330,7 @@ enum operand_size {
 #if defined(_WIN32)
 static const int nonvolatile_reg[] = {RBP, RBX, RDI, RSI, R12, R13, R14, R15};
 static const int parameter_reg[] = {RCX, RDX, R8, R9};
-static struct host_reg register_map[] = {
+static HART_LOCAL struct host_reg register_map[] = {
     {RAX, -1, 0, 0}, {R10, -1, 0, 0}, {RDX, -1, 0, 0}, {R8, -1, 0, 0},
     {R9, -1, 0, 0},  {R14, -1, 0, 0}, {R15, -1, 0, 0}, {RDI, -1, 0, 0},
     {RSI, -1, 0, 0}, {RBX, -1, 0, 0}, {RBP, -1, 0, 0},
@@ -331,7 +339,7 @@ static int temp_reg = R11;
 #else
 static const int nonvolatile_reg[] = {RBP, RBX, R12, R13, R14, R15};
 static const int parameter_reg[] = {RDI, RSI, RDX, RCX, R8, R9};
-static struct host_reg register_map[] = {
+static HART_LOCAL struct host_reg register_map[] = {
     {RAX, -1, 0, 0}, {RBX, -1, 0, 0}, {RDX, -1, 0, 0}, {R8, -1, 0, 0},
     {R9, -1, 0, 0},  {R10, -1, 0, 0}, {R11, -1, 0, 0}, {R13, -1, 0, 0},
     {R14, -1, 0, 0}, {R15, -1, 0, 0},
@@ -361,7 +369,7 @@ static int temp_reg = R8;
  * safe for use within straight-line JIT code but values must not be expected to
  * survive function calls.
  */
-static struct host_reg register_map[] = {
+static HART_LOCAL struct host_reg register_map[] = {
     {R5, -1, 0, 0},  {R6, -1, 0, 0},  {R7, -1, 0, 0},  {R9, -1, 0, 0},
     {R11, -1, 0, 0}, {R12, -1, 0, 0}, {R13, -1, 0, 0}, {R14, -1, 0, 0},
     {R15, -1, 0, 0}, {R16, -1, 0, 0}, {R17, -1, 0, 0}, {R26, -1, 0, 0},
@@ -393,16 +401,188 @@ static inline bool host_reg_maps_x0(int reg_idx)
     return false;
 }
 
+/* Host addresses baked into the generated code.  Both the emulator image and
+ * the guest memory mapping move between runs (ASLR), so the persistent code
+ * cache records where they are emitted and rebases them on reload.
+ */
+enum {
+    RELOC_TEXT, /* function in the emulator image */
+    RELOC_MEM,  /* pointer into guest memory, i.e. mem_base + offset */
+};
+
+struct persist_reloc {
+    uint32_t offset; /* imm64 (x86-64) or MOVZ/MOVK quadruple (Arm64) */
+    uint32_t kind;
+};
+
+/* A chained jump from one block into the entry of another */
+struct persist_edge {
+    uint32_t offset_loc;
+    uint32_t target_offset;
+};
+
+/* A block reloaded from disk */
+struct persist_block {
+    uint32_t pc;
+    uint32_t satp;
+    uint32_t offset;
+    uint32_t state;
+    uint64_t digest;
+};
+
+struct persist_link {
+    uint32_t edge; /* index into edges */
+    uint32_t peer; /* block at the other end */
+};
+
+enum {
+    PERSIST_DORMANT, /* not yet seen by the guest in this run */
+    PERSIST_LIVE,    /* validated, registered in offset_map */
+    PERSIST_DEAD,    /* guest code differs, never executed */
+    PERSIST_EVICTED, /* code overwritten after its region was evicted */
+};
+
+struct jit_persist {
+    char *path;
+    uint64_t key;
+    bool broken; /* bookkeeping failed, do not write the cache back */
+
+    /* every relocation site and chaining edge in buf[org_size, offset) */
+    struct persist_reloc *relocs;
+    uint32_t n_relocs, cap_relocs;
+    struct persist_edge *edges;
+    uint32_t n_edges, cap_edges;
+
+    /* content digest of each offset_map entry, 0 if it must not persist */
+    uint64_t *digests;
+
+    /* reloaded blocks sorted by (satp, pc), with their incoming and outgoing
+     * edges as index lists so that attaching a block relinks it in O(degree).
+     */
+    struct persist_block *blocks;
+    uint32_t n_blocks;
+    uint32_t *link_start; /* n_blocks + 1 */
+    struct persist_link *links;
+};
+
+static bool jit_array_grow(void **array, uint32_t *cap, size_t elem_size)
+{
+    uint32_t new_cap = *cap ? *cap * 2 : 1024;
+    void *new_array = realloc(*array, new_cap * elem_size);
+    if (!new_array)
+        return false;
+    *array = new_array;
+    *cap = new_cap;
+    return true;
+}
+
+static void record_reloc(struct jit_state *state, uint32_t kind)
+{
+    struct jit_persist *p = state->persist;
+    if (likely(!p) || p->broken)
+        return;
+    if (p->n_relocs == p->cap_relocs &&
+        !jit_array_grow((void **) &p->relocs, &p->cap_relocs,
+                        sizeof(struct persist_reloc))) {
+        p->broken = true;
+        return;
+    }
+    p->relocs[p->n_relocs++] = (struct persist_reloc){state->offset, kind};
+}
+
+static void record_edge(struct jit_state *state,
+                        uint32_t offset_loc,
+                        uint32_t target_offset)
+{
+    struct jit_persist *p = state->persist;
+    if (likely(!p) || p->broken)
+        return;
+    if (p->n_edges == p->cap_edges &&
+        !jit_array_grow((void **) &p->edges, &p->cap_edges,
+                        sizeof(struct persist_edge))) {
+        p->broken = true;
+        return;
+    }
+    p->edges[p->n_edges++] = (struct persist_edge){offset_loc, target_offset};
+}
+
+/* Every chained branch is remembered so that evicting a region can send the
+ * branches that jump into it back to their exit path. A branch that cannot be
+ * recorded must stay unchained.
+ */
+static bool record_chain(struct jit_state *state,
+                         uint32_t offset_loc,
+                         uint32_t target_offset)
+{
+    if (state->n_chains == state->cap_chains &&
+        !jit_array_grow((void **) &state->chains, &state->cap_chains,
+                        sizeof(struct jit_chain)))
+        return false;
+    state->chains[state->n_chains++] =
+        (struct jit_chain){offset_loc, target_offset};
+    return true;
+}
+
+#if RV32_HAS(SYSTEM)
+#define OFFSET_MAP_SATP(entry) ((entry)->satp)
+#define BLOCK_SATP(block) ((block)->satp)
+#define OFFSET_MAP_KEY(entry) \
+    ((((rv_hash_key_t) (entry)->satp) << 32) | (rv_hash_key_t) (entry)->pc)
+#else
+#define OFFSET_MAP_SATP(entry) 0
+#define BLOCK_SATP(block) 0
+#define OFFSET_MAP_KEY(entry) ((rv_hash_key_t) (entry)->pc)
+#endif
+
+static inline uint32_t region_of(const struct jit_state *state,
+                                 uint32_t offset)
+{
+    const struct jit_region *first = &state->regions[0];
+    uint32_t idx = (offset - first->start) / (first->end - first->start);
+    return idx < JIT_N_REGIONS ? idx : JIT_N_REGIONS - 1;
+}
+
+static inline struct offset_map *offset_map_find(struct jit_state *state,
+                                                 uint32_t pc,
+                                                 uint32_t satp UNUSED)
+{
+#if RV32_HAS(SYSTEM)
+    uint64_t key = ((uint64_t) satp << 32) | pc;
+#else
+    uint64_t key = pc;
+#endif
+    uint32_t idx = jit_index_find(&state->offset_index, key);
+    return idx == JIT_INDEX_EMPTY ? NULL : &state->offset_map[idx];
+}
+
 static inline void offset_map_insert(struct jit_state *state, block_t *block)
 {
     assert(state->n_blocks < MAX_BLOCKS);
 
+    if (unlikely(state->persist)) {
+        uint64_t digest = block->digest;
+#if RV32_HAS(SYSTEM_MMIO) && RV32_HAS(MOP_FUSION)
+        /* Lazily fused loads/stores assume their addresses were RAM when
+         * they were verified, which the instruction bytes do not capture.
+         */
+        for (uint8_t i = 0; i < block->n_lazy_candidates; i++) {
+            if (block->lazy_candidates[i].verified)
+                digest = 0;
+        }
+#endif
+        state->persist->digests[state->n_blocks] = digest;
+    }
+
     struct offset_map *map_entry = &state->offset_map[state->n_blocks++];
     map_entry->pc = block->pc_start;
     map_entry->offset = state->offset;
+    map_entry->freq = 0;
 #if RV32_HAS(SYSTEM)
     map_entry->satp = block->satp;
 #endif
+    jit_index_put(&state->offset_index, OFFSET_MAP_KEY(map_entry),
+                  state->n_blocks - 1);
+    state->regions[state->cur_region].n_blocks++;
 }
 
 #if !defined(__APPLE__)
@@ -410,8 +590,6 @@ static inline void offset_map_insert(struct jit_state *state, block_t *block)
     __builtin___clear_cache((char *) (addr), (char *) (addr) + (size));
 #endif
 
-static bool should_flush = false;
-
 #if defined(__APPLE__) && defined(__aarch64__)
 /* Track JIT write mode to batch write protection toggling.
  * On Apple Silicon, rapid toggling of write protection can cause
@@ -444,12 +622,9 @@ static inline void jit_exit_write_mode(void)
 
 static void emit_bytes(struct jit_state *state, void *data, uint32_t len)
 {
-    if (unlikely((state->offset + len) > state->size)) {
-        should_flush = true;
-        return;
-    }
-    if (unlikely(state->n_blocks == MAX_BLOCKS)) {
-        should_flush = true;
+    if (unlikely((state->offset + len) >
+                 state->regions[state->cur_region].end)) {
+        state->should_flush = true;
         return;
     }
 #if defined(__APPLE__) && defined(__aarch64__)
@@ -1043,13 +1218,13 @@ static inline void emit_load(struct jit_state *state,
     }
 
 #if defined(__x86_64__)
-    if (src & 8 || dst & 8)
-        emit_basic_rex(state, 0, dst, src);
+    if (src & 8 || dst & 8 || size == S64)
+        emit_basic_rex(state, size == S64, dst, src);
     if (size == S8 || size == S16) {
         /* movzx */
         emit1(state, 0x0f);
         emit1(state, size == S8 ? 0xb6 : 0xb7);
-    } else if (size == S32) {
+    } else if (size == S32 || size == S64) {
         /* mov */
         emit1(state, 0x8b);
     } else {
@@ -1184,6 +1359,34 @@ static inline void emit_load_imm_sext(struct jit_state *state,
 #endif
 }
 
+/* Load a host address that changes between runs.  The fixed-width encoding
+ * lets the persistent code cache rebase it in place.
+ */
+static inline void emit_load_host_addr(struct jit_state *state,
+                                       int dst,
+                                       uintptr_t addr,
+                                       uint32_t kind)
+{
+#if defined(__x86_64__)
+    /* movabs $addr, dst */
+    emit_basic_rex(state, 1, 0, dst);
+    emit1(state, 0xb8 | (dst & 7));
+    record_reloc(state, kind);
+    emit8(state, addr);
+
+    set_dirty(dst, true);
+#elif defined(__aarch64__)
+    /* movz + 3x movk, one per 16-bit chunk, even if the chunk is zero */
+    record_reloc(state, kind);
+    for (uint32_t i = 0; i < 4; i++) {
+        uint32_t imm16 = (addr >> (i * 16)) & 0xffff;
+        emit_a64(state, sz(true) | (i ? MW_MOVK : MW_MOVZ) | (i << 21) |
+                            (imm16 << 5) | dst);
+    }
+    set_dirty(dst, true);
+#endif
+}
+
 static inline bool jit_store_x0(struct jit_state *state,
                                 enum operand_size size,
                                 int src,
@@ -1260,8 +1463,8 @@ static inline void emit_store(struct jit_state *state,
 #if defined(__x86_64__)
     if (size == S16)
         emit1(state, 0x66); /* 16-bit override */
-    if (src & 8 || dst & 8 || size == S8)
-        emit_rex(state, 0, !!(src & 8), 0, !!(dst & 8));
+    if (src & 8 || dst & 8 || size == S8 || size == S64)
+        emit_rex(state, size == S64, !!(src & 8), 0, !!(dst & 8));
     emit1(state, size == S8 ? 0x88 : 0x89);
     emit_modrm_and_displacement(state, src, dst, offset);
 #elif defined(__aarch64__)
@@ -1314,7 +1517,7 @@ static inline void unmap_vm_reg(int);
 static inline void emit_call(struct jit_state *state, intptr_t target)
 {
 #if defined(__x86_64__)
-    emit_load_imm_sext(state, RAX, target);
+    emit_load_host_addr(state, RAX, target, RELOC_TEXT);
     /* callq *%rax */
     emit1(state, 0xff);
     /* ModR/M byte: b11010000b = xd0, rax is register 0 */
@@ -1324,7 +1527,7 @@ static inline void emit_call(struct jit_state *state, intptr_t target)
     emit_addsub_imm(state, true, AS_SUB, SP, SP, stack_movement);
     emit_loadstore_imm(state, LS_STRX, R30, SP, 0);
 
-    emit_movewide_imm(state, true, temp_imm_reg, target);
+    emit_load_host_addr(state, temp_imm_reg, target, RELOC_TEXT);
     emit_uncond_branch_reg(state, BR_BLR, temp_imm_reg);
 
     save_reg(state, 0); /* R5 */
@@ -1878,7 +2081,7 @@ static void emit_x64_cmov(struct jit_state *state, uint8_t cc, int dst, int src)
  * path) whenever any of the following are not met, so each one keeps the
  * slow path's behavior intact:
  *   - vaddr aligned to access_size
- *   - dTLB[idx] is valid and its VPN matches
+ *   - way 0 of the dTLB set is valid and its tag matches vpn and ASID
  *   - entry.perm has PTE_R (load) or PTE_W (store)
  *   - For stores: entry.dirty == 1 (so PTE_D update stays in C)
  *   - paddr + access_size <= mem_size (MMIO and bound-violators take slow path)
@@ -1977,28 +2180,34 @@ static uint32_t emit_jit_mmu_fastpath(struct jit_state *state,
                         (UINT32_C(31) << 10) | ((uint32_t) R8 << 5) |
                         (uint32_t) R10);
 
-    /* idx = vpn & (TLB_SIZE - 1) into w24 */
-    emit_load_imm(state, R24, TLB_SIZE - 1);
+    /* set = vpn & TLB_SET_MASK into w24 */
+    emit_load_imm(state, R24, TLB_SET_MASK);
     emit_logical_register(state, false, LOG_AND, R24, R10, R24);
 
-    /* x24 = idx << 4 (each tlb_entry_t is 16 bytes)
-     * LSL Xd, Xn, #4 = UBFM Xd, Xn, #(64-4)=60, #(63-4)=59
-     * sf=1, N=1: 0xd3400000 | (60<<16) | (59<<10) | (Rn<<5) | Rd
+    /* x24 = set << TLB_SET_SHIFT, the offset of way 0 of the set
+     * LSL Xd, Xn, #s = UBFM Xd, Xn, #(64-s), #(63-s)
+     * sf=1, N=1: 0xd3400000 | (immr<<16) | (imms<<10) | (Rn<<5) | Rd
      */
-    emit_a64(state, UINT32_C(0xd3400000) | (UINT32_C(60) << 16) |
-                        (UINT32_C(59) << 10) | ((uint32_t) R24 << 5) |
-                        (uint32_t) R24);
+    emit_a64(state, UINT32_C(0xd3400000) |
+                        ((uint32_t) (64 - TLB_SET_SHIFT) << 16) |
+                        ((uint32_t) (63 - TLB_SET_SHIFT) << 10) |
+                        ((uint32_t) R24 << 5) | (uint32_t) R24);
 
-    /* x25 = rv + offsetof(dtlb) + idx*16 */
+    /* x25 = rv + offsetof(dtlb) */
     emit_load_imm_sext(state, R25,
                        (int64_t) (uintptr_t) offsetof(riscv_t, dtlb));
     emit_addsub_register(state, true, AS_ADD, R25, R0, R25);
-    emit_addsub_register(state, true, AS_ADD, R25, R25, R24);
-    /* w10 still holds vpn (LSR result above; not clobbered by the AND into
-     * R24 nor by the LSL on R24).
+
+    /* tag = vpn | tlb_asid_tag, which sits right before dtlb:
+     * LDUR w11,[x25,#-4]; ORR w10,w10,w11
      */
+    emit_loadstore_imm(state, LS_LDRW, R11, R25, -4);
+    emit_logical_register(state, false, LOG_ORR, R10, R10, R11);
+
+    /* x25 += set offset */
+    emit_addsub_register(state, true, AS_ADD, R25, R25, R24);
 
-    /* VPN match: LDR w24,[x25,#0]; CMP w24,w10; B.NE slow */
+    /* tag match: LDR w24,[x25,#0]; CMP w24,w10; B.NE slow */
     emit_loadstore_imm(state, LS_LDRW, R24, R25, 0);
     emit_addsub_register(state, false, AS_SUBS, RZ, R24, R10);
     slow_branches[n_slow++] = emit_a64_bcond(state, COND_NE);
@@ -2058,7 +2267,7 @@ static uint32_t emit_jit_mmu_fastpath(struct jit_state *state,
      * The OR above was a 32-bit op, which zero-extends, so the high 32 bits of
      * x24 are already zero and the 64-bit ADD is correct.
      */
-    emit_load_imm_sext(state, R25, (int64_t) (uintptr_t) mem->mem_base);
+    emit_load_host_addr(state, R25, (uintptr_t) mem->mem_base, RELOC_MEM);
     emit_addsub_register(state, true, AS_ADD, R25, R25, R24);
 
     /* Perform the access */
@@ -2162,21 +2371,28 @@ static uint32_t emit_jit_mmu_fastpath(struct jit_state *state,
     emit_modrm(state, 0xc0, 5, RAX);
     emit1(state, 12);
 
-    /* idx (in ESI) = vpn & (TLB_SIZE - 1); then ESI <<= 4 */
+    /* set (in ESI) = vpn & TLB_SET_MASK; then RSI <<= TLB_SET_SHIFT */
     /* mov esi, eax */
     emit1(state, 0x89);
     emit_modrm_reg2reg(state, RAX, RSI);
-    /* and esi, TLB_SIZE - 1   (imm8 fits since TLB_SIZE - 1 = 63) */
-    emit1(state, 0x83);
+    /* and esi, TLB_SET_MASK — 81 /4 imm32 */
+    emit1(state, 0x81);
     emit_modrm(state, 0xc0, 4, RSI);
-    emit1(state, (uint8_t) (TLB_SIZE - 1));
-    /* shl rsi, 4 — REX.W + C1 /4 imm8 */
+    emit4(state, TLB_SET_MASK);
+    /* shl rsi, TLB_SET_SHIFT — REX.W + C1 /4 imm8 */
     emit1(state, 0x48);
     emit1(state, 0xc1);
     emit_modrm(state, 0xc0, 4, RSI);
-    emit1(state, 4);
+    emit1(state, TLB_SET_SHIFT);
+
+    /* tag = vpn | rv->tlb_asid_tag: or eax, [rdi + disp32]
+     * opcode 0b /r, ModRM = 87 (mod=10 disp32, reg=EAX, r/m=RDI).
+     */
+    emit1(state, 0x0b);
+    emit1(state, 0x87);
+    emit4(state, (uint32_t) offsetof(riscv_t, tlb_asid_tag));
 
-    /* r12 = rdi + offsetof(dtlb) + rsi (idx*16 already in rsi)
+    /* r12 = rdi + offsetof(dtlb) + rsi (way 0 of the set)
      * LEA r12, [rdi + rsi*1 + dtlb_offset]
      * REX.WRB = 0x4c, opcode 8d, ModRM = 84 (mod=10 disp32, reg=R12 low3=4,
      *   r/m=100 SIB), SIB = 37 (scale=00, index=110=RSI, base=111=RDI).
@@ -2187,7 +2403,7 @@ static uint32_t emit_jit_mmu_fastpath(struct jit_state *state,
     emit1(state, 0x37);
     emit4(state, (uint32_t) offsetof(riscv_t, dtlb));
 
-    /* VPN match: cmp eax, [r12]; jne slow
+    /* tag match: cmp eax, [r12]; jne slow
      * REX.B for r12 base, opcode 3b, mod=00 r/m=100 SIB, SIB.base=R12.
      */
     emit1(state, 0x41);
@@ -2260,6 +2476,7 @@ static uint32_t emit_jit_mmu_fastpath(struct jit_state *state,
     /* mov r12, imm64 — REX.WB + B8+(r&7) + imm64 */
     emit1(state, 0x49);
     emit1(state, 0xbc);
+    record_reloc(state, RELOC_MEM);
     emit8(state, (uint64_t) (uintptr_t) mem->mem_base);
     /* add r12, rax — REX.WB + 01 /r — opcode 01 has direction r/m += reg */
     emit1(state, 0x49);
@@ -2417,6 +2634,7 @@ void emit_jit_mmu_handler(struct jit_state *state,
     /* mov r11, &handler — caller-saved scratch */
     emit1(state, 0x49); /* REX.W + REX.B */
     emit1(state, 0xb8 | (R11 & 7));
+    record_reloc(state, RELOC_TEXT);
     emit8(state, (uint64_t) (uintptr_t) &jit_mmu_handler);
 
     /* call r11 */
@@ -2459,6 +2677,7 @@ void emit_jit_mmu_handler(struct jit_state *state,
     /* mov r11, &handler — caller-saved scratch */
     emit1(state, 0x49); /* REX.W + REX.B */
     emit1(state, 0xb8 | (R11 & 7));
+    record_reloc(state, RELOC_TEXT);
     emit8(state, (uint64_t) (uintptr_t) &jit_mmu_handler);
 
     /* call r11 */
@@ -2493,7 +2712,8 @@ void emit_jit_mmu_handler(struct jit_state *state,
     emit_movewide_imm(state, false, R1, vreg_idx);
 
     /* load &jit_mmu_handler into temp_reg */
-    emit_movewide_imm(state, true, temp_reg, (uintptr_t) &jit_mmu_handler);
+    emit_load_host_addr(state, temp_reg, (uintptr_t) &jit_mmu_handler,
+                        RELOC_TEXT);
     /* blr temp_reg */
     insn = (0xd63f << 16) | (temp_reg << 5);
     emit_a64(state, insn);
@@ -2505,6 +2725,52 @@ void emit_jit_mmu_handler(struct jit_state *state,
 }
 #endif
 
+/* Emit the call fn(rv, opcode, operands, pc) to one of the per-instruction
+ * helpers (jit_vector_handler(), jit_fp_handler(), ...) and leave its return
+ * value in temp_reg. A helper that takes fewer arguments ignores the extra
+ * argument registers. The call clobbers the caller-saved host registers, so
+ * the caller spills the register allocator beforehand.
+ */
+static void emit_insn_helper(struct jit_state *state,
+                             intptr_t fn,
+                             uint32_t opcode,
+                             uint32_t operands,
+                             uint32_t pc)
+{
+#if defined(__x86_64__) && defined(_WIN32)
+    /* Same stack layout as emit_jit_mmu_handler(), minus the 5th argument */
+    emit_push(state, parameter_reg[0]);
+    emit_alu64_imm32(state, 0x81, 5, RSP, 0x28);
+    emit_load_imm(state, RDX, opcode);
+    emit_load_imm(state, R8, operands);
+    emit_load_imm(state, R9, pc);
+    emit_call(state, fn);
+    emit_alu64_imm32(state, 0x81, 0, RSP, 0x28);
+    emit_pop(state, parameter_reg[0]);
+    emit_mov(state, RAX, temp_reg);
+#elif defined(__x86_64__)
+    emit_push(state, parameter_reg[0]);
+    emit_alu64_imm32(state, 0x81, 5, RSP, 0x8);
+    emit_load_imm(state, RSI, opcode);
+    emit_load_imm(state, RDX, operands);
+    emit_load_imm(state, RCX, pc);
+    emit_call(state, fn);
+    emit_alu64_imm32(state, 0x81, 0, RSP, 0x8);
+    emit_pop(state, parameter_reg[0]);
+    emit_mov(state, RAX, temp_reg);
+#elif defined(__aarch64__)
+    /* push rv (X0) onto stack: str x0, [sp, #-16]! */
+    emit_a64(state, (0xf81f0fe << 4) | R0);
+    emit_movewide_imm(state, true, R1, opcode);
+    emit_movewide_imm(state, true, R2, operands);
+    emit_movewide_imm(state, true, R3, pc);
+    emit_call(state, fn);
+    emit_logical_register(state, false, LOG_ORR, temp_reg, RZ, R0);
+    /* pop rv: ldr x0, [sp], #16 */
+    emit_a64(state, (0xf84107e << 4) | R0);
+#endif
+}
+
 static void prepare_translate(struct jit_state *state)
 {
 #if defined(__x86_64__)
@@ -2585,12 +2851,12 @@ static void prepare_translate(struct jit_state *state)
     state->org_size = state->offset;
 }
 
-static int liveness[N_RV_REGS];
+static HART_LOCAL int liveness[N_RV_REGS];
 /* The priority queue of vm registers. The one which has farthest liveness is
  * first.
  */
-static uint8_t candidate_queue[N_RV_REGS];
-static int vm_reg[3]; /* enum x64_reg/a64_reg */
+static HART_LOCAL uint8_t candidate_queue[N_RV_REGS];
+static HART_LOCAL int vm_reg[3]; /* enum x64_reg/a64_reg */
 
 static void reset_reg()
 {
@@ -2744,6 +3010,66 @@ static inline void liveness_calc(block_t *block)
             liveness[ir->rs2] = idx;
             break;
 #endif
+#if RV32_HAS(Zicsr)
+        case rv_insn_csrrw:
+        case rv_insn_csrrs:
+        case rv_insn_csrrc:
+            liveness[ir->rs1] = idx;
+            break;
+        case rv_insn_csrrwi:
+        case rv_insn_csrrsi:
+        case rv_insn_csrrci:
+            break;
+#endif
+#if RV32_HAS(EXT_A)
+        case rv_insn_lrw:
+            liveness[ir->rs1] = idx;
+            break;
+        case rv_insn_scw:
+        case rv_insn_amoswapw:
+        case rv_insn_amoaddw:
+        case rv_insn_amoxorw:
+        case rv_insn_amoandw:
+        case rv_insn_amoorw:
+        case rv_insn_amominw:
+        case rv_insn_amomaxw:
+        case rv_insn_amominuw:
+        case rv_insn_amomaxuw:
+            liveness[ir->rs1] = idx;
+            liveness[ir->rs2] = idx;
+            break;
+#endif
+#if RV32_HAS(EXT_F)
+        case rv_insn_flw:
+        case rv_insn_fsw:
+        case rv_insn_fcvtsw:
+        case rv_insn_fcvtswu:
+        case rv_insn_fmvwx:
+            liveness[ir->rs1] = idx;
+            break;
+        case rv_insn_fmadds:
+        case rv_insn_fmsubs:
+        case rv_insn_fnmsubs:
+        case rv_insn_fnmadds:
+        case rv_insn_fadds:
+        case rv_insn_fsubs:
+        case rv_insn_fmuls:
+        case rv_insn_fdivs:
+        case rv_insn_fsqrts:
+        case rv_insn_fsgnjs:
+        case rv_insn_fsgnjns:
+        case rv_insn_fsgnjxs:
+        case rv_insn_fmins:
+        case rv_insn_fmaxs:
+        case rv_insn_fcvtws:
+        case rv_insn_fcvtwus:
+        case rv_insn_fmvxw:
+        case rv_insn_feqs:
+        case rv_insn_flts:
+        case rv_insn_fles:
+        case rv_insn_fclasss:
+            break;
+#endif
 #if RV32_HAS(EXT_C)
         case rv_insn_caddi4spn:
             liveness[rv_reg_sp] = idx;
@@ -2810,6 +3136,41 @@ static inline void liveness_calc(block_t *block)
             liveness[rv_reg_sp] = idx;
             liveness[ir->rs2] = idx;
             break;
+#if RV32_HAS(EXT_F)
+        case rv_insn_cflwsp:
+        case rv_insn_cfswsp:
+            liveness[rv_reg_sp] = idx;
+            break;
+        case rv_insn_cflw:
+        case rv_insn_cfsw:
+            liveness[ir->rs1] = idx;
+            break;
+#endif
+#endif
+#if RV32_HAS(EXT_V)
+        case rv_insn_vsetvli:
+        case rv_insn_vle8_v:
+        case rv_insn_vle16_v:
+        case rv_insn_vle32_v:
+        case rv_insn_vse8_v:
+        case rv_insn_vse16_v:
+        case rv_insn_vse32_v:
+        case rv_insn_vadd_vx:
+        case rv_insn_vsub_vx:
+        case rv_insn_vmul_vx:
+        case rv_insn_vmv_v_x:
+        case rv_insn_vmv_s_x:
+            liveness[ir->rs1] = idx;
+            break;
+        case rv_insn_vsetivli:
+        case rv_insn_vadd_vv:
+        case rv_insn_vadd_vi:
+        case rv_insn_vsub_vv:
+        case rv_insn_vmul_vv:
+        case rv_insn_vredsum_vs:
+        case rv_insn_vmv_v_i:
+        case rv_insn_vmv_x_s:
+            break;
 #endif
         case rv_insn_fuse1:
             for (int i = 0; i < ir->imm2; i++) {
@@ -3128,11 +3489,14 @@ static void ra_load2_sext(struct jit_state *state,
 }
 #endif
 
-void parse_branch_history_table(struct jit_state *state,
-                                riscv_t *rv UNUSED,
-                                rv_insn_t *ir)
+/* Jump to the T1 code of the target the branch history table @bt saw most
+ * often when temp_reg holds it, loading the target into @scratch to compare.
+ */
+static void emit_bht_jump(struct jit_state *state,
+                          riscv_t *rv UNUSED,
+                          const branch_history_table_t *bt,
+                          int scratch)
 {
-    branch_history_table_t *bt = ir->branch_table;
     int max_idx = bht_find_max_idx(bt);
 #if RV32_HAS(SYSTEM)
     if (!bht_should_translate(bt, max_idx, rv->csr_satp))
@@ -3141,10 +3505,8 @@ void parse_branch_history_table(struct jit_state *state,
     if (!bht_should_translate(bt, max_idx))
         return;
 #endif
-    save_reg(state, 0);
-    unmap_vm_reg(0);
-    emit_load_imm(state, register_map[0].reg_idx, bt->PC[max_idx]);
-    emit_cmp32(state, temp_reg, register_map[0].reg_idx);
+    emit_load_imm(state, scratch, bt->PC[max_idx]);
+    emit_cmp32(state, temp_reg, scratch);
     uint32_t jump_loc_0 = state->offset;
     emit_jcc_offset(state, JCC_JNE);
 #if RV32_HAS(SYSTEM)
@@ -3155,111 +3517,1117 @@ void parse_branch_history_table(struct jit_state *state,
     emit_jump_target_offset(state, JUMP_LOC_0, state->offset);
 }
 
+void parse_branch_history_table(struct jit_state *state,
+                                riscv_t *rv,
+                                rv_insn_t *ir)
+{
+    save_reg(state, 0);
+    unmap_vm_reg(0);
+    emit_bht_jump(state, rv, ir->branch_table, register_map[0].reg_idx);
+}
+
 /* Timer increment removed: timer is now derived from cycle counter at
  * interrupt check points (rv_check_interrupt) rather than per-instruction.
  * This eliminates per-instruction memory operations in the JIT hot path.
  */
 
-#define GEN(inst, code)                                                       \
-    static void do_##inst(struct jit_state *state UNUSED, riscv_t *rv UNUSED, \
-                          rv_insn_t *ir UNUSED)                               \
-    {                                                                         \
-        code;                                                                 \
-    }
-#include "rv32_jit.c"
-#undef GEN
-
-static void do_fuse1(struct jit_state *state, riscv_t *rv UNUSED, rv_insn_t *ir)
+#if RV32_HAS(EXT_F) || RV32_HAS(EXT_A) || RV32_HAS(Zicsr)
+#if defined(__x86_64__)
+/* Reload the mapped registers after a helper call, which clobbers the
+ * caller-saved host registers and may write X[rd]. The caller spilled them
+ * with store_back() beforehand, so the mapping carries over and an inline
+ * fast path can merge with the call. The call sequence marks the registers
+ * it loads dirty even when they hold no vm register; clear that, or a later
+ * eviction would store them below rv->X.
+ */
+static void ra_reload(struct jit_state *state)
 {
-    opcode_fuse_t *fuse = ir->fuse;
-    for (int i = 0; i < ir->imm2; i++) {
-        vm_reg[0] = map_vm_reg(state, fuse[i].rd);
-        emit_load_imm(state, vm_reg[0], fuse[i].imm);
+    for (int i = 0; i < n_host_regs; i++) {
+        register_map[i].dirty = false;
+        if (register_map[i].vm_reg_idx == -1)
+            continue;
+        emit_load(state, S32, parameter_reg[0], register_map[i].reg_idx,
+                  offsetof(riscv_t, X) + 4 * register_map[i].vm_reg_idx);
     }
 }
+#endif
 
-static void do_fuse2(struct jit_state *state, riscv_t *rv UNUSED, rv_insn_t *ir)
+/* Run @ir through the helper @fn, jit_fp_handler() or jit_insn_handler(),
+ * and leave the block if it trapped. The caller has spilled the register
+ * allocator with store_back().
+ */
+static void emit_insn_checked(struct jit_state *state,
+                              intptr_t fn,
+                              rv_insn_t *ir,
+                              uint32_t operands)
 {
-    vm_reg[0] = map_vm_reg(state, ir->rd);
-    emit_load_imm(state, vm_reg[0], ir->imm);
-    emit_mov(state, vm_reg[0], temp_reg);
-    vm_reg[1] = ra_load(state, ir->rs1);
-    vm_reg[2] = map_vm_reg_reserved(state, ir->rs2, vm_reg[1]);
-    emit_mov(state, vm_reg[1], vm_reg[2]);
-    emit_alu32(state, 0x01, temp_reg, vm_reg[2]);
+    emit_insn_helper(state, fn, ir->opcode, operands, ir->pc);
+#if defined(__x86_64__)
+    ra_reload(state);
+#else
+    reset_reg();
+#endif
+    emit_cmp_imm32(state, temp_reg, 0);
+    uint32_t jump_loc_0 = state->offset;
+    emit_jcc_offset(state, JCC_JNE);
+    emit_exit(state);
+    emit_jump_target_offset(state, JUMP_LOC_0, state->offset);
 }
+#endif
 
-static void do_fuse3(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
+/* The return address stack (ras_t) in T1 code.
+ *
+ * A call pushes its return address inline. A return pops the stack inline as
+ * well. Unless the target its branch history table saw most often is taken,
+ * a return whose popped entry predicts its target jumps straight to the T1
+ * code cached in the entry, which jit_ras_lookup() fills in on the first
+ * return through it. A mispredicted return exits. The hits and misses of the
+ * stack are counted only for -s, and leave out the returns the branch history
+ * table resolved.
+ */
+_Static_assert(sizeof(ras_entry_t) == 16, "T1 code indexes ras.entry by 16");
+#define RAS_ENTRY_SHIFT 4
+
+/* Look up the T1 code of rv->PC for a predicted return, and cache it in the
+ * popped entry unless @cache is zero. Return where to go: the code, or the exit
+ * path if rv->PC has none.
+ */
+static uintptr_t jit_ras_lookup(riscv_t *rv,
+                                uint32_t opcode UNUSED,
+                                uint32_t cache,
+                                uint32_t pc UNUSED)
 {
-    memory_t *m = PRIV(rv)->mem;
-    opcode_fuse_t *fuse = ir->fuse;
-    for (int i = 0; i < ir->imm2; i++) {
-        vm_reg[0] = ra_load(state, fuse[i].rs1);
-        emit_load_imm_sext(state, temp_reg,
-                           (intptr_t) (m->mem_base + fuse[i].imm));
-        emit_alu64(state, 0x01, vm_reg[0], temp_reg);
-        vm_reg[1] = ra_load(state, fuse[i].rs2);
-        emit_store(state, S32, vm_reg[1], temp_reg, 0);
-    }
+    struct jit_state *state = rv->jit_state;
+    const struct offset_map *map = offset_map_find(
+        state, rv->PC, IIF(RV32_HAS(SYSTEM))(rv->csr_satp, 0));
+    if (!map)
+        return (uintptr_t) (state->buf + state->exit_loc);
+    const uintptr_t code = (uintptr_t) (state->buf + map->offset);
+    if (cache)
+        rv->ras.entry[(rv->ras.top + 1) & (RAS_SIZE - 1)].code = code;
+    return code;
 }
 
-static void do_fuse4(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
+/* Emit a forward jcc, and return what emit_jump_target_offset() patches */
+static uint32_t emit_jcc_forward(struct jit_state *state, int code)
 {
-    memory_t *m = PRIV(rv)->mem;
-    opcode_fuse_t *fuse = ir->fuse;
-    for (int i = 0; i < ir->imm2; i++) {
-        vm_reg[0] = ra_load(state, fuse[i].rs1);
-        emit_load_imm_sext(state, temp_reg,
-                           (intptr_t) (m->mem_base + fuse[i].imm));
-        emit_alu64(state, 0x01, vm_reg[0], temp_reg);
-        vm_reg[1] = map_vm_reg(state, fuse[i].rd);
-        emit_load(state, S32, temp_reg, vm_reg[1], 0);
-    }
+    const uint32_t loc = state->offset;
+    emit_jcc_offset(state, code);
+#if defined(__x86_64__)
+    return loc + (code == JCC_JMP ? 1 : 2);
+#else
+    return loc;
+#endif
 }
 
-static void do_fuse5(struct jit_state *state, riscv_t *rv UNUSED, rv_insn_t *ir)
+static void emit_jmp_reg(struct jit_state *state, int reg)
 {
-    opcode_fuse_t *fuse = ir->fuse;
-    for (int i = 0; i < ir->imm2; i++) {
-        switch (fuse[i].opcode) {
-        case rv_insn_slli:
-            vm_reg[0] = ra_load(state, fuse[i].rs1);
-            vm_reg[1] = map_vm_reg_reserved(state, fuse[i].rd, vm_reg[0]);
-            if (vm_reg[0] != vm_reg[1])
-                emit_mov(state, vm_reg[0], vm_reg[1]);
-            emit_alu32_imm8(state, 0xc1, 4, vm_reg[1], fuse[i].imm & 0x1f);
-            break;
-        case rv_insn_srli:
-            vm_reg[0] = ra_load(state, fuse[i].rs1);
-            vm_reg[1] = map_vm_reg_reserved(state, fuse[i].rd, vm_reg[0]);
-            if (vm_reg[0] != vm_reg[1])
-                emit_mov(state, vm_reg[0], vm_reg[1]);
-            emit_alu32_imm8(state, 0xc1, 5, vm_reg[1], fuse[i].imm & 0x1f);
-            break;
-        case rv_insn_srai:
-            vm_reg[0] = ra_load(state, fuse[i].rs1);
-            vm_reg[1] = map_vm_reg_reserved(state, fuse[i].rd, vm_reg[0]);
-            if (vm_reg[0] != vm_reg[1])
-                emit_mov(state, vm_reg[0], vm_reg[1]);
-            emit_alu32_imm8(state, 0xc1, 7, vm_reg[1], fuse[i].imm & 0x1f);
-            break;
-        default:
-            __UNREACHABLE;
-            break;
-        }
-    }
+#if defined(__x86_64__)
+    /* jmp *reg */
+    emit_basic_rex(state, 0, 0, reg);
+    emit1(state, 0xff);
+    emit_modrm_reg2reg(state, 4, reg);
+#elif defined(__aarch64__)
+    emit_uncond_branch_reg(state, BR_BR, reg);
+#endif
 }
 
-/* fused LI a7, imm + ECALL
- * This fusion is only available in standard RV32I/M/A/F/C since RV32E
- * uses a different syscall convention (t0 instead of a7).
+#if defined(__x86_64__)
+/* x86-64 reaches rv->ras through rv itself, Arm64 through a pointer to it
+ * loaded with emit_ras_base(), which keeps the displacements within the 9 bits
+ * of its loads and stores. A second scratch register next to temp_reg holds
+ * it and the values compared with the stack at a call.
  */
-#if !RV32_HAS(RV32E)
-static void do_fuse6(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
+#define RAS_FIELD(f) ((int32_t) (offsetof(riscv_t, ras) + offsetof(ras_t, f)))
+static const int ras_scratch_reg = R12;
+#elif defined(__aarch64__)
+#define RAS_FIELD(f) ((int32_t) offsetof(ras_t, f))
+static const int ras_scratch_reg = temp_div_reg;
+#endif
+
+/* Return the register to reach rv->ras through, which is @reg on Arm64 */
+static int emit_ras_base(struct jit_state *state UNUSED, int reg UNUSED)
 {
-    /* Set a7 = syscall number (imm) */
-    vm_reg[0] = map_vm_reg(state, rv_reg_a7);
-    emit_load_imm(state, vm_reg[0], ir->imm);
+#if defined(__x86_64__)
+    return parameter_reg[0];
+#elif defined(__aarch64__)
+    emit_load_imm_sext(state, reg, offsetof(riscv_t, ras));
+    emit_alu64(state, 0x01, parameter_reg[0], reg);
+    return reg;
+#endif
+}
+
+/* Turn ras.top in @entry into the address of the newest entry, less the
+ * displacement of entry[0] in RAS_FIELD()
+ */
+static void emit_ras_entry(struct jit_state *state, int ras, int entry)
+{
+    emit_alu32_imm8(state, 0xc1, 4, entry, RAS_ENTRY_SHIFT);
+    emit_alu64(state, 0x01, ras, entry);
+}
+
+/* Count a hit or a miss in rv->stats for -s, using @scratch on Arm64 */
+static void emit_ras_count(struct jit_state *state,
+                           riscv_t *rv,
+                           int scratch UNUSED,
+                           int32_t offset)
+{
+    if (!(PRIV(rv)->run_flag & RV_RUN_STATS))
+        return;
+#if defined(__x86_64__)
+    /* add qword [rv + offset], 1 */
+    emit_basic_rex(state, 1, 0, parameter_reg[0]);
+    emit1(state, 0x83);
+    emit_modrm_and_displacement(state, 0, parameter_reg[0], offset);
+    emit1(state, 1);
+#elif defined(__aarch64__)
+    emit_load_imm_sext(state, scratch, offset);
+    emit_alu64(state, 0x01, parameter_reg[0], scratch);
+    emit_loadstore_imm(state, LS_LDRX, R10, scratch, 0);
+    emit_addsub_imm(state, true, AS_ADD, R10, R10, 1);
+    emit_loadstore_imm(state, LS_STRX, R10, scratch, 0);
+#endif
+}
+
+/* Make @entry hold @link as ras_push() does, keeping its cached code if it
+ * held @link already. @scratch is clobbered.
+ */
+static void emit_ras_fill(struct jit_state *state,
+                          riscv_t *rv UNUSED,
+                          int entry,
+                          int scratch,
+                          uint32_t link)
+{
+    emit_load(state, S32, entry, scratch, RAS_FIELD(entry[0].pc));
+    emit_cmp_imm32(state, scratch, link);
+#if RV32_HAS(SYSTEM)
+    const uint32_t fill = emit_jcc_forward(state, JCC_JNE);
+    emit_load(state, S32, entry, scratch, RAS_FIELD(entry[0].satp));
+    emit_cmp_imm32(state, scratch, rv->csr_satp);
+#endif
+    const uint32_t done = emit_jcc_forward(state, JCC_JE);
+#if RV32_HAS(SYSTEM)
+    emit_jump_target_offset(state, fill, state->offset);
+    emit_load_imm(state, scratch, rv->csr_satp);
+    emit_store(state, S32, scratch, entry, RAS_FIELD(entry[0].satp));
+#endif
+    emit_load_imm(state, scratch, link);
+    emit_store(state, S32, scratch, entry, RAS_FIELD(entry[0].pc));
+    emit_load_imm(state, scratch, 0);
+    emit_store(state, S64, scratch, entry, RAS_FIELD(entry[0].code));
+    emit_jump_target_offset(state, done, state->offset);
+}
+
+/* Push @link at a call. The mapped host registers are left alone. */
+static void emit_ras_push(struct jit_state *state, riscv_t *rv, uint32_t link)
+{
+    const int ras = emit_ras_base(state, ras_scratch_reg);
+    emit_load(state, S32, ras, temp_reg, RAS_FIELD(top));
+    emit_alu32_imm32(state, 0x81, 0, temp_reg, 1);
+    emit_alu32_imm32(state, 0x81, 4, temp_reg, RAS_SIZE - 1);
+    emit_store(state, S32, temp_reg, ras, RAS_FIELD(top));
+    emit_ras_entry(state, ras, temp_reg);
+    emit_ras_fill(state, rv, temp_reg, ras_scratch_reg, link);
+}
+
+/* Pop the return address stack, as @ras_op says, at the indirect jump @ir
+ * whose target is in temp_reg, and jump to the T1 code of the target if the
+ * stack predicted it; a jump that also links leaves @link in the popped entry.
+ * Otherwise, fall through to the rest of the exit path. A plain return first
+ * tries the target its branch history table saw most often, which costs less
+ * than the stack when it hits, and a return the stack mostly missed while
+ * interpreted, like a switch between coroutines, only pops. Return whether
+ * the branch history table has been tried. The caller has spilled the register
+ * allocator with store_back().
+ */
+static bool emit_ras_return(struct jit_state *state,
+                            riscv_t *rv,
+                            const rv_insn_t *ir,
+                            uint32_t ras_op,
+                            uint32_t link)
+{
+    if (!(ras_op & RAS_POP))
+        return false;
+    const branch_history_table_t *bt = ir->branch_table;
+    const bool predict = bt->ras_misses <= bt->ras_hits;
+    for (int i = 0; i < 2; i++) {
+        save_reg(state, i);
+        unmap_vm_reg(i);
+    }
+    const int entry = register_map[0].reg_idx;
+    const int code = register_map[1].reg_idx;
+    const int ras = emit_ras_base(state, ras_scratch_reg);
+    emit_load(state, S32, ras, entry, RAS_FIELD(top));
+    if (!(ras_op & RAS_PUSH)) {
+        emit_mov(state, entry, code);
+        emit_alu32_imm32(state, 0x81, 0, code, RAS_SIZE - 1);
+        emit_alu32_imm32(state, 0x81, 4, code, RAS_SIZE - 1);
+        emit_store(state, S32, code, ras, RAS_FIELD(top));
+        emit_bht_jump(state, rv, bt, code);
+    }
+    if (predict || (ras_op & RAS_PUSH))
+        emit_ras_entry(state, ras, entry);
+    if (predict) {
+        emit_load(state, S32, entry, code, RAS_FIELD(entry[0].pc));
+        emit_cmp32(state, temp_reg, code);
+        const uint32_t miss = emit_jcc_forward(state, JCC_JNE);
+#if RV32_HAS(SYSTEM)
+        emit_load(state, S32, entry, code, RAS_FIELD(entry[0].satp));
+        emit_cmp_imm32(state, code, rv->csr_satp);
+        const uint32_t miss_satp = emit_jcc_forward(state, JCC_JNE);
+#endif
+        emit_ras_count(state, rv, ras_scratch_reg,
+                       offsetof(riscv_t, stats.ras_hits));
+        emit_load(state, S64, entry, code, RAS_FIELD(entry[0].code));
+        if (ras_op & RAS_PUSH)
+            emit_ras_fill(state, rv, entry, ras_scratch_reg, link);
+#if defined(__x86_64__)
+        emit_alu64(state, 0x85, code, code);
+#elif defined(__aarch64__)
+        emit_addsub_imm(state, true, AS_SUBS, RZ, code, 0);
+#endif
+        const uint32_t lookup = emit_jcc_forward(state, JCC_JE);
+        emit_jmp_reg(state, code);
+        emit_jump_target_offset(state, lookup, state->offset);
+        /* the scratch registers hold no vm register, so emit_call() on Arm64
+         * must not spill them
+         */
+        for (int i = 0; i < 2; i++)
+            register_map[i].dirty = false;
+        emit_store(state, S32, temp_reg, parameter_reg[0],
+                   offsetof(riscv_t, PC));
+        emit_insn_helper(state, (intptr_t) &jit_ras_lookup, 0,
+                         !(ras_op & RAS_PUSH), 0);
+        emit_jmp_reg(state, temp_reg);
+        emit_jump_target_offset(state, miss, state->offset);
+#if RV32_HAS(SYSTEM)
+        emit_jump_target_offset(state, miss_satp, state->offset);
+#endif
+    }
+    emit_ras_count(state, rv, ras_scratch_reg,
+                   offsetof(riscv_t, stats.ras_misses));
+    if (ras_op & RAS_PUSH)
+        emit_ras_fill(state, rv, entry, ras_scratch_reg, link);
+    for (int i = 0; i < 2; i++)
+        register_map[i].dirty = false;
+    return !(ras_op & RAS_PUSH);
+}
+
+#if RV32_HAS(EXT_F)
+/* Single-precision floating point.
+ *
+ * The F registers are never held in host registers: each handler reads its
+ * operands from rv->F and writes its result back, so jit_fp_handler() always
+ * finds the register file up to date. On x86-64 the common cases run on SSE
+ * scalar instructions under the MXCSR that jit_fp_reset() installs (round to
+ * nearest even, exceptions masked); src/rv32_f_jit.c explains how the flags
+ * they raise reach fflags. Whatever the inline code cannot settle falls back
+ * to jit_fp_handler(), and so does every F instruction on Arm64, whose short
+ * load/store displacements do not reach rv->F.
+ */
+static inline int32_t fp_reg_offset(int idx)
+{
+    return offsetof(riscv_t, F) + 4 * idx;
+}
+
+/* Run @ir through jit_fp_handler() and leave the block if it trapped. The
+ * caller has spilled the register allocator with store_back().
+ */
+static void emit_fp_helper(struct jit_state *state, rv_insn_t *ir)
+{
+    emit_insn_checked(state, (intptr_t) &jit_fp_handler, ir, jit_fp_pack(ir));
+}
+
+/* F instructions that are not worth inlining: fmin.s, fmax.s, fclass.s */
+static void emit_fp_call(struct jit_state *state, rv_insn_t *ir)
+{
+    store_back(state);
+    emit_fp_helper(state, ir);
+}
+
+#if defined(__x86_64__)
+#define JCC_JBE 0x86 /* Jump if Below or Equal - unsigned (conditional) */
+#define JCC_JP 0x8a  /* Jump if Parity, i.e. unordered after (U)COMISS */
+
+/* SSE opcodes, following the 0x0f escape */
+#define SSE_MOVSS_LOAD 0x10 /* movss xmm, m32 */
+#define SSE_MOVSS_STORE 0x11
+#define SSE_CVTSI2SS 0x2a
+#define SSE_CVTTSS2SI 0x2c /* truncating */
+#define SSE_CVTSS2SI 0x2d  /* rounding as MXCSR says */
+#define SSE_UCOMISS 0x2e   /* quiet compare */
+#define SSE_COMISS 0x2f    /* signaling compare */
+#define SSE_SQRTSS 0x51
+#define SSE_ADDSS 0x58
+#define SSE_MULSS 0x59
+#define SSE_SUBSS 0x5c
+#define SSE_DIVSS 0x5e
+#define SSE_STMXCSR 0xae /* with ModRM.reg = 3 */
+
+/* FMA3 opcodes in the VEX 0f38 map: xmm0 = +/-(xmm0 * xmm1) +/- m32 */
+#define FMA_VFMADD213SS 0xa9
+#define FMA_VFMSUB213SS 0xab
+#define FMA_VFNMADD213SS 0xad
+#define FMA_VFNMSUB213SS 0xaf
+
+#define FP_SIGN_MASK INT32_MIN
+
+/* [prefix] [REX] 0f op with the operands reg and [base + offset] */
+static void emit_sse_mem(struct jit_state *state,
+                         uint8_t prefix,
+                         int w,
+                         uint8_t op,
+                         int reg,
+                         int base,
+                         int32_t offset)
+{
+    if (prefix)
+        emit1(state, prefix);
+    emit_basic_rex(state, w, reg, base);
+    emit1(state, 0x0f);
+    emit1(state, op);
+    emit_modrm_and_displacement(state, reg, base, offset);
+}
+
+/* [prefix] [REX] 0f op with the register operands reg and rm */
+static void emit_sse_reg(struct jit_state *state,
+                         uint8_t prefix,
+                         int w,
+                         uint8_t op,
+                         int reg,
+                         int rm)
+{
+    if (prefix)
+        emit1(state, prefix);
+    emit_basic_rex(state, w, reg, rm);
+    emit1(state, 0x0f);
+    emit1(state, op);
+    emit_modrm_reg2reg(state, reg, rm);
+}
+
+/* op xmm0, xmm1, [rv + offset] in the VEX.LIG.66.0F38.W0 encoding */
+static void emit_fma(struct jit_state *state, uint8_t op, int32_t offset)
+{
+    emit1(state, 0xc4);
+    /* inverted R, X and B, then the 0f38 map */
+    emit1(state, 0xe2 & ~((parameter_reg[0] & 8) << 2));
+    /* W = 0, inverted vvvv = xmm1, L = 0, pp = 66 */
+    emit1(state, 0x71);
+    emit1(state, op);
+    emit_modrm_and_displacement(state, 0, parameter_reg[0], offset);
+}
+
+/* 32-bit op reg, [rv + offset], e.g. xor (0x33) or cmp (0x3b) */
+static void emit_alu32_mem(struct jit_state *state,
+                           int op,
+                           int reg,
+                           int32_t offset)
+{
+    emit_basic_rex(state, 0, reg, parameter_reg[0]);
+    emit1(state, op);
+    emit_modrm_and_displacement(state, reg, parameter_reg[0], offset);
+}
+
+/* Fold the MXCSR flags into fflags. The call only happens when a flag shows
+ * up that jit_fp_seen does not know about yet.
+ */
+static void emit_fp_accrue(struct jit_state *state)
+{
+    emit_sse_mem(state, 0, 0, SSE_STMXCSR, 3, parameter_reg[0],
+                 offsetof(riscv_t, jit_fp_scratch));
+    emit_load(state, S32, parameter_reg[0], temp_reg,
+              offsetof(riscv_t, jit_fp_scratch));
+    emit_alu32_imm32(state, 0x81, 4, temp_reg, JIT_FP_MXCSR_FLAGS);
+    emit_alu32_mem(state, 0x3b, temp_reg, offsetof(riscv_t, jit_fp_seen));
+    uint32_t jump_loc_0 = state->offset;
+    emit_jcc_offset(state, JCC_JE);
+    emit_insn_helper(state, (intptr_t) &jit_fp_accrue, 0, 0, 0);
+    ra_reload(state);
+    emit_jump_target_offset(state, JUMP_LOC_0, state->offset);
+}
+
+/* Branches from an inline fast path to its jit_fp_handler() fallback */
+struct fp_slow {
+    uint32_t loc[3];
+    uint32_t n;
+};
+
+static void emit_fp_bail(struct jit_state *state,
+                         struct fp_slow *slow,
+                         int code)
+{
+    assert(slow->n < ARRAY_SIZE(slow->loc));
+    slow->loc[slow->n++] = state->offset + 2; /* rel32 of the jcc */
+    emit_jcc_offset(state, code);
+}
+
+/* End the fast path of @ir and emit the fallback its bail-outs lead to */
+static void emit_fp_fallback(struct jit_state *state,
+                             rv_insn_t *ir,
+                             struct fp_slow *slow)
+{
+    if (!slow->n)
+        return;
+    uint32_t jump_normal = state->offset;
+    emit_jcc_offset(state, JCC_JMP);
+    for (uint32_t i = 0; i < slow->n; i++)
+        emit_jump_target_offset(state, slow->loc[i], state->offset);
+    emit_fp_helper(state, ir);
+    emit_jump_target_offset(state, JUMP_NORMAL, state->offset);
+}
+
+/* Whether inline code can round as @rm asks. MXCSR rounds to nearest even,
+ * so a dynamic rm bails out unless frm is RNE at run time.
+ */
+static bool emit_fp_rm(struct jit_state *state,
+                       uint8_t rm,
+                       struct fp_slow *slow)
+{
+    if (rm == 0b000)
+        return true;
+    if (rm != 0b111)
+        return false;
+    emit_load(state, S32, parameter_reg[0], temp_reg,
+              offsetof(riscv_t, csr_fcsr));
+    emit_alu32_imm32(state, 0x81, 4, temp_reg, 0xe0);
+    emit_fp_bail(state, slow, JCC_JNE);
+    return true;
+}
+
+/* F[rd] = xmm0 unless it is a NaN: RISC-V wants the canonical NaN, and for
+ * the fused forms the invalid flag on inf * 0 + qNaN, so softfloat redoes
+ * those.
+ */
+static void emit_fp_result(struct jit_state *state,
+                           rv_insn_t *ir,
+                           struct fp_slow *slow)
+{
+    emit_sse_reg(state, 0, 0, SSE_UCOMISS, 0, 0);
+    emit_fp_bail(state, slow, JCC_JP);
+    emit_sse_mem(state, 0xf3, 0, SSE_MOVSS_STORE, 0, parameter_reg[0],
+                 fp_reg_offset(ir->rd));
+    emit_fp_accrue(state);
+}
+
+/* X[rd] = temp_reg, in its host register as well as in memory, where a
+ * helper call on the way reloads it from.
+ */
+static void emit_fp_set_x(struct jit_state *state, rv_insn_t *ir, int rd_reg)
+{
+    if (!ir->rd)
+        return;
+    emit_mov(state, temp_reg, rd_reg);
+    emit_store(state, S32, rd_reg, parameter_reg[0],
+               offsetof(riscv_t, X) + 4 * ir->rd);
+}
+#endif
+
+/* fadd.s, fsub.s, fmul.s, fdiv.s, fsqrt.s */
+static void emit_fp_arith(struct jit_state *state, rv_insn_t *ir)
+{
+    store_back(state);
+#if defined(__x86_64__)
+    struct fp_slow slow = {.n = 0};
+    if (emit_fp_rm(state, ir->rm, &slow)) {
+        const int rv_reg = parameter_reg[0];
+        uint8_t op;
+        switch (ir->opcode) {
+        case rv_insn_fadds:
+            op = SSE_ADDSS;
+            break;
+        case rv_insn_fsubs:
+            op = SSE_SUBSS;
+            break;
+        case rv_insn_fmuls:
+            op = SSE_MULSS;
+            break;
+        case rv_insn_fdivs:
+            op = SSE_DIVSS;
+            break;
+        default:
+            op = SSE_SQRTSS;
+            break;
+        }
+        if (op == SSE_SQRTSS) {
+            emit_sse_mem(state, 0xf3, 0, op, 0, rv_reg,
+                         fp_reg_offset(ir->rs1));
+        } else {
+            emit_sse_mem(state, 0xf3, 0, SSE_MOVSS_LOAD, 0, rv_reg,
+                         fp_reg_offset(ir->rs1));
+            emit_sse_mem(state, 0xf3, 0, op, 0, rv_reg,
+                         fp_reg_offset(ir->rs2));
+        }
+        emit_fp_result(state, ir, &slow);
+        emit_fp_fallback(state, ir, &slow);
+        return;
+    }
+#endif
+    emit_fp_helper(state, ir);
+}
+
+/* fmadd.s, fmsub.s, fnmsub.s, fnmadd.s, fused only on hosts with FMA3 */
+static void emit_fp_fma(struct jit_state *state, rv_insn_t *ir)
+{
+    store_back(state);
+#if defined(__x86_64__)
+    struct fp_slow slow = {.n = 0};
+    if (__builtin_cpu_supports("fma") && emit_fp_rm(state, ir->rm, &slow)) {
+        const int rv_reg = parameter_reg[0];
+        uint8_t op;
+        switch (ir->opcode) {
+        case rv_insn_fmadds: /* rs1 * rs2 + rs3 */
+            op = FMA_VFMADD213SS;
+            break;
+        case rv_insn_fmsubs: /* rs1 * rs2 - rs3 */
+            op = FMA_VFMSUB213SS;
+            break;
+        case rv_insn_fnmsubs: /* -(rs1 * rs2) + rs3 */
+            op = FMA_VFNMADD213SS;
+            break;
+        default: /* fnmadd.s: -(rs1 * rs2) - rs3 */
+            op = FMA_VFNMSUB213SS;
+            break;
+        }
+        emit_sse_mem(state, 0xf3, 0, SSE_MOVSS_LOAD, 0, rv_reg,
+                     fp_reg_offset(ir->rs1));
+        emit_sse_mem(state, 0xf3, 0, SSE_MOVSS_LOAD, 1, rv_reg,
+                     fp_reg_offset(ir->rs2));
+        emit_fma(state, op, fp_reg_offset(ir->rs3));
+        emit_fp_result(state, ir, &slow);
+        emit_fp_fallback(state, ir, &slow);
+        return;
+    }
+#endif
+    emit_fp_helper(state, ir);
+}
+
+/* feq.s, flt.s, fle.s. COMISS raises invalid on any NaN, as flt.s and fle.s
+ * do, UCOMISS only on a signaling one, as feq.s does.
+ */
+static void emit_fp_cmp(struct jit_state *state, rv_insn_t *ir)
+{
+    store_back(state);
+#if defined(__x86_64__)
+    const int rv_reg = parameter_reg[0];
+    int rd_reg = ir->rd ? map_vm_reg(state, ir->rd) : -1;
+    uint32_t jump_loc_0, jump_loc_1 = 0;
+    if (ir->opcode == rv_insn_feqs) {
+        emit_sse_mem(state, 0xf3, 0, SSE_MOVSS_LOAD, 0, rv_reg,
+                     fp_reg_offset(ir->rs1));
+        emit_sse_mem(state, 0, 0, SSE_UCOMISS, 0, rv_reg,
+                     fp_reg_offset(ir->rs2));
+        emit_load_imm(state, temp_reg, 0);
+        jump_loc_1 = state->offset;
+        emit_jcc_offset(state, JCC_JP);
+        jump_loc_0 = state->offset;
+        emit_jcc_offset(state, JCC_JNE);
+    } else {
+        /* rs2 > rs1 or rs2 >= rs1, false when unordered */
+        emit_sse_mem(state, 0xf3, 0, SSE_MOVSS_LOAD, 0, rv_reg,
+                     fp_reg_offset(ir->rs2));
+        emit_sse_mem(state, 0, 0, SSE_COMISS, 0, rv_reg,
+                     fp_reg_offset(ir->rs1));
+        emit_load_imm(state, temp_reg, 0);
+        jump_loc_0 = state->offset;
+        emit_jcc_offset(state, ir->opcode == rv_insn_flts ? JCC_JBE : JCC_JB);
+    }
+    emit_load_imm(state, temp_reg, 1);
+    emit_jump_target_offset(state, JUMP_LOC_0, state->offset);
+    if (jump_loc_1)
+        emit_jump_target_offset(state, jump_loc_1 + 2, state->offset);
+    emit_fp_set_x(state, ir, rd_reg);
+    emit_fp_accrue(state);
+#else
+    emit_fp_helper(state, ir);
+#endif
+}
+
+/* fcvt.w.s, fcvt.wu.s */
+static void emit_fp_cvt_w(struct jit_state *state, rv_insn_t *ir)
+{
+    store_back(state);
+#if defined(__x86_64__)
+    struct fp_slow slow = {.n = 0};
+    /* round towards zero by truncation, or to nearest even as MXCSR does */
+    bool rtz = ir->rm == 0b001;
+    if (rtz || emit_fp_rm(state, ir->rm, &slow)) {
+        bool is_unsigned = ir->opcode == rv_insn_fcvtwus;
+        int rd_reg = ir->rd ? map_vm_reg(state, ir->rd) : -1;
+        /* fcvt.wu.s converts to 64 bits, which covers the whole range */
+        emit_sse_mem(state, 0xf3, is_unsigned,
+                     rtz ? SSE_CVTTSS2SI : SSE_CVTSS2SI, temp_reg,
+                     parameter_reg[0], fp_reg_offset(ir->rs1));
+        if (is_unsigned) {
+            if (ir->rd)
+                emit_alu32(state, 0x89, temp_reg, rd_reg);
+            /* shr $32, temp_reg: a NaN or a result out of range remains */
+            emit_alu64(state, 0xc1, 5, temp_reg);
+            emit1(state, 32);
+            emit_fp_bail(state, &slow, JCC_JNE);
+            if (ir->rd)
+                emit_store(state, S32, rd_reg, parameter_reg[0],
+                           offsetof(riscv_t, X) + 4 * ir->rd);
+        } else {
+            /* the integer indefinite: NaN, out of range or just INT32_MIN */
+            emit_cmp_imm32(state, temp_reg, INT32_MIN);
+            emit_fp_bail(state, &slow, JCC_JE);
+            emit_fp_set_x(state, ir, rd_reg);
+        }
+        emit_fp_accrue(state);
+        emit_fp_fallback(state, ir, &slow);
+        return;
+    }
+#endif
+    emit_fp_helper(state, ir);
+}
+
+/* fcvt.s.w, fcvt.s.wu */
+static void emit_fp_cvt_s(struct jit_state *state, rv_insn_t *ir)
+{
+    store_back(state);
+#if defined(__x86_64__)
+    struct fp_slow slow = {.n = 0};
+    if (emit_fp_rm(state, ir->rm, &slow)) {
+        const int rv_reg = parameter_reg[0];
+        if (ir->opcode == rv_insn_fcvtsw) {
+            emit_sse_mem(state, 0xf3, 0, SSE_CVTSI2SS, 0, rv_reg,
+                         offsetof(riscv_t, X) + 4 * ir->rs1);
+        } else {
+            /* zero-extended to 64 bits, then converted as signed */
+            emit_load(state, S32, rv_reg, temp_reg,
+                      offsetof(riscv_t, X) + 4 * ir->rs1);
+            emit_sse_reg(state, 0xf3, 1, SSE_CVTSI2SS, 0, temp_reg);
+        }
+        emit_sse_mem(state, 0xf3, 0, SSE_MOVSS_STORE, 0, rv_reg,
+                     fp_reg_offset(ir->rd));
+        emit_fp_accrue(state);
+        emit_fp_fallback(state, ir, &slow);
+        return;
+    }
+#endif
+    emit_fp_helper(state, ir);
+}
+
+/* fsgnj.s, fsgnjn.s, fsgnjx.s, fmv.x.w and fmv.w.x only move bits around */
+static void emit_fp_bits(struct jit_state *state, rv_insn_t *ir)
+{
+#if defined(__x86_64__)
+    const int rv_reg = parameter_reg[0];
+    switch (ir->opcode) {
+    case rv_insn_fmvxw:
+        if (!ir->rd)
+            return;
+        emit_load(state, S32, rv_reg, temp_reg, fp_reg_offset(ir->rs1));
+        vm_reg[0] = map_vm_reg(state, ir->rd);
+        emit_mov(state, temp_reg, vm_reg[0]);
+        return;
+    case rv_insn_fmvwx:
+        vm_reg[0] = ra_load(state, ir->rs1);
+        emit_mov(state, vm_reg[0], temp_reg);
+        break;
+    case rv_insn_fsgnjxs:
+        /* rs1 ^ (rs2 & sign) */
+        emit_load(state, S32, rv_reg, temp_reg, fp_reg_offset(ir->rs2));
+        emit_alu32_imm32(state, 0x81, 4, temp_reg, FP_SIGN_MASK);
+        emit_alu32_mem(state, 0x33, temp_reg, fp_reg_offset(ir->rs1));
+        break;
+    default:
+        /* ((rs1 ^ rs2) & sign) ^ rs1, with the sign of rs2 flipped for
+         * fsgnjn.s
+         */
+        emit_load(state, S32, rv_reg, temp_reg, fp_reg_offset(ir->rs1));
+        emit_alu32_mem(state, 0x33, temp_reg, fp_reg_offset(ir->rs2));
+        emit_alu32_imm32(state, 0x81, 4, temp_reg, FP_SIGN_MASK);
+        if (ir->opcode == rv_insn_fsgnjns)
+            emit_alu32_imm32(state, 0x81, 6, temp_reg, FP_SIGN_MASK);
+        emit_alu32_mem(state, 0x33, temp_reg, fp_reg_offset(ir->rs1));
+        break;
+    }
+    emit_store(state, S32, temp_reg, rv_reg, fp_reg_offset(ir->rd));
+#else
+    emit_fp_call(state, ir);
+#endif
+}
+
+/* flw and its compressed forms: F[rd] = mem[X[base] + imm] */
+static void emit_fp_load(struct jit_state *state,
+                         riscv_t *rv UNUSED,
+                         rv_insn_t *ir,
+                         int base)
+{
+#if defined(__x86_64__) && !RV32_HAS(SYSTEM_MMIO)
+    memory_t *m = PRIV(rv)->mem;
+    vm_reg[0] = ra_load(state, base);
+    emit_load_host_addr(state, temp_reg, (uintptr_t) (m->mem_base + ir->imm),
+                        RELOC_MEM);
+    emit_alu64(state, 0x01, vm_reg[0], temp_reg);
+    emit_sse_mem(state, 0xf3, 0, SSE_MOVSS_LOAD, 0, temp_reg, 0);
+    emit_sse_mem(state, 0xf3, 0, SSE_MOVSS_STORE, 0, parameter_reg[0],
+                 fp_reg_offset(ir->rd));
+#else
+    (void) base;
+    /* the interpreter handler walks the MMU and takes the page faults */
+    emit_fp_call(state, ir);
+#endif
+}
+
+/* fsw and its compressed forms: mem[X[base] + imm] = F[rs2] */
+static void emit_fp_store(struct jit_state *state,
+                          riscv_t *rv UNUSED,
+                          rv_insn_t *ir,
+                          int base)
+{
+#if defined(__x86_64__) && !RV32_HAS(SYSTEM_MMIO)
+    memory_t *m = PRIV(rv)->mem;
+    vm_reg[0] = ra_load(state, base);
+    emit_load_host_addr(state, temp_reg, (uintptr_t) (m->mem_base + ir->imm),
+                        RELOC_MEM);
+    emit_alu64(state, 0x01, vm_reg[0], temp_reg);
+    emit_sse_mem(state, 0xf3, 0, SSE_MOVSS_LOAD, 0, parameter_reg[0],
+                 fp_reg_offset(ir->rs2));
+    emit_sse_mem(state, 0xf3, 0, SSE_MOVSS_STORE, 0, temp_reg, 0);
+#else
+    (void) base;
+    emit_fp_call(state, ir);
+#endif
+}
+#endif
+
+#if RV32_HAS(EXT_A) || RV32_HAS(Zicsr)
+/* Atomics and CSR accesses that T1 code does not run inline */
+static void emit_insn_call(struct jit_state *state, rv_insn_t *ir)
+{
+    store_back(state);
+    emit_insn_checked(state, (intptr_t) &jit_insn_handler, ir,
+                      jit_insn_pack(ir));
+}
+#endif
+
+#if defined(__x86_64__) && \
+    (RV32_HAS(EXT_A) || RV32_HAS(Zicsr) || RV32_HAS(T2C))
+/* op between reg and the 32-bit, or 64-bit if @w, memory operand at
+ * [base + offset]; @op 0x0fc1 stands for xadd.
+ */
+static void emit_mem_op(struct jit_state *state,
+                        int w,
+                        int op,
+                        int reg,
+                        int base,
+                        int32_t offset)
+{
+    emit_basic_rex(state, w, reg, base);
+    if (op > 0xff)
+        emit1(state, op >> 8);
+    emit1(state, op & 0xff);
+    emit_modrm_and_displacement(state, reg, base, offset);
+}
+#endif
+
+/* On-stack promotion of loops to T2C. A backward branch to @target counts
+ * down rv->loop_budget and leaves T1 code for @target once it runs out, so
+ * that rv_step() sees a loop that T1 code would otherwise never leave, see
+ * loop_credit(). The caller has spilled the register allocator with
+ * store_back(). Arm64 code keeps such loops in T1 code.
+ */
+static void emit_back_edge(struct jit_state *state UNUSED,
+                           const rv_insn_t *ir UNUSED,
+                           uint32_t target UNUSED)
+{
+#if RV32_HAS(T2C) && defined(__x86_64__)
+    if (target > ir->pc)
+        return;
+    /* sub dword [rv + loop_budget], 1 */
+    emit_mem_op(state, 0, 0x83, 5, parameter_reg[0],
+                offsetof(riscv_t, loop_budget));
+    emit1(state, 1);
+    uint32_t jump_loc_0 = state->offset;
+    emit_jcc_offset(state, JCC_JNE);
+    emit_load_imm(state, temp_reg, target);
+    emit_store(state, S32, temp_reg, parameter_reg[0], offsetof(riscv_t, PC));
+    emit_exit(state);
+    emit_jump_target_offset(state, JUMP_LOC_0, state->offset);
+#endif
+}
+
+#if RV32_HAS(Zicsr)
+/* Reads of the counters and of the F CSRs, the only CSR accesses that
+ * jit_csr_translatable() lets into translated code.
+ *
+ * T1 code leaves csr_cycle alone: on exit, rv_step() adds the cost of the
+ * block it entered, and the blocks chained after it go uncounted. A counter
+ * read therefore retires itself first, or a loop polling cycle or instret
+ * would never see it move. jit_insn_handler() does the same for time and
+ * timeh, which stay out of line along with the writes to the F CSRs.
+ */
+static void emit_csr(struct jit_state *state, rv_insn_t *ir)
+{
+#if defined(__x86_64__)
+    const int rv_reg = parameter_reg[0];
+    const uint32_t csr = ir->imm & 0xfff;
+    switch (csr) {
+    case CSR_CYCLE:
+    case CSR_CYCLEH:
+    case CSR_INSTRET:
+    case CSR_INSTRETH:
+        /* add qword [rv + csr_cycle], 1 */
+        emit_mem_op(state, 1, 0x83, 0, rv_reg, offsetof(riscv_t, csr_cycle));
+        emit1(state, 1);
+        if (ir->rd) {
+            vm_reg[0] = map_vm_reg(state, ir->rd);
+            emit_load(state, S32, rv_reg, vm_reg[0],
+                      offsetof(riscv_t, csr_cycle) + (csr & 0x80 ? 4 : 0));
+            set_dirty(vm_reg[0], true);
+        }
+        return;
+#if RV32_HAS(EXT_F)
+    case CSR_FFLAGS:
+    case CSR_FRM:
+    case CSR_FCSR:
+        if (ir->opcode == rv_insn_csrrwi || ir->rs1)
+            break; /* a write */
+        if (ir->rd) {
+            vm_reg[0] = map_vm_reg(state, ir->rd);
+            emit_load(state, S32, rv_reg, vm_reg[0],
+                      offsetof(riscv_t, csr_fcsr));
+            if (csr == CSR_FRM)
+                emit_alu32_imm8(state, 0xc1, 5, vm_reg[0], 5);
+            if (csr != CSR_FCSR)
+                emit_alu32_imm32(state, 0x81, 4, vm_reg[0],
+                                 csr == CSR_FRM ? 0x7 : 0x1f);
+            set_dirty(vm_reg[0], true);
+        }
+        return;
+#endif
+    }
+#endif
+    emit_insn_call(state, ir);
+}
+#endif
+
+#if RV32_HAS(EXT_A)
+/* LR.W, SC.W and the AMOs.
+ *
+ * Outside of system emulation a single hart runs on the host thread: the
+ * interpreter carries out the AMOs as plain read-modify-write sequences, and
+ * SC.W always succeeds since no other hart can break the reservation. x86-64
+ * code does the same on guest memory in at most three instructions. The
+ * misaligned addresses, which must trap, go through jit_insn_handler(), and
+ * so does every atomic on Arm64 and in system emulation, where
+ * rv_atomic_on_host() maps them to host atomics on the physical address and
+ * models the LR/SC reservation.
+ */
+static void emit_atomic(struct jit_state *state,
+                        riscv_t *rv UNUSED,
+                        rv_insn_t *ir)
+{
+    store_back(state);
+#if defined(__x86_64__) && !RV32_HAS(SYSTEM_MMIO)
+    memory_t *m = PRIV(rv)->mem;
+    const bool is_lr = ir->opcode == rv_insn_lrw;
+    if (is_lr)
+        vm_reg[0] = ra_load(state, ir->rs1);
+    else
+        ra_load2(state, ir->rs1, ir->rs2);
+
+    emit_mov(state, vm_reg[0], temp_reg);
+    emit_alu32_imm32(state, 0x81, 4, temp_reg, 3);
+    uint32_t jump_loc_0 = state->offset;
+    emit_jcc_offset(state, JCC_JNE);
+
+    emit_load_host_addr(state, temp_reg, (uintptr_t) m->mem_base, RELOC_MEM);
+    emit_alu64(state, 0x01, vm_reg[0], temp_reg);
+    int rd_reg = -1;
+    if (ir->rd) {
+        rd_reg = is_lr ? map_vm_reg(state, ir->rd)
+                       : map_vm_reg_reserved2(state, ir->rd, vm_reg[0],
+                                              vm_reg[1]);
+    }
+    const int src = vm_reg[1];
+    switch (ir->opcode) {
+    case rv_insn_lrw:
+        if (ir->rd)
+            emit_load(state, S32, temp_reg, rd_reg, 0);
+        break;
+    case rv_insn_scw:
+        emit_store(state, S32, src, temp_reg, 0);
+        if (ir->rd)
+            emit_load_imm(state, rd_reg, 0);
+        break;
+    case rv_insn_amoswapw:
+    case rv_insn_amoaddw: {
+        const bool is_swap = ir->opcode == rv_insn_amoswapw;
+        if (!ir->rd) {
+            if (is_swap)
+                emit_store(state, S32, src, temp_reg, 0);
+            else
+                emit_mem_op(state, 0, 0x01, src, temp_reg, 0);
+            break;
+        }
+        if (rd_reg != src)
+            emit_mov(state, src, rd_reg);
+        /* xchg or xadd */
+        emit_mem_op(state, 0, is_swap ? 0x87 : 0x0fc1, rd_reg, temp_reg, 0);
+        break;
+    }
+    default:
+        /* rd = old value. If rd is rs2 as well, swap instead: memory then
+         * holds rs2 and rs2 the old value, which amounts to the same since
+         * the operations below are commutative.
+         */
+        if (ir->rd) {
+            if (rd_reg != src)
+                emit_load(state, S32, temp_reg, rd_reg, 0);
+            else
+                emit_mem_op(state, 0, 0x87, src, temp_reg, 0);
+        }
+        switch (ir->opcode) {
+        case rv_insn_amoxorw:
+            emit_mem_op(state, 0, 0x31, src, temp_reg, 0);
+            break;
+        case rv_insn_amoandw:
+            emit_mem_op(state, 0, 0x21, src, temp_reg, 0);
+            break;
+        case rv_insn_amoorw:
+            emit_mem_op(state, 0, 0x09, src, temp_reg, 0);
+            break;
+        default: {
+            /* store src unless the word in memory wins: compare src with the
+             * word for the minimum, the word with src for the maximum
+             */
+            const bool is_min = ir->opcode == rv_insn_amominw ||
+                                ir->opcode == rv_insn_amominuw;
+            const bool is_signed = ir->opcode == rv_insn_amominw ||
+                                   ir->opcode == rv_insn_amomaxw;
+            emit_mem_op(state, 0, is_min ? 0x3b : 0x39, src, temp_reg, 0);
+            uint32_t jump_loc_1 = state->offset;
+            emit_jcc_offset(state, is_signed ? JCC_JGE : JCC_JAE);
+            emit_store(state, S32, src, temp_reg, 0);
+            emit_jump_target_offset(state, jump_loc_1 + 2, state->offset);
+            break;
+        }
+        }
+        break;
+    }
+    /* write rd through, so that the fallback below can merge */
+    if (ir->rd)
+        emit_store(state, S32, rd_reg, parameter_reg[0],
+                   offsetof(riscv_t, X) + 4 * ir->rd);
+    uint32_t jump_normal = state->offset;
+    emit_jcc_offset(state, JCC_JMP);
+    /* misaligned: the interpreter raises the exception */
+    emit_jump_target_offset(state, JUMP_LOC_0, state->offset);
+    emit_insn_checked(state, (intptr_t) &jit_insn_handler, ir,
+                      jit_insn_pack(ir));
+    emit_jump_target_offset(state, JUMP_NORMAL, state->offset);
+#else
+    emit_insn_checked(state, (intptr_t) &jit_insn_handler, ir,
+                      jit_insn_pack(ir));
+#endif
+}
+#endif
+
+#define GEN(inst, code)                                                       \
+    static void do_##inst(struct jit_state *state UNUSED, riscv_t *rv UNUSED, \
+                          rv_insn_t *ir UNUSED)                               \
+    {                                                                         \
+        code;                                                                 \
+    }
+#include "rv32_jit.c"
+#undef GEN
+
+static void do_fuse1(struct jit_state *state, riscv_t *rv UNUSED, rv_insn_t *ir)
+{
+    opcode_fuse_t *fuse = ir->fuse;
+    for (int i = 0; i < ir->imm2; i++) {
+        vm_reg[0] = map_vm_reg(state, fuse[i].rd);
+        emit_load_imm(state, vm_reg[0], fuse[i].imm);
+    }
+}
+
+static void do_fuse2(struct jit_state *state, riscv_t *rv UNUSED, rv_insn_t *ir)
+{
+    vm_reg[0] = map_vm_reg(state, ir->rd);
+    emit_load_imm(state, vm_reg[0], ir->imm);
+    emit_mov(state, vm_reg[0], temp_reg);
+    vm_reg[1] = ra_load(state, ir->rs1);
+    vm_reg[2] = map_vm_reg_reserved(state, ir->rs2, vm_reg[1]);
+    emit_mov(state, vm_reg[1], vm_reg[2]);
+    emit_alu32(state, 0x01, temp_reg, vm_reg[2]);
+}
+
+static void do_fuse3(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
+{
+    memory_t *m = PRIV(rv)->mem;
+    opcode_fuse_t *fuse = ir->fuse;
+    for (int i = 0; i < ir->imm2; i++) {
+        vm_reg[0] = ra_load(state, fuse[i].rs1);
+        emit_load_host_addr(state, temp_reg,
+                            (uintptr_t) (m->mem_base + fuse[i].imm),
+                            RELOC_MEM);
+        emit_alu64(state, 0x01, vm_reg[0], temp_reg);
+        vm_reg[1] = ra_load(state, fuse[i].rs2);
+        emit_store(state, S32, vm_reg[1], temp_reg, 0);
+    }
+}
+
+static void do_fuse4(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
+{
+    memory_t *m = PRIV(rv)->mem;
+    opcode_fuse_t *fuse = ir->fuse;
+    for (int i = 0; i < ir->imm2; i++) {
+        vm_reg[0] = ra_load(state, fuse[i].rs1);
+        emit_load_host_addr(state, temp_reg,
+                            (uintptr_t) (m->mem_base + fuse[i].imm),
+                            RELOC_MEM);
+        emit_alu64(state, 0x01, vm_reg[0], temp_reg);
+        vm_reg[1] = map_vm_reg(state, fuse[i].rd);
+        emit_load(state, S32, temp_reg, vm_reg[1], 0);
+    }
+}
+
+static void do_fuse5(struct jit_state *state, riscv_t *rv UNUSED, rv_insn_t *ir)
+{
+    opcode_fuse_t *fuse = ir->fuse;
+    for (int i = 0; i < ir->imm2; i++) {
+        switch (fuse[i].opcode) {
+        case rv_insn_slli:
+            vm_reg[0] = ra_load(state, fuse[i].rs1);
+            vm_reg[1] = map_vm_reg_reserved(state, fuse[i].rd, vm_reg[0]);
+            if (vm_reg[0] != vm_reg[1])
+                emit_mov(state, vm_reg[0], vm_reg[1]);
+            emit_alu32_imm8(state, 0xc1, 4, vm_reg[1], fuse[i].imm & 0x1f);
+            break;
+        case rv_insn_srli:
+            vm_reg[0] = ra_load(state, fuse[i].rs1);
+            vm_reg[1] = map_vm_reg_reserved(state, fuse[i].rd, vm_reg[0]);
+            if (vm_reg[0] != vm_reg[1])
+                emit_mov(state, vm_reg[0], vm_reg[1]);
+            emit_alu32_imm8(state, 0xc1, 5, vm_reg[1], fuse[i].imm & 0x1f);
+            break;
+        case rv_insn_srai:
+            vm_reg[0] = ra_load(state, fuse[i].rs1);
+            vm_reg[1] = map_vm_reg_reserved(state, fuse[i].rd, vm_reg[0]);
+            if (vm_reg[0] != vm_reg[1])
+                emit_mov(state, vm_reg[0], vm_reg[1]);
+            emit_alu32_imm8(state, 0xc1, 7, vm_reg[1], fuse[i].imm & 0x1f);
+            break;
+        default:
+            __UNREACHABLE;
+            break;
+        }
+    }
+}
+
+/* fused LI a7, imm + ECALL
+ * This fusion is only available in standard RV32I/M/A/F/C since RV32E
+ * uses a different syscall convention (t0 instead of a7).
+ */
+#if !RV32_HAS(RV32E)
+static void do_fuse6(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
+{
+    /* Set a7 = syscall number (imm) */
+    vm_reg[0] = map_vm_reg(state, rv_reg_a7);
+    emit_load_imm(state, vm_reg[0], ir->imm);
     /* Store back all registers and call ecall handler.
      * ECALL is at ir->pc + 4 (second instruction in fused pair).
      */
@@ -3362,7 +4730,7 @@ static void do_fuse9(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
     emit_jump_target_offset(state, JUMP_LOC_0, state->offset);
     emit_load(state, S32, parameter_reg[0], temp_reg,
               offsetof(riscv_t, jit_mmu.paddr));
-    emit_load_imm_sext(state, vm_reg[0], (intptr_t) m->mem_base);
+    emit_load_host_addr(state, vm_reg[0], (uintptr_t) m->mem_base, RELOC_MEM);
     emit_alu64(state, ALU_OP_ADD, temp_reg, vm_reg[0]);
     emit_load(state, S32, vm_reg[0], vm_reg[0], 0);
     emit_jump_target_offset(state, JUMP_LOC_1, state->offset);
@@ -3378,7 +4746,8 @@ static void do_fuse9(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
     /* Write LUI result to rd - required when rd != LW destination */
     vm_reg[0] = map_vm_reg(state, ir->rd);
     emit_load_imm(state, vm_reg[0], ir->imm);
-    emit_load_imm_sext(state, temp_reg, (intptr_t) (m->mem_base + addr));
+    emit_load_host_addr(state, temp_reg, (uintptr_t) (m->mem_base + addr),
+                        RELOC_MEM);
     vm_reg[1] = map_vm_reg(state, ir->rs2);
     emit_load(state, S32, temp_reg, vm_reg[1], 0);
 #endif
@@ -3428,7 +4797,7 @@ static void do_fuse10(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
     emit_load(state, S32, parameter_reg[0], temp_reg,
               offsetof(riscv_t, jit_mmu.paddr));
     vm_reg[0] = map_vm_reg(state, ir->rd);
-    emit_load_imm_sext(state, vm_reg[0], (intptr_t) m->mem_base);
+    emit_load_host_addr(state, vm_reg[0], (uintptr_t) m->mem_base, RELOC_MEM);
     emit_alu64(state, ALU_OP_ADD, temp_reg, vm_reg[0]);
     vm_reg[1] = ra_load(state, ir->rs1);
     emit_store(state, S32, vm_reg[1], vm_reg[0], 0);
@@ -3447,7 +4816,8 @@ static void do_fuse10(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
     vm_reg[0] = map_vm_reg(state, ir->rd);
     emit_load_imm(state, vm_reg[0], ir->imm);
     vm_reg[1] = ra_load(state, ir->rs1);
-    emit_load_imm_sext(state, temp_reg, (intptr_t) (m->mem_base + addr));
+    emit_load_host_addr(state, temp_reg, (uintptr_t) (m->mem_base + addr),
+                        RELOC_MEM);
     emit_store(state, S32, vm_reg[1], temp_reg, 0);
 #endif
 }
@@ -3503,7 +4873,7 @@ static void do_fuse11(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
     emit_jump_target_offset(state, JUMP_LOC_0, state->offset);
     emit_load(state, S32, parameter_reg[0], temp_reg,
               offsetof(riscv_t, jit_mmu.paddr));
-    emit_load_imm_sext(state, vm_reg[0], (intptr_t) m->mem_base);
+    emit_load_host_addr(state, vm_reg[0], (uintptr_t) m->mem_base, RELOC_MEM);
     emit_alu64(state, ALU_OP_ADD, temp_reg, vm_reg[0]);
     emit_load(state, S32, vm_reg[0], vm_reg[0], 0);
     emit_jump_target_offset(state, JUMP_LOC_1, state->offset);
@@ -3525,7 +4895,8 @@ static void do_fuse11(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
 #else
     vm_reg[0] = ra_load(state, ir->rs1);
     /* Compute address: mem_base + rs1 + imm */
-    emit_load_imm_sext(state, temp_reg, (intptr_t) (m->mem_base + ir->imm));
+    emit_load_host_addr(state, temp_reg, (uintptr_t) (m->mem_base + ir->imm),
+                        RELOC_MEM);
     emit_alu64(state, 0x01, vm_reg[0], temp_reg);
     /* Load value into rd */
     vm_reg[1] = map_vm_reg(state, ir->rd);
@@ -3565,6 +4936,7 @@ static void do_fuse12(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
     emit_exit(state);
     /* Taken path: rd != 0, branch to PC + 4 + imm2 */
     emit_jump_target_offset(state, JUMP_LOC_0, state->offset);
+    emit_back_edge(state, ir, ir->pc + 4 + ir->imm2);
     if (ir->branch_taken) {
         emit_jmp(state, ir->pc + 4 + ir->imm2, rv->csr_satp);
     }
@@ -3586,23 +4958,193 @@ static const void *dispatch_table[] = {
 };
 /* clang-format on */
 
-void clear_hot(block_t *block)
+/* Retarget an already emitted jump whose displacement sits at offset_loc */
+static void patch_jump(struct jit_state *state,
+                       uint32_t offset_loc,
+                       uint32_t target_loc)
 {
-    block->hot = false;
+#if defined(__x86_64__)
+    uint32_t rel = target_loc - (offset_loc + sizeof(uint32_t));
+    memcpy(state->buf + offset_loc, &rel, sizeof(uint32_t));
+#elif defined(__aarch64__)
+    uint32_t insn;
+    memcpy(&insn, state->buf + offset_loc, sizeof(uint32_t));
+    if ((insn & 0x7c000000U) == 0x14000000U)
+        insn &= ~0x03ffffffU;
+    else
+        insn &= ~(0x7ffffU << 5);
+    memcpy(state->buf + offset_loc, &insn, sizeof(uint32_t));
+    patch_branch_imm(state, offset_loc, (int32_t) (target_loc - offset_loc));
+    sys_icache_invalidate(state->buf + offset_loc, sizeof(uint32_t));
+#endif
 }
 
-static void code_cache_flush(struct jit_state *state, riscv_t *rv)
+/* The cache_t frequency of a block counts how often the dispatcher looked it
+ * up, which covers every entry into its T1 code. Blocks already running as
+ * T2C code no longer need their T1 copy and count as cold.
+ */
+static uint32_t block_dispatch_freq(riscv_t *rv,
+                                    const struct offset_map *entry)
 {
-    should_flush = false;
-    state->offset = state->org_size;
-    state->n_blocks = 0;
-    set_reset(&state->set);
-    clear_cache_hot(rv->block_cache, (clear_func_t) clear_hot);
+    block_t *block = cache_get(rv->block_cache, entry->pc, false);
+    if (!block || !block->hot || block->offset != entry->offset ||
+        BLOCK_SATP(block) != OFFSET_MAP_SATP(entry))
+        return 0;
 #if RV32_HAS(T2C)
-    jit_cache_clear(rv->jit_cache);
-    inline_cache_clear(rv->inline_cache);
+    if (ATOMIC_LOAD(&block->hot2, ATOMIC_ACQUIRE))
+        return 0;
 #endif
-    return;
+    return cache_freq(rv->block_cache, entry->pc);
+}
+
+/* Forget the reloaded blocks, relocations and edges inside [start, end) */
+static void persist_evict(struct jit_persist *p, uint32_t start, uint32_t end)
+{
+    for (uint32_t i = 0; i < p->n_blocks; i++) {
+        if (p->blocks[i].offset >= start && p->blocks[i].offset < end)
+            p->blocks[i].state = PERSIST_EVICTED;
+    }
+
+    uint32_t n_relocs = 0;
+    for (uint32_t i = 0; i < p->n_relocs; i++) {
+        if (p->relocs[i].offset < start || p->relocs[i].offset >= end)
+            p->relocs[n_relocs++] = p->relocs[i];
+    }
+    p->n_relocs = n_relocs;
+
+    /* links refer to edges by index, so evicted edges are only invalidated */
+    for (uint32_t i = 0; i < p->n_edges; i++) {
+        struct persist_edge *e = &p->edges[i];
+        if ((e->offset_loc >= start && e->offset_loc < end) ||
+            (e->target_offset >= start && e->target_offset < end))
+            e->offset_loc = 0;
+    }
+}
+
+/* Throw away the code of one region. Its blocks fall back to the
+ * interpreter until they turn hot again, and only the branches chained into
+ * the region from elsewhere are unchained; the rest of the cache stays intact.
+ */
+static void region_evict(struct jit_state *state, riscv_t *rv, uint32_t idx)
+{
+    struct jit_region *region = &state->regions[idx];
+    uint32_t n_evicted = 0;
+
+    for (int i = 0; i < state->n_blocks;) {
+        struct offset_map *entry = &state->offset_map[i];
+        if (entry->offset < region->start || entry->offset >= region->end) {
+            i++;
+            continue;
+        }
+        block_t *block = cache_get(rv->block_cache, entry->pc, false);
+        if (block && block->offset == entry->offset &&
+            BLOCK_SATP(block) == OFFSET_MAP_SATP(entry))
+            block->hot = false;
+        set_remove(&state->set, OFFSET_MAP_KEY(entry));
+        jit_index_remove(&state->offset_index, OFFSET_MAP_KEY(entry));
+
+        /* swap with the last entry, keeping the persist digests parallel */
+        if (i != --state->n_blocks) {
+            *entry = state->offset_map[state->n_blocks];
+            jit_index_put(&state->offset_index, OFFSET_MAP_KEY(entry), i);
+            if (state->persist)
+                state->persist->digests[i] =
+                    state->persist->digests[state->n_blocks];
+        }
+        n_evicted++;
+    }
+
+    uint32_t n_chains = 0;
+    for (uint32_t i = 0; i < state->n_chains; i++) {
+        struct jit_chain chain = state->chains[i];
+        if (chain.offset_loc >= region->start && chain.offset_loc < region->end)
+            continue;
+        if (chain.target_offset >= region->start &&
+            chain.target_offset < region->end) {
+            patch_jump(state, chain.offset_loc,
+                       chain.offset_loc + sizeof(uint32_t));
+            continue;
+        }
+        state->chains[n_chains++] = chain;
+    }
+    state->n_chains = n_chains;
+
+    if (state->persist)
+        persist_evict(state->persist, region->start, region->end);
+
+    region->offset = region->start;
+    region->n_blocks = 0;
+    ras_forget(rv);
+    rv->stats.code_cache_evictions++;
+    rv->stats.evicted_blocks += n_evicted;
+    /* churn: blocks have to get hotter to earn a place in the code cache */
+    if (rv->hot_shift < HOT_SHIFT_MAX)
+        rv->hot_shift++;
+    rv->jit_calm = 0;
+}
+
+/* Move translation to another region when the current one is full, or when
+ * offset_map is. An untouched region is taken as is; otherwise the region
+ * whose blocks were dispatched least often since the previous call is
+ * evicted, so code that stopped running ages out while the working set
+ * survives.
+ */
+static void code_cache_evict(struct jit_state *state, riscv_t *rv)
+{
+    uint64_t activity[JIT_N_REGIONS] = {0};
+    for (int i = 0; i < state->n_blocks; i++) {
+        struct offset_map *entry = &state->offset_map[i];
+        uint32_t freq = block_dispatch_freq(rv, entry);
+        activity[region_of(state, entry->offset)] +=
+            freq >= entry->freq ? freq - entry->freq : freq;
+        entry->freq = freq;
+    }
+
+    const bool need_slots = state->n_blocks == MAX_BLOCKS;
+    state->regions[state->cur_region].offset = state->offset;
+
+    /* visit the current region last, ties go round-robin */
+    uint32_t victim = state->cur_region;
+    uint64_t coldest = UINT64_MAX;
+    for (uint32_t i = 1; i <= JIT_N_REGIONS; i++) {
+        uint32_t idx = (state->cur_region + i) % JIT_N_REGIONS;
+        const struct jit_region *region = &state->regions[idx];
+        if (!need_slots && region->offset == region->start) {
+            victim = idx; /* untouched, nothing to evict */
+            break;
+        }
+        if (need_slots && !region->n_blocks)
+            continue;
+        /* the current region is only a last resort */
+        if (idx == state->cur_region && coldest != UINT64_MAX)
+            break;
+        if (activity[idx] < coldest) {
+            coldest = activity[idx];
+            victim = idx;
+        }
+    }
+
+    if (state->regions[victim].offset != state->regions[victim].start)
+        region_evict(state, rv, victim);
+    state->cur_region = victim;
+    state->offset = state->regions[victim].offset;
+}
+
+/* Forget the blocks of a translation that ran out of space midway */
+static void translation_abort(struct jit_state *state,
+                              int n_blocks,
+                              uint32_t offset,
+                              uint32_t n_relocs)
+{
+    while (state->n_blocks > n_blocks) {
+        struct offset_map *entry = &state->offset_map[--state->n_blocks];
+        set_remove(&state->set, OFFSET_MAP_KEY(entry));
+        jit_index_remove(&state->offset_index, OFFSET_MAP_KEY(entry));
+        state->regions[state->cur_region].n_blocks--;
+    }
+    state->offset = offset;
+    if (state->persist)
+        state->persist->n_relocs = n_relocs;
 }
 
 typedef void (*codegen_block_func_t)(struct jit_state *,
@@ -3616,8 +5158,8 @@ static void translate(struct jit_state *state, riscv_t *rv, block_t *block)
     reset_reg();
     liveness_reset();
     liveness_calc(block);
-    for (idx = 0, ir = block->ir_head; idx < block->n_insn && !should_flush;
-         idx++, ir = next) {
+    for (idx = 0, ir = block->ir_head;
+         idx < block->n_insn && !state->should_flush; idx++, ir = next) {
         next = ir->next;
         regs_refresh(idx);
         ((codegen_block_func_t) dispatch_table[ir->opcode])(state, rv, ir);
@@ -3628,7 +5170,7 @@ static void translate(struct jit_state *state, riscv_t *rv, block_t *block)
      * Unlike branch-terminated blocks, page-terminated blocks always fall
      * through to the next sequential address (pc_end).
      */
-    if (block->page_terminated && !should_flush) {
+    if (block->page_terminated && !state->should_flush) {
         ir = block->ir_tail;
         store_back(state);
         if (ir->branch_taken) {
@@ -3669,15 +5211,12 @@ static void resolve_jumps(struct jit_state *state)
 #endif
         else {
             target_loc = jump.offset_loc + sizeof(uint32_t);
-            for (int j = 0; j < state->n_blocks; j++) {
-                if (jump.target_pc == state->offset_map[j].pc) {
-                    IIF(RV32_HAS(SYSTEM))(
-                        if (jump.target_satp == state->offset_map[j].satp), )
-                    {
-                        target_loc = state->offset_map[j].offset;
-                        break;
-                    }
-                }
+            const struct offset_map *entry = offset_map_find(
+                state, jump.target_pc,
+                IIF(RV32_HAS(SYSTEM))(jump.target_satp, 0));
+            if (entry && record_chain(state, jump.offset_loc, entry->offset)) {
+                target_loc = entry->offset;
+                record_edge(state, jump.offset_loc, target_loc);
             }
         }
 #if defined(__x86_64__)
@@ -3693,9 +5232,11 @@ static void resolve_jumps(struct jit_state *state)
     }
 }
 
+/* Translate a block, followed by its successors unless @chain is false */
 static void translate_chained_block(struct jit_state *state,
                                     riscv_t *rv,
-                                    block_t *block)
+                                    block_t *block,
+                                    bool chain)
 {
     if (set_has(&state->set, RV_HASH_KEY(block)))
         return;
@@ -3703,6 +5244,14 @@ static void translate_chained_block(struct jit_state *state,
     if (state->n_blocks == MAX_BLOCKS)
         return;
 
+#if RV32_HAS(SUPERBLOCK)
+    /* a successor still profiling its last branch runs in the interpreter
+     * until superblock_reform() rebuilt it
+     */
+    if (block->profiling)
+        return;
+#endif
+
     /* Check whether the remaining jump slots can accommodate this block.
      * Each instruction emits up to JUMPS_PER_INSN jump targets (SYSTEM_MMIO
      * load paths are the worst case) plus up to 2 for a page-terminated
@@ -3715,7 +5264,7 @@ static void translate_chained_block(struct jit_state *state,
     assert(added);
     offset_map_insert(state, block);
     translate(state, rv, block);
-    if (unlikely(should_flush))
+    if (unlikely(state->should_flush) || !chain)
         return;
     rv_insn_t *ir = block->ir_tail;
     if (ir->branch_untaken && !set_has(&state->set, ir->branch_untaken->pc)) {
@@ -3724,7 +5273,7 @@ static void translate_chained_block(struct jit_state *state,
         if (block1->translatable) {
             IIF(RV32_HAS(SYSTEM))(
                 if (block1->satp == rv->csr_satp && !block1->invalidated), )
-                translate_chained_block(state, rv, block1);
+                translate_chained_block(state, rv, block1, true);
         }
     }
     if (ir->branch_taken && !set_has(&state->set, ir->branch_taken->pc)) {
@@ -3733,7 +5282,7 @@ static void translate_chained_block(struct jit_state *state,
         if (block1->translatable) {
             IIF(RV32_HAS(SYSTEM))(
                 if (block1->satp == rv->csr_satp && !block1->invalidated), )
-                translate_chained_block(state, rv, block1);
+                translate_chained_block(state, rv, block1, true);
         }
     }
 
@@ -3752,7 +5301,7 @@ static void translate_chained_block(struct jit_state *state,
             if (block1 && block1->translatable) {
                 IIF(RV32_HAS(SYSTEM))(
                     if (block1->satp == rv->csr_satp && !block1->invalidated), )
-                    translate_chained_block(state, rv, block1);
+                    translate_chained_block(state, rv, block1, true);
             }
         }
     }
@@ -3763,19 +5312,24 @@ bool jit_translate(riscv_t *rv, block_t *block)
     struct jit_state *state = rv->jit_state;
     if (set_has(&state->set, RV_HASH_KEY(block))) {
         /* Block already translated - skip */
-        for (int i = 0; i < state->n_blocks; i++) {
-            if (block->pc_start == state->offset_map[i].pc
-#if RV32_HAS(SYSTEM)
-                && block->satp == state->offset_map[i].satp
+        const struct offset_map *entry =
+            offset_map_find(state, block->pc_start, BLOCK_SATP(block));
+        assert(entry);
+        block->offset = entry->offset;
+        block->hot = true;
+        return true;
+    }
+    uint64_t start_ns = rv_stats_now();
+    bool chain = true;
+#if RV32_HAS(SUPERBLOCK)
+    /* the profiler let it through, or it is translated unprofiled */
+    block->profiling = false;
 #endif
-            ) {
-                block->offset = state->offset_map[i].offset;
-                block->hot = true;
-                return true;
-            }
-        }
-        assert(NULL);
-        __UNREACHABLE;
+    if (state->n_blocks == MAX_BLOCKS) {
+#if defined(__APPLE__) && defined(__aarch64__)
+        jit_enter_write_mode();
+#endif
+        code_cache_evict(state, rv);
     }
 restart:
     /* Only clear the portion that was used in the previous translation.
@@ -3789,6 +5343,8 @@ restart:
     if (state->n_jumps)
         memset(state->jumps, 0, state->n_jumps * sizeof(struct jump));
     state->n_jumps = 0;
+    uint32_t n_blocks = state->n_blocks;
+    uint32_t n_relocs = state->persist ? state->persist->n_relocs : 0;
     block->offset = state->offset;
 #if defined(__APPLE__) && defined(__aarch64__)
     /* Enter write mode for the entire translation phase.
@@ -3797,13 +5353,28 @@ restart:
      */
     jit_enter_write_mode();
 #endif
-    translate_chained_block(state, rv, block);
-    if (unlikely(should_flush)) {
+    translate_chained_block(state, rv, block, chain);
+    if (unlikely(state->should_flush)) {
+        state->should_flush = false;
+        translation_abort(state, n_blocks, block->offset, n_relocs);
+        const struct jit_region *region = &state->regions[state->cur_region];
+        if (state->offset != region->start) {
+            code_cache_evict(state, rv);
+            goto restart;
+        }
+        /* Even a whole region cannot hold the block along with its
+         * successors. Retry it alone, and leave it to the interpreter if
+         * that does not fit either.
+         */
+        if (chain) {
+            chain = false;
+            goto restart;
+        }
 #if defined(__APPLE__) && defined(__aarch64__)
         jit_exit_write_mode();
 #endif
-        code_cache_flush(state, rv);
-        goto restart;
+        rv_stats_hist_add(&rv->stats.t1_compile, rv_stats_now() - start_ns);
+        return false;
     }
 
     /* If the root block was not translated (e.g. jump budget exhausted on
@@ -3815,6 +5386,7 @@ restart:
 #if defined(__APPLE__) && defined(__aarch64__)
         jit_exit_write_mode();
 #endif
+        rv_stats_hist_add(&rv->stats.t1_compile, rv_stats_now() - start_ns);
         return false;
     }
 
@@ -3838,10 +5410,559 @@ restart:
     __asm__ volatile("dsb ish" ::: "memory");
     __asm__ volatile("isb" ::: "memory");
 #endif
+    block->hot = true;
+    rv->stats.promoted[RV_TIER_T1] += state->n_blocks - n_blocks;
+    if (rv->hot_shift && ++rv->jit_calm == HOT_CALM) {
+        rv->hot_shift--;
+        rv->jit_calm = 0;
+    }
+    rv_stats_hist_add(&rv->stats.t1_compile, rv_stats_now() - start_ns);
+    return true;
+}
+
+/* Persistent code cache.
+ *
+ * On-disk layout, in host byte order:
+ *   struct persist_header
+ *   machine code for buf[org_size, org_size + code_size)
+ *   struct persist_block[n_blocks]
+ *   struct persist_reloc[n_relocs]
+ *   struct persist_edge[n_edges]
+ *
+ * Chaining edges are stored unresolved and relinked only once both ends have
+ * been validated against the instructions the guest actually decoded, so code
+ * translated from stale guest bytes can never be reached.
+ */
+#define PERSIST_MAGIC 0x3143315456323352ULL /* "R32VT1C1" */
+#define PERSIST_VERSION 1
+
+#if defined(__x86_64__)
+#define PERSIST_RELOC_SIZE 8 /* imm64 of movabs */
+#elif defined(__aarch64__)
+#define PERSIST_RELOC_SIZE 16 /* movz + 3x movk */
+#endif
+
+struct persist_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t org_size;
+    uint32_t exit_loc;
+    uint32_t code_size;
+    uint32_t n_blocks;
+    uint32_t n_relocs;
+    uint32_t n_edges;
+    uint32_t reserved;
+    uint64_t key;
+    uint64_t text_base; /* address of jit_state_init in the saving process */
+    uint64_t mem_base;
+};
+
+static void persist_free(struct jit_state *state)
+{
+    struct jit_persist *p = state->persist;
+    free(p->path);
+    free(p->relocs);
+    free(p->edges);
+    free(p->digests);
+    free(p->blocks);
+    free(p->link_start);
+    free(p->links);
+    free(p);
+    state->persist = NULL;
+}
+
+static bool persist_hash_file(uint64_t *hash, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    uint64_t chunk[2048];
+    ssize_t n;
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+        if (n % sizeof(uint64_t))
+            memset((uint8_t *) chunk + n, 0, sizeof(uint64_t) - n % 8);
+        for (ssize_t i = 0; i < (n + 7) / 8; i++)
+            *hash = (*hash ^ chunk[i]) * 0x100000001b3ULL;
+        *hash = jit_digest_step(*hash, (uint32_t) n);
+    }
+    close(fd);
+    return n == 0;
+}
+
+static bool persist_self_exe(char *path, size_t size)
+{
+#if defined(__linux__)
+    ssize_t len = readlink("/proc/self/exe", path, size - 1);
+    if (len < 0)
+        return false;
+    path[len] = '\0';
+    return true;
+#elif defined(__APPLE__)
+    uint32_t len = size;
+    return _NSGetExecutablePath(path, &len) == 0;
+#else
+    (void) path;
+    (void) size;
+    return false;
+#endif
+}
+
+static int persist_block_cmp(const void *a, const void *b)
+{
+    const struct persist_block *x = a, *y = b;
+    if (x->satp != y->satp)
+        return x->satp < y->satp ? -1 : 1;
+    if (x->pc != y->pc)
+        return x->pc < y->pc ? -1 : 1;
+    return 0;
+}
+
+static int persist_offset_cmp(const void *a, const void *b)
+{
+    const struct persist_block *x = a, *y = b;
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+/* index of the block whose code contains offset, or -1 */
+static int persist_find_owner(const struct persist_block *sorted,
+                              uint32_t n,
+                              uint32_t offset)
+{
+    int lo = 0, hi = (int) n - 1, found = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (sorted[mid].offset <= offset) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return found;
+}
+
+static void persist_rebase(struct jit_state *state,
+                           uint32_t offset,
+                           uint64_t delta)
+{
+#if defined(__x86_64__)
+    uint64_t addr;
+    memcpy(&addr, state->buf + offset, sizeof(addr));
+    addr += delta;
+    memcpy(state->buf + offset, &addr, sizeof(addr));
+#elif defined(__aarch64__)
+    uint32_t insn[4];
+    uint64_t addr = 0;
+    memcpy(insn, state->buf + offset, sizeof(insn));
+    for (int i = 0; i < 4; i++)
+        addr |= (uint64_t) ((insn[i] >> 5) & 0xffff) << (i * 16);
+    addr += delta;
+    for (int i = 0; i < 4; i++)
+        insn[i] = (insn[i] & ~(0xffffU << 5)) |
+                  (uint32_t) ((addr >> (i * 16)) & 0xffff) << 5;
+    memcpy(state->buf + offset, insn, sizeof(insn));
+#endif
+}
+
+/* Build the per-block edge lists used by jit_persist_attach().  Edges whose
+ * ends cannot be identified are dropped and stay unresolved.
+ */
+static bool persist_link(struct jit_persist *p)
+{
+    uint32_t n = p->n_blocks;
+    bool ok = false;
+    struct persist_block *by_offset = malloc(n * sizeof(*by_offset) + 1);
+    uint32_t *src = malloc(p->n_edges * sizeof(uint32_t) + 1);
+    uint32_t *dst = malloc(p->n_edges * sizeof(uint32_t) + 1);
+    uint32_t *fill = malloc(n * sizeof(uint32_t) + 1);
+    p->link_start = calloc(n + 1, sizeof(uint32_t));
+    p->links = malloc(2 * p->n_edges * sizeof(struct persist_link) + 1);
+    if (!by_offset || !src || !dst || !fill || !p->link_start || !p->links)
+        goto out;
+
+    /* the state field carries the index into the (satp, pc) order */
+    memcpy(by_offset, p->blocks, n * sizeof(*by_offset));
+    for (uint32_t i = 0; i < n; i++)
+        by_offset[i].state = i;
+    qsort(by_offset, n, sizeof(*by_offset), persist_offset_cmp);
+
+    uint32_t n_edges = 0;
+    for (uint32_t i = 0; i < p->n_edges; i++) {
+        struct persist_edge e = p->edges[i];
+        int s = persist_find_owner(by_offset, n, e.offset_loc);
+        int d = persist_find_owner(by_offset, n, e.target_offset);
+        if (s < 0 || d < 0 || by_offset[d].offset != e.target_offset)
+            continue;
+        p->edges[n_edges] = e;
+        src[n_edges] = by_offset[s].state;
+        dst[n_edges] = by_offset[d].state;
+        p->link_start[src[n_edges]]++;
+        p->link_start[dst[n_edges]]++;
+        n_edges++;
+    }
+    p->n_edges = n_edges;
+
+    /* exclusive prefix sum over the degrees, then scatter */
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i <= n; i++) {
+        uint32_t count = p->link_start[i];
+        p->link_start[i] = sum;
+        sum += count;
+    }
+    memcpy(fill, p->link_start, n * sizeof(uint32_t));
+    for (uint32_t i = 0; i < n_edges; i++) {
+        p->links[fill[src[i]]++] = (struct persist_link){i, dst[i]};
+        p->links[fill[dst[i]]++] = (struct persist_link){i, src[i]};
+    }
+    ok = true;
+
+out:
+    free(by_offset);
+    free(src);
+    free(dst);
+    free(fill);
+    return ok;
+}
+
+static bool persist_load(struct jit_state *state, memory_t *mem)
+{
+    struct jit_persist *p = state->persist;
+    FILE *f = fopen(p->path, "rb");
+    if (!f)
+        return false;
+
+    struct persist_header hdr;
+    bool ok = fread(&hdr, sizeof(hdr), 1, f) == 1 &&
+              hdr.magic == PERSIST_MAGIC && hdr.version == PERSIST_VERSION &&
+              hdr.key == p->key && hdr.org_size == state->org_size &&
+              hdr.exit_loc == state->exit_loc &&
+              hdr.code_size <= state->size - state->org_size &&
+              hdr.n_blocks <= MAX_BLOCKS;
+    if (!ok)
+        goto out;
+
+    p->blocks = malloc(hdr.n_blocks * sizeof(struct persist_block) + 1);
+    p->relocs = malloc(hdr.n_relocs * sizeof(struct persist_reloc) + 1);
+    p->edges = malloc(hdr.n_edges * sizeof(struct persist_edge) + 1);
+    if (!p->blocks || !p->relocs || !p->edges) {
+        ok = false;
+        goto out;
+    }
+    p->cap_relocs = hdr.n_relocs;
+    p->cap_edges = hdr.n_edges;
+
+#if defined(__APPLE__) && defined(__aarch64__)
+    jit_enter_write_mode();
+#endif
+    ok = fread(state->buf + state->org_size, 1, hdr.code_size, f) ==
+             hdr.code_size &&
+         fread(p->blocks, sizeof(struct persist_block), hdr.n_blocks, f) ==
+             hdr.n_blocks &&
+         fread(p->relocs, sizeof(struct persist_reloc), hdr.n_relocs, f) ==
+             hdr.n_relocs &&
+         fread(p->edges, sizeof(struct persist_edge), hdr.n_edges, f) ==
+             hdr.n_edges;
+
+    /* everything must point into the reloaded code */
+    uint32_t end = state->org_size + hdr.code_size;
+    for (uint32_t i = 0; ok && i < hdr.n_blocks; i++)
+        ok = p->blocks[i].offset >= state->org_size &&
+             p->blocks[i].offset < end && p->blocks[i].digest;
+    for (uint32_t i = 0; ok && i < hdr.n_relocs; i++)
+        ok = p->relocs[i].offset >= state->org_size &&
+             p->relocs[i].offset + PERSIST_RELOC_SIZE <= end &&
+             p->relocs[i].kind <= RELOC_MEM;
+    for (uint32_t i = 0; ok && i < hdr.n_edges; i++)
+        ok = p->edges[i].offset_loc >= state->org_size &&
+             p->edges[i].offset_loc + sizeof(uint32_t) <= end;
+
+    if (ok) {
+        p->n_blocks = hdr.n_blocks;
+        p->n_relocs = hdr.n_relocs;
+        p->n_edges = hdr.n_edges;
+
+        const uint64_t text_delta =
+            (uint64_t) (uintptr_t) &jit_state_init - hdr.text_base;
+        const uint64_t mem_delta =
+            (uint64_t) (uintptr_t) mem->mem_base - hdr.mem_base;
+        for (uint32_t i = 0; i < p->n_relocs; i++) {
+            persist_rebase(state, p->relocs[i].offset,
+                           p->relocs[i].kind == RELOC_TEXT ? text_delta
+                                                           : mem_delta);
+        }
+
+        /* every block starts out unchained, i.e. falls through to its exit */
+        for (uint32_t i = 0; i < p->n_edges; i++) {
+            patch_jump(state, p->edges[i].offset_loc,
+                               p->edges[i].offset_loc + sizeof(uint32_t));
+        }
+
+        for (uint32_t i = 0; i < p->n_blocks; i++)
+            p->blocks[i].state = PERSIST_DORMANT;
+        qsort(p->blocks, p->n_blocks, sizeof(struct persist_block),
+              persist_block_cmp);
+        ok = persist_link(p);
+    }
+
+    if (ok) {
+        /* regions before the end of the reloaded code count as full */
+        for (int i = 0; i < JIT_N_REGIONS; i++) {
+            struct jit_region *region = &state->regions[i];
+            region->offset = region->end <= end    ? region->end
+                             : region->start < end ? end
+                                                   : region->start;
+        }
+        state->cur_region = region_of(state, end);
+        state->offset = state->regions[state->cur_region].offset;
+        sys_icache_invalidate(state->buf + state->org_size, hdr.code_size);
+    } else {
+        p->n_blocks = p->n_relocs = p->n_edges = 0;
+    }
+#if defined(__APPLE__) && defined(__aarch64__)
+    jit_exit_write_mode();
+#endif
+
+out:
+    fclose(f);
+    if (!ok)
+        rv_log_warn("Ignoring unusable JIT code cache %s", p->path);
+    return ok;
+}
+
+static void persist_save(struct jit_state *state, memory_t *mem)
+{
+    struct jit_persist *p = state->persist;
+
+    /* every block with code in the buffer, reloaded or translated */
+    uint32_t n_all = state->n_blocks;
+    for (uint32_t i = 0; i < p->n_blocks; i++)
+        n_all += p->blocks[i].state != PERSIST_LIVE &&
+                 p->blocks[i].state != PERSIST_EVICTED;
+    struct persist_block *all = malloc(n_all * sizeof(*all) + 1);
+    struct persist_block *saved = malloc(n_all * sizeof(*saved) + 1);
+    struct persist_edge *edges = malloc(p->n_edges * sizeof(*edges) + 1);
+    if (!all || !saved || !edges)
+        goto out;
+
+    uint32_t n = 0;
+    for (int i = 0; i < state->n_blocks; i++) {
+        all[n++] = (struct persist_block){
+            .pc = state->offset_map[i].pc,
+            .satp = OFFSET_MAP_SATP(&state->offset_map[i]),
+            .offset = state->offset_map[i].offset,
+            .digest = p->digests[i],
+        };
+    }
+    for (uint32_t i = 0; i < p->n_blocks; i++) {
+        if (p->blocks[i].state == PERSIST_LIVE ||
+            p->blocks[i].state == PERSIST_EVICTED)
+            continue;
+        all[n] = p->blocks[i];
+        if (p->blocks[i].state == PERSIST_DEAD)
+            all[n].digest = 0;
+        n++;
+    }
+    qsort(all, n, sizeof(*all), persist_offset_cmp);
+
+    /* regions are filled out of order, write up to the furthest one */
+    state->regions[state->cur_region].offset = state->offset;
+    uint32_t code_end = state->org_size;
+    for (int i = 0; i < JIT_N_REGIONS; i++) {
+        if (state->regions[i].offset > code_end)
+            code_end = state->regions[i].offset;
+    }
+
+    uint32_t n_saved = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (all[i].digest)
+            saved[n_saved++] = all[i];
+    }
+
+    /* keep only edges between two blocks that are written out */
+    uint32_t n_edges = 0;
+    for (uint32_t i = 0; i < p->n_edges; i++) {
+        int s = persist_find_owner(all, n, p->edges[i].offset_loc);
+        int d = persist_find_owner(all, n, p->edges[i].target_offset);
+        if (s < 0 || d < 0 || !all[s].digest || !all[d].digest ||
+            all[d].offset != p->edges[i].target_offset)
+            continue;
+        edges[n_edges++] = p->edges[i];
+    }
+
+    struct persist_header hdr = {
+        .magic = PERSIST_MAGIC,
+        .version = PERSIST_VERSION,
+        .org_size = state->org_size,
+        .exit_loc = state->exit_loc,
+        .code_size = code_end - state->org_size,
+        .n_blocks = n_saved,
+        .n_relocs = p->n_relocs,
+        .n_edges = n_edges,
+        .key = p->key,
+        .text_base = (uint64_t) (uintptr_t) &jit_state_init,
+        .mem_base = (uint64_t) (uintptr_t) mem->mem_base,
+    };
+
+    /* write a private file and rename it, so that concurrent runs of the
+     * same image never observe a partially written cache
+     */
+    size_t tmp_len = strlen(p->path) + 16;
+    char *tmp = malloc(tmp_len);
+    if (!tmp)
+        goto out;
+    snprintf(tmp, tmp_len, "%s.%d", p->path, (int) getpid());
+    FILE *f = fopen(tmp, "wb");
+    bool ok = f && fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+              fwrite(state->buf + state->org_size, 1, hdr.code_size, f) ==
+                  hdr.code_size &&
+              fwrite(saved, sizeof(*saved), n_saved, f) == n_saved &&
+              fwrite(p->relocs, sizeof(*p->relocs), p->n_relocs, f) ==
+                  p->n_relocs &&
+              fwrite(edges, sizeof(*edges), n_edges, f) == n_edges;
+    if (f && fclose(f))
+        ok = false;
+    if (ok && rename(tmp, p->path))
+        ok = false;
+    if (!ok) {
+        unlink(tmp);
+        rv_log_warn("Failed to write JIT code cache %s", p->path);
+    } else {
+        rv_log_info("Saved %u blocks to JIT code cache %s", n_saved, p->path);
+    }
+    free(tmp);
+
+out:
+    free(all);
+    free(saved);
+    free(edges);
+}
+
+bool jit_persist_open(struct jit_state *state,
+                      riscv_t *rv,
+                      const char *dir,
+                      const char *const *images,
+                      int n_images)
+{
+    memory_t *mem = PRIV(rv)->mem;
+
+    /* The key covers everything the generated code depends on besides the
+     * guest instructions themselves: the emulator build, the guest images and
+     * the guest memory size baked into bounds checks.
+     */
+    uint64_t key = 0xcbf29ce484222325ULL;
+    char exe[PATH_MAX];
+    if (!persist_self_exe(exe, sizeof(exe)) || !persist_hash_file(&key, exe)) {
+        rv_log_warn("JIT code cache disabled: cannot identify the emulator");
+        return false;
+    }
+    for (int i = 0; i < n_images; i++) {
+        if (images[i] && !persist_hash_file(&key, images[i])) {
+            rv_log_warn("JIT code cache disabled: cannot read %s", images[i]);
+            return false;
+        }
+    }
+    key = jit_digest_step(key, (uint32_t) mem->mem_size);
+    key = jit_digest_step(key, (uint32_t) (mem->mem_size >> 32));
+    key = jit_digest_step(key, sizeof(riscv_t));
+    key = jit_digest_step(key, state->size); /* fixes the region layout */
+
+    struct jit_persist *p = calloc(1, sizeof(struct jit_persist));
+    if (!p)
+        return false;
+    state->persist = p;
+    p->key = key;
+    p->digests = calloc(MAX_BLOCKS, sizeof(uint64_t));
+    size_t path_len = strlen(dir) + 1 + 16 + sizeof(".t1c");
+    p->path = malloc(path_len);
+    if (!p->digests || !p->path) {
+        persist_free(state);
+        return false;
+    }
+    snprintf(p->path, path_len, "%s/%016" PRIx64 ".t1c", dir, key);
+    if (mkdir(dir, 0755) && errno != EEXIST)
+        rv_log_warn("Cannot create JIT code cache directory %s", dir);
+
+    if (persist_load(state, mem))
+        rv_log_info("Reloaded %u blocks from JIT code cache %s", p->n_blocks,
+                    p->path);
+    return true;
+}
+
+bool jit_persist_attach(struct jit_state *state, block_t *block)
+{
+    struct jit_persist *p = state->persist;
+    if (likely(!p) || !p->n_blocks)
+        return false;
+
+    struct persist_block key = {
+        .pc = block->pc_start,
+        .satp = BLOCK_SATP(block),
+    };
+    struct persist_block *entry =
+        bsearch(&key, p->blocks, p->n_blocks, sizeof(struct persist_block),
+                persist_block_cmp);
+    if (!entry || entry->state >= PERSIST_DEAD)
+        return false;
+    if (entry->digest != block->digest) {
+        if (entry->state == PERSIST_DORMANT)
+            entry->state = PERSIST_DEAD;
+        return false;
+    }
+
+    if (entry->state == PERSIST_DORMANT) {
+        if (state->n_blocks == MAX_BLOCKS ||
+            set_has(&state->set, RV_HASH_KEY(block)))
+            return false;
+
+        set_add(&state->set, RV_HASH_KEY(block));
+        p->digests[state->n_blocks] = entry->digest;
+        struct offset_map *map_entry = &state->offset_map[state->n_blocks++];
+        map_entry->pc = entry->pc;
+        map_entry->offset = entry->offset;
+        map_entry->freq = 0;
+#if RV32_HAS(SYSTEM)
+        map_entry->satp = entry->satp;
+#endif
+        jit_index_put(&state->offset_index, OFFSET_MAP_KEY(map_entry),
+                      state->n_blocks - 1);
+        state->regions[region_of(state, entry->offset)].n_blocks++;
+        entry->state = PERSIST_LIVE;
+
+        /* chain with every neighbour that is already live */
+        uint32_t idx = entry - p->blocks;
+#if defined(__APPLE__) && defined(__aarch64__)
+        jit_enter_write_mode();
+#endif
+        for (uint32_t i = p->link_start[idx]; i < p->link_start[idx + 1];
+             i++) {
+            struct persist_link link = p->links[i];
+            if (p->blocks[link.peer].state != PERSIST_LIVE)
+                continue;
+            struct persist_edge *e = &p->edges[link.edge];
+            if (e->offset_loc &&
+                record_chain(state, e->offset_loc, e->target_offset))
+                patch_jump(state, e->offset_loc, e->target_offset);
+        }
+#if defined(__APPLE__) && defined(__aarch64__)
+        jit_exit_write_mode();
+#endif
+    }
+
+    block->offset = entry->offset;
     block->hot = true;
     return true;
 }
 
+void jit_persist_close(struct jit_state *state, riscv_t *rv)
+{
+    if (!state->persist)
+        return;
+    if (!state->persist->broken)
+        persist_save(state, PRIV(rv)->mem);
+    persist_free(state);
+}
+
 struct jit_state *jit_state_init(size_t size)
 {
     struct jit_state *state = malloc(sizeof(struct jit_state));
@@ -3866,9 +5987,26 @@ struct jit_state *jit_state_init(size_t size)
     assert(state->buf != MAP_FAILED);
 
     state->n_blocks = 0;
+    state->chains = NULL;
+    state->n_chains = state->cap_chains = 0;
+    state->persist = NULL;
+    state->should_flush = false;
     set_reset(&state->set);
     reset_reg();
+    state->cur_region = 0;
+    state->regions[0].end = size;
     prepare_translate(state);
+
+    /* cache-line aligned regions, the last one takes the remainder */
+    uint32_t region_size = ((size - state->org_size) / JIT_N_REGIONS) & ~63U;
+    for (int i = 0; i < JIT_N_REGIONS; i++) {
+        struct jit_region *region = &state->regions[i];
+        region->start = state->org_size + i * region_size;
+        region->end =
+            i == JIT_N_REGIONS - 1 ? size : region->start + region_size;
+        region->offset = region->start;
+        region->n_blocks = 0;
+    }
 #if defined(__APPLE__) && defined(__aarch64__)
     /* Final cache flush for prologue/epilogue code.
      * emit_bytes handles per-instruction cache maintenance, but a final
@@ -3893,13 +6031,25 @@ struct jit_state *jit_state_init(size_t size)
         return NULL;
     }
 
+    if (!jit_index_init(&state->offset_index, OFFSET_INDEX_BITS)) {
+        free(state->jumps);
+        free(state->offset_map);
+        munmap(state->buf, state->size);
+        free(state);
+        return NULL;
+    }
+
     return state;
 }
 
 void jit_state_exit(struct jit_state *state)
 {
+    if (state->persist)
+        persist_free(state);
     munmap(state->buf, state->size);
     free(state->offset_map);
+    jit_index_free(&state->offset_index);
     free(state->jumps);
+    free(state->chains);
     free(state);
 }
@@ -5,9 +5,11 @@
 
 #pragma once
 
+#include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#include "jit_index.h"
 #include "riscv_private.h"
 #include "utils.h"
 
@@ -36,11 +38,32 @@ struct jump {
 struct offset_map {
     uint32_t pc;
     uint32_t offset;
+    uint32_t freq; /* cache_t frequency of the block at the last eviction */
 #if RV32_HAS(SYSTEM)
     uint32_t satp;
 #endif
 };
 
+/* The code space after the prologue and epilogue is split into equally sized
+ * regions. Translation fills one region at a time; when it runs out, the
+ * coldest region is evicted and refilled instead of flushing the whole cache.
+ */
+#define JIT_N_REGIONS 8
+
+struct jit_region {
+    uint32_t start, end; /* [start, end) within buf */
+    uint32_t offset;     /* allocation cursor, unused while current */
+    uint32_t n_blocks;   /* offset_map entries whose code lies here */
+};
+
+/* a direct branch patched to jump from one translated block into another */
+struct jit_chain {
+    uint32_t offset_loc;
+    uint32_t target_offset;
+};
+
+struct jit_persist;
+
 struct jit_state {
     set_t set;
     uint8_t *buf;
@@ -53,8 +76,15 @@ struct jit_state {
     uint32_t retpoline_loc;
     struct offset_map *offset_map;
     int n_blocks;
+    jit_index_t offset_index; /* (pc, satp) to offset_map index */
     struct jump *jumps;
     int n_jumps;
+    struct jit_region regions[JIT_N_REGIONS];
+    uint32_t cur_region; /* region that state->offset allocates from */
+    struct jit_chain *chains;
+    uint32_t n_chains, cap_chains;
+    struct jit_persist *persist; /* on-disk code cache, NULL if disabled */
+    bool should_flush; /* the block under translation ran out of its region */
 };
 
 struct host_reg {
@@ -70,6 +100,29 @@ void jit_state_exit(struct jit_state *state);
 bool jit_translate(riscv_t *rv, block_t *block);
 typedef void (*exec_block_func_t)(riscv_t *rv, uintptr_t);
 
+/* Persistent T1 code cache.
+ *
+ * jit_persist_open() names a cache file after the loaded guest images and the
+ * emulator binary, then reloads and relocates the code saved by a previous
+ * run.  Reloaded blocks stay dormant until jit_persist_attach() sees the guest
+ * decode the same instruction bytes at the same PC (and SATP), at which point
+ * the block is hot from its first execution.  jit_persist_close() writes the
+ * code cache back to disk.
+ */
+bool jit_persist_open(struct jit_state *state,
+                      riscv_t *rv,
+                      const char *dir,
+                      const char *const *images,
+                      int n_images);
+bool jit_persist_attach(struct jit_state *state, block_t *block);
+void jit_persist_close(struct jit_state *state, riscv_t *rv);
+
+/* Fold one fetched instruction word into the content digest of a block. */
+static inline uint64_t jit_digest_step(uint64_t digest, uint32_t insn)
+{
+    return (digest ^ insn) * 0x100000001b3ULL;
+}
+
 /* JIT misaligned memory access handler.
  * Performs misaligned load/store operations using byte-level memory accesses.
  */
@@ -79,8 +132,263 @@ void jit_misaligned_handler(riscv_t *rv,
                             uint32_t type,
                             bool is_store);
 
+/* Atomics and CSR accesses that T1 and T2C code do not run inline go through
+ * jit_insn_handler(). The operands travel as one 32-bit immediate:
+ *
+ *   bits  0-4   rd
+ *   bits  5-9   rs1, or the 5-bit immediate of csrrwi/csrrsi/csrrci
+ *   bits 10-14  rs2
+ *   bits 20-31  imm, e.g. the CSR number
+ */
+static inline uint32_t jit_insn_pack(const rv_insn_t *ir)
+{
+    return ir->rd | ir->rs1 << 5 | (uint32_t) ir->rs2 << 10 |
+           (uint32_t) ir->imm << 20;
+}
+
+/* Inverse of jit_insn_pack(): rebuild the operand fields of @ir */
+static inline void jit_insn_unpack(rv_insn_t *ir,
+                                   uint32_t opcode,
+                                   uint32_t operands)
+{
+    ir->opcode = opcode;
+    ir->rd = operands & 0x1f;
+    ir->rs1 = (operands >> 5) & 0x1f;
+    ir->rs2 = (operands >> 10) & 0x1f;
+    ir->imm = (int32_t) operands >> 20;
+}
+
+/**
+ * jit_insn_handler - execute one atomic or CSR instruction for T1/T2C code
+ * @rv: RISC-V emulation core
+ * @opcode: rv_insn_* of the instruction
+ * @operands: operand fields packed by jit_insn_pack()
+ * @pc: address of the instruction
+ * @return: zero if the instruction trapped
+ */
+uint32_t jit_insn_handler(riscv_t *rv,
+                          uint32_t opcode,
+                          uint32_t operands,
+                          uint32_t pc);
+
+#if RV32_HAS(Zicsr)
+/* Whether the CSR instruction @ir may stay in translated code: a read of
+ * one of the counters, or any access to the F CSRs. Every other CSR either
+ * needs the privilege checks of the interpreter or changes state, such as
+ * SATP or the interrupt enables, that rv_step() must look at before running
+ * the next block.
+ */
+static inline bool jit_csr_translatable(const rv_insn_t *ir)
+{
+    const bool read_only = ir->opcode != rv_insn_csrrw &&
+                           ir->opcode != rv_insn_csrrwi && !ir->rs1;
+    switch (ir->imm & 0xfff) {
+    case CSR_CYCLE:
+    case CSR_CYCLEH:
+    case CSR_INSTRET:
+    case CSR_INSTRETH:
+    case CSR_TIME:
+    case CSR_TIMEH:
+        return read_only;
+#if RV32_HAS(EXT_F)
+    case CSR_FFLAGS:
+    case CSR_FRM:
+    case CSR_FCSR:
+        /* csrrw ends its block, see RV_INSN_LIST */
+        return ir->opcode != rv_insn_csrrw;
+#endif
+    default:
+        return false;
+    }
+}
+#endif
+
+#if RV32_HAS(EXT_V)
+/* T1 code runs vector instructions through jit_vector_handler(). The decoded
+ * operands travel as one 32-bit immediate so the emitted call does not point
+ * into the IR, which is freed and reused independently of the code cache:
+ *
+ *   bits  0-4   vd, vs3 or rd
+ *   bits  5-9   vs1, rs1 or the 5-bit immediate
+ *   bits 10-14  vs2
+ *   bit  15     vm
+ *   bits 16-26  zimm of vsetvli/vsetivli
+ */
+static inline uint32_t jit_vector_pack(const rv_insn_t *ir)
+{
+    uint32_t dest = ir->vd, src1 = ir->vs1;
+
+    switch (ir->opcode) {
+    case rv_insn_vsetvli:
+    case rv_insn_vsetivli:
+        return ir->rd | ir->rs1 << 5 | (uint32_t) ir->zimm << 16;
+    case rv_insn_vmv_x_s:
+        dest = ir->rd;
+        break;
+    case rv_insn_vse8_v:
+    case rv_insn_vse16_v:
+    case rv_insn_vse32_v:
+        dest = ir->vs3;
+        src1 = ir->rs1;
+        break;
+    case rv_insn_vle8_v:
+    case rv_insn_vle16_v:
+    case rv_insn_vle32_v:
+    case rv_insn_vadd_vx:
+    case rv_insn_vsub_vx:
+    case rv_insn_vmul_vx:
+    case rv_insn_vmv_v_x:
+    case rv_insn_vmv_s_x:
+        src1 = ir->rs1;
+        break;
+    case rv_insn_vadd_vi:
+    case rv_insn_vmv_v_i:
+        src1 = ir->imm & 0x1f;
+        break;
+    case rv_insn_vadd_vv:
+    case rv_insn_vsub_vv:
+    case rv_insn_vmul_vv:
+    case rv_insn_vredsum_vs:
+        break;
+    default:
+        /* only the opcodes marked translatable in decode.h come here */
+        assert(NULL);
+        __UNREACHABLE;
+    }
+    return dest | src1 << 5 | (uint32_t) ir->vs2 << 10 |
+           (uint32_t) ir->vm << 15;
+}
+
+/* Inverse of jit_vector_pack(): rebuild the operand fields of @ir */
+static inline void jit_vector_unpack(rv_insn_t *ir,
+                                     uint32_t opcode,
+                                     uint32_t operands)
+{
+    uint8_t dest = operands & 0x1f, src1 = (operands >> 5) & 0x1f;
+
+    ir->opcode = opcode;
+    ir->rd = ir->vd = ir->vs3 = dest;
+    ir->rs1 = ir->vs1 = src1;
+    ir->vs2 = (operands >> 10) & 0x1f;
+    ir->vm = (operands >> 15) & 1;
+    ir->zimm = (operands >> 16) & 0x7ff;
+    ir->imm = ((int32_t) src1 << 27) >> 27;
+    switch (opcode) {
+    case rv_insn_vle8_v:
+    case rv_insn_vse8_v:
+        ir->eew = 8;
+        break;
+    case rv_insn_vle16_v:
+    case rv_insn_vse16_v:
+        ir->eew = 16;
+        break;
+    case rv_insn_vle32_v:
+    case rv_insn_vse32_v:
+        ir->eew = 32;
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * jit_vector_handler - execute one vector instruction for T1 code
+ * @rv: RISC-V emulation core
+ * @opcode: rv_insn_* of the instruction
+ * @operands: operand fields packed by jit_vector_pack()
+ * @pc: address of the instruction
+ * @return: zero if the instruction trapped
+ */
+uint32_t jit_vector_handler(riscv_t *rv,
+                            uint32_t opcode,
+                            uint32_t operands,
+                            uint32_t pc);
+#endif
+
+#if RV32_HAS(EXT_F)
+/* F instructions that T1 and T2C code do not run inline go through
+ * jit_fp_handler(). The loads and stores pack their operands as
+ * jit_insn_pack() does; the others have rs3 and rm instead of imm:
+ *
+ *   bits  0-4   rd
+ *   bits  5-9   rs1
+ *   bits 10-14  rs2
+ *   bits 15-19  rs3
+ *   bits 20-22  rm
+ */
+static inline bool jit_fp_is_mem(uint32_t opcode)
+{
+    switch (opcode) {
+    case rv_insn_flw:
+    case rv_insn_fsw:
+#if RV32_HAS(EXT_C)
+    case rv_insn_cflwsp:
+    case rv_insn_cfswsp:
+    case rv_insn_cflw:
+    case rv_insn_cfsw:
+#endif
+        return true;
+    default:
+        return false;
+    }
+}
+
+static inline uint32_t jit_fp_pack(const rv_insn_t *ir)
+{
+    if (jit_fp_is_mem(ir->opcode))
+        return jit_insn_pack(ir);
+    return ir->rd | ir->rs1 << 5 | (uint32_t) ir->rs2 << 10 |
+           (uint32_t) (ir->rs3 & 0x1f) << 15 | (uint32_t) (ir->rm & 0x7) << 20;
+}
+
+/* Inverse of jit_fp_pack(): rebuild the operand fields of @ir */
+static inline void jit_fp_unpack(rv_insn_t *ir,
+                                 uint32_t opcode,
+                                 uint32_t operands)
+{
+    jit_insn_unpack(ir, opcode, operands);
+    if (!jit_fp_is_mem(opcode)) {
+        ir->imm = 0;
+        ir->rs3 = (operands >> 15) & 0x1f;
+        ir->rm = (operands >> 20) & 0x7;
+    }
+}
+
+/**
+ * jit_fp_handler - execute one F instruction for T1 and T2C code
+ * @rv: RISC-V emulation core
+ * @opcode: rv_insn_* of the instruction
+ * @operands: operand fields packed by jit_fp_pack()
+ * @pc: address of the instruction
+ * @return: zero if the instruction trapped
+ */
+uint32_t jit_fp_handler(riscv_t *rv,
+                        uint32_t opcode,
+                        uint32_t operands,
+                        uint32_t pc);
+
+#if defined(__x86_64__)
+/* MXCSR exception flags with an fflags counterpart: IE, ZE, OE, UE and PE.
+ * DE, the denormal-operand flag, has none.
+ */
+#define JIT_FP_MXCSR_FLAGS 0x3d
+#endif
+
+/* Fold the host exception flags raised by inline T1 code into fflags */
+void jit_fp_accrue(riscv_t *rv);
+
+/* Forget the host exception flags, e.g. once the guest has written fflags */
+void jit_fp_reset(riscv_t *rv);
+#endif
+
 #if RV32_HAS(T2C)
-void t2c_compile(riscv_t *, block_t *, pthread_mutex_t *);
+/* Each T2C compile worker owns one LLVM context for its whole lifetime */
+void *t2c_context_create(void);
+void t2c_context_dispose(void *ctx);
+/* Must be entered inside the read-side critical section @reader of
+ * rv->block_cache, which it leaves before returning.
+ */
+void t2c_compile(riscv_t *, block_t *, void *ctx, uint32_t reader);
 typedef void (*exec_t2c_func_t)(riscv_t *);
 
 /* The jit-cache records the program counters and the entries of executable
@@ -114,7 +422,7 @@ typedef void (*exec_t2c_func_t)(riscv_t *);
  * Invalidation: Inline cache entries are cleared on:
  * - Block eviction (inline_cache_clear_key in emulate.c)
  * - SFENCE.VMA (inline_cache_clear_page in rv32_template.c)
- * - FENCE.I / code_cache_flush (inline_cache_clear in jit.c)
+ * - FENCE.I (inline_cache_clear in rv32_template.c)
  *
  * On cache hit, ISB is skipped on ARM64 since we already executed this target
  * successfully - the instruction cache was coherent at that time.
@@ -152,7 +460,7 @@ void inline_cache_clear_page(struct inline_cache *cache,
 
 /* jit_cache entry for T2C compiled code lookup.
  * Thread safety: Uses seqlock pattern for lock-free readers.
- * - Writers (under cache_lock): increment seq to odd, write entry+key,
+ * - The writer (the hart only): increment seq to odd, write entry+key,
  *   increment seq to even
  * - Lock-free readers (LLVM-generated): read seq1, if odd retry; read
  *   entry+key; read seq2; if seq1 != seq2 retry Seqlock ensures readers see
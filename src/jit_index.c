@@ -0,0 +1,77 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit_index.h"
+
+bool jit_index_init(jit_index_t *index, uint32_t size_bits)
+{
+    assert(size_bits > 0 && size_bits < 32);
+    index->slots = malloc(sizeof(jit_index_slot_t) << size_bits);
+    if (!index->slots)
+        return false;
+    index->mask = (1U << size_bits) - 1;
+    index->shift = 64 - size_bits;
+    jit_index_clear(index);
+    return true;
+}
+
+void jit_index_free(jit_index_t *index)
+{
+    free(index->slots);
+    index->slots = NULL;
+}
+
+void jit_index_clear(jit_index_t *index)
+{
+    /* every byte 0xff marks each slot JIT_INDEX_EMPTY */
+    memset(index->slots, 0xff, sizeof(jit_index_slot_t) * (index->mask + 1));
+    index->count = 0;
+}
+
+void jit_index_put(jit_index_t *index, uint64_t key, uint32_t value)
+{
+    assert(value != JIT_INDEX_EMPTY);
+    uint32_t i = jit_index_home(index, key);
+    for (; index->slots[i].value != JIT_INDEX_EMPTY;
+         i = (i + 1) & index->mask) {
+        if (index->slots[i].key == key) {
+            index->slots[i].value = value;
+            return;
+        }
+    }
+    assert(index->count < index->mask);
+    index->slots[i] = (jit_index_slot_t){key, value};
+    index->count++;
+}
+
+bool jit_index_remove(jit_index_t *index, uint64_t key)
+{
+    uint32_t hole = jit_index_home(index, key);
+    for (;; hole = (hole + 1) & index->mask) {
+        if (index->slots[hole].value == JIT_INDEX_EMPTY)
+            return false;
+        if (index->slots[hole].key == key)
+            break;
+    }
+
+    /* Pull back every later entry of the run that may legally sit in the
+     * hole, i.e. whose home slot is not cyclically between hole and itself.
+     */
+    for (uint32_t i = (hole + 1) & index->mask;
+         index->slots[i].value != JIT_INDEX_EMPTY; i = (i + 1) & index->mask) {
+        uint32_t home = jit_index_home(index, index->slots[i].key);
+        if (((i - home) & index->mask) >= ((i - hole) & index->mask)) {
+            index->slots[hole] = index->slots[i];
+            hole = i;
+        }
+    }
+    index->slots[hole].value = JIT_INDEX_EMPTY;
+    index->count--;
+    return true;
+}
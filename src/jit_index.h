@@ -0,0 +1,91 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/* Fixed-capacity hash index from a 64-bit key to a 32-bit value.
+ *
+ * The T1 compiler uses it to map a (pc, satp) key to the offset_map entry of
+ * a translated block. Slots are open-addressed with linear probing, and
+ * removal shifts the following run backwards instead of leaving tombstones,
+ * so lookups stay short however often blocks come and go. The capacity is
+ * fixed at creation; keep the load factor at or below one half.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define JIT_INDEX_EMPTY UINT32_MAX
+
+typedef struct {
+    uint64_t key;
+    uint32_t value; /* JIT_INDEX_EMPTY if the slot is free */
+} jit_index_slot_t;
+
+typedef struct {
+    jit_index_slot_t *slots;
+    uint32_t mask;
+    uint32_t shift;
+    uint32_t count;
+} jit_index_t;
+
+/**
+ * jit_index_init - allocate an empty index
+ * @index: index to initialize
+ * @size_bits: the index has 2^size_bits slots
+ * @return: false if out of memory
+ */
+bool jit_index_init(jit_index_t *index, uint32_t size_bits);
+
+/**
+ * jit_index_free - release the slots of an index
+ * @index: target index
+ */
+void jit_index_free(jit_index_t *index);
+
+/**
+ * jit_index_clear - remove every key
+ * @index: target index
+ */
+void jit_index_clear(jit_index_t *index);
+
+/**
+ * jit_index_put - insert a key, or update its value if already present
+ * @index: target index, which must have a free slot
+ * @key: the key of the entry
+ * @value: any value except JIT_INDEX_EMPTY
+ */
+void jit_index_put(jit_index_t *index, uint64_t key, uint32_t value);
+
+/**
+ * jit_index_remove - remove a key
+ * @index: target index
+ * @key: the key of the removed entry
+ * @return: false if the key was not present
+ */
+bool jit_index_remove(jit_index_t *index, uint64_t key);
+
+static inline uint32_t jit_index_home(const jit_index_t *index, uint64_t key)
+{
+    /* Fibonacci hashing keeps the high product bits, which mix all the bits
+     * of the key, including the aligned low bits of a pc.
+     */
+    return (uint32_t) ((key * 0x9e3779b97f4a7c15ULL) >> index->shift);
+}
+
+/**
+ * jit_index_find - look up a key
+ * @index: target index
+ * @key: the key of the specified entry
+ * @return: the value of the key, or JIT_INDEX_EMPTY if absent
+ */
+static inline uint32_t jit_index_find(const jit_index_t *index, uint64_t key)
+{
+    for (uint32_t i = jit_index_home(index, key);; i = (i + 1) & index->mask) {
+        const jit_index_slot_t *slot = &index->slots[i];
+        if (slot->value == JIT_INDEX_EMPTY || slot->key == key)
+            return slot->value;
+    }
+}
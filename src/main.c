@@ -48,7 +48,7 @@ static char *opt_prog_name;
 /* target argc and argv */
 static int prog_argc;
 static char **prog_args;
-static const char *optstr = "tgqmhpd:a:k:i:b:x:";
+static const char *optstr = "tgqmhpsd:a:k:i:b:x:c:j:n:M:w:S:R:F:";
 
 /* enable misaligned memory access */
 static bool opt_misaligned = false;
@@ -57,6 +57,17 @@ static bool opt_misaligned = false;
 static bool opt_prof_data = false;
 static char *prof_out_file;
 
+/* report tiered-execution statistics */
+static bool opt_stats = false;
+
+#if RV32_HAS(JIT)
+/* directory of the persistent JIT code cache */
+static char *opt_jit_cache_dir;
+
+/* size of the T1 code cache in MiB, 0 for the default */
+static uint32_t opt_jit_cache_mib;
+#endif
+
 #if RV32_HAS(SYSTEM_MMIO)
 /* Linux kernel data */
 static char *opt_kernel_img;
@@ -69,6 +80,21 @@ static int opt_virtio_blk_idx = 0;
 
 /* enable virtio-rng device */
 static bool opt_virtio_rng = false;
+
+/* number of harts */
+static uint32_t opt_harts = 1;
+#endif
+
+/* host memory backing the guest memory */
+static memory_opts_t opt_mem;
+
+#if !defined(__EMSCRIPTEN__)
+/* snapshot point, taken once the guest prints the marker */
+static char *opt_snapshot_marker;
+static char *opt_snapshot_file;
+static char *opt_restore_file;
+/* test inputs to run from the snapshot point */
+static char *opt_fork_list;
 #endif
 
 static void reset_getopt_state(void)
@@ -104,6 +130,11 @@ static void reset_runtime_options(void)
     opt_prof_data = false;
     free(prof_out_file);
     prof_out_file = NULL;
+    opt_stats = false;
+#if RV32_HAS(JIT)
+    opt_jit_cache_dir = NULL;
+    opt_jit_cache_mib = 0;
+#endif
 #if RV32_HAS(SYSTEM_MMIO)
     opt_kernel_img = NULL;
     opt_rootfs_img = NULL;
@@ -111,6 +142,14 @@ static void reset_runtime_options(void)
     memset(opt_virtio_blk_img, 0, sizeof(opt_virtio_blk_img));
     opt_virtio_blk_idx = 0;
     opt_virtio_rng = false;
+    opt_harts = 1;
+#endif
+    memset(&opt_mem, 0, sizeof(opt_mem));
+#if !defined(__EMSCRIPTEN__)
+    opt_snapshot_marker = NULL;
+    opt_snapshot_file = NULL;
+    opt_restore_file = NULL;
+    opt_fork_list = NULL;
 #endif
 
     reset_getopt_state();
@@ -132,12 +171,14 @@ static void print_usage(const char *filename)
 #if RV32_HAS(SYSTEM_MMIO)
         "  -k <image> : use <image> as kernel image\n"
         "  -i <image> : use <image> as rootfs\n"
-        "  -x vblk:<image>[,readonly]: use "
+        "  -x vblk:<image>[,readonly][,async][,direct]: use "
         "<image> as virtio-blk disk image "
-        "(default read and write). This option may be specified "
-        "multiple times for multiple block devices\n"
+        "(default read and write; async: do the I/O on the host in the "
+        "background; direct: async, bypassing the host page cache). This "
+        "option may be specified multiple times for multiple block devices\n"
         "  -x vrng : enable virtio-rng device\n"
         "  -b <bootargs> : use customized <bootargs> for the kernel\n"
+        "  -n <harts> : number of harts (1-8, default 1)\n"
 #endif
         "  -d [filename]: dump registers as JSON to the "
         "given file or `-` (STDOUT)\n"
@@ -146,10 +187,63 @@ static void print_usage(const char *filename)
         "required by arch-test test\n"
         "  -m : enable misaligned memory access\n"
         "  -p : generate profiling data\n"
+        "  -s : print execution statistics on exit (and on SIGUSR1)\n"
+        "  -M <paged|thp|hugetlb>[,prefault][,numa] : back the guest memory "
+        "with demand paged host memory (default), transparent huge pages or "
+        "hugetlbfs pages (prefault: populate it up front; numa: place it on "
+        "the NUMA node of the emulator)\n"
+#if !defined(__EMSCRIPTEN__)
+        "  -w <marker> : take the snapshot point once the guest prints "
+        "<marker>\n"
+        "  -S <file> : save the machine to <file> at the snapshot point and "
+        "exit\n"
+        "  -R <file> : restore the machine from <file>, the snapshot point\n"
+        "  -F <list> : from the snapshot point, run each test input listed in "
+        "<list> as stdin of a fresh copy of the machine\n"
+#endif
+#if RV32_HAS(JIT)
+        "  -c <dir> : keep a persistent JIT code cache in <dir>\n"
+        "  -j <MiB> : size of the JIT code cache (1-64, default 4)\n"
+#endif
         "  -h : show this message",
         filename);
 }
 
+/* parse the <backend>[,prefault][,numa] argument of -M */
+static bool parse_mem_opts(const char *spec)
+{
+    static const char *const backends[] = {
+        [MEMORY_PAGED] = "paged",
+        [MEMORY_THP] = "thp",
+        [MEMORY_HUGETLB] = "hugetlb",
+    };
+
+    memset(&opt_mem, 0, sizeof(opt_mem));
+    for (bool first = true; *spec; first = false) {
+        size_t len = strcspn(spec, ",");
+        bool known = false;
+        if (first) {
+            for (size_t i = 0; i < ARRAY_SIZE(backends); i++) {
+                if (strlen(backends[i]) == len &&
+                    !strncmp(spec, backends[i], len)) {
+                    opt_mem.backend = i;
+                    known = true;
+                }
+            }
+        } else if (len == 8 && !strncmp(spec, "prefault", len)) {
+            opt_mem.prefault = known = true;
+        } else if (len == 4 && !strncmp(spec, "numa", len)) {
+            opt_mem.numa = known = true;
+        }
+        if (!known) {
+            rv_log_error("Invalid memory option: %.*s", (int) len, spec);
+            return false;
+        }
+        spec += len + (spec[len] == ',');
+    }
+    return true;
+}
+
 static bool parse_args(int argc, char **args)
 {
     int opt;
@@ -211,6 +305,62 @@ static bool parse_args(int argc, char **args)
         case 'p':
             opt_prof_data = true;
             break;
+        case 's':
+            opt_stats = true;
+            break;
+#if RV32_HAS(JIT)
+        case 'c':
+            opt_jit_cache_dir = optarg;
+            emu_argc++;
+            break;
+        case 'j': {
+            char *end;
+            unsigned long mib = strtoul(optarg, &end, 10);
+            if (*end || mib < 1 || mib > 64) {
+                rv_log_error("Invalid JIT code cache size: %s MiB", optarg);
+                return false;
+            }
+            opt_jit_cache_mib = mib;
+            emu_argc++;
+            break;
+        }
+#endif
+#if RV32_HAS(SYSTEM_MMIO)
+        case 'n': {
+            char *end;
+            unsigned long harts = strtoul(optarg, &end, 10);
+            if (*end || harts < 1 || harts > RV_MAX_HARTS) {
+                rv_log_error("Invalid number of harts: %s", optarg);
+                return false;
+            }
+            opt_harts = harts;
+            emu_argc++;
+            break;
+        }
+#endif
+        case 'M':
+            if (!parse_mem_opts(optarg))
+                return false;
+            emu_argc++;
+            break;
+#if !defined(__EMSCRIPTEN__)
+        case 'w':
+            opt_snapshot_marker = optarg;
+            emu_argc++;
+            break;
+        case 'S':
+            opt_snapshot_file = optarg;
+            emu_argc++;
+            break;
+        case 'R':
+            opt_restore_file = optarg;
+            emu_argc++;
+            break;
+        case 'F':
+            opt_fork_list = optarg;
+            emu_argc++;
+            break;
+#endif
         case 'd':
             opt_dump_regs = true;
             registers_out_file = optarg;
@@ -226,6 +376,22 @@ static bool parse_args(int argc, char **args)
         }
     }
 
+#if !defined(__EMSCRIPTEN__)
+    if (opt_snapshot_marker && opt_restore_file) {
+        rv_log_error("-w and -R are mutually exclusive");
+        return false;
+    }
+    if ((opt_snapshot_file || opt_fork_list) && !opt_snapshot_marker &&
+        !opt_restore_file) {
+        rv_log_error("-S and -F need a snapshot point (-w or -R)");
+        return false;
+    }
+    if (opt_snapshot_file && opt_fork_list) {
+        rv_log_error("-S and -F are mutually exclusive");
+        return false;
+    }
+#endif
+
     prog_argc = argc - emu_argc - 1;
     /* optind points to the first non-option string, so it should indicate the
      * target program.
@@ -264,7 +430,8 @@ static bool parse_args(int argc, char **args)
     return true;
 }
 
-static void dump_test_signature(const char UNUSED *prog_name)
+static void dump_test_signature(const memory_t *mem,
+                                const char UNUSED *prog_name)
 {
     elf_t *elf = elf_new();
     assert(elf && elf_open(elf, prog_name));
@@ -289,7 +456,7 @@ static void dump_test_signature(const char UNUSED *prog_name)
 
     /* dump it word by word */
     for (uint32_t addr = start; addr < end; addr += 4)
-        fprintf(f, "%08x\n", memory_read_w(addr));
+        fprintf(f, "%08x\n", memory_read_w(mem, addr));
 
     fclose(f);
     elf_delete(elf);
@@ -312,11 +479,11 @@ static void dump_test_signature(const char UNUSED *prog_name)
 
 /* To use rv_halt function in wasm, we have to expose RISC-V instance(rv),
  * but we can add a layer to not expose the instance and make rv_halt
- * callable. A small trade-off is that declaring instance as a global
+ * callable. A small trade-off is that declaring instance as a file-scope
  * variable. rv_halt is useful when cancelling the main loop of wasm,
  * see rv_step in emulate.c for more detail
  */
-riscv_t *rv;
+static riscv_t *rv;
 #ifdef __EMSCRIPTEN__
 static bool rv_stop_requested;
 
@@ -368,6 +535,7 @@ int main(int argc, char **args)
     run_flag |= opt_gdbstub << 1;
 #endif
     run_flag |= opt_prof_data << 2;
+    run_flag |= opt_stats << 3;
 
     vm_attr_t attr = {
         .mem_size = MEM_SIZE,
@@ -384,11 +552,23 @@ int main(int argc, char **args)
         .fd_stdout = STDOUT_FILENO,
         .fd_stderr = STDERR_FILENO,
     };
+    attr.mem_opts = opt_mem;
+#if !defined(__EMSCRIPTEN__)
+    attr.snapshot_marker = opt_snapshot_marker;
+    attr.snapshot_file = opt_snapshot_file;
+    attr.restore_file = opt_restore_file;
+    attr.fork_list = opt_fork_list;
+#endif
+#if RV32_HAS(JIT)
+    attr.jit_cache_dir = opt_jit_cache_dir;
+    attr.jit_cache_size = opt_jit_cache_mib << 20;
+#endif
 #if RV32_HAS(SYSTEM_MMIO)
     attr.data.system.kernel = opt_kernel_img;
     attr.data.system.initrd = opt_rootfs_img;
     attr.data.system.bootargs = opt_bootargs;
     attr.data.system.vrng_enabled = opt_virtio_rng;
+    attr.n_harts = opt_harts;
     if (opt_virtio_blk_idx) {
         attr.data.system.vblk_device = opt_virtio_blk_img;
         attr.data.system.vblk_device_cnt = opt_virtio_blk_idx;
@@ -443,16 +623,13 @@ int main(int argc, char **args)
 
     /* dump test result in test mode */
     if (opt_arch_test)
-        dump_test_signature(opt_prog_name);
+        dump_test_signature(attr.mem, opt_prog_name);
+
+    uint64_t mem_usage = memory_get_usage(attr.mem);
 
     /* finalize the RISC-V runtime */
     rv_delete(rv);
-    /*
-     * Other translation units cannot update the pointer, update it here
-     * to prevent multiple atexit()'s callback be called.
-     */
     rv = NULL;
-    uint64_t mem_usage = memory_get_usage();
     rv_log_info("Peak memory usage: %" PRIu64 " KB (%" PRIu64 " MB)",
                 mem_usage / 1024, mem_usage / (1024 * 1024));
     rv_log_info("RISC-V emulator is destroyed");
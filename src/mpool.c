@@ -17,13 +17,13 @@
 #include "feature.h"
 #include "mpool.h"
 
-/* T2C runs a worker thread that calls mpool_free on the same pools the
- * main thread allocates from (block_mp / block_ir_mp / fuse_mp). The
- * freelist is unsynchronized internally, so without a guard the worker's
- * free can hand the same chunk out twice on the next main-thread alloc,
- * which later surfaces as `free(): corrupted unsorted chunks` on the libc
- * heap once a double-freed ir->branch_table is released. Gate the mutex on
- * T2C so non-threaded builds keep the original lock-free fast path.
+/* T2C runs a worker thread that calls mpool_free on the same pool the main
+ * thread allocates from (block_mp). The freelist is unsynchronized
+ * internally, so without a guard the worker's free can hand the same chunk
+ * out twice on the next main-thread alloc, which later surfaces as
+ * `free(): corrupted unsorted chunks` on the libc heap once the IRs of the
+ * double-freed block are released. Gate the mutex on T2C so non-threaded
+ * builds keep the original lock-free fast path.
  */
 #if RV32_HAS(T2C)
 #include <pthread.h>
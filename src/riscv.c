@@ -11,8 +11,13 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#if !defined(__EMSCRIPTEN__)
+#include <sys/wait.h>
+#endif
 
 #if RV32_HAS(SYSTEM_MMIO)
+#include <pthread.h>
+#include <sched.h>
 #include <termios.h>
 #include "dtc/libfdt/libfdt.h"
 #endif
@@ -35,6 +40,7 @@
 #include "mpool.h"
 #include "riscv.h"
 #include "riscv_private.h"
+#include "snapshot.h"
 #include "utils.h"
 #if RV32_HAS(JIT)
 #if RV32_HAS(T2C)
@@ -45,14 +51,13 @@
 #define CODE_CACHE_SIZE (4 * 1024 * 1024)
 #endif
 
-#define BLOCK_IR_MAP_CAPACITY_BITS 10
-
 #if !RV32_HAS(JIT)
 /* initialize the block map */
 static void block_map_init(block_map_t *map, const uint8_t bits)
 {
     map->block_capacity = 1 << bits;
     map->size = 0;
+    map->hand = 0;
     map->map = calloc(map->block_capacity, sizeof(struct block *));
     assert(map->map);
 }
@@ -66,16 +71,7 @@ void block_map_clear(riscv_t *rv)
         if (!block)
             continue;
 
-        uint32_t idx;
-        rv_insn_t *ir, *next;
-        for (idx = 0, ir = block->ir_head; idx < block->n_insn;
-             idx++, ir = next) {
-            if (ir->fuse)
-                mpool_free(rv->fuse_mp, ir->fuse);
-            free(ir->branch_table);
-            next = ir->next;
-            mpool_free(rv->block_ir_mp, ir);
-        }
+        free(block->ir_head);
         mpool_free(rv->block_mp, block);
         map->map[i] = NULL;
     }
@@ -88,6 +84,14 @@ void block_map_clear(riscv_t *rv)
     for (int i = 0; i < BLOCK_L1_SIZE; i++)
         rv->block_l1.tags[i] = BLOCK_L1_INVALID_TAG;
     memset(rv->block_l1.ptrs, 0, sizeof(rv->block_l1.ptrs));
+    ras_forget(rv);
+
+#if RV32_HAS(SYSTEM)
+    /* no page holds translated code anymore */
+    memset(rv->code_pages, 0, rv->code_words * sizeof(uint32_t));
+    memset(rv->stale_pages, 0, rv->code_words * sizeof(uint32_t));
+    rv->code_stale = false;
+#endif
 }
 
 static void block_map_destroy(riscv_t *rv)
@@ -96,8 +100,6 @@ static void block_map_destroy(riscv_t *rv)
     free(rv->block_map.map);
 
     mpool_destroy(rv->block_mp);
-    mpool_destroy(rv->block_ir_mp);
-    mpool_destroy(rv->fuse_mp);
 }
 #endif
 
@@ -150,7 +152,7 @@ void rv_remap_stdstream(riscv_t *rv, fd_stream_pair_t *fsp, uint32_t fsp_size)
     assert(rv);
 
     vm_attr_t *attr = PRIV(rv);
-    assert(attr && attr->fd_map);
+    assert(attr && attr->fd_table);
 
     for (uint32_t i = 0; i < fsp_size; i++) {
         int fd = fsp[i].fd;
@@ -161,16 +163,10 @@ void rv_remap_stdstream(riscv_t *rv, fd_stream_pair_t *fsp, uint32_t fsp_size)
         if (fd != STDIN_FILENO && fd != STDOUT_FILENO && fd != STDERR_FILENO)
             continue;
 
-        /* check if standard stream refered by fd exists or not */
-        map_iter_t it;
-        map_find(attr->fd_map, &it, &fd);
-        if (it.node) /* found, remove first */
-            map_erase(attr->fd_map, &it);
-        map_insert(attr->fd_map, &fd, &file);
-
         /* store new fd to make the vm_attr_t consistent */
         int new_fd = FILENO(file);
         assert(new_fd != -1);
+        attr->fd_table[fd] = new_fd;
 
         if (fd == STDIN_FILENO)
             attr->fd_stdin = new_fd;
@@ -183,15 +179,14 @@ void rv_remap_stdstream(riscv_t *rv, fd_stream_pair_t *fsp, uint32_t fsp_size)
 }
 
 #define MEMIO(op) on_mem_##op
-#define IO_HANDLER_IMPL(type, op, RW)                                  \
-    static IIF(RW)(                                                    \
-        /* W */ void MEMIO(op)(UNUSED riscv_t * rv, riscv_word_t addr, \
-                               riscv_##type##_t data),                 \
-        /* R */ riscv_##type##_t MEMIO(op)(UNUSED riscv_t * rv,        \
-                                           riscv_word_t addr))         \
-    {                                                                  \
-        IIF(RW)(memory_##op(addr, (uint8_t *) &data),                  \
-                return memory_##op(addr));                             \
+#define IO_HANDLER_IMPL(type, op, RW)                                        \
+    static IIF(RW)(                                                          \
+        /* W */ void MEMIO(op)(riscv_t * rv, riscv_word_t addr,              \
+                               riscv_##type##_t data),                       \
+        /* R */ riscv_##type##_t MEMIO(op)(riscv_t * rv, riscv_word_t addr)) \
+    {                                                                        \
+        IIF(RW)(memory_##op(PRIV(rv)->mem, addr, (uint8_t *) &data),         \
+                return memory_##op(PRIV(rv)->mem, addr));                    \
     }
 
 #if !RV32_HAS(SYSTEM)
@@ -212,67 +207,215 @@ IO_HANDLER_IMPL(byte, write_b, W)
 #endif
 
 #if RV32_HAS(T2C)
-static pthread_t t2c_thread;
+/* Number of compile workers; 0 selects one per online CPU, clamped to
+ * [1, T2C_MAX_WORKERS].
+ */
+#ifndef CONFIG_T2C_WORKERS
+#define CONFIG_T2C_WORKERS 0
+#endif
+static_assert(CONFIG_T2C_WORKERS >= 0 && CONFIG_T2C_WORKERS <= T2C_MAX_WORKERS,
+              "T2C worker count must be 0-T2C_MAX_WORKERS");
+
+static uint32_t t2c_worker_count(void)
+{
+    long n = CONFIG_T2C_WORKERS;
+    if (!n) {
+#if defined(_SC_NPROCESSORS_ONLN)
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        if (n < 1)
+            n = 1;
+        if (n > T2C_MAX_WORKERS)
+            n = T2C_MAX_WORKERS;
+    }
+    return (uint32_t) n;
+}
+
+/* The wait queue is a binary max-heap on prio, so the hottest pending block is
+ * compiled first no matter when it was requested. All heap operations run
+ * with wait_queue_lock held.
+ */
+static void t2c_queue_sift_up(t2c_request_t *heap, uint32_t i)
+{
+    t2c_request_t req = heap[i];
+    while (i) {
+        uint32_t parent = (i - 1) / 2;
+        if (heap[parent].prio >= req.prio)
+            break;
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = req;
+}
+
+static void t2c_queue_sift_down(t2c_request_t *heap, uint32_t len, uint32_t i)
+{
+    t2c_request_t req = heap[i];
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= len)
+            break;
+        if (child + 1 < len && heap[child + 1].prio > heap[child].prio)
+            child++;
+        if (req.prio >= heap[child].prio)
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = req;
+}
+
+bool t2c_enqueue(riscv_t *rv, uint64_t key, uint32_t prio)
+{
+    bool queued = true;
+    pthread_mutex_lock(&rv->wait_queue_lock);
+
+    /* A key can be requested again once its block has been evicted and
+     * retranslated, or to promote a request that kept getting hotter while it
+     * waited. Either way the pending entry is reused, so a key is never
+     * compiled twice for one request. The queue only ever holds blocks past
+     * THRESHOLD that are still waiting for a worker, so a linear probe stays
+     * cheap.
+     */
+    for (uint32_t i = 0; i < rv->wait_queue_len; i++) {
+        if (rv->wait_queue[i].key != key)
+            continue;
+        if (prio > rv->wait_queue[i].prio) {
+            rv->wait_queue[i].prio = prio;
+            t2c_queue_sift_up(rv->wait_queue, i);
+        }
+        goto out;
+    }
+
+    if (rv->wait_queue_len == rv->wait_queue_cap) {
+        uint32_t cap = rv->wait_queue_cap ? rv->wait_queue_cap * 2 : 64;
+        t2c_request_t *heap =
+            realloc(rv->wait_queue, cap * sizeof(t2c_request_t));
+        if (unlikely(!heap)) {
+            queued = false;
+            goto out;
+        }
+        rv->wait_queue = heap;
+        rv->wait_queue_cap = cap;
+    }
+    rv->wait_queue[rv->wait_queue_len] =
+        (t2c_request_t){key, prio, rv_stats_now()};
+    t2c_queue_sift_up(rv->wait_queue, rv->wait_queue_len++);
+    if (rv->wait_queue_len > rv->stats.queue_peak)
+        rv->stats.queue_peak = rv->wait_queue_len;
+    pthread_cond_signal(&rv->wait_queue_cond);
+
+out:
+    pthread_mutex_unlock(&rv->wait_queue_lock);
+    return queued;
+}
+
 static void *t2c_runloop(void *arg)
 {
-    riscv_t *rv = (riscv_t *) arg;
+    t2c_worker_t *worker = (t2c_worker_t *) arg;
+    riscv_t *rv = worker->rv;
     pthread_mutex_lock(&rv->wait_queue_lock);
     while (!rv->quit) {
         /* Wait for work or quit signal */
-        while (list_empty(&rv->wait_queue) && !rv->quit)
+        while (!rv->wait_queue_len && !rv->quit)
             pthread_cond_wait(&rv->wait_queue_cond, &rv->wait_queue_lock);
 
         if (rv->quit)
             break;
 
-        /* Extract work item while holding the lock */
-        queue_entry_t *entry =
-            list_last_entry(&rv->wait_queue, queue_entry_t, list);
-        list_del_init(&entry->list);
+        /* Extract the hottest request while holding the lock */
+        uint64_t key = rv->wait_queue[0].key;
+        rv_stats_hist_add(&rv->stats.t2c_queue_delay,
+                          rv_stats_now() - rv->wait_queue[0].enqueued_ns);
+        rv->wait_queue[0] = rv->wait_queue[--rv->wait_queue_len];
+        if (rv->wait_queue_len)
+            t2c_queue_sift_down(rv->wait_queue, rv->wait_queue_len, 0);
         pthread_mutex_unlock(&rv->wait_queue_lock);
 
-        /* Perform compilation with minimal lock contention.
-         *
-         * Lock strategy: Hold cache_lock only when accessing shared data:
-         * 1. Initial lookup and validation (short)
-         * 2. Final jit_cache update (short)
-         *
-         * The expensive LLVM compilation runs without holding cache_lock,
-         * allowing SFENCE.VMA/FENCE.I to proceed with minimal latency.
-         * If the block is invalidated during compilation, we detect this
-         * via the invalidated flag and discard the compiled result.
+        /* Compile without ever blocking the hart. The hart may evict or
+         * invalidate the block at any time, but it frees neither the block
+         * nor the blocks chained to it while the worker is inside the block
+         * cache, and it ignores the T2C code of blocks it dropped.
          */
-        pthread_mutex_lock(&rv->cache_lock);
+        const uint32_t reader = worker - rv->t2c_workers;
+        cache_read_lock(rv->block_cache, reader);
         /* Look up block from cache using the key (might have been evicted) */
-        uint32_t pc = (uint32_t) entry->key;
+        uint32_t pc = (uint32_t) key;
         block_t *block = (block_t *) cache_get(rv->block_cache, pc, false);
 #if RV32_HAS(SYSTEM)
         /* Verify SATP matches (for system mode) */
-        uint32_t satp = (uint32_t) (entry->key >> 32);
+        uint32_t satp = (uint32_t) (key >> 32);
         if (block && block->satp != satp)
             block = NULL;
 #endif
-        /* Compile only if block still exists in cache */
-        if (block)
-            t2c_compile(rv, block, &rv->cache_lock);
+        /* Compile only if block still exists in cache and no other worker
+         * picked it up through an earlier request for the same key.
+         */
+        if (block && !ATOMIC_EXCHANGE(&block->claimed, true, ATOMIC_RELAXED))
+            t2c_compile(rv, block, worker->llvm_ctx, reader);
         else
-            pthread_mutex_unlock(&rv->cache_lock);
-        free(entry);
+            cache_read_unlock(rv->block_cache, reader);
 
         pthread_mutex_lock(&rv->wait_queue_lock);
     }
     pthread_mutex_unlock(&rv->wait_queue_lock);
     return NULL;
 }
+
+/* Start a thread for each T2C worker, whose LLVM context is in place. Should
+ * a thread fail to start, the workers from there on are dropped. Also used
+ * in a forked process, which has none of the threads of its parent.
+ */
+static void t2c_workers_start(riscv_t *rv)
+{
+    /* Use larger stack (8MB) to handle deep recursion in t2c_trace_ebb
+     * and LLVM's internal stack usage during compilation.
+     */
+    pthread_attr_t t2c_attr;
+    pthread_attr_init(&t2c_attr);
+    pthread_attr_setstacksize(&t2c_attr, 8 * 1024 * 1024); /* 8MB stack */
+    rv->quit = false;
+    for (uint32_t i = 0; i < rv->n_t2c_workers; i++) {
+        t2c_worker_t *worker = &rv->t2c_workers[i];
+        if (pthread_create(&worker->thread, &t2c_attr, t2c_runloop, worker)) {
+            for (uint32_t j = i; j < rv->n_t2c_workers; j++)
+                t2c_context_dispose(rv->t2c_workers[j].llvm_ctx);
+            rv->n_t2c_workers = i;
+            break;
+        }
+    }
+    pthread_attr_destroy(&t2c_attr);
+}
+
+/* Stop the T2C worker threads, if running. The pending requests and the LLVM
+ * contexts stay for t2c_workers_start().
+ */
+static void t2c_workers_stop(riscv_t *rv)
+{
+    pthread_mutex_lock(&rv->wait_queue_lock);
+    bool running = !rv->quit;
+    rv->quit = true;
+    pthread_cond_broadcast(&rv->wait_queue_cond);
+    pthread_mutex_unlock(&rv->wait_queue_lock);
+
+    if (!running)
+        return;
+    for (uint32_t i = 0; i < rv->n_t2c_workers; i++)
+        pthread_join(rv->t2c_workers[i].thread, NULL);
+}
 #endif
 
 #if RV32_HAS(SYSTEM_MMIO)
-/* Map a file into memory at the specified location.
+/* Map a file into guest memory at @addr, copy-on-write where memory_load_file()
+ * can, so that large images neither take time to copy nor memory of their own.
  * If max_size > 0, validates that file size does not exceed max_size.
  * Returns the actual file size on success, or -1 when file exceeds max_size
  * (caller handles the error message). Other errors cause program exit.
  */
-static off_t map_file(char **ram_loc, const char *name, off_t max_size)
+static off_t map_file(memory_t *mem,
+                      uint32_t addr,
+                      const char *name,
+                      off_t max_size)
 {
     int fd = open(name, O_RDONLY);
     if (fd < 0)
@@ -289,26 +432,9 @@ static off_t map_file(char **ram_loc, const char *name, off_t max_size)
         return -1; /* Caller handles the error message */
     }
 
-#if HAVE_MMAP
-    /* Remap file to memory region. Emscripten/Windows use fallback read path
-     * since they don't support mmap with location hints.
-     */
-    *ram_loc = mmap(*ram_loc, st.st_size, PROT_READ | PROT_WRITE,
-                    MAP_FIXED | MAP_PRIVATE, fd, 0);
-    if (*ram_loc == MAP_FAILED)
-        goto cleanup;
-#else
-    if (read(fd, *ram_loc, st.st_size) != st.st_size) {
-        free(*ram_loc);
+    if (!memory_load_file(mem, addr, fd, 0, st.st_size))
         goto cleanup;
-    }
-#endif
 
-    /*
-     * The kernel selects a nearby page boundary and attempts to create
-     * the mapping.
-     */
-    *ram_loc += st.st_size;
     close(fd);
     return st.st_size;
 
@@ -343,6 +469,68 @@ static char *realloc_property(char *fdt,
     return fdt;
 }
 
+/* Describe harts 1 to n_harts - 1 next to cpu@0 of the minimal DTB, and route
+ * the S-mode PLIC context of every hart to its local interrupt controller.
+ */
+static void dtb_add_harts(void *dtb, uint32_t n_harts)
+{
+    int cpus = fdt_path_offset(dtb, "/cpus");
+    assert(cpus >= 0);
+    int cpu0 = fdt_subnode_offset(dtb, cpus, "cpu@0");
+    assert(cpu0 >= 0);
+    int intc0 = fdt_subnode_offset(dtb, cpu0, "interrupt-controller");
+    assert(intc0 >= 0);
+
+    /* copy out before the blob gets reshuffled by the new nodes */
+    char isa[64], mmu[32];
+    const char *prop = fdt_getprop(dtb, cpu0, "riscv,isa", NULL);
+    assert(prop);
+    snprintf(isa, sizeof(isa), "%s", prop);
+    prop = fdt_getprop(dtb, cpu0, "mmu-type", NULL);
+    assert(prop);
+    snprintf(mmu, sizeof(mmu), "%s", prop);
+
+    uint32_t intc_phandle[RV_MAX_HARTS];
+    intc_phandle[0] = fdt_get_phandle(dtb, intc0);
+    assert(intc_phandle[0]);
+
+    /* fdt_add_subnode() prepends, so go backwards to keep the ids ascending */
+    for (uint32_t i = n_harts - 1; i > 0; i--) {
+        char node_name[16];
+        snprintf(node_name, sizeof(node_name), "cpu@%x", i);
+
+        int cpu =
+            fdt_add_subnode(dtb, fdt_path_offset(dtb, "/cpus"), node_name);
+        assert(cpu >= 0);
+        assert(fdt_setprop_string(dtb, cpu, "device_type", "cpu") == 0);
+        assert(fdt_setprop_u32(dtb, cpu, "reg", i) == 0);
+        assert(fdt_setprop_string(dtb, cpu, "compatible", "riscv") == 0);
+        assert(fdt_setprop_string(dtb, cpu, "riscv,isa", isa) == 0);
+        assert(fdt_setprop_string(dtb, cpu, "mmu-type", mmu) == 0);
+
+        int intc = fdt_add_subnode(dtb, cpu, "interrupt-controller");
+        assert(intc >= 0);
+        assert(fdt_setprop_u32(dtb, intc, "#interrupt-cells", 1) == 0);
+        assert(fdt_setprop_u32(dtb, intc, "#address-cells", 0) == 0);
+        assert(fdt_setprop_empty(dtb, intc, "interrupt-controller") == 0);
+        assert(fdt_setprop_string(dtb, intc, "compatible",
+                                  "riscv,cpu-intc") == 0);
+        assert(fdt_generate_phandle(dtb, &intc_phandle[i]) == 0);
+        assert(fdt_setprop_u32(dtb, intc, "phandle", intc_phandle[i]) == 0);
+    }
+
+    /* interrupts-extended = <&intcN 9 ...>, 9 being the S-mode external IRQ */
+    uint32_t irqs[2 * RV_MAX_HARTS];
+    for (uint32_t i = 0; i < n_harts; i++) {
+        irqs[2 * i] = cpu_to_fdt32(intc_phandle[i]);
+        irqs[2 * i + 1] = cpu_to_fdt32(9);
+    }
+    int plic = fdt_path_offset(dtb, "/soc@F0000000/interrupt-controller@0");
+    assert(plic >= 0);
+    assert(fdt_setprop(dtb, plic, "interrupts-extended", irqs,
+                       2 * n_harts * sizeof(uint32_t)) == 0);
+}
+
 static void load_dtb(char **ram_loc, vm_attr_t *attr)
 {
 #include "minimal_dtb.h"
@@ -356,14 +544,17 @@ static void load_dtb(char **ram_loc, vm_attr_t *attr)
     int totalsize;
 
 #define DTB_EXPAND_SIZE 1024 /* or more if needed */
+#define DTB_HART_SIZE 512    /* a cpu node and its interrupt controller */
 
     /* Allocate enough memory for DTB + extra room */
     size_t minimal_len = ARRAY_SIZE(minimal);
-    void *dtb_buf = calloc(minimal_len + DTB_EXPAND_SIZE, sizeof(uint8_t));
+    size_t dtb_len =
+        minimal_len + DTB_EXPAND_SIZE + attr->n_harts * DTB_HART_SIZE;
+    void *dtb_buf = calloc(dtb_len, sizeof(uint8_t));
     assert(dtb_buf);
 
     /* Expand it to a usable DTB blob */
-    err = fdt_open_into(minimal, dtb_buf, minimal_len + DTB_EXPAND_SIZE);
+    err = fdt_open_into(minimal, dtb_buf, dtb_len);
     if (err < 0) {
         rv_log_error("fdt_open_into fails\n");
         exit(EXIT_FAILURE);
@@ -387,6 +578,9 @@ static void load_dtb(char **ram_loc, vm_attr_t *attr)
         assert(!err);
     }
 
+    if (attr->n_harts > 1)
+        dtb_add_harts(dtb_buf, attr->n_harts);
+
 /* Remove the rtc node if it is not enabled during compile time */
 #if !RV32_HAS(GOLDFISH_RTC)
     const char *rtc_path = fdt_get_alias(dtb_buf, "rtc0");
@@ -505,7 +699,7 @@ static void load_dtb(char **ram_loc, vm_attr_t *attr)
     }
 
 dtb_end:
-    memcpy(blob, dtb_buf, minimal_len + DTB_EXPAND_SIZE);
+    memcpy(blob, dtb_buf, dtb_len);
     free(dtb_buf);
 
     totalsize = fdt_totalsize(blob);
@@ -556,14 +750,16 @@ static void capture_keyboard_input()
  *
  * atexit() registers void (*)(void) callbacks, so no parameters can be passed.
  * Memory must be freed at runtime. block_map_clear() requires a RISC-V instance
- * and runs in interpreter mode. Instead of modifying its signature, access the
- * global RISC-V instance in main.c with external linkage.
+ * and runs in interpreter mode. System emulation owns the terminal and the
+ * block devices, so there is a single machine per process, recorded here by
+ * rv_create() and forgotten by rv_delete().
  *
  */
-extern riscv_t *rv;
+static riscv_t *machine;
 static void rv_async_block_clear()
 {
 #if !RV32_HAS(JIT)
+    riscv_t *rv = machine;
     if (rv && rv->block_map.size)
         block_map_clear(rv);
 #else  /* TODO: JIT mode */
@@ -573,6 +769,7 @@ static void rv_async_block_clear()
 
 static void rv_fsync_device()
 {
+    riscv_t *rv = machine;
     if (!rv)
         return;
 
@@ -621,6 +818,421 @@ static void rv_fsync_device()
 }
 #endif /* RV32_HAS(SYSTEM_MMIO) */
 
+#if RV32_HAS(JIT)
+static void free_block_irs(void *block)
+{
+    assert(block);
+    free(((block_t *) block)->ir_head);
+}
+#endif
+
+/* Set up the translation state private to a hart: the block memory pool, then
+ * the block map, or the code caches of the JIT tiers.
+ */
+static bool rv_exec_init(riscv_t *rv)
+{
+    vm_attr_t UNUSED *attr = PRIV(rv);
+
+    /* create block memory pool, blocks allocate their IRs themselves */
+    rv->block_mp = mpool_create(sizeof(block_t) << BLOCK_MAP_CAPACITY_BITS,
+                                sizeof(block_t));
+    if (!rv->block_mp) {
+        rv_log_fatal("Failed to create memory pool");
+        goto fail_mpool;
+    }
+    rv->ir_buf = NULL;
+    rv->fuse_buf = NULL;
+    rv->ir_buf_cap = 0;
+#if RV32_HAS(SYSTEM)
+    if (!mmu_code_init(rv)) {
+        rv_log_fatal("Failed to allocate the code page bitmaps");
+        goto fail_mpool;
+    }
+#endif
+
+#if !RV32_HAS(JIT)
+    /* initialize the block map */
+    block_map_init(&rv->block_map, BLOCK_MAP_CAPACITY_BITS);
+
+    /* initialize L1 block cache with invalid tags */
+    for (int i = 0; i < BLOCK_L1_SIZE; i++)
+        rv->block_l1.tags[i] = BLOCK_L1_INVALID_TAG;
+    memset(rv->block_l1.ptrs, 0, sizeof(rv->block_l1.ptrs));
+#else
+    INIT_LIST_HEAD(&rv->block_list);
+    rv->jit_state = jit_state_init(
+        attr->jit_cache_size ? attr->jit_cache_size : CODE_CACHE_SIZE);
+    if (!rv->jit_state) {
+        rv_log_fatal("Failed to initialize JIT state");
+        goto fail_jit_state;
+    }
+    rv->block_cache = cache_create(BLOCK_MAP_CAPACITY_BITS);
+    if (!rv->block_cache) {
+        rv_log_fatal("Failed to create block cache");
+        goto fail_block_cache;
+    }
+#if RV32_HAS(T2C)
+    rv->quit = false;
+    rv->jit_cache = jit_cache_init();
+    if (!rv->jit_cache) {
+        rv_log_fatal("Failed to initialize JIT cache");
+        goto fail_jit_cache;
+    }
+    rv->inline_cache = inline_cache_init();
+    if (!rv->inline_cache) {
+        rv_log_fatal("Failed to initialize inline cache");
+        goto fail_inline_cache;
+    }
+    /* prepare wait queue. */
+    pthread_mutex_init(&rv->wait_queue_lock, NULL);
+    pthread_cond_init(&rv->wait_queue_cond, NULL);
+    rv->wait_queue = NULL;
+    rv->wait_queue_len = rv->wait_queue_cap = 0;
+    rv->loop_budget = LOOP_BUDGET;
+    /* Activate the background compilation workers, each one a reader of the
+     * block cache
+     */
+    rv->n_t2c_workers = t2c_worker_count();
+    rv->t2c_workers = calloc(rv->n_t2c_workers, sizeof(t2c_worker_t));
+    if (!rv->t2c_workers ||
+        !cache_set_readers(rv->block_cache, rv->n_t2c_workers))
+        rv->n_t2c_workers = 0;
+    for (uint32_t i = 0; i < rv->n_t2c_workers; i++) {
+        rv->t2c_workers[i].rv = rv;
+        rv->t2c_workers[i].llvm_ctx = t2c_context_create();
+    }
+    t2c_workers_start(rv);
+    if (!rv->n_t2c_workers)
+        rv_log_warn("Failed to start T2C workers, staying on tier-1");
+#endif
+#endif
+
+    return true;
+
+#if RV32_HAS(JIT)
+#if RV32_HAS(T2C)
+fail_inline_cache:
+    jit_cache_exit(rv->jit_cache);
+fail_jit_cache:
+    cache_free(rv->block_cache);
+#endif
+fail_block_cache:
+    if (rv->jit_state)
+        jit_state_exit(rv->jit_state);
+fail_jit_state:
+#endif
+fail_mpool:
+#if RV32_HAS(SYSTEM)
+    mmu_code_exit(rv);
+#endif
+    mpool_destroy(rv->block_mp);
+    return false;
+}
+
+/* Tear down what rv_exec_init() set up */
+static void rv_exec_exit(riscv_t *rv)
+{
+#if !RV32_HAS(JIT)
+    block_map_destroy(rv);
+#else
+#if RV32_HAS(T2C)
+    t2c_workers_stop(rv);
+
+    /* Drop any requests still pending in wait queue */
+    free(rv->wait_queue);
+
+    pthread_mutex_destroy(&rv->wait_queue_lock);
+    pthread_cond_destroy(&rv->wait_queue_cond);
+    jit_cache_exit(rv->jit_cache);
+    inline_cache_exit(rv->inline_cache);
+
+    /* Free the evicted blocks the workers could still have been using, then
+     * dispose LLVM engines for all remaining blocks before freeing cache.
+     */
+    rv_reclaim_blocks(rv);
+    clear_cache_hot(rv->block_cache, t2c_dispose_block_engine);
+    /* Contexts go last: every engine above was built inside one of them */
+    for (uint32_t i = 0; i < rv->n_t2c_workers; i++)
+        t2c_context_dispose(rv->t2c_workers[i].llvm_ctx);
+    free(rv->t2c_workers);
+#endif
+    /* Free the IRs of all remaining blocks before freeing cache */
+    clear_cache_hot(rv->block_cache, free_block_irs);
+    jit_state_exit(rv->jit_state);
+    cache_free(rv->block_cache);
+    mpool_destroy(rv->block_mp);
+#endif
+    free(rv->ir_buf);
+    free(rv->fuse_buf);
+#if RV32_HAS(SYSTEM)
+    mmu_code_exit(rv);
+#endif
+}
+
+#if RV32_HAS(SYSTEM_MMIO)
+/* Set up the pipe other threads wake the hart in WFI with. Without it, WFI
+ * does not sleep.
+ */
+static void hart_wake_init(riscv_t *rv)
+{
+    rv->wake_fd[0] = rv->wake_fd[1] = -1;
+#if !defined(__EMSCRIPTEN__)
+    if (pipe(rv->wake_fd) == -1) {
+        rv_log_warn("Failed to create the WFI wakeup pipe: %s",
+                    strerror(errno));
+        rv->wake_fd[0] = rv->wake_fd[1] = -1;
+        return;
+    }
+    fcntl(rv->wake_fd[0], F_SETFL, O_NONBLOCK);
+    fcntl(rv->wake_fd[1], F_SETFL, O_NONBLOCK);
+#endif
+}
+
+static void hart_wake_exit(riscv_t *rv)
+{
+    if (rv->wake_fd[0] >= 0) {
+        close(rv->wake_fd[0]);
+        close(rv->wake_fd[1]);
+    }
+}
+
+/* Create secondary hart @id of the machine booted by @rv. It shares the guest
+ * memory and the devices with the boot hart, but has its own registers, CSRs,
+ * TLBs and translated code, and it stays stopped until SBI HSM starts it.
+ */
+static riscv_t *hart_new(riscv_t *rv, uint32_t id)
+{
+    riscv_t *hart = calloc(1, sizeof(riscv_t));
+    if (!hart)
+        return NULL;
+
+    hart->data = rv->data;
+    memcpy(&hart->io, &rv->io, sizeof(riscv_io_t));
+    rv_stats_init(&hart->stats);
+    rv_reset(hart, 0U);
+    hart->hart_id = id;
+    hart->hsm_state = HART_STOPPED;
+    hart->sbi_timer = 0xFFFFFFFFFFFFFFF;
+
+    if (!rv_exec_init(hart)) {
+        free(hart);
+        return NULL;
+    }
+    hart_wake_init(hart);
+    return hart;
+}
+
+/* Enter S-mode at the address handed to hart_start, as the SBI HSM extension
+ * specifies: a0 holds the hart id, a1 the opaque argument, and the MMU and
+ * the supervisor interrupts are off. Called with hart_lock held.
+ */
+static void hart_boot(riscv_t *rv)
+{
+    vm_attr_t *attr = PRIV(rv);
+
+    rv->PC = rv->start_addr;
+    rv->X[rv_reg_a0] = rv->hart_id;
+    rv->X[rv_reg_a1] = rv->start_arg;
+    rv->priv_mode = RV_PRIV_S_MODE;
+    rv->csr_satp = 0;
+    rv->csr_sstatus &= ~SSTATUS_SIE;
+    rv->is_trapped = false;
+    rv->lr_valid = false;
+    rv->sbi_timer = 0xFFFFFFFFFFFFFFF;
+    rv->tlb_asid_tag = 0;
+    mmu_tlb_flush_all(rv);
+    reset_rv_run_state(rv);
+
+    /* guest code may have changed while the hart was stopped */
+#if !RV32_HAS(JIT)
+    block_map_clear(rv);
+#else
+    ATOMIC_FETCH_OR(&rv->fence_pending, RV_FENCE_I, ATOMIC_RELEASE);
+#endif
+
+    /* pick up the time where the running harts are */
+    uint64_t now = rv->csr_cycle + rv->timer_offset;
+    uint64_t base = ATOMIC_LOAD(&attr->time_base, ATOMIC_RELAXED);
+    if (base > now)
+        rv->timer_offset += base - now;
+
+    ATOMIC_STORE(&rv->hsm_state, HART_STARTED, ATOMIC_RELEASE);
+}
+
+static void *hart_runloop(void *arg)
+{
+    riscv_t *rv = arg;
+    vm_attr_t *attr = PRIV(rv);
+
+    pthread_mutex_lock(&attr->hart_lock);
+    for (;;) {
+        while (!attr->harts_quit && rv->hsm_state != HART_START_PENDING)
+            pthread_cond_wait(&attr->hart_cond, &attr->hart_lock);
+        if (attr->harts_quit)
+            break;
+        hart_boot(rv);
+        pthread_mutex_unlock(&attr->hart_lock);
+
+        while (!rv_has_halted(rv))
+            rv_step(rv);
+
+        pthread_mutex_lock(&attr->hart_lock);
+        rv->halt = false;
+        /* a hart_start may already be waiting if the guest raced hart_stop */
+        if (rv->hsm_state == HART_STARTED)
+            ATOMIC_STORE(&rv->hsm_state, HART_STOPPED, ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&attr->hart_lock);
+    return NULL;
+}
+
+/* Start the threads of the secondary harts. Each waits for SBI HSM to start
+ * it before it runs any guest code.
+ */
+static void harts_launch(riscv_t *rv)
+{
+    vm_attr_t *attr = PRIV(rv);
+    for (uint32_t i = 1; i < attr->n_harts; i++) {
+        riscv_t *hart = attr->harts[i];
+        if (pthread_create(&hart->thread, NULL, hart_runloop, hart)) {
+            rv_log_fatal("Failed to start the thread of hart %u", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* Halt the secondary harts once the boot hart is done, and wait for them */
+static void harts_shutdown(riscv_t *rv)
+{
+    vm_attr_t *attr = PRIV(rv);
+
+    pthread_mutex_lock(&attr->hart_lock);
+    attr->harts_quit = true;
+    for (uint32_t i = 1; i < attr->n_harts; i++) {
+        ATOMIC_STORE(&attr->harts[i]->halt, true, ATOMIC_RELEASE);
+        rv_hart_kick(attr->harts[i]);
+    }
+    pthread_cond_broadcast(&attr->hart_cond);
+    pthread_mutex_unlock(&attr->hart_lock);
+
+    for (uint32_t i = 1; i < attr->n_harts; i++)
+        pthread_join(attr->harts[i]->thread, NULL);
+}
+
+int rv_hart_start(riscv_t *rv,
+                  uint32_t hartid,
+                  uint32_t start_addr,
+                  uint32_t opaque)
+{
+    vm_attr_t *attr = PRIV(rv);
+    if (hartid >= attr->n_harts)
+        return SBI_ERR_INVALID_PARAM;
+#if RV32_HAS(EXT_C)
+    if (start_addr & 1)
+#else
+    if (start_addr & 3)
+#endif
+        return SBI_ERR_INVALID_ADDRESS;
+
+    riscv_t *hart = attr->harts[hartid];
+    int err = SBI_SUCCESS;
+    pthread_mutex_lock(&attr->hart_lock);
+    if (hart->hsm_state != HART_STOPPED) {
+        err = SBI_ERR_ALREADY_AVAILABLE;
+    } else {
+        hart->start_addr = start_addr;
+        hart->start_arg = opaque;
+        ATOMIC_STORE(&hart->hsm_state, HART_START_PENDING, ATOMIC_RELEASE);
+        pthread_cond_broadcast(&attr->hart_cond);
+    }
+    pthread_mutex_unlock(&attr->hart_lock);
+    return err;
+}
+
+int rv_hart_stop(riscv_t *rv)
+{
+    vm_attr_t *attr = PRIV(rv);
+
+    /* the boot hart drives rv_run() and the devices, it cannot go away */
+    if (rv->hart_id == 0)
+        return SBI_ERR_FAILED;
+
+    pthread_mutex_lock(&attr->hart_lock);
+    ATOMIC_STORE(&rv->hsm_state, HART_STOPPED, ATOMIC_RELEASE);
+    pthread_mutex_unlock(&attr->hart_lock);
+    rv_halt(rv);
+    return SBI_SUCCESS;
+}
+
+void rv_remote_fence(riscv_t *rv, uint32_t harts, uint32_t fences)
+{
+    vm_attr_t *attr = PRIV(rv);
+
+    for (uint32_t i = 0; i < attr->n_harts; i++) {
+        if (harts & (1U << i)) {
+            ATOMIC_FETCH_OR(&attr->harts[i]->fence_pending, fences,
+                            ATOMIC_RELEASE);
+            rv_hart_kick(attr->harts[i]);
+        }
+    }
+
+    /* Wait until every running target has applied the fences. Serve the ones
+     * posted to this hart meanwhile, so that two harts fencing each other at
+     * the same time cannot deadlock.
+     */
+    for (uint32_t i = 0; i < attr->n_harts; i++) {
+        riscv_t *hart = attr->harts[i];
+        if (!(harts & (1U << i)))
+            continue;
+        while (ATOMIC_LOAD(&hart->fence_pending, ATOMIC_ACQUIRE) & fences) {
+            if (ATOMIC_LOAD(&rv->fence_pending, ATOMIC_RELAXED)) {
+                rv_apply_remote_fences(rv);
+                continue;
+            }
+            /* a stopped hart flushes everything when it is started again */
+            if (ATOMIC_LOAD(&hart->hsm_state, ATOMIC_ACQUIRE) !=
+                    HART_STARTED ||
+                ATOMIC_LOAD(&hart->halt, ATOMIC_RELAXED))
+                break;
+            sched_yield();
+        }
+    }
+}
+
+void rv_hart_kick(riscv_t *hart)
+{
+    /* Pairs with the fence in rv_wfi(): either the hart sees the request
+     * posted before this call, or this sees the hart parked.
+     */
+    ATOMIC_THREAD_FENCE(ATOMIC_SEQ_CST);
+    if (!ATOMIC_LOAD(&hart->wfi_parked, ATOMIC_RELAXED) || hart->wake_fd[1] < 0)
+        return;
+    /* a full pipe already holds a wakeup */
+    if (write(hart->wake_fd[1], "", 1) < 0 && errno != EAGAIN)
+        rv_log_error("Failed to wake hart %u: %s", hart->hart_id,
+                     strerror(errno));
+}
+
+/* virtio-blk DMA bypasses the MMU, so tell every hart which guest RAM it
+ * overwrote in case translated code lived there.
+ */
+static void vblk_ram_written(void *opaque, uint32_t addr, uint32_t len)
+{
+    vm_attr_t *attr = opaque;
+    for (uint32_t i = 0; i < attr->n_harts; i++) {
+        if (attr->harts[i])
+            mmu_code_written(attr->harts[i], addr, len);
+    }
+}
+
+/* watch the console for the snapshot marker */
+static void uart_watch(void *opaque, uint8_t value)
+{
+    snapshot_watch(opaque, &value, 1);
+}
+
+#endif
+
 riscv_t *rv_create(riscv_user_t rv_attr)
 {
     assert(rv_attr);
@@ -631,6 +1243,7 @@ riscv_t *rv_create(riscv_user_t rv_attr)
     assert(rv);
 
 #if RV32_HAS(SYSTEM_MMIO)
+    machine = rv;
     /* register cleaning callback for CTRL+a+x exit */
     atexit(rv_async_block_clear);
     /* register device sync callback for CTRL+a+x exit */
@@ -641,7 +1254,11 @@ riscv_t *rv_create(riscv_user_t rv_attr)
     rv->data = rv_attr;
 
     vm_attr_t *attr = PRIV(rv);
-    attr->mem = memory_new(attr->mem_size);
+    rv_stats_init(&rv->stats);
+    if (attr->run_flag & RV_RUN_STATS)
+        rv_stats_install_signal();
+
+    attr->mem = memory_new(attr->mem_size, &attr->mem_opts);
     assert(attr->mem);
     assert(!(((uintptr_t) attr->mem) & 0b11));
 
@@ -655,7 +1272,11 @@ riscv_t *rv_create(riscv_user_t rv_attr)
      * The logging stdout stream will be remapped as well
      *
      */
-    attr->fd_map = map_init(int, FILE *, map_cmp_int);
+    attr->fd_table_size = 16;
+    attr->fd_table = malloc(attr->fd_table_size * sizeof(int));
+    assert(attr->fd_table);
+    for (uint32_t i = 0; i < attr->fd_table_size; i++)
+        attr->fd_table[i] = -1;
     rv_remap_stdstream(rv,
                        (fd_stream_pair_t[]) {
                            {STDIN_FILENO, stdin},
@@ -673,7 +1294,7 @@ riscv_t *rv_create(riscv_user_t rv_attr)
 
     if (!elf_open(elf, attr->data.user.elf_program)) {
         rv_log_fatal("elf_open() failed");
-        map_delete(attr->fd_map);
+        free(attr->fd_table);
         memory_delete(attr->mem);
         free(rv);
         exit(EXIT_FAILURE);
@@ -745,18 +1366,26 @@ riscv_t *rv_create(riscv_user_t rv_attr)
      * *----------------*----------------*-------*
      */
 
-    /* load_dtb needs the count to add the virtio block subnode dynamically */
+    /* load_dtb needs the counts to add the virtio block and cpu subnodes */
     attr->vblk_cnt = attr->data.system.vblk_device_cnt;
+    if (!attr->n_harts)
+        attr->n_harts = 1;
+
+    /* snapshots hold a single hart, and the disks as of the snapshot point */
+    const bool snapshots = attr->snapshot_marker || attr->restore_file;
+    if (snapshots && attr->n_harts > 1) {
+        rv_log_fatal("Snapshots are limited to a single hart");
+        exit(EXIT_FAILURE);
+    }
     attr->vrng = NULL;
     attr->vrng_mmio_base_hi = 0;
     attr->vrng_irq = 0;
 
-    char *ram_loc = (char *) attr->mem->mem_base;
-    map_file(&ram_loc, attr->data.system.kernel, 0);
+    map_file(attr->mem, 0, attr->data.system.kernel, 0);
     rv_log_info("Kernel loaded");
 
     uint32_t dtb_addr = attr->mem->mem_size - DTB_SIZE;
-    ram_loc = ((char *) attr->mem->mem_base) + dtb_addr;
+    char *ram_loc = ((char *) attr->mem->mem_base) + dtb_addr;
     load_dtb(&ram_loc, attr);
     rv_log_info("DTB loaded");
     /* Load optional initrd image before the dtb region.
@@ -771,9 +1400,8 @@ riscv_t *rv_create(riscv_user_t rv_attr)
             exit(EXIT_FAILURE);
         }
         uint32_t initrd_addr = dtb_addr - INITRD_SIZE;
-        ram_loc = ((char *) attr->mem->mem_base) + initrd_addr;
-        off_t initrd_size =
-            map_file(&ram_loc, attr->data.system.initrd, INITRD_SIZE);
+        off_t initrd_size = map_file(attr->mem, initrd_addr,
+                                     attr->data.system.initrd, INITRD_SIZE);
         if (initrd_size < 0) {
             /* map_file returns -1 when file exceeds max_size */
             rv_log_fatal(
@@ -795,7 +1423,17 @@ riscv_t *rv_create(riscv_user_t rv_attr)
     rv_set_reg(rv, rv_reg_a1, dtb_addr);
 
     /* setup timer */
-    attr->timer = 0xFFFFFFFFFFFFFFF;
+    rv->sbi_timer = 0xFFFFFFFFFFFFFFF;
+
+    /* the other harts are created stopped once the devices are in place */
+    attr->harts[0] = rv;
+    rv->hart_id = 0;
+    rv->hsm_state = HART_STARTED;
+    hart_wake_init(rv);
+    pthread_mutex_init(&attr->device_lock, NULL);
+    pthread_mutex_init(&attr->hart_lock, NULL);
+    pthread_cond_init(&attr->hart_cond, NULL);
+    attr->harts_quit = false;
 
     /* setup PLIC */
     attr->plic = plic_new();
@@ -803,10 +1441,12 @@ riscv_t *rv_create(riscv_user_t rv_attr)
     attr->plic->rv = rv;
 
     /* setup UART */
-    attr->uart = u8250_new();
+    attr->uart = u8250_new(attr->fd_stdin, attr->fd_stdout);
     assert(attr->uart);
-    attr->uart->in_fd = attr->fd_stdin;
-    attr->uart->out_fd = attr->fd_stdout;
+    if (attr->snapshot_marker) {
+        attr->uart->tx_watch = uart_watch;
+        attr->uart->tx_opaque = rv;
+    }
 
     /* setup rtc */
 #if RV32_HAS(GOLDFISH_RTC)
@@ -821,8 +1461,8 @@ riscv_t *rv_create(riscv_user_t rv_attr)
 
     if (attr->vblk_cnt) {
         for (int i = 0; i < attr->vblk_cnt; i++) {
-/* Currently, only used for block image path and permission */
-#define MAX_OPTS 2
+/* The block image path followed by its options */
+#define MAX_OPTS 4
             char *vblk_device_str = attr->data.system.vblk_device[i];
             if (!vblk_device_str[0]) {
                 rv_log_error("Disk path cannot be empty");
@@ -842,8 +1482,7 @@ riscv_t *rv_create(riscv_user_t rv_attr)
             }
 
             char *vblk_device;
-            char *vblk_readonly = vblk_opts[1];
-            bool readonly = false;
+            uint32_t vblk_flags = 0;
 
             if (vblk_opts[0][0] == '~') {
                 /* HOME environment variable should be common in macOS and Linux
@@ -876,18 +1515,28 @@ riscv_t *rv_create(riscv_user_t rv_attr)
                 vblk_device = vblk_opts[0];
             }
 
-            if (vblk_readonly) {
-                if (strcmp(vblk_readonly, "readonly") != 0) {
-                    rv_log_error("Unknown vblk option: %s", vblk_readonly);
+            for (int j = 1; j < vblk_opt_idx; j++) {
+                if (!strcmp(vblk_opts[j], "readonly")) {
+                    vblk_flags |= VBLK_OPT_READONLY;
+                } else if (!strcmp(vblk_opts[j], "async")) {
+                    vblk_flags |= VBLK_OPT_ASYNC;
+                } else if (!strcmp(vblk_opts[j], "direct")) {
+                    vblk_flags |= VBLK_OPT_DIRECT;
+                } else {
+                    rv_log_error("Unknown vblk option: %s", vblk_opts[j]);
                     exit(EXIT_FAILURE);
                 }
-                readonly = true;
             }
+            /* every run from a snapshot starts with the same disk */
+            if (snapshots)
+                vblk_flags |= VBLK_OPT_PRIVATE;
 
             attr->vblk[i] = vblk_new();
             attr->vblk[i]->ram = (uint32_t *) attr->mem->mem_base;
+            attr->vblk[i]->ram_written = vblk_ram_written;
+            attr->vblk[i]->ram_opaque = attr;
             attr->disk[i] =
-                virtio_blk_init(attr->vblk[i], vblk_device, readonly);
+                virtio_blk_init(attr->vblk[i], vblk_device, vblk_flags);
 
             if (vblk_opts[0][0] == '~')
                 free(vblk_device);
@@ -907,89 +1556,56 @@ riscv_t *rv_create(riscv_user_t rv_attr)
     capture_keyboard_input();
 #endif /* !RV32_HAS(SYSTEM_MMIO) */
 
-    /* create block and IRs memory pool */
-    rv->block_mp = mpool_create(sizeof(block_t) << BLOCK_MAP_CAPACITY_BITS,
-                                sizeof(block_t));
-    rv->block_ir_mp = mpool_create(
-        sizeof(rv_insn_t) << BLOCK_IR_MAP_CAPACITY_BITS, sizeof(rv_insn_t));
-    /* Fuse pool: fixed-size slots for macro-op fusion arrays.
-     * Each slot holds up to FUSE_MAX_ENTRIES opcode_fuse_t structures.
-     */
-    rv->fuse_mp = mpool_create(FUSE_SLOT_SIZE << BLOCK_IR_MAP_CAPACITY_BITS,
-                               FUSE_SLOT_SIZE);
-    if (!rv->block_mp || !rv->block_ir_mp || !rv->fuse_mp) {
-        rv_log_fatal("Failed to create memory pool");
-        goto fail_mpool;
-    }
-
-#if !RV32_HAS(JIT)
-    /* initialize the block map */
-    block_map_init(&rv->block_map, BLOCK_MAP_CAPACITY_BITS);
-
-    /* initialize L1 block cache with invalid tags */
-    for (int i = 0; i < BLOCK_L1_SIZE; i++)
-        rv->block_l1.tags[i] = BLOCK_L1_INVALID_TAG;
-    memset(rv->block_l1.ptrs, 0, sizeof(rv->block_l1.ptrs));
+    if (!rv_exec_init(rv))
+        goto fail_exec;
+#if RV32_HAS(JIT)
+    if (attr->jit_cache_dir) {
+#if RV32_HAS(SYSTEM_MMIO)
+        const char *images[] = {attr->data.system.kernel,
+                                attr->data.system.initrd};
 #else
-    INIT_LIST_HEAD(&rv->block_list);
-    rv->jit_state = jit_state_init(CODE_CACHE_SIZE);
-    if (!rv->jit_state) {
-        rv_log_fatal("Failed to initialize JIT state");
-        goto fail_jit_state;
-    }
-    rv->block_cache = cache_create(BLOCK_MAP_CAPACITY_BITS);
-    if (!rv->block_cache) {
-        rv_log_fatal("Failed to create block cache");
-        goto fail_block_cache;
+        const char *images[] = {attr->data.user.elf_program};
+#endif
+        jit_persist_open(rv->jit_state, rv, attr->jit_cache_dir, images,
+                         ARRAY_SIZE(images));
     }
-#if RV32_HAS(T2C)
-    rv->quit = false;
-    rv->jit_cache = jit_cache_init();
-    if (!rv->jit_cache) {
-        rv_log_fatal("Failed to initialize JIT cache");
-        goto fail_jit_cache;
+#endif
+
+    /* a restored machine is at the snapshot point right away */
+    if (attr->restore_file) {
+        if (!snapshot_restore(rv, attr->restore_file))
+            goto fail_restore;
+        attr->snapshot_due = true;
     }
-    rv->inline_cache = inline_cache_init();
-    if (!rv->inline_cache) {
-        rv_log_fatal("Failed to initialize inline cache");
-        goto fail_inline_cache;
+
+#if RV32_HAS(SYSTEM_MMIO)
+    for (uint32_t i = 1; i < attr->n_harts; i++) {
+        attr->harts[i] = hart_new(rv, i);
+        if (!attr->harts[i]) {
+            rv_log_fatal("Failed to create hart %u", i);
+            goto fail_harts;
+        }
     }
-    /* prepare wait queue. */
-    pthread_mutex_init(&rv->wait_queue_lock, NULL);
-    pthread_mutex_init(&rv->cache_lock, NULL);
-    pthread_cond_init(&rv->wait_queue_cond, NULL);
-    INIT_LIST_HEAD(&rv->wait_queue);
-    /* Activate the background compilation thread.
-     * Use larger stack (8MB) to handle deep recursion in t2c_trace_ebb
-     * and LLVM's internal stack usage during compilation.
-     */
-    pthread_attr_t t2c_attr;
-    pthread_attr_init(&t2c_attr);
-    pthread_attr_setstacksize(&t2c_attr, 8 * 1024 * 1024); /* 8MB stack */
-    pthread_create(&t2c_thread, &t2c_attr, t2c_runloop, rv);
-    pthread_attr_destroy(&t2c_attr);
-#endif
 #endif
 
     return rv;
 
-#if RV32_HAS(JIT)
-#if RV32_HAS(T2C)
-fail_inline_cache:
-    jit_cache_exit(rv->jit_cache);
-fail_jit_cache:
-    cache_free(rv->block_cache);
+#if RV32_HAS(SYSTEM_MMIO)
+fail_harts:
+    for (uint32_t i = 1; i < attr->n_harts && attr->harts[i]; i++) {
+        rv_exec_exit(attr->harts[i]);
+        hart_wake_exit(attr->harts[i]);
+        free(attr->harts[i]);
+    }
 #endif
-fail_block_cache:
-    if (rv->jit_state)
-        jit_state_exit(rv->jit_state);
-fail_jit_state:
+fail_restore:
+#if RV32_HAS(JIT)
+    jit_persist_close(rv->jit_state, rv);
 #endif
-fail_mpool:
-    mpool_destroy(rv->block_ir_mp);
-    mpool_destroy(rv->block_mp);
-    mpool_destroy(rv->fuse_mp);
+    rv_exec_exit(rv);
+fail_exec:
 #if RV32_HAS(SYSTEM_MMIO)
+    hart_wake_exit(rv);
     if (attr->uart)
         u8250_delete(attr->uart);
     if (attr->plic)
@@ -1009,8 +1625,9 @@ fail_mpool:
 
     if (attr->vrng)
         vrng_delete(attr->vrng);
+    machine = NULL;
 #endif
-    map_delete(attr->fd_map);
+    free(attr->fd_table);
     memory_delete(attr->mem);
     free(rv);
     return NULL;
@@ -1045,6 +1662,106 @@ static void rv_run_and_trace(riscv_t *rv)
 }
 #endif
 
+#if !defined(__EMSCRIPTEN__)
+/* Run each test input listed in fork_list, one path per line, in a copy of
+ * the machine forked at the snapshot point, which reads the input on its
+ * console (or stdin). The copies run one after another, and the parent
+ * reports on stderr how each of them ended. Returns in the copies; the
+ * parent stops the machine once the list is done.
+ */
+static void fork_server(riscv_t *rv)
+{
+    vm_attr_t *attr = PRIV(rv);
+    FILE *list = fopen(attr->fork_list, "r");
+    if (!list) {
+        rv_log_error("Cannot open %s: %s", attr->fork_list, strerror(errno));
+        attr->exit_code = 1;
+        rv_halt(rv);
+        return;
+    }
+
+    /* fork() only copies the calling thread, no other may be left */
+#if RV32_HAS(SYSTEM_MMIO)
+    u8250_set_input(attr->uart, -1);
+#endif
+#if RV32_HAS(T2C)
+    t2c_workers_stop(rv);
+#endif
+
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, list)) > 0) {
+        if (line[len - 1] == '\n')
+            line[--len] = '\0';
+        if (!len)
+            continue;
+        int fd = open(line, O_RDONLY);
+        if (fd < 0) {
+            rv_log_error("Cannot open %s: %s", line, strerror(errno));
+            attr->exit_code = 1;
+            continue;
+        }
+
+        /* buffered output would be written once by every copy */
+        fflush(NULL);
+        pid_t pid = fork();
+        if (!pid) {
+            dup2(fd, attr->fd_stdin);
+            close(fd);
+            fclose(list);
+            free(line);
+#if RV32_HAS(SYSTEM_MMIO)
+            u8250_set_input(attr->uart, attr->fd_stdin);
+#endif
+#if RV32_HAS(T2C)
+            t2c_workers_start(rv);
+#endif
+            return;
+        }
+        close(fd);
+        if (pid < 0) {
+            rv_log_error("Failed to fork: %s", strerror(errno));
+            attr->exit_code = 1;
+            break;
+        }
+
+        int status;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+            ;
+        if (WIFEXITED(status))
+            fprintf(stderr, "%s: exit %d\n", line, WEXITSTATUS(status));
+        else
+            fprintf(stderr, "%s: signal %d\n", line, WTERMSIG(status));
+    }
+    free(line);
+    fclose(list);
+    rv_halt(rv);
+}
+
+/* The machine reached the snapshot point: save it and stop, or hand it to
+ * the fork server.
+ */
+static void snapshot_point(riscv_t *rv)
+{
+    vm_attr_t *attr = PRIV(rv);
+    attr->snapshot_due = false;
+    attr->snapshot_marker = NULL; /* the point is only taken once */
+    rv->halt = false;
+#if RV32_HAS(SYSTEM_MMIO)
+    u8250_flush(attr->uart);
+#endif
+
+    if (attr->snapshot_file) {
+        if (!snapshot_save(rv, attr->snapshot_file))
+            attr->exit_code = 1;
+        rv_halt(rv);
+    } else if (attr->fork_list) {
+        fork_server(rv);
+    }
+}
+#endif
+
 #if RV32_HAS(GDBSTUB)
 /* Run the RISC-V emulator as gdbstub */
 void rv_debug(riscv_t *rv);
@@ -1065,13 +1782,27 @@ void rv_run(riscv_t *rv)
 #endif
     );
 
+    reset_rv_run_state(rv);
+
     if (!(attr->run_flag & (RV_RUN_TRACE | RV_RUN_GDBSTUB))) {
 #ifdef __EMSCRIPTEN__
         emscripten_set_main_loop_arg(rv_step, (void *) rv, 0, 1);
 #else
-        /* default main loop */
-        for (; !rv_has_halted(rv);) /* run until the flag is done */
-            rv_step(rv);            /* step instructions */
+#if RV32_HAS(SYSTEM_MMIO)
+        harts_launch(rv);
+#endif
+        /* default main loop, left at the snapshot point as well */
+        for (;;) {
+            if (attr->snapshot_due)
+                snapshot_point(rv);
+            for (; !rv_has_halted(rv);) /* run until the flag is done */
+                rv_step(rv);            /* step instructions */
+            if (!attr->snapshot_due)
+                break;
+        }
+#if RV32_HAS(SYSTEM_MMIO)
+        harts_shutdown(rv);
+#endif
 #endif
     }
 #if !RV32_HAS(SYSTEM_MMIO)
@@ -1087,11 +1818,29 @@ void rv_run(riscv_t *rv)
         assert(attr->profile_output_file);
         rv_profile(rv, attr->profile_output_file);
     }
+
+    if (attr->run_flag & RV_RUN_STATS)
+        rv_dump_stats(rv);
+}
+
+void rv_dump_stats(riscv_t *rv)
+{
+    uint32_t queue_depth = 0;
+#if RV32_HAS(T2C)
+    pthread_mutex_lock(&rv->wait_queue_lock);
+    queue_depth = rv->wait_queue_len;
+    pthread_mutex_unlock(&rv->wait_queue_lock);
+#endif
+    rv_stats_dump(&rv->stats, queue_depth, stderr);
 }
 
 void rv_halt(riscv_t *rv)
 {
     rv->halt = true;
+#if RV32_HAS(SYSTEM_MMIO)
+    /* another hart may be stopping this one */
+    rv_hart_kick(rv);
+#endif
 }
 
 bool rv_has_halted(riscv_t *rv)
@@ -1111,60 +1860,29 @@ void rv_set_fromhost_addr(riscv_t *rv, uint32_t addr)
 }
 #endif
 
-#if RV32_HAS(JIT)
-static void free_block_branch_tables(void *block)
-{
-    assert(block);
-    block_t *blk = (block_t *) block;
-    for (rv_insn_t *ir = blk->ir_head; ir; ir = ir->next)
-        free(ir->branch_table);
-}
-#endif
-
 void rv_delete(riscv_t *rv)
 {
     assert(rv);
     vm_attr_t *attr = PRIV(rv);
-#if !RV32_HAS(JIT)
-    map_delete(attr->fd_map);
-    memory_delete(attr->mem);
-    block_map_destroy(rv);
-#else
-#if RV32_HAS(T2C)
-    /* Signal the thread to quit */
-    pthread_mutex_lock(&rv->wait_queue_lock);
-    rv->quit = true;
-    pthread_cond_signal(&rv->wait_queue_cond);
-    pthread_mutex_unlock(&rv->wait_queue_lock);
-
-    pthread_join(t2c_thread, NULL);
-
-    /* Clean up any remaining entries in wait queue */
-    queue_entry_t *entry, *safe;
-    list_for_each_entry_safe (entry, safe, &rv->wait_queue, list) {
-        list_del(&entry->list);
-        free(entry);
+#if RV32_HAS(SYSTEM_MMIO)
+    for (uint32_t i = 1; i < attr->n_harts; i++) {
+        rv_exec_exit(attr->harts[i]);
+        hart_wake_exit(attr->harts[i]);
+        free(attr->harts[i]);
     }
-
-    pthread_mutex_destroy(&rv->wait_queue_lock);
-    pthread_mutex_destroy(&rv->cache_lock);
-    pthread_cond_destroy(&rv->wait_queue_cond);
-    jit_cache_exit(rv->jit_cache);
-    inline_cache_exit(rv->inline_cache);
-
-    /* Dispose LLVM engines for all remaining blocks before freeing cache */
-    clear_cache_hot(rv->block_cache, t2c_dispose_block_engine);
+    hart_wake_exit(rv);
 #endif
-    /* Free branch tables for all remaining blocks before freeing cache */
-    clear_cache_hot(rv->block_cache, free_block_branch_tables);
-    jit_state_exit(rv->jit_state);
-    cache_free(rv->block_cache);
-    mpool_destroy(rv->block_ir_mp);
-    mpool_destroy(rv->block_mp);
-    mpool_destroy(rv->fuse_mp);
-    map_delete(attr->fd_map);
-    memory_delete(attr->mem);
+#if RV32_HAS(JIT)
+    jit_persist_close(rv->jit_state, rv);
 #endif
+    rv_exec_exit(rv);
+    /* files the guest left open; the standard streams belong to the host */
+    for (uint32_t fd = 3; fd < attr->fd_table_size; fd++) {
+        if (attr->fd_table[fd] >= 0)
+            close(attr->fd_table[fd]);
+    }
+    free(attr->fd_table);
+    memory_delete(attr->mem);
 #if RV32_HAS(SYSTEM_MMIO)
     u8250_delete(attr->uart);
     plic_delete(attr->plic);
@@ -1173,6 +1891,10 @@ void rv_delete(riscv_t *rv)
 #endif /* RV32_HAS(GOLDFISH_RTC) */
     /* sync device, cleanup inside the callee */
     rv_fsync_device();
+    machine = NULL;
+    pthread_mutex_destroy(&attr->device_lock);
+    pthread_mutex_destroy(&attr->hart_lock);
+    pthread_cond_destroy(&attr->hart_cond);
 #endif
     free(rv);
 }
@@ -1191,6 +1913,7 @@ void rv_reset(riscv_t *rv, riscv_word_t pc)
 
     /* set the reset address */
     rv->PC = pc;
+    reset_rv_run_state(rv);
 #ifdef __EMSCRIPTEN__
     rv->wasm_block_depth = WASM_BLOCK_LIMIT;
     rv->next_insn = NULL;
@@ -1306,12 +2029,12 @@ void rv_reset(riscv_t *rv, riscv_word_t pc)
     /* not being trapped */
     rv->is_trapped = false;
 
-    /* Reset address translation: clear SATP and flush both TLBs to prevent
+    /* Reset address translation: clear SATP and flush the TLBs to prevent
      * stale translations from previous execution.
      */
     rv->csr_satp = 0;
-    memset(rv->dtlb, 0, sizeof(rv->dtlb));
-    memset(rv->itlb, 0, sizeof(rv->itlb));
+    rv->tlb_asid_tag = 0;
+    mmu_tlb_flush_all(rv);
 #else
     /* ISA simulation defaults to M-mode */
     rv->priv_mode = RV_PRIV_M_MODE;
@@ -11,9 +11,11 @@
 
 #include "io.h"
 #include "log.h"
-#include "map.h"
 
 #if RV32_HAS(SYSTEM)
+#if RV32_HAS(SYSTEM_MMIO)
+#include <pthread.h>
+#endif
 #include "devices/plic.h"
 #if RV32_HAS(GOLDFISH_RTC)
 #include "devices/rtc.h"
@@ -256,7 +258,11 @@ enum TRAP_CODE {
  * SBI reference: https://github.com/riscv-non-isa/riscv-sbi-doc
  */
 #define SBI_SUCCESS 0
+#define SBI_ERR_FAILED -1
 #define SBI_ERR_NOT_SUPPORTED -2
+#define SBI_ERR_INVALID_PARAM -3
+#define SBI_ERR_INVALID_ADDRESS -5
+#define SBI_ERR_ALREADY_AVAILABLE -6
 
 /*
  * All of the functions in the base extension must be supported by
@@ -279,8 +285,29 @@ enum TRAP_CODE {
 #define SBI_EID_RST 0x53525354
 #define SBI_RST_SYSTEM_RESET 0
 
+/* Send a supervisor software interrupt to a set of harts. */
+#define SBI_EID_IPI 0x735049
+#define SBI_IPI_SEND_IPI 0
+
+/* Ask a set of harts to execute FENCE.I or SFENCE.VMA on our behalf. */
+#define SBI_EID_RFENCE 0x52464E43
+#define SBI_RFENCE_REMOTE_FENCE_I 0
+#define SBI_RFENCE_REMOTE_SFENCE_VMA 1
+#define SBI_RFENCE_REMOTE_SFENCE_VMA_ASID 2
+
+/* Start, stop and query the state of the secondary harts. */
+#define SBI_EID_HSM 0x48534D
+#define SBI_HSM_HART_START 0
+#define SBI_HSM_HART_STOP 1
+#define SBI_HSM_HART_GET_STATUS 2
+
 #define BLOCK_MAP_CAPACITY_BITS 10
 
+#if RV32_HAS(SYSTEM_MMIO)
+/* every hart owns one S-mode context of the PLIC */
+#define RV_MAX_HARTS PLIC_MAX_CONTEXTS
+#endif
+
 /* forward declaration for internal structure */
 typedef struct riscv_internal riscv_t;
 typedef void *riscv_user_t;
@@ -476,6 +503,23 @@ void rv_set_fromhost_addr(riscv_t *rv, uint32_t addr);
  */
 void mmu_tlb_flush_all(riscv_t *rv);
 void mmu_tlb_flush(riscv_t *rv, uint32_t vaddr);
+void mmu_tlb_flush_asid(riscv_t *rv, uint32_t asid);
+void mmu_tlb_flush_page_asid(riscv_t *rv, uint32_t vaddr, uint32_t asid);
+
+/* Retag the TLBs after a write of satp that changed it from @old_satp */
+void mmu_tlb_switch(riscv_t *rv, uint32_t old_satp);
+
+/* Shadow bits of the guest RAM pages that hold code translated by a hart,
+ * see system.c. mmu_code_written() marks the pages of @size bytes at the
+ * physical address @paddr stale if the hart translated code from them; the
+ * stores of all harts call it, and so does device DMA. mmu_code_fence() moves
+ * the stale pages to rv->fence_pages for FENCE.I and returns false if there
+ * were none.
+ */
+bool mmu_code_init(riscv_t *rv);
+void mmu_code_exit(riscv_t *rv);
+void mmu_code_written(riscv_t *rv, uint32_t paddr, uint32_t size);
+bool mmu_code_fence(riscv_t *rv);
 #endif
 
 enum {
@@ -488,6 +532,9 @@ enum {
     /* run and profile relationship of blocks and save to prof_output_file
        during emulation */
     RV_RUN_PROFILE = 4,
+
+    /* report tiered-execution statistics when emulation finishes */
+    RV_RUN_STATS = 8,
 };
 
 typedef struct {
@@ -516,6 +563,27 @@ typedef struct {
 
 typedef struct {
 #if RV32_HAS(SYSTEM_MMIO)
+    /* number of harts, each run by its own host thread. harts[0] is the boot
+     * hart returned by rv_create(), the others wait for an SBI HSM start.
+     */
+    uint32_t n_harts;
+    riscv_t *harts[RV_MAX_HARTS];
+
+    /* serializes device emulation, which every hart may reach through MMIO */
+    pthread_mutex_t device_lock;
+
+    /* protects the HSM state of the harts, signalled on hart start and on
+     * shutdown (harts_quit)
+     */
+    pthread_mutex_t hart_lock;
+    pthread_cond_t hart_cond;
+    bool harts_quit;
+
+    /* latest time any hart has read, keeps the time CSR monotonic across
+     * harts whose cycle counters advance at different speeds
+     */
+    uint64_t time_base;
+
     /* uart object */
     u8250_state_t *uart;
 
@@ -551,6 +619,9 @@ typedef struct {
      */
     uint64_t mem_size;
 
+    /* host memory backing the guest memory, demand paging if zeroed */
+    memory_opts_t mem_opts;
+
     /* vm main stack size */
     uint32_t stack_size;
 
@@ -585,20 +656,46 @@ typedef struct {
     bool allow_misalign;
 
     /* run flag, it is the bitwise OR from
-     * RV_RUN_TRACE, RV_RUN_GDBSTUB, and RV_RUN_PROFILE
+     * RV_RUN_TRACE, RV_RUN_GDBSTUB, RV_RUN_PROFILE, and RV_RUN_STATS
      */
     uint8_t run_flag;
 
     /* profiling output file if RV_RUN_PROFILE is set in run_flag */
     char *profile_output_file;
 
+#if RV32_HAS(JIT)
+    /* directory of the persistent T1 code cache, NULL to disable */
+    char *jit_cache_dir;
+
+    /* size of the T1 code cache in bytes, 0 for the default */
+    uint32_t jit_cache_size;
+#endif
+
+    /* Snapshots, see snapshot.c. rv_create() restores the machine from
+     * restore_file if set. The snapshot point is the guest printing
+     * snapshot_marker on its console, or the start of a restored machine.
+     * There, rv_run() saves the machine to snapshot_file and stops, or runs
+     * each test input listed in fork_list in a forked copy of the machine.
+     */
+    char *restore_file;
+    char *snapshot_marker;
+    char *snapshot_file;
+    char *fork_list;
+
+    /* the snapshot point is reached, and the length of the end of the guest
+     * output that matches the start of snapshot_marker
+     */
+    bool snapshot_due;
+    uint32_t marker_matched;
+
     /* set by rv_create during initialization.
      * use rv_remap_stdstream to overwrite them
      */
     int fd_stdin, fd_stdout, fd_stderr;
 
-    /* vm file descriptor map: int -> (FILE *) */
-    map_t fd_map;
+    /* vm file descriptor table: host fd of each guest fd, -1 if closed */
+    int *fd_table;
+    uint32_t fd_table_size;
 
     /* the data segment break address */
     riscv_word_t break_addr;
@@ -615,9 +712,6 @@ typedef struct {
     /* flag to determine if running SDL program in guestOS */
     bool running_sdl;
 #endif /* SDL */
-
-    /* SBI timer */
-    uint64_t timer;
 } vm_attr_t;
 
 #ifdef __cplusplus
@@ -15,6 +15,7 @@
 #endif
 #include "decode.h"
 #include "riscv.h"
+#include "stats.h"
 #include "utils.h"
 #if RV32_HAS(JIT)
 #if RV32_HAS(T2C)
@@ -25,11 +26,17 @@
 
 #define PRIV(x) ((vm_attr_t *) x->data)
 
-/* Maximum entries per fuse slot - limits fusion to 16 consecutive instructions.
- * Larger sequences are rare and provide diminishing returns.
+/* File-scope scratch of the T1 translator, which lasts for one translation,
+ * is declared HART_LOCAL so that harts and emulator instances on other host
+ * threads may translate at the same time. State that has to last from one
+ * rv_step() to the next belongs in riscv_t instead.
+ */
+#define HART_LOCAL __thread
+
+/* Maximum entries per fused instruction - limits fusion to 16 consecutive
+ * instructions. Larger sequences are rare and provide diminishing returns.
  */
 #define FUSE_MAX_ENTRIES 16
-#define FUSE_SLOT_SIZE (FUSE_MAX_ENTRIES * sizeof(opcode_fuse_t))
 
 /* CSRs */
 enum {
@@ -119,18 +126,33 @@ typedef struct block {
     uint32_t pc_start, pc_end; /**< address range of the basic block */
     uint32_t cycle_cost;       /**< cycle cost for block-level counting */
 
+    /* The IRs are an array in execution order, allocated in one piece with
+     * the branch history tables and the fuse entries they point to, see
+     * block_seal(). Fusion only unlinks IRs after ir_head, which therefore
+     * remains the address of the allocation.
+     */
     rv_insn_t *ir_head, *ir_tail; /**< the first and last ir for this block */
+    opcode_fuse_t *fuse_free;     /**< fuse entries left for fusion */
+    uint32_t n_fuse_free;
 
 #if RV32_HAS(BLOCK_CHAINING)
     bool page_terminated; /**< Block ended at page boundary (not a branch) */
 #endif
 
+#if RV32_HAS(SUPERBLOCK)
+    bool profiling; /**< sampling its last branch, see superblock_reform() */
+#endif
+
 #if RV32_HAS(SYSTEM_MMIO) && RV32_HAS(MOP_FUSION)
     uint8_t n_lazy_candidates; /**< number of lazy fusion candidates */
     lazy_fusion_candidate_t lazy_candidates[MAX_LAZY_CANDIDATES];
     bool lazy_fusion_done; /**< lazy fusion already attempted */
 #endif
 
+#if !RV32_HAS(JIT)
+    bool referenced; /**< looked up since the clock hand last passed it */
+#endif
+
 #if RV32_HAS(JIT)
     bool hot;          /**< Determine the block is potential hotspot or not */
     bool hot2;         /**< Determine the block is strong hotspot or not */
@@ -140,14 +162,17 @@ typedef struct block {
     uint32_t satp;
     bool invalidated; /**< Block invalidated by SFENCE.VMA, needs recompilation
                        */
+    uint32_t code_page[2]; /**< physical pages of the first and last insn */
 #endif
 #if RV32_HAS(T2C)
-    bool compiled;     /**< The T2C request is enqueued or not */
-    bool is_compiling; /**< T2C thread is currently processing this block */
-    bool should_free;  /**< Block was evicted while compiling, freed by T2C */
+    bool compiled; /**< The T2C request is enqueued or not */
+    bool claimed;  /**< A T2C worker has taken the block */
+    bool linked;   /**< The T2C code is reachable through jit_cache */
 #endif
     uint32_t offset;   /**< The machine code offset in T1 code cache */
     uint32_t n_invoke; /**< The invoking times of T1 machine code */
+    uint32_t run_cycles; /**< Cycles interpreted from entries of the block */
+    uint64_t digest;   /**< Digest of the decoded instruction words */
     void *func;        /**< The function pointer of T2 machine code */
 #if RV32_HAS(T2C)
     void *llvm_engine; /**< LLVM execution engine (keeps func memory alive) */
@@ -156,12 +181,59 @@ typedef struct block {
 #endif
 } block_t;
 
+/* Return address stack (RAS).
+ *
+ * Calls push their return address and returns pop it, following the hints of
+ * the RISC-V unprivileged specification: jal and jalr with rd of x1 or x5
+ * push, jalr with rs1 of x1 or x5 pops, and a jalr whose rd and rs1 are two
+ * different link registers does both. The stack is circular, so deep
+ * recursion overwrites the oldest entries, and a popped entry predicts
+ * nothing unless it matches the actual target.
+ *
+ * Each entry also caches where its return address leads: the first IR of the
+ * block without the JIT, and the T1 code with it. The cache lives as long as
+ * the same address is pushed at the same depth, as it is for a call made over
+ * and over from one site, however many other sites call the same function.
+ */
+#define RAS_SIZE 16
+#define RAS_PUSH 1
+#define RAS_POP 2
+
+typedef struct {
+    uint32_t pc;
+#if RV32_HAS(JIT) && RV32_HAS(SYSTEM)
+    uint32_t satp;
+#endif
+#if !RV32_HAS(JIT)
+    rv_insn_t *target; /**< IR at pc, NULL if not looked up */
+#else
+    uintptr_t code; /**< T1 code at pc, 0 if not looked up */
+#endif
+} ras_entry_t;
+
+typedef struct {
+    uint32_t top; /**< index of the newest entry */
+    ras_entry_t entry[RAS_SIZE];
+} ras_t;
+
 /* T2C implies JIT (enforced by Kconfig and feature.h) */
 #if RV32_HAS(T2C)
 typedef struct {
-    uint64_t key; /**< cache key (PC or PC|SATP) to look up block */
-    struct list_head list;
-} queue_entry_t;
+    uint64_t key;         /**< cache key (PC or PC|SATP) to look up block */
+    uint32_t prio;        /**< T1 invocation count when last (re)queued */
+    uint64_t enqueued_ns; /**< rv_stats_now() of the first request */
+} t2c_request_t;
+
+/* Upper bound of the T2C compile pool, which is allocated at creation. Each
+ * worker keeps a private LLVM context alive for the lifetime of the emulator.
+ */
+#define T2C_MAX_WORKERS 256
+
+typedef struct {
+    riscv_t *rv;
+    void *llvm_ctx; /**< LLVM context owning every engine this worker built */
+    pthread_t thread;
+} t2c_worker_t;
 #endif
 
 #if RV32_HAS(SYSTEM)
@@ -169,33 +241,58 @@ typedef struct {
  * This reduces the overhead of page table walks in system simulation mode.
  *
  * TLB design:
- * - Direct-mapped cache indexed by VPN lower bits
- * - 64 entries for ~256KB working set coverage
- * - Each entry caches: VPN, PPN, permissions, and page level
+ * - Set-associative, TLB_ENTRIES entries in sets of TLB_WAYS, indexed by the
+ *   VPN lower bits. Ways are kept in LRU order, so way 0 of a set holds its
+ *   most recently used entry, which is the only way the JIT probes inline.
+ * - Entries are tagged with the ASID of satp, so that switching between
+ *   address spaces with distinct ASIDs keeps their translations
+ * - Each entry caches: tag, PPN, permissions, and page level
  * - Separate dTLB (data) and iTLB (instruction) for better hit rates
- * - Superpages tracked via level field for selective SFENCE.VMA
- * - Invalidated on SFENCE.VMA or SATP changes
+ * - Superpages are cached per 4 KiB page, with their level for the offset
+ *   mask. A small fully associative array keeps whole superpages so that
+ *   their other pages are refilled without a page walk.
+ * - Invalidated by SFENCE.VMA (per address and/or per ASID), or on satp
+ *   writes that change the page table but not the ASID
  */
-#define TLB_SIZE 64
-#define TLB_MASK (TLB_SIZE - 1)
+#ifndef TLB_ENTRIES
+#define TLB_ENTRIES 1024
+#endif
+#ifndef TLB_WAYS
+#define TLB_WAYS 4
+#endif
+#define TLB_SETS (TLB_ENTRIES / TLB_WAYS)
+_Static_assert(TLB_WAYS > 0 && (TLB_WAYS & (TLB_WAYS - 1)) == 0 &&
+                   TLB_SETS > 0 && (TLB_SETS & (TLB_SETS - 1)) == 0,
+               "TLB_ENTRIES and TLB_WAYS must be powers of two");
+#define TLB_SET_MASK (TLB_SETS - 1)
+#define TLB_SUPER_ENTRIES 16
+
+/* a tag holds the VPN in bits 19:0 and the ASID above */
+#define TLB_ASID_SHIFT 20
+#define TLB_VPN_MASK ((1U << TLB_ASID_SHIFT) - 1)
 
 /* Sv32 page levels: 1 = 4MB superpage, 2 = 4KB page */
 #define TLB_PAGE_LEVEL_SUPER 1
 #define TLB_PAGE_LEVEL_4K 2
 
 typedef struct {
-    uint32_t vpn, ppn; /* Virtual/Physical page number (upper 20 bits of VA) */
+    uint32_t tag;      /* VPN (upper 20 bits of VA) and ASID, see above */
+    uint32_t ppn;      /* Physical page base address */
     uint32_t pte_addr; /* Physical address of PTE for A/D bit updates */
-    uint8_t perm;      /* Permission bits: R(1), W(2), X(4), U(16) */
+    uint8_t perm;      /* Permission bits: R(1), W(2), X(4), U(16), G(32) */
     uint8_t valid;     /* Entry validity flag */
     uint8_t dirty;     /* Cached dirty bit state (avoid repeated PTE writes) */
     uint8_t level;     /* Page level: 1=superpage (4MB), 2=4KB page */
 } tlb_entry_t;
+
+/* log2 of the distance in bytes between the sets, for the JIT probes */
+#define TLB_SET_SHIFT (4 + __builtin_ctz(TLB_WAYS))
 #endif
 
 typedef struct {
     uint32_t block_capacity; /**< max number of entries in the block map */
     uint32_t size;           /**< number of entries currently in the map */
+    uint32_t hand;           /**< clock hand of the eviction sweep */
     block_t **map;           /**< block map */
 } block_map_t;
 
@@ -243,6 +340,61 @@ typedef struct {
 /* clear all block in the block map */
 void block_map_clear(riscv_t *rv);
 
+/* print the tiered-execution statistics of @rv to stderr */
+void rv_dump_stats(riscv_t *rv);
+
+#if RV32_HAS(T2C)
+/* Queue block @key for tier-2 compilation, or raise the priority of a pending
+ * request for the same key. Returns false if the request could not be queued.
+ */
+bool t2c_enqueue(riscv_t *rv, uint64_t key, uint32_t prio);
+
+/* free the evicted blocks no T2C worker can be using any more */
+void rv_reclaim_blocks(riscv_t *rv);
+#endif
+
+#if RV32_HAS(SYSTEM_MMIO)
+/* hart states as reported by SBI HSM hart_get_status */
+typedef enum {
+    HART_STARTED = 0,
+    HART_STOPPED = 1,
+    HART_START_PENDING = 2,
+} hsm_state_t;
+
+/* fences another hart asks for through SBI RFENCE */
+enum {
+    RV_FENCE_I = 1 << 0,
+    RV_FENCE_VMA = 1 << 1,
+};
+
+/* Start the stopped hart @hartid at @start_addr in S-mode with a0 = hartid
+ * and a1 = @opaque. Returns an SBI error code.
+ */
+int rv_hart_start(riscv_t *rv,
+                  uint32_t hartid,
+                  uint32_t start_addr,
+                  uint32_t opaque);
+
+/* Stop the calling hart, which then waits for the next rv_hart_start().
+ * Returns an SBI error code; the boot hart cannot be stopped.
+ */
+int rv_hart_stop(riscv_t *rv);
+
+/* Run @fences (RV_FENCE_*) on every hart in the bitmap @harts and return once
+ * all of them are done.
+ */
+void rv_remote_fence(riscv_t *rv, uint32_t harts, uint32_t fences);
+
+/* carry out the fences other harts posted to @rv */
+void rv_apply_remote_fences(riscv_t *rv);
+
+/* Wake @hart if it sleeps in WFI. Call after posting a request to it. */
+void rv_hart_kick(riscv_t *hart);
+#endif
+
+/* forget the block chaining state of the run loop of @rv */
+void reset_rv_run_state(riscv_t *rv);
+
 struct riscv_internal {
     bool halt; /**< indicate whether the core is halted */
 
@@ -316,6 +468,10 @@ struct riscv_internal {
     /* float registers */
     riscv_float_t F[32];
     uint32_t csr_fcsr;
+#if RV32_HAS(JIT)
+    uint32_t jit_fp_seen;    /* host FP flags already folded into fflags */
+    uint32_t jit_fp_scratch; /* where T1 code stores MXCSR to inspect it */
+#endif
 #endif
 
     /* csr registers */
@@ -357,18 +513,33 @@ struct riscv_internal {
     struct cache *block_cache;
     struct list_head block_list; /**< list of all translated blocks */
 #if RV32_HAS(T2C)
-    struct list_head wait_queue;
-    pthread_mutex_t wait_queue_lock, cache_lock;
+    /* pending compile requests, a max-heap ordered by prio (hottest first) */
+    t2c_request_t *wait_queue;
+    uint32_t wait_queue_len, wait_queue_cap;
+    pthread_mutex_t wait_queue_lock;
     pthread_cond_t wait_queue_cond;
     bool quit; /**< termination flag, protected by wait_queue_lock */
+    t2c_worker_t *t2c_workers; /**< also the block cache readers, in order */
+    uint32_t n_t2c_workers;
 #endif
     void *jit_state;
     void *jit_cache;
+    /* the T1 threshold is THRESHOLD << hot_shift, see HOT_SHIFT_MAX */
+    uint32_t hot_shift, jit_calm;
+#if RV32_HAS(T2C)
+    uint32_t loop_budget; /* back-edges left until T1 code leaves */
+#endif
 #if RV32_HAS(T2C)
     void *inline_cache; /* Inline cache for fast indirect jump resolution */
 #endif
 #endif
-    struct mpool *block_mp, *block_ir_mp, *fuse_mp;
+    struct mpool *block_mp;
+    /* translation buffers: the IRs and fuse entries of the block under
+     * translation, moved into the block once it is complete
+     */
+    rv_insn_t *ir_buf;
+    opcode_fuse_t *fuse_buf;
+    uint32_t ir_buf_cap;
 
 #if RV32_HAS(GDBSTUB)
     /* gdbstub instance */
@@ -391,16 +562,6 @@ struct riscv_internal {
      */
     uint32_t last_csr_sepc;
 
-    /* Data TLB for caching virtual-to-physical address translations.
-     * Reduces page table walk overhead for repeated memory accesses.
-     */
-    tlb_entry_t dtlb[TLB_SIZE];
-
-    /* Instruction TLB for caching instruction fetch translations.
-     * Separate from dTLB for better hit rates and simpler permission checks.
-     */
-    tlb_entry_t itlb[TLB_SIZE];
-
     /* Timer offset for deriving timer from cycle counter.
      * timer = csr_cycle + timer_offset
      * This avoids per-instruction timer increments in the main loop.
@@ -411,6 +572,48 @@ struct riscv_internal {
      * TIME would be independent of CPU frequency scaling or sleep states.
      */
     uint64_t timer_offset;
+
+    /* SBI timer: supervisor timer interrupt fires once TIME passes it */
+    uint64_t sbi_timer;
+
+    /* Bitmaps of guest RAM, one bit per 4 KiB page, for self-modifying
+     * code: the pages this hart translated blocks from, those of them
+     * written since, and the ones the running FENCE.I drops the blocks of.
+     * Only the hart itself sets code_pages; the stores of the other harts
+     * and DMA may set stale_pages and code_stale from other threads.
+     */
+    uint32_t *code_pages, *stale_pages, *fence_pages;
+    uint32_t code_words; /**< size of each bitmap in words */
+    bool code_stale;     /**< stale_pages is not empty */
+    uint32_t ifetch_page; /**< physical page of the last fetch */
+#endif
+
+#if RV32_HAS(SYSTEM_MMIO)
+    /* SMP: the hart id, its SBI HSM state (hsm_state_t, guarded by
+     * hart_lock in vm_attr_t) and where hart_start asked it to begin.
+     */
+    uint32_t hart_id;
+    uint32_t hsm_state;
+    uint32_t start_addr, start_arg;
+    pthread_t thread;
+
+    /* Requests posted by other threads. The hart folds the interrupt lines
+     * into csr_sip and carries out the fences (RV_FENCE_*) at its next
+     * interrupt check, so these are the only hart fields written remotely.
+     */
+    bool ipi_pending;
+    bool seip;
+    uint32_t fence_pending;
+
+    /* WFI parks the hart in poll() on wake_fd[0] with wfi_parked set, and
+     * rv_hart_kick() writes to wake_fd[1] after posting one of the above.
+     */
+    bool wfi_parked;
+    int wake_fd[2];
+
+    /* LR/SC reservation: physical address and the value LR.W observed */
+    bool lr_valid;
+    uint32_t lr_addr, lr_val;
 #endif
 
 #if RV32_HAS(ARCH_TEST)
@@ -430,8 +633,137 @@ struct riscv_internal {
     uint32_t csr_vtype;  /* Vector data type register */
     uint32_t csr_vlenb;  /* VLEN/8 (vector register length in bytes) */
 #endif
+
+    ras_t ras; /**< return address stack */
+
+    rv_stats_t stats; /**< tiered-execution telemetry */
+
+#if RV32_HAS(SYSTEM)
+    /* The TLBs come last, so that their configurable size does not move the
+     * fields the JIT reaches with short displacements from rv.
+     */
+
+    /* whole superpages, replaced round-robin */
+    tlb_entry_t stlb[TLB_SUPER_ENTRIES];
+    uint32_t stlb_next;
+
+    /* 4 MiB regions of which the dTLB or iTLB hold superpage copies */
+    uint32_t tlb_super_regions[1024 / 32];
+
+    /* ASID of satp in tag position; the JIT reads it right before dtlb */
+    uint32_t tlb_asid_tag;
+
+    /* Data TLB for caching virtual-to-physical address translations.
+     * Reduces page table walk overhead for repeated memory accesses.
+     */
+    tlb_entry_t dtlb[TLB_ENTRIES];
+
+    /* Instruction TLB for caching instruction fetch translations.
+     * Separate from dTLB for better hit rates and simpler permission checks.
+     */
+    tlb_entry_t itlb[TLB_ENTRIES];
+#endif
+
+    /* State the run loop carries from one rv_step() to the next, so that
+     * instances may be stepped in any order on any thread. Reset by
+     * reset_rv_run_state(); kept behind the TLBs for the same reason.
+     */
+    block_t *prev_block;  /**< block run last, to chain from */
+    uint32_t last_pc;     /**< PC of the jump that left prev_block */
+    bool is_branch_taken; /**< whether that jump was a taken branch */
+    uint16_t gc_counter;  /**< memory_gc() runs each time it wraps */
+#if RV32_HAS(JIT)
+    set_t pc_set;   /**< block PCs entered since T1 code last ran */
+    bool has_loops; /**< a branch closed a loop among them */
+#endif
+#if RV32_HAS(SYSTEM)
+    /* Signal to RVOP macro that inline trap handling occurred.
+     * When set, the instruction should return without advancing PC to allow
+     * retry. Used both for Linux kernel signal handling (modifies SEPC) and
+     * ELF loader mode inline trap handling (page fault resolved, instruction
+     * needs retry).
+     */
+    bool need_handle_signal;
+    bool need_retranslate; /**< the faulting fetch must be decoded again */
+    /* the jalr of the kernel that turns on the MMU was reached */
+    bool reloc_enable_mmu;
+    uint32_t reloc_enable_mmu_jalr_addr;
+#if !RV32_HAS(JIT)
+    bool need_clear_block_map; /**< satp changed under the running block */
+#endif
+#endif
+#if RV32_HAS(SYSTEM_MMIO)
+    uint32_t peripheral_update_ctr; /**< steps until the devices are polled */
+#endif
 };
 
+/* RAS_PUSH and/or RAS_POP for a jump linking @rd through @rs1; pass rs1 = 0
+ * for jal.
+ */
+static inline uint32_t ras_action(uint8_t rd, uint8_t rs1)
+{
+    const bool rd_link = rd == rv_reg_ra || rd == rv_reg_t0;
+    const bool rs1_link = rs1 == rv_reg_ra || rs1 == rv_reg_t0;
+    if (!rs1_link)
+        return rd_link ? RAS_PUSH : 0;
+    if (!rd_link)
+        return RAS_POP;
+    return rd == rs1 ? RAS_PUSH : RAS_POP | RAS_PUSH;
+}
+
+static inline void ras_push(riscv_t *rv, uint32_t pc)
+{
+    ras_t *ras = &rv->ras;
+    ras->top = (ras->top + 1) & (RAS_SIZE - 1);
+    ras_entry_t *entry = &ras->entry[ras->top];
+#if RV32_HAS(JIT) && RV32_HAS(SYSTEM)
+    if (entry->pc == pc && entry->satp == rv->csr_satp)
+        return;
+    entry->satp = rv->csr_satp;
+#else
+    if (entry->pc == pc)
+        return;
+#endif
+    entry->pc = pc;
+#if !RV32_HAS(JIT)
+    entry->target = NULL;
+#else
+    entry->code = 0;
+#endif
+}
+
+/* Pop the newest entry for a return to @pc. Return it if it predicted @pc, or
+ * NULL.
+ */
+static inline ras_entry_t *ras_pop(riscv_t *rv, uint32_t pc)
+{
+    ras_t *ras = &rv->ras;
+    ras_entry_t *entry = &ras->entry[ras->top];
+    ras->top = (ras->top + RAS_SIZE - 1) & (RAS_SIZE - 1);
+    if (entry->pc != pc
+#if RV32_HAS(JIT) && RV32_HAS(SYSTEM)
+        || entry->satp != rv->csr_satp
+#endif
+    ) {
+        rv->stats.ras_misses++;
+        return NULL;
+    }
+    rv->stats.ras_hits++;
+    return entry;
+}
+
+/* Drop the cached targets once the IR or T1 code they point to is gone */
+static inline void ras_forget(riscv_t *rv)
+{
+    for (int i = 0; i < RAS_SIZE; i++) {
+#if !RV32_HAS(JIT)
+        rv->ras.entry[i].target = NULL;
+#else
+        rv->ras.entry[i].code = 0;
+#endif
+    }
+}
+
 /* sign extend a 16 bit value */
 FORCE_INLINE uint32_t sign_extend_h(const uint32_t x)
 {
@@ -537,3 +869,33 @@ FORCE_INLINE void ram_write_b(const riscv_t *rv, uint32_t addr, uint8_t val)
     attr->mem->mem_base[addr] = val;
 }
 #endif /* !RV32_HAS(SYSTEM) */
+
+#if RV32_HAS(SYSTEM)
+/* whether @rv translated code from the guest RAM page @page */
+FORCE_INLINE bool mmu_code_page(riscv_t *rv, uint32_t page)
+{
+    return (ATOMIC_LOAD(&rv->code_pages[page / 32], ATOMIC_RELAXED) >>
+            (page % 32)) &
+           1;
+}
+
+/* Check a store of @size bytes to the guest RAM at @paddr against the code
+ * the harts translated, see mmu_code_written().
+ */
+FORCE_INLINE void mmu_code_store(riscv_t *rv, uint32_t paddr, uint32_t size)
+{
+    const uint32_t first = paddr >> RV_PG_SHIFT;
+    const uint32_t last = (paddr + size - 1) >> RV_PG_SHIFT;
+#if RV32_HAS(SYSTEM_MMIO)
+    const vm_attr_t *attr = PRIV(rv);
+    for (uint32_t i = 0; i < attr->n_harts; i++) {
+        riscv_t *hart = attr->harts[i];
+        if (unlikely(mmu_code_page(hart, first) || mmu_code_page(hart, last)))
+            mmu_code_written(hart, paddr, size);
+    }
+#else
+    if (unlikely(mmu_code_page(rv, first) || mmu_code_page(rv, last)))
+        mmu_code_written(rv, paddr, size);
+#endif
+}
+#endif
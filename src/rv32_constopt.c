@@ -54,11 +54,11 @@ CONSTOPT(jalr, {
 /* clang-format off */
 #define OPT_BRANCH_FUNC(type, cond)                                 \
     if (info->is_constant[ir->rs1] && info->is_constant[ir->rs2]) { \
+        int32_t imm = ir->imm;                                      \
         if ((type) info->const_val[ir->rs1] cond                    \
             (type) info->const_val[ir->rs2])                        \
-            ir->imm = 4;                                            \
-        ir->opcode = rv_insn_jal;                                   \
-        ir->impl = dispatch_table[ir->opcode];                      \
+            imm = 4;                                                \
+        constopt_fold_branch(ir, imm, rv_insn_jal);                 \
     }
 /* clang-format on */
 
@@ -943,22 +943,16 @@ CONSTOPT(cj, {})
  * value in register rs1' is zero. It expands to beq rs1', x0, offset[8:1].
  */
 CONSTOPT(cbeqz, {
-    if (info->is_constant[ir->rs1]) {
-        if (info->const_val[ir->rs1])
-            ir->imm = 2;
-        ir->opcode = rv_insn_cj;
-        ir->impl = dispatch_table[ir->opcode];
-    }
+    if (info->is_constant[ir->rs1])
+        constopt_fold_branch(ir, info->const_val[ir->rs1] ? 2 : ir->imm,
+                             rv_insn_cj);
 })
 
 /* C.BEQZ */
 CONSTOPT(cbnez, {
-    if (info->is_constant[ir->rs1]) {
-        if (!info->const_val[ir->rs1])
-            ir->imm = 2;
-        ir->opcode = rv_insn_cj;
-        ir->impl = dispatch_table[ir->opcode];
-    }
+    if (info->is_constant[ir->rs1])
+        constopt_fold_branch(ir, !info->const_val[ir->rs1] ? 2 : ir->imm,
+                             rv_insn_cj);
 })
 
 /* C.SLLI is a CI-format instruction that performs a logical left shift of
@@ -0,0 +1,108 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/* RISC-V "F" Single-Precision Extension - runtime for tier-1 and tier-2 code.
+ *
+ * Included from emulate.c when both RV32_HAS(JIT) and RV32_HAS(EXT_F) are
+ * set, after rv32_template.c and the dispatch table.
+ *
+ * On x86-64, T1 code runs the common operations inline on SSE scalar
+ * instructions (see the F handlers in rv32_jit.c) and leaves the exception
+ * flags they raise in MXCSR, whose flags are sticky just like fflags.
+ * rv->jit_fp_seen holds the MXCSR flags that have already been folded into
+ * fflags. T1 code compares the two after each operation and calls
+ * jit_fp_accrue() only when a new flag shows up, so a loop that keeps raising
+ * "inexact" pays for one call rather than one per instruction.
+ *
+ * Whatever T1 code cannot settle inline runs the interpreter handler through
+ * jit_fp_handler(): static rounding modes other than RNE, a dynamic frm other
+ * than RNE, NaN results (RISC-V wants the canonical NaN and, for the fused
+ * forms, the invalid flag on inf * 0 + qNaN), out-of-range conversions and
+ * MMU-translated loads and stores. Every F instruction takes this path on
+ * arm64; T2C code builds the moves, sign injections and user-mode loads and
+ * stores in LLVM IR and calls it for the rest.
+ */
+
+#if defined(__x86_64__)
+#include <xmmintrin.h>
+
+/* all exceptions masked, round to nearest even, no FTZ/DAZ */
+#define MXCSR_DEFAULT 0x1f80
+#endif
+
+void jit_fp_reset(riscv_t *rv)
+{
+#if defined(__x86_64__)
+    _mm_setcsr(MXCSR_DEFAULT);
+    rv->jit_fp_seen = 0;
+#else
+    (void) rv;
+#endif
+}
+
+/* Bring MXCSR back in line with jit_fp_seen before T1 code relies on it.
+ * Host code, other harts sharing the thread or an inline attempt that ended
+ * up in jit_fp_handler() may have raised flags in the meantime, none of which
+ * belong to the guest: every flag raised by T1 code itself has already been
+ * folded into fflags.
+ */
+static inline void jit_fp_sync(riscv_t *rv)
+{
+#if defined(__x86_64__)
+    if (unlikely((_mm_getcsr() & ~_MM_EXCEPT_DENORM) !=
+                 (MXCSR_DEFAULT | rv->jit_fp_seen)))
+        jit_fp_reset(rv);
+#else
+    (void) rv;
+#endif
+}
+
+void jit_fp_accrue(riscv_t *rv)
+{
+#if defined(__x86_64__)
+    const uint32_t flags = _mm_getcsr() & JIT_FP_MXCSR_FLAGS;
+    if (flags & _MM_EXCEPT_INVALID)
+        rv->csr_fcsr |= FFLAG_INVALID_OP;
+    if (flags & _MM_EXCEPT_DIV_ZERO)
+        rv->csr_fcsr |= FFLAG_DIV_BY_ZERO;
+    if (flags & _MM_EXCEPT_OVERFLOW)
+        rv->csr_fcsr |= FFLAG_OVERFLOW;
+    if (flags & _MM_EXCEPT_UNDERFLOW)
+        rv->csr_fcsr |= FFLAG_UNDERFLOW;
+    if (flags & _MM_EXCEPT_INEXACT)
+        rv->csr_fcsr |= FFLAG_INEXACT;
+    rv->jit_fp_seen = flags;
+#else
+    (void) rv;
+#endif
+}
+
+uint32_t jit_fp_handler(riscv_t *rv,
+                        uint32_t opcode,
+                        uint32_t operands,
+                        uint32_t pc)
+{
+    rv_insn_t ir;
+    memset(&ir, 0, sizeof(rv_insn_t));
+    jit_fp_unpack(&ir, opcode, operands);
+
+    /* Run the interpreter handler as a one-instruction block, the way
+     * jit_vector_handler() does: it sets rv->PC to the next instruction and
+     * advances csr_cycle, but the calling block accounts for the cycles of
+     * all its instructions on exit.
+     */
+    uint64_t cycle = rv->csr_cycle;
+    ir.pc = pc;
+    ir.impl = dispatch_table[opcode];
+    rv->PC = pc; /* the exception PC if the instruction traps */
+    bool ok = ir.impl(rv, &ir, cycle, pc);
+    rv->csr_cycle = cycle;
+    /* softfloat has the final say on the flags of an abandoned inline try */
+    jit_fp_sync(rv);
+#if RV32_HAS(SYSTEM)
+    ok = ok && !rv->is_trapped;
+#endif
+    return ok;
+}
@@ -71,6 +71,7 @@
         emit_exit(state);                                          \
         emit_jump_target_offset(state, JUMP_LOC_0, state->offset); \
         if (ir->branch_taken) {                                    \
+            emit_back_edge(state, ir, ir->pc + ir->imm);           \
             emit_jmp(state, ir->pc + ir->imm, rv->csr_satp);       \
         }                                                          \
         emit_load_imm(state, temp_reg, ir->pc + ir->imm);          \
@@ -79,6 +80,26 @@
         emit_exit(state);                                          \
     } while (0)
 
+/* Superblock branch helper - the next IR is on the side the branch leans to,
+ * so jump over a side exit to the other side and carry on with the registers
+ * still mapped. Inverting a JCC_* identifier flips its lowest bit.
+ */
+#define EMIT_SUPERBLOCK_BRANCH(cond, inst_size)                         \
+    do {                                                                \
+        const bool hot_taken = ir->next->pc == ir->pc + ir->imm;        \
+        const uint32_t cold_pc =                                        \
+            hot_taken ? ir->pc + (inst_size) : ir->pc + ir->imm;        \
+        uint32_t jump_loc_0 = state->offset;                            \
+        emit_jcc_offset(state, hot_taken ? (cond) : (cond) ^ 1);        \
+        emit_back_edge(state, ir, cold_pc);                             \
+        emit_jmp(state, cold_pc, rv->csr_satp);                         \
+        emit_load_imm(state, temp_reg, cold_pc);                        \
+        emit_store(state, S32, temp_reg, parameter_reg[0],              \
+                   offsetof(riscv_t, PC));                              \
+        emit_exit(state);                                               \
+        emit_jump_target_offset(state, JUMP_LOC_0, state->offset);      \
+    } while (0)
+
 /* Branch instruction handler macro - all branch instructions follow
  * the same pattern, differing only in the condition code.
  */
@@ -87,6 +108,10 @@
         ra_load2(state, ir->rs1, ir->rs2);                \
         emit_cmp32(state, vm_reg[1], vm_reg[0]);          \
         store_back(state);                                \
+        if (ir->next) {                                   \
+            EMIT_SUPERBLOCK_BRANCH(cond, 4);              \
+            return;                                       \
+        }                                                 \
         uint32_t jump_loc_0 = state->offset;              \
         emit_jcc_offset(state, cond);                     \
         EMIT_BRANCH_EPILOGUE(4); /* 4-byte instruction */ \
@@ -100,6 +125,10 @@
         vm_reg[0] = ra_load(state, ir->rs1);              \
         emit_cmp_imm32(state, vm_reg[0], 0);              \
         store_back(state);                                \
+        if (ir->next) {                                   \
+            EMIT_SUPERBLOCK_BRANCH(cond, 2);              \
+            return;                                       \
+        }                                                 \
         uint32_t jump_loc_0 = state->offset;              \
         emit_jcc_offset(state, cond);                     \
         EMIT_BRANCH_EPILOGUE(2); /* 2-byte instruction */ \
@@ -282,7 +311,8 @@
                 emit_jump_target_offset(state, JUMP_LOC_0, state->offset);     \
                 emit_load(state, S32, parameter_reg[0], temp_reg,              \
                           offsetof(riscv_t, jit_mmu.paddr));                   \
-                emit_load_imm_sext(state, vm_reg[1], (intptr_t) m->mem_base);  \
+                emit_load_host_addr(state, vm_reg[1], (uintptr_t) m->mem_base, \
+                                    RELOC_MEM);                                \
                 emit_alu64(state, ALU_OP_ADD, temp_reg, vm_reg[1]);            \
                 load_fn(state, size, vm_reg[1], vm_reg[1], 0);                 \
                 emit_jump_target_offset(state, JUMP_LOC_1, state->offset);     \
@@ -298,8 +328,9 @@
                     emit_jump_target_offset(state, fp_end_loc, state->offset); \
             },                                                                 \
             {                                                                  \
-                emit_load_imm_sext(state, temp_reg,                            \
-                                   (intptr_t) (m->mem_base + ir->imm));        \
+                emit_load_host_addr(state, temp_reg,                           \
+                                    (uintptr_t) (m->mem_base + ir->imm),       \
+                                    RELOC_MEM);                                \
                 emit_alu64(state, ALU_OP_ADD, vm_reg[0], temp_reg);            \
                 vm_reg[1] = map_vm_reg(state, ir->rd);                         \
                 load_fn(state, size, temp_reg, vm_reg[1], 0);                  \
@@ -366,7 +397,8 @@
                 emit_load(state, S32, parameter_reg[0], temp_reg,              \
                           offsetof(riscv_t, jit_mmu.paddr));                   \
                 vm_reg[0] = map_vm_reg(state, rv_reg_zero);                    \
-                emit_load_imm_sext(state, vm_reg[0], (intptr_t) m->mem_base);  \
+                emit_load_host_addr(state, vm_reg[0], (uintptr_t) m->mem_base, \
+                                    RELOC_MEM);                                \
                 emit_alu64(state, ALU_OP_ADD, vm_reg[0], temp_reg);            \
                 emit_store(state, size, vm_reg[1], temp_reg, 0);               \
                 emit_jump_target_offset(state, JUMP_LOC_0, state->offset);     \
@@ -383,8 +415,9 @@
                 reset_reg();                                                   \
             },                                                                 \
             {                                                                  \
-                emit_load_imm_sext(state, temp_reg,                            \
-                                   (intptr_t) (m->mem_base + ir->imm));        \
+                emit_load_host_addr(state, temp_reg,                           \
+                                    (uintptr_t) (m->mem_base + ir->imm),       \
+                                    RELOC_MEM);                                \
                 emit_alu64(state, ALU_OP_ADD, vm_reg[0], temp_reg);            \
                 vm_reg[1] = ra_load(state, ir->rs2);                           \
                 emit_store(state, size, vm_reg[1], temp_reg, 0);               \
@@ -405,13 +438,22 @@ GEN(jal, {
         vm_reg[0] = map_vm_reg(state, ir->rd);
         emit_load_imm(state, vm_reg[0], ir->pc + 4);
     }
+    if (ras_action(ir->rd, 0) & RAS_PUSH)
+        emit_ras_push(state, rv, ir->pc + 4);
+    /* in a superblock, the next IR is the jump target */
+    if (ir->next)
+        return;
     store_back(state);
+    emit_back_edge(state, ir, ir->pc + ir->imm);
     emit_jmp(state, ir->pc + ir->imm, rv->csr_satp);
     emit_load_imm(state, temp_reg, ir->pc + ir->imm);
     emit_store(state, S32, temp_reg, parameter_reg[0], offsetof(riscv_t, PC));
     emit_exit(state);
 })
 GEN(jalr, {
+    const uint32_t ras_op = ras_action(ir->rd, ir->rs1);
+    if (ras_op == RAS_PUSH)
+        emit_ras_push(state, rv, ir->pc + 4);
     vm_reg[0] = ra_load(state, ir->rs1);
     emit_mov(state, vm_reg[0], temp_reg);
     emit_alu32_imm32(state, ALU_GRP1_OPCODE, ALU_ADD, temp_reg, ir->imm);
@@ -422,7 +464,8 @@ GEN(jalr, {
         emit_load_imm(state, vm_reg[1], ir->pc + 4);
     }
     store_back(state);
-    parse_branch_history_table(state, rv, ir);
+    if (!emit_ras_return(state, rv, ir, ras_op, ir->pc + 4))
+        parse_branch_history_table(state, rv, ir);
     emit_store(state, S32, temp_reg, parameter_reg[0], offsetof(riscv_t, PC));
     emit_exit(state);
 })
@@ -493,12 +536,15 @@ GEN(sfencevma, { assert(NULL); })
 GEN(fencei, { assert(NULL); })
 #endif
 #if RV32_HAS(Zicsr) /* RV32 Zicsr Standard Extension */
+/* csrrw ends its block; the others come here when jit_csr_translatable()
+ * says so, see emit_csr() in src/jit.c.
+ */
 GEN(csrrw, { assert(NULL); })
-GEN(csrrs, { assert(NULL); })
-GEN(csrrc, { assert(NULL); })
-GEN(csrrwi, { assert(NULL); })
-GEN(csrrsi, { assert(NULL); })
-GEN(csrrci, { assert(NULL); })
+GEN(csrrs, { emit_csr(state, ir); })
+GEN(csrrc, { emit_csr(state, ir); })
+GEN(csrrwi, { emit_csr(state, ir); })
+GEN(csrrsi, { emit_csr(state, ir); })
+GEN(csrrci, { emit_csr(state, ir); })
 #endif
 #if RV32_HAS(EXT_M)
 GEN(mul, {
@@ -562,45 +608,49 @@ GEN(remu, {
 })
 #endif
 #if RV32_HAS(EXT_A)
-GEN(lrw, { assert(NULL); })
-GEN(scw, { assert(NULL); })
-GEN(amoswapw, { assert(NULL); })
-GEN(amoaddw, { assert(NULL); })
-GEN(amoxorw, { assert(NULL); })
-GEN(amoandw, { assert(NULL); })
-GEN(amoorw, { assert(NULL); })
-GEN(amominw, { assert(NULL); })
-GEN(amomaxw, { assert(NULL); })
-GEN(amominuw, { assert(NULL); })
-GEN(amomaxuw, { assert(NULL); })
+/* see emit_atomic() in src/jit.c */
+GEN(lrw, { emit_atomic(state, rv, ir); })
+GEN(scw, { emit_atomic(state, rv, ir); })
+GEN(amoswapw, { emit_atomic(state, rv, ir); })
+GEN(amoaddw, { emit_atomic(state, rv, ir); })
+GEN(amoxorw, { emit_atomic(state, rv, ir); })
+GEN(amoandw, { emit_atomic(state, rv, ir); })
+GEN(amoorw, { emit_atomic(state, rv, ir); })
+GEN(amominw, { emit_atomic(state, rv, ir); })
+GEN(amomaxw, { emit_atomic(state, rv, ir); })
+GEN(amominuw, { emit_atomic(state, rv, ir); })
+GEN(amomaxuw, { emit_atomic(state, rv, ir); })
 #endif
 #if RV32_HAS(EXT_F)
-GEN(flw, { assert(NULL); })
-GEN(fsw, { assert(NULL); })
-GEN(fmadds, { assert(NULL); })
-GEN(fmsubs, { assert(NULL); })
-GEN(fnmsubs, { assert(NULL); })
-GEN(fnmadds, { assert(NULL); })
-GEN(fadds, { assert(NULL); })
-GEN(fsubs, { assert(NULL); })
-GEN(fmuls, { assert(NULL); })
-GEN(fdivs, { assert(NULL); })
-GEN(fsqrts, { assert(NULL); })
-GEN(fsgnjs, { assert(NULL); })
-GEN(fsgnjns, { assert(NULL); })
-GEN(fsgnjxs, { assert(NULL); })
-GEN(fmins, { assert(NULL); })
-GEN(fmaxs, { assert(NULL); })
-GEN(fcvtws, { assert(NULL); })
-GEN(fcvtwus, { assert(NULL); })
-GEN(fmvxw, { assert(NULL); })
-GEN(feqs, { assert(NULL); })
-GEN(flts, { assert(NULL); })
-GEN(fles, { assert(NULL); })
-GEN(fclasss, { assert(NULL); })
-GEN(fcvtsw, { assert(NULL); })
-GEN(fcvtswu, { assert(NULL); })
-GEN(fmvwx, { assert(NULL); })
+/* The F registers live in rv->F only; see emit_fp_arith() and its siblings in
+ * src/jit.c for the inline SSE code and the jit_fp_handler() fallback.
+ */
+GEN(flw, { emit_fp_load(state, rv, ir, ir->rs1); })
+GEN(fsw, { emit_fp_store(state, rv, ir, ir->rs1); })
+GEN(fmadds, { emit_fp_fma(state, ir); })
+GEN(fmsubs, { emit_fp_fma(state, ir); })
+GEN(fnmsubs, { emit_fp_fma(state, ir); })
+GEN(fnmadds, { emit_fp_fma(state, ir); })
+GEN(fadds, { emit_fp_arith(state, ir); })
+GEN(fsubs, { emit_fp_arith(state, ir); })
+GEN(fmuls, { emit_fp_arith(state, ir); })
+GEN(fdivs, { emit_fp_arith(state, ir); })
+GEN(fsqrts, { emit_fp_arith(state, ir); })
+GEN(fsgnjs, { emit_fp_bits(state, ir); })
+GEN(fsgnjns, { emit_fp_bits(state, ir); })
+GEN(fsgnjxs, { emit_fp_bits(state, ir); })
+GEN(fmins, { emit_fp_call(state, ir); })
+GEN(fmaxs, { emit_fp_call(state, ir); })
+GEN(fcvtws, { emit_fp_cvt_w(state, ir); })
+GEN(fcvtwus, { emit_fp_cvt_w(state, ir); })
+GEN(fmvxw, { emit_fp_bits(state, ir); })
+GEN(feqs, { emit_fp_cmp(state, ir); })
+GEN(flts, { emit_fp_cmp(state, ir); })
+GEN(fles, { emit_fp_cmp(state, ir); })
+GEN(fclasss, { emit_fp_call(state, ir); })
+GEN(fcvtsw, { emit_fp_cvt_s(state, ir); })
+GEN(fcvtswu, { emit_fp_cvt_s(state, ir); })
+GEN(fmvwx, { emit_fp_bits(state, ir); })
 #endif
 #if RV32_HAS(EXT_C)
 GEN(caddi4spn, {
@@ -615,7 +665,8 @@ GEN(caddi4spn, {
 GEN(clw, {
     memory_t *m = PRIV(rv)->mem;
     vm_reg[0] = ra_load(state, ir->rs1);
-    emit_load_imm_sext(state, temp_reg, (intptr_t) (m->mem_base + ir->imm));
+    emit_load_host_addr(state, temp_reg, (uintptr_t) (m->mem_base + ir->imm),
+                        RELOC_MEM);
     emit_alu64(state, 0x01, vm_reg[0], temp_reg);
     vm_reg[1] = map_vm_reg(state, ir->rd);
     emit_load(state, S32, temp_reg, vm_reg[1], 0);
@@ -623,7 +674,8 @@ GEN(clw, {
 GEN(csw, {
     memory_t *m = PRIV(rv)->mem;
     vm_reg[0] = ra_load(state, ir->rs1);
-    emit_load_imm_sext(state, temp_reg, (intptr_t) (m->mem_base + ir->imm));
+    emit_load_host_addr(state, temp_reg, (uintptr_t) (m->mem_base + ir->imm),
+                        RELOC_MEM);
     emit_alu64(state, 0x01, vm_reg[0], temp_reg);
     vm_reg[1] = ra_load(state, ir->rs2);
     emit_store(state, S32, vm_reg[1], temp_reg, 0);
@@ -637,7 +689,11 @@ GEN(caddi, {
 GEN(cjal, {
     vm_reg[0] = map_vm_reg(state, rv_reg_ra);
     emit_load_imm(state, vm_reg[0], ir->pc + 2);
+    emit_ras_push(state, rv, ir->pc + 2);
+    if (ir->next)
+        return;
     store_back(state);
+    emit_back_edge(state, ir, ir->pc + ir->imm);
     emit_jmp(state, ir->pc + ir->imm, rv->csr_satp);
     emit_load_imm(state, temp_reg, ir->pc + ir->imm);
     emit_store(state, S32, temp_reg, parameter_reg[0], offsetof(riscv_t, PC));
@@ -696,7 +752,10 @@ GEN(cand, {
     emit_alu32(state, 0x21, temp_reg, vm_reg[2]);
 })
 GEN(cj, {
+    if (ir->next)
+        return;
     store_back(state);
+    emit_back_edge(state, ir, ir->pc + ir->imm);
     emit_jmp(state, ir->pc + ir->imm, rv->csr_satp);
     emit_load_imm(state, temp_reg, ir->pc + ir->imm);
     emit_store(state, S32, temp_reg, parameter_reg[0], offsetof(riscv_t, PC));
@@ -713,16 +772,19 @@ GEN(cslli, {
 GEN(clwsp, {
     memory_t *m = PRIV(rv)->mem;
     vm_reg[0] = ra_load(state, rv_reg_sp);
-    emit_load_imm_sext(state, temp_reg, (intptr_t) (m->mem_base + ir->imm));
+    emit_load_host_addr(state, temp_reg, (uintptr_t) (m->mem_base + ir->imm),
+                        RELOC_MEM);
     emit_alu64(state, 0x01, vm_reg[0], temp_reg);
     vm_reg[1] = map_vm_reg(state, ir->rd);
     emit_load(state, S32, temp_reg, vm_reg[1], 0);
 })
 GEN(cjr, {
+    const uint32_t ras_op = ras_action(rv_reg_zero, ir->rs1);
     vm_reg[0] = ra_load(state, ir->rs1);
     emit_mov(state, vm_reg[0], temp_reg);
     store_back(state);
-    parse_branch_history_table(state, rv, ir);
+    if (!emit_ras_return(state, rv, ir, ras_op, 0))
+        parse_branch_history_table(state, rv, ir);
     emit_store(state, S32, temp_reg, parameter_reg[0], offsetof(riscv_t, PC));
     emit_exit(state);
 })
@@ -743,12 +805,16 @@ GEN(cebreak, {
     emit_exit(state);
 })
 GEN(cjalr, {
+    const uint32_t ras_op = ras_action(rv_reg_ra, ir->rs1);
+    if (ras_op == RAS_PUSH)
+        emit_ras_push(state, rv, ir->pc + 2);
     vm_reg[0] = ra_load(state, ir->rs1);
     emit_mov(state, vm_reg[0], temp_reg);
     vm_reg[1] = map_vm_reg(state, rv_reg_ra);
     emit_load_imm(state, vm_reg[1], ir->pc + 2);
     store_back(state);
-    parse_branch_history_table(state, rv, ir);
+    if (!emit_ras_return(state, rv, ir, ras_op, ir->pc + 2))
+        parse_branch_history_table(state, rv, ir);
     emit_store(state, S32, temp_reg, parameter_reg[0], offsetof(riscv_t, PC));
     emit_exit(state);
 })
@@ -762,17 +828,18 @@ GEN(cadd, {
 GEN(cswsp, {
     memory_t *m = PRIV(rv)->mem;
     vm_reg[0] = ra_load(state, rv_reg_sp);
-    emit_load_imm_sext(state, temp_reg, (intptr_t) (m->mem_base + ir->imm));
+    emit_load_host_addr(state, temp_reg, (uintptr_t) (m->mem_base + ir->imm),
+                        RELOC_MEM);
     emit_alu64(state, 0x01, vm_reg[0], temp_reg);
     vm_reg[1] = ra_load(state, ir->rs2);
     emit_store(state, S32, vm_reg[1], temp_reg, 0);
 })
 #endif
 #if RV32_HAS(EXT_C) && RV32_HAS(EXT_F)
-GEN(cflwsp, { assert(NULL); })
-GEN(cfswsp, { assert(NULL); })
-GEN(cflw, { assert(NULL); })
-GEN(cfsw, { assert(NULL); })
+GEN(cflwsp, { emit_fp_load(state, rv, ir, rv_reg_sp); })
+GEN(cfswsp, { emit_fp_store(state, rv, ir, rv_reg_sp); })
+GEN(cflw, { emit_fp_load(state, rv, ir, ir->rs1); })
+GEN(cfsw, { emit_fp_store(state, rv, ir, ir->rs1); })
 #endif
 #if RV32_HAS(Zba)
 GEN(sh1add, { assert(NULL); })
@@ -816,7 +883,7 @@ GEN(bseti, { assert(NULL); })
 #endif
 
 #if RV32_HAS(EXT_V)
-/* JIT stubs for every V opcode. We deliberately reuse rv32_v_constopt.c
+/* Handlers for every V opcode. We deliberately reuse rv32_v_constopt.c
  * for the opcode list instead of including rv32_v_template.c here: the
  * interpreter template defines static-inline FP helpers (FMASK_SIGN /
  * is_nan / softfloat shims) that depend on rv32_template.c's earlier F
@@ -827,12 +894,29 @@ GEN(bseti, { assert(NULL); })
  * the macro converts the list to GEN handlers without touching the rest
  * of the file.
  *
- * Vector instructions are marked translatable=0 in src/decode.h, so the
- * JIT never reaches these handlers in normal flow. The assert(NULL)
- * stub catches accidental flips of that flag without quietly emitting
- * empty (wrong) JIT code for vector ops.
+ * Vector state lives in riscv_t beyond the reach of the short Arm64 load
+ * and store displacements, so each instruction becomes a call to
+ * jit_vector_handler(), which runs host SIMD kernels for the common unmasked
+ * cases and the interpreter handler otherwise. The surrounding scalar code
+ * (strip-mining loop, pointer bumps, branches) stays native. A zero return
+ * means the instruction trapped and the trap handler already set rv->PC.
+ *
+ * Only the opcodes marked translatable in src/decode.h reach these
+ * handlers; jit_vector_pack() asserts on the others.
  */
-#define CONSTOPT(inst, body) GEN(inst, { assert(NULL); })
+#define CONSTOPT(inst, body)                                                \
+    GEN(inst, {                                                             \
+        store_back(state);                                                  \
+        emit_insn_helper(state, (intptr_t) &jit_vector_handler, ir->opcode, \
+                         jit_vector_pack(ir), ir->pc);                      \
+        /* the helper may write X[rd] and clobbers host registers */        \
+        reset_reg();                                                        \
+        emit_cmp_imm32(state, temp_reg, 0);                                 \
+        uint32_t jump_loc_0 = state->offset;                                \
+        emit_jcc_offset(state, JCC_JNE);                                    \
+        emit_exit(state);                                                   \
+        emit_jump_target_offset(state, JUMP_LOC_0, state->offset);          \
+    })
 #include "rv32_v_constopt.c"
 #undef CONSTOPT
 #endif
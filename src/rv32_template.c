@@ -52,23 +52,23 @@ RVOP(jal, {
     /* link with return address */
     if (ir->rd)
         rv->X[ir->rd] = pc + 4;
+    if (ras_action(ir->rd, 0) & RAS_PUSH)
+        ras_push(rv, pc + 4);
     /* check instruction misaligned */
 #if !RV32_HAS(EXT_C)
     RV_EXC_MISALIGN_HANDLER(pc, INSN, false, 0);
 #endif
+    RVOP_SUPERBLOCK_NEXT(rv, ir, cycle, PC);
     struct rv_insn *taken = ir->branch_taken;
     if (taken) {
 #if RV32_HAS(JIT)
-        IIF(RV32_HAS(SYSTEM)(if (!rv->is_trapped && !reloc_enable_mmu), ))
+        IIF(RV32_HAS(SYSTEM)(if (!rv->is_trapped && !rv->reloc_enable_mmu), ))
         {
-            IIF(RV32_HAS(SYSTEM))(block_t *next =, )
-                cache_get(rv->block_cache, PC, true);
+            block_t *next = cache_get(rv->block_cache, PC, true);
             IIF(RV32_HAS(SYSTEM))(
                 if (next->satp == rv->csr_satp && !next->invalidated), )
             {
-                if (!set_add(&pc_set, PC))
-                    has_loops = true;
-                if (cache_hot(rv->block_cache, PC))
+                if (jit_chain_exit(rv, next, PC))
                     goto end_op;
             }
         }
@@ -87,7 +87,7 @@ RVOP(jal, {
              * This rule also applies to same statements elsewhere in this
              * file.
              */
-            last_pc = PC;
+            rv->last_pc = PC;
 
             MUST_TAIL return taken->impl(rv, taken, cycle, PC);
         }
@@ -114,7 +114,7 @@ RVOP(jal, {
      */                                                                        \
     IIF(RV32_HAS(GDBSTUB)(if (!rv->debug_mode), ))                             \
     {                                                                          \
-        IIF(RV32_HAS(SYSTEM)(if (!rv->is_trapped && !reloc_enable_mmu), ))     \
+        IIF(RV32_HAS(SYSTEM)(if (!rv->is_trapped && !rv->reloc_enable_mmu), )) \
         {                                                                      \
             /* Direct-mapped lookup: O(1) instead of O(n) linear search */     \
             const uint32_t bht_idx = (PC >> 2) & (HISTORY_SIZE - 1);           \
@@ -124,7 +124,7 @@ RVOP(jal, {
                     rv, ir->branch_table->target[bht_idx], cycle, PC);         \
             }                                                                  \
             block_t *block = block_find(&rv->block_map, PC);                   \
-            if (block) {                                                       \
+            if (block && block_chainable(block)) {                             \
                 /* Direct replacement at computed index */                     \
                 ir->branch_table->PC[bht_idx] = PC;                            \
                 ir->branch_table->target[bht_idx] = block->ir_head;            \
@@ -135,10 +135,10 @@ RVOP(jal, {
     }
 #else
 #define LOOKUP_OR_UPDATE_BRANCH_HISTORY_TABLE()                              \
-    IIF(RV32_HAS(SYSTEM))(if (!rv->is_trapped && !reloc_enable_mmu), )       \
+    IIF(RV32_HAS(SYSTEM))(if (!rv->is_trapped && !rv->reloc_enable_mmu), )   \
     {                                                                        \
         block_t *block = cache_get(rv->block_cache, PC, true);               \
-        if (block) {                                                         \
+        if (block && block_chainable(block)) {                               \
             /* Direct-mapped lookup: O(1) instead of O(n) linear search */   \
             const uint32_t bht_idx = (PC >> 2) & (HISTORY_SIZE - 1);         \
             if (ir->branch_table->PC[bht_idx] == PC) {                       \
@@ -146,7 +146,8 @@ RVOP(jal, {
                     if (ir->branch_table->satp[bht_idx] == rv->csr_satp), )  \
                 {                                                            \
                     ir->branch_table->times[bht_idx]++;                      \
-                    if (cache_hot(rv->block_cache, PC))                      \
+                    if (cache_freq(rv->block_cache, PC) >=                   \
+                        hot_threshold(rv))                                   \
                         goto end_op;                                         \
                 }                                                            \
             }                                                                \
@@ -155,7 +156,7 @@ RVOP(jal, {
             ir->branch_table->PC[bht_idx] = PC;                              \
             IIF(RV32_HAS(SYSTEM))(                                           \
                 ir->branch_table->satp[bht_idx] = rv->csr_satp, );           \
-            if (cache_hot(rv->block_cache, PC))                              \
+            if (cache_freq(rv->block_cache, PC) >= hot_threshold(rv))        \
                 goto end_op;                                                 \
             MUST_TAIL return block->ir_head->impl(rv, block->ir_head, cycle, \
                                                   PC);                       \
@@ -163,6 +164,50 @@ RVOP(jal, {
     }
 #endif
 
+/* Push and pop the return address stack for an indirect jump to PC, as @op
+ * from ras_action() says, and push @link. Without the JIT, a return that the
+ * stack predicts continues at the IR cached in the popped entry, so that
+ * returns from a function called from many sites do not thrash the branch
+ * history table. With the JIT, the interpreter only keeps the stack in step
+ * for T1 code, and counts how often it predicts each return, so that T1 code
+ * leaves out the prediction for returns it keeps missing. The guards are those
+ * of the branch history table.
+ */
+#if !RV32_HAS(JIT)
+#define RAS_UPDATE(op, link)                                                   \
+    {                                                                          \
+        ras_entry_t *ras_entry = (op) & RAS_POP ? ras_pop(rv, PC) : NULL;      \
+        rv_insn_t *ras_target = NULL;                                          \
+        IIF(RV32_HAS(GDBSTUB))(if (!rv->debug_mode), )                         \
+        IIF(RV32_HAS(SYSTEM))(if (!rv->is_trapped && !rv->reloc_enable_mmu), ) \
+        if (ras_entry) {                                                       \
+            ras_target = ras_entry->target;                                    \
+            if (!ras_target) {                                                 \
+                block_t *block = block_find(&rv->block_map, PC);               \
+                if (block && block_chainable(block))                           \
+                    ras_target = block->ir_head;                               \
+                ras_entry->target = ras_target;                                \
+            }                                                                  \
+        }                                                                      \
+        if ((op) & RAS_PUSH)                                                   \
+            ras_push(rv, link);                                                \
+        if (ras_target)                                                        \
+            MUST_TAIL return ras_target->impl(rv, ras_target, cycle, PC);      \
+    }
+#else
+#define RAS_UPDATE(op, link)                    \
+    {                                           \
+        if ((op) & RAS_POP) {                   \
+            if (ras_pop(rv, PC))                \
+                ir->branch_table->ras_hits++;   \
+            else                                \
+                ir->branch_table->ras_misses++; \
+        }                                       \
+        if ((op) & RAS_PUSH)                    \
+            ras_push(rv, link);                 \
+    }
+#endif
+
 /* The indirect jump instruction JALR uses the I-type encoding. The target
  * address is obtained by adding the sign-extended 12-bit I-immediate to the
  * register rs1, then setting the least-significant bit of the result to zero.
@@ -181,6 +226,7 @@ RVOP(jalr, {
 #if !RV32_HAS(EXT_C)
     RV_EXC_MISALIGN_HANDLER(pc, INSN, false, 0);
 #endif
+    RAS_UPDATE(ras_action(ir->rd, ir->rs1), pc + 4);
     LOOKUP_OR_UPDATE_BRANCH_HISTORY_TABLE();
 
 #if RV32_HAS(SYSTEM)
@@ -197,9 +243,9 @@ RVOP(jalr, {
      * Based on this, we need to manually escape from the trap_handler after
      * the jalr instruction is executed.
      */
-    if (!reloc_enable_mmu && reloc_enable_mmu_jalr_addr == 0xc00000b4) {
-        reloc_enable_mmu = true;
-        need_retranslate = true;
+    if (!rv->reloc_enable_mmu && rv->reloc_enable_mmu_jalr_addr == 0xc00000b4) {
+        rv->reloc_enable_mmu = true;
+        rv->need_retranslate = true;
         rv->is_trapped = false;
     }
 
@@ -219,10 +265,12 @@ RVOP(jalr, {
         IIF(RV32_HAS(SYSTEM))(                                                 \
             {                                                                  \
                 if (!rv->is_trapped) {                                         \
-                    is_branch_taken = false;                                   \
+                    rv->is_branch_taken = false;                               \
                 }                                                              \
             },                                                                 \
-            is_branch_taken = false;);                                         \
+            rv->is_branch_taken = false;);                                     \
+        RVOP_SUPERBLOCK_COUNT(ir, untaken);                                    \
+        RVOP_SUPERBLOCK_FALLTHROUGH(rv, ir, cycle, PC, 4);                     \
         struct rv_insn *untaken = ir->branch_untaken;                          \
         if (!untaken)                                                          \
             goto nextop;                                                       \
@@ -231,9 +279,7 @@ RVOP(jalr, {
                 block_t *next = cache_get(rv->block_cache, PC + 4, true);      \
                 if (next IIF(RV32_HAS(SYSTEM))(&&next->satp == rv->csr_satp && \
                                                    !next->invalidated, )) {    \
-                    if (!set_add(&pc_set, PC + 4))                             \
-                        has_loops = true;                                      \
-                    if (cache_hot(rv->block_cache, PC + 4))                    \
+                    if (jit_chain_exit(rv, next, PC + 4))                      \
                         goto nextop;                                           \
                 }                                                              \
             }, );                                                              \
@@ -241,7 +287,7 @@ RVOP(jalr, {
         IIF(RV32_HAS(SYSTEM))(                                                 \
             {                                                                  \
                 if (!rv->is_trapped) {                                         \
-                    last_pc = PC;                                              \
+                    rv->last_pc = PC;                                          \
                     MUST_TAIL return untaken->impl(rv, untaken, cycle, PC);    \
                 }                                                              \
             }, );                                                              \
@@ -250,13 +296,15 @@ RVOP(jalr, {
     IIF(RV32_HAS(SYSTEM))(                                                     \
         {                                                                      \
             if (!rv->is_trapped) {                                             \
-                is_branch_taken = true;                                        \
+                rv->is_branch_taken = true;                                    \
             }                                                                  \
         },                                                                     \
-        is_branch_taken = true;);                                              \
+        rv->is_branch_taken = true;);                                          \
+    RVOP_SUPERBLOCK_COUNT(ir, taken);                                          \
     PC += ir->imm;                                                             \
     /* check instruction misaligned */                                         \
     IIF(RV32_HAS(EXT_C))(, RV_EXC_MISALIGN_HANDLER(pc, INSN, false, 0););      \
+    RVOP_SUPERBLOCK_NEXT(rv, ir, cycle, PC);                                   \
     struct rv_insn *taken = ir->branch_taken;                                  \
     if (taken) {                                                               \
         IIF(RV32_HAS(JIT))(                                                    \
@@ -264,16 +312,14 @@ RVOP(jalr, {
                 block_t *next = cache_get(rv->block_cache, PC, true);          \
                 if (next IIF(RV32_HAS(SYSTEM))(&&next->satp == rv->csr_satp && \
                                                    !next->invalidated, )) {    \
-                    if (!set_add(&pc_set, PC))                                 \
-                        has_loops = true;                                      \
-                    if (cache_hot(rv->block_cache, PC))                        \
+                    if (jit_chain_exit(rv, next, PC))                          \
                         goto end_op;                                           \
                 }                                                              \
             }, );                                                              \
         IIF(RV32_HAS(SYSTEM))(                                                 \
             {                                                                  \
                 if (!rv->is_trapped) {                                         \
-                    last_pc = PC;                                              \
+                    rv->last_pc = PC;                                          \
                     MUST_TAIL return taken->impl(rv, taken, cycle, PC);        \
                 }                                                              \
             }, );                                                              \
@@ -522,7 +568,13 @@ RVOP(
  */
 RVOP(fence, {
     PC += 4;
-    /* FIXME: fill real implementations */
+#if RV32_HAS(SYSTEM_MMIO)
+    /* Other harts run on other host threads: order this hart's accesses to
+     * guest RAM against theirs. The predecessor/successor sets are not
+     * decoded, every FENCE is a full barrier.
+     */
+    ATOMIC_THREAD_FENCE(ATOMIC_SEQ_CST);
+#endif
     goto end_op;
 })
 
@@ -547,8 +599,14 @@ RVOP(ebreak, {
 /* WFI: Wait for Interrupt */
 RVOP(wfi, {
     PC += 4;
-    /* FIXME: Implement */
+#if RV32_HAS(SYSTEM_MMIO)
+    rv->csr_cycle = cycle;
+    rv->PC = PC;
+    rv_wfi(rv);
+    return true;
+#else
     goto end_op;
+#endif
 })
 
 /* URET: return from traps in U-mode */
@@ -600,7 +658,8 @@ RVOP(mret, {
  * This instruction invalidates TLB entries:
  * - rs1 = 0: all TLB entries (global flush)
  * - rs1 != 0: only the entry for virtual address in rs1
- * The rs2 field specifies ASID (not implemented, treated as global).
+ * - rs2 != 0: limited to the address space whose ASID is in rs2, global
+ *   mappings excepted
  *
  * For JIT mode, we also invalidate compiled blocks that may contain stale
  * VA→PA mappings. This is necessary when PTEs are modified without changing
@@ -610,42 +669,33 @@ RVOP(sfencevma, {
     PC += 4;
 #if RV32_HAS(SYSTEM)
     if (ir->rs1 == 0) {
-        /* Global flush: invalidate all TLB entries */
-        mmu_tlb_flush_all(rv);
+        /* Global flush: invalidate all TLB entries (of the ASID) */
+        if (ir->rs2)
+            mmu_tlb_flush_asid(rv, rv->X[ir->rs2]);
+        else
+            mmu_tlb_flush_all(rv);
 #if RV32_HAS(JIT)
-#if RV32_HAS(T2C)
-        /* Hold cache_lock during invalidation to prevent race with T2C
-         * compilation thread. This ensures the invalidated flag and hot2 reset
-         * are seen atomically by the T2C thread.
-         */
-        pthread_mutex_lock(&rv->cache_lock);
-#endif
         /* Invalidate JIT blocks with current SATP */
         cache_invalidate_satp(rv->block_cache, rv->csr_satp);
 #if RV32_HAS(T2C)
         jit_cache_clear(rv->jit_cache);
         inline_cache_clear(rv->inline_cache);
-        pthread_mutex_unlock(&rv->cache_lock);
 #endif
 #endif
     } else {
         /* Selective flush: invalidate TLB entry for specific VA */
         uint32_t va = rv->X[ir->rs1];
-        mmu_tlb_flush(rv, va);
+        if (ir->rs2)
+            mmu_tlb_flush_page_asid(rv, va, rv->X[ir->rs2]);
+        else
+            mmu_tlb_flush(rv, va);
 #if RV32_HAS(JIT)
-#if RV32_HAS(T2C)
-        /* Hold cache_lock during invalidation to prevent race with T2C
-         * compilation thread.
-         */
-        pthread_mutex_lock(&rv->cache_lock);
-#endif
         /* Invalidate JIT blocks in the target VA page */
         cache_invalidate_va(rv->block_cache, va, rv->csr_satp);
 #if RV32_HAS(T2C)
         /* Selectively clear only jit_cache entries matching the VA page */
         jit_cache_clear_page(rv->jit_cache, va, rv->csr_satp);
         inline_cache_clear_page(rv->inline_cache, va, rv->csr_satp);
-        pthread_mutex_unlock(&rv->cache_lock);
 #endif
 #endif
     }
@@ -656,38 +706,45 @@ RVOP(sfencevma, {
 #if RV32_HAS(Zifencei) /* RV32 Zifencei Standard Extension */
 /* FENCE.I: Instruction fence for self-modifying code synchronization.
  * Ensures that stores to instruction memory are visible to instruction fetches.
- * Must invalidate all cached/JITed code since instruction stream may have
- * changed.
  *
  * Unlike SFENCE.VMA which handles virtual memory changes, FENCE.I handles
  * instruction cache coherence - required when code modifies itself or loads
  * new code (e.g., dynamic linkers, JIT compilers running inside the guest).
+ *
+ * In system mode the hart knows the physical pages written since it
+ * translated code from them (see mmu_code_written()), so only the blocks of
+ * those pages are dropped, in every address space, and nothing at all when
+ * no code was written. Without the JIT the IR of the blocks links across
+ * them, so any written code drops the whole block map. In user mode,
+ * self-modifying code is rare and blocks will be naturally evicted.
  */
 RVOP(fencei, {
     PC += 4;
-#if RV32_HAS(JIT) && RV32_HAS(SYSTEM)
+#if RV32_HAS(SYSTEM)
+    if (mmu_code_fence(rv)) {
+#if RV32_HAS(JIT)
 #if RV32_HAS(T2C)
-    /* Hold cache_lock during invalidation to prevent race with T2C
-     * compilation thread. Same locking protocol as SFENCE.VMA.
-     */
-    pthread_mutex_lock(&rv->cache_lock);
+        /* T2C code is not tracked by page, so any invalidated block drops
+         * all of it.
+         */
+        if (cache_invalidate_pages(rv->block_cache, rv->fence_pages,
+                                   rv->code_words * 32)) {
+            jit_cache_clear(rv->jit_cache);
+            inline_cache_clear(rv->inline_cache);
+        }
+#else
+        cache_invalidate_pages(rv->block_cache, rv->fence_pages,
+                               rv->code_words * 32);
 #endif
-    /* Invalidate all JIT blocks for current address space.
-     * FENCE.I is a global instruction cache barrier - must clear all cached
-     * code since we don't know which addresses were modified.
-     * Uses same invalidation as global SFENCE.VMA (rs1=0).
-     */
-    cache_invalidate_satp(rv->block_cache, rv->csr_satp);
-#if RV32_HAS(T2C)
-    jit_cache_clear(rv->jit_cache);
-    inline_cache_clear(rv->inline_cache);
-    pthread_mutex_unlock(&rv->cache_lock);
+#else
+        /* leave the freed block the way the RVOP epilogue does */
+        block_map_clear(rv);
+        rv->csr_cycle = cycle;
+        rv->PC = PC;
+        return false;
 #endif
+    }
 #endif
-    /* Note: In non-system JIT mode, self-modifying code is rare and blocks
-     * will be naturally evicted. Full cache invalidation is not implemented
-     * for this case as it would require additional infrastructure.
-     */
     rv->csr_cycle = cycle;
     rv->PC = PC;
     return true;
@@ -863,173 +920,189 @@ RVOP(remu, {
  * when performing 32-bit AMOs, the value placed in the register rd is always
  * sign-extended.
  *
- * At present, AMO is not implemented atomically because the emulated RISC-V
- * core just runs on single thread, and no out-of-order execution happens.
- * In addition, rl/aq are not handled.
+ * With several harts, an instruction that targets guest RAM is carried out
+ * with host atomics by rv_atomic_on_host(), which treats every AMO as aq/rl.
+ * Otherwise the plain read-modify-write below is used: a single hart runs on
+ * one thread and no out-of-order execution happens.
  */
 
 /* LR.W: Load Reserved */
 RVOP(lrw, {
     const uint32_t addr = rv->X[ir->rs1];
     RV_EXC_MISALIGN_HANDLER(3, LOAD, false, 1);
-    if (ir->rd)
+    if (!rv_atomic_on_host(rv, ir, addr) && ir->rd)
         rv->X[ir->rd] = MEM_READ_W(rv, addr);
-    /* skip registration of the 'reservation set'
-     * FIXME: unimplemented
-     */
 })
 
 /* SC.W: Store Conditional */
 RVOP(scw, {
-    /* assume the 'reservation set' is valid
-     * FIXME: unimplemented
-     */
     const uint32_t addr = rv->X[ir->rs1];
     RV_EXC_MISALIGN_HANDLER(3, STORE, false, 1);
-    const uint32_t value = rv->X[ir->rs2];
-    MEM_WRITE_W(rv, addr, value);
-    rv->X[ir->rd] = 0;
+    if (!rv_atomic_on_host(rv, ir, addr)) {
+        /* without other harts the reservation is always valid */
+        const uint32_t value = rv->X[ir->rs2];
+        MEM_WRITE_W(rv, addr, value);
+        rv->X[ir->rd] = 0;
 #if RV32_HAS(ARCH_TEST)
-    check_tohost_write(rv, addr, value);
+        check_tohost_write(rv, addr, value);
 #endif
+    }
 })
 
 /* AMOSWAP.W: Atomic Swap */
 RVOP(amoswapw, {
     const uint32_t addr = rv->X[ir->rs1];
     RV_EXC_MISALIGN_HANDLER(3, LOAD, false, 1);
-    const uint32_t value1 = MEM_READ_W(rv, addr);
-    const uint32_t value2 = rv->X[ir->rs2];
-    if (ir->rd)
-        rv->X[ir->rd] = value1;
-    MEM_WRITE_W(rv, addr, value2);
+    if (!rv_atomic_on_host(rv, ir, addr)) {
+        const uint32_t value1 = MEM_READ_W(rv, addr);
+        const uint32_t value2 = rv->X[ir->rs2];
+        if (ir->rd)
+            rv->X[ir->rd] = value1;
+        MEM_WRITE_W(rv, addr, value2);
 #if RV32_HAS(ARCH_TEST)
-    check_tohost_write(rv, addr, value2);
+        check_tohost_write(rv, addr, value2);
 #endif
+    }
 })
 
 /* AMOADD.W: Atomic ADD */
 RVOP(amoaddw, {
     const uint32_t addr = rv->X[ir->rs1];
     RV_EXC_MISALIGN_HANDLER(3, LOAD, false, 1);
-    const uint32_t value1 = MEM_READ_W(rv, addr);
-    const uint32_t value2 = rv->X[ir->rs2];
-    if (ir->rd)
-        rv->X[ir->rd] = value1;
-    const uint32_t res = value1 + value2;
-    MEM_WRITE_W(rv, addr, res);
+    if (!rv_atomic_on_host(rv, ir, addr)) {
+        const uint32_t value1 = MEM_READ_W(rv, addr);
+        const uint32_t value2 = rv->X[ir->rs2];
+        if (ir->rd)
+            rv->X[ir->rd] = value1;
+        const uint32_t res = value1 + value2;
+        MEM_WRITE_W(rv, addr, res);
 #if RV32_HAS(ARCH_TEST)
-    check_tohost_write(rv, addr, res);
+        check_tohost_write(rv, addr, res);
 #endif
+    }
 })
 
 /* AMOXOR.W: Atomic XOR */
 RVOP(amoxorw, {
     const uint32_t addr = rv->X[ir->rs1];
     RV_EXC_MISALIGN_HANDLER(3, LOAD, false, 1);
-    const uint32_t value1 = MEM_READ_W(rv, addr);
-    const uint32_t value2 = rv->X[ir->rs2];
-    if (ir->rd)
-        rv->X[ir->rd] = value1;
-    const uint32_t res = value1 ^ value2;
-    MEM_WRITE_W(rv, addr, res);
+    if (!rv_atomic_on_host(rv, ir, addr)) {
+        const uint32_t value1 = MEM_READ_W(rv, addr);
+        const uint32_t value2 = rv->X[ir->rs2];
+        if (ir->rd)
+            rv->X[ir->rd] = value1;
+        const uint32_t res = value1 ^ value2;
+        MEM_WRITE_W(rv, addr, res);
 #if RV32_HAS(ARCH_TEST)
-    check_tohost_write(rv, addr, res);
+        check_tohost_write(rv, addr, res);
 #endif
+    }
 })
 
 /* AMOAND.W: Atomic AND */
 RVOP(amoandw, {
     const uint32_t addr = rv->X[ir->rs1];
     RV_EXC_MISALIGN_HANDLER(3, LOAD, false, 1);
-    const uint32_t value1 = MEM_READ_W(rv, addr);
-    const uint32_t value2 = rv->X[ir->rs2];
-    if (ir->rd)
-        rv->X[ir->rd] = value1;
-    const uint32_t res = value1 & value2;
-    MEM_WRITE_W(rv, addr, res);
+    if (!rv_atomic_on_host(rv, ir, addr)) {
+        const uint32_t value1 = MEM_READ_W(rv, addr);
+        const uint32_t value2 = rv->X[ir->rs2];
+        if (ir->rd)
+            rv->X[ir->rd] = value1;
+        const uint32_t res = value1 & value2;
+        MEM_WRITE_W(rv, addr, res);
 #if RV32_HAS(ARCH_TEST)
-    check_tohost_write(rv, addr, res);
+        check_tohost_write(rv, addr, res);
 #endif
+    }
 })
 
 /* AMOOR.W: Atomic OR */
 RVOP(amoorw, {
     const uint32_t addr = rv->X[ir->rs1];
     RV_EXC_MISALIGN_HANDLER(3, LOAD, false, 1);
-    const uint32_t value1 = MEM_READ_W(rv, addr);
-    const uint32_t value2 = rv->X[ir->rs2];
-    if (ir->rd)
-        rv->X[ir->rd] = value1;
-    const uint32_t res = value1 | value2;
-    MEM_WRITE_W(rv, addr, res);
+    if (!rv_atomic_on_host(rv, ir, addr)) {
+        const uint32_t value1 = MEM_READ_W(rv, addr);
+        const uint32_t value2 = rv->X[ir->rs2];
+        if (ir->rd)
+            rv->X[ir->rd] = value1;
+        const uint32_t res = value1 | value2;
+        MEM_WRITE_W(rv, addr, res);
 #if RV32_HAS(ARCH_TEST)
-    check_tohost_write(rv, addr, res);
+        check_tohost_write(rv, addr, res);
 #endif
+    }
 })
 
 /* AMOMIN.W: Atomic MIN */
 RVOP(amominw, {
     const uint32_t addr = rv->X[ir->rs1];
     RV_EXC_MISALIGN_HANDLER(3, LOAD, false, 1);
-    const uint32_t value1 = MEM_READ_W(rv, addr);
-    const uint32_t value2 = rv->X[ir->rs2];
-    if (ir->rd)
-        rv->X[ir->rd] = value1;
-    const int32_t a = value1;
-    const int32_t b = value2;
-    const uint32_t res = a < b ? value1 : value2;
-    MEM_WRITE_W(rv, addr, res);
+    if (!rv_atomic_on_host(rv, ir, addr)) {
+        const uint32_t value1 = MEM_READ_W(rv, addr);
+        const uint32_t value2 = rv->X[ir->rs2];
+        if (ir->rd)
+            rv->X[ir->rd] = value1;
+        const int32_t a = value1;
+        const int32_t b = value2;
+        const uint32_t res = a < b ? value1 : value2;
+        MEM_WRITE_W(rv, addr, res);
 #if RV32_HAS(ARCH_TEST)
-    check_tohost_write(rv, addr, res);
+        check_tohost_write(rv, addr, res);
 #endif
+    }
 })
 
 /* AMOMAX.W: Atomic MAX */
 RVOP(amomaxw, {
     const uint32_t addr = rv->X[ir->rs1];
     RV_EXC_MISALIGN_HANDLER(3, LOAD, false, 1);
-    const uint32_t value1 = MEM_READ_W(rv, addr);
-    const uint32_t value2 = rv->X[ir->rs2];
-    if (ir->rd)
-        rv->X[ir->rd] = value1;
-    const int32_t a = value1;
-    const int32_t b = value2;
-    const uint32_t res = a > b ? value1 : value2;
-    MEM_WRITE_W(rv, addr, res);
+    if (!rv_atomic_on_host(rv, ir, addr)) {
+        const uint32_t value1 = MEM_READ_W(rv, addr);
+        const uint32_t value2 = rv->X[ir->rs2];
+        if (ir->rd)
+            rv->X[ir->rd] = value1;
+        const int32_t a = value1;
+        const int32_t b = value2;
+        const uint32_t res = a > b ? value1 : value2;
+        MEM_WRITE_W(rv, addr, res);
 #if RV32_HAS(ARCH_TEST)
-    check_tohost_write(rv, addr, res);
+        check_tohost_write(rv, addr, res);
 #endif
+    }
 })
 
 /* AMOMINU.W */
 RVOP(amominuw, {
     const uint32_t addr = rv->X[ir->rs1];
     RV_EXC_MISALIGN_HANDLER(3, LOAD, false, 1);
-    const uint32_t value1 = MEM_READ_W(rv, addr);
-    const uint32_t value2 = rv->X[ir->rs2];
-    if (ir->rd)
-        rv->X[ir->rd] = value1;
-    const uint32_t ures = value1 < value2 ? value1 : value2;
-    MEM_WRITE_W(rv, addr, ures);
+    if (!rv_atomic_on_host(rv, ir, addr)) {
+        const uint32_t value1 = MEM_READ_W(rv, addr);
+        const uint32_t value2 = rv->X[ir->rs2];
+        if (ir->rd)
+            rv->X[ir->rd] = value1;
+        const uint32_t ures = value1 < value2 ? value1 : value2;
+        MEM_WRITE_W(rv, addr, ures);
 #if RV32_HAS(ARCH_TEST)
-    check_tohost_write(rv, addr, ures);
+        check_tohost_write(rv, addr, ures);
 #endif
+    }
 })
 
 /* AMOMAXU.W */
 RVOP(amomaxuw, {
     const uint32_t addr = rv->X[ir->rs1];
     RV_EXC_MISALIGN_HANDLER(3, LOAD, false, 1);
-    const uint32_t value1 = MEM_READ_W(rv, addr);
-    const uint32_t value2 = rv->X[ir->rs2];
-    if (ir->rd)
-        rv->X[ir->rd] = value1;
-    const uint32_t ures = value1 > value2 ? value1 : value2;
-    MEM_WRITE_W(rv, addr, ures);
+    if (!rv_atomic_on_host(rv, ir, addr)) {
+        const uint32_t value1 = MEM_READ_W(rv, addr);
+        const uint32_t value2 = rv->X[ir->rs2];
+        if (ir->rd)
+            rv->X[ir->rd] = value1;
+        const uint32_t ures = value1 > value2 ? value1 : value2;
+        MEM_WRITE_W(rv, addr, ures);
 #if RV32_HAS(ARCH_TEST)
-    check_tohost_write(rv, addr, ures);
+        check_tohost_write(rv, addr, ures);
 #endif
+    }
 })
 #endif /* RV32_HAS(EXT_A) */
 
@@ -1309,18 +1382,17 @@ RVOP(caddi, { rv->X[ir->rd] += (int16_t) ir->imm; })
 /* C.JAL */
 RVOP(cjal, {
     rv->X[rv_reg_ra] = PC + 2;
+    ras_push(rv, PC + 2);
     PC += ir->imm;
+    RVOP_SUPERBLOCK_NEXT(rv, ir, cycle, PC);
     struct rv_insn *taken = ir->branch_taken;
     if (taken) {
 #if RV32_HAS(JIT)
-        IIF(RV32_HAS(SYSTEM))(block_t *next =, )
-            cache_get(rv->block_cache, PC, true);
+        block_t *next = cache_get(rv->block_cache, PC, true);
         IIF(RV32_HAS(SYSTEM))(
             if (next->satp == rv->csr_satp && !next->invalidated), )
         {
-            if (!set_add(&pc_set, PC))
-                has_loops = true;
-            if (cache_hot(rv->block_cache, PC))
+            if (jit_chain_exit(rv, next, PC))
                 goto end_op;
         }
 #endif
@@ -1329,7 +1401,7 @@ RVOP(cjal, {
         if (!rv->is_trapped)
 #endif
         {
-            last_pc = PC;
+            rv->last_pc = PC;
             MUST_TAIL return taken->impl(rv, taken, cycle, PC);
         }
     }
@@ -1398,17 +1470,15 @@ RVOP(cand, { rv->X[ir->rd] = rv->X[ir->rs1] & rv->X[ir->rs2]; })
  */
 RVOP(cj, {
     PC += ir->imm;
+    RVOP_SUPERBLOCK_NEXT(rv, ir, cycle, PC);
     struct rv_insn *taken = ir->branch_taken;
     if (taken) {
 #if RV32_HAS(JIT)
-        IIF(RV32_HAS(SYSTEM))(block_t *next =, )
-            cache_get(rv->block_cache, PC, true);
+        block_t *next = cache_get(rv->block_cache, PC, true);
         IIF(RV32_HAS(SYSTEM))(
             if (next->satp == rv->csr_satp && !next->invalidated), )
         {
-            if (!set_add(&pc_set, PC))
-                has_loops = true;
-            if (cache_hot(rv->block_cache, PC))
+            if (jit_chain_exit(rv, next, PC))
                 goto end_op;
         }
 #endif
@@ -1416,7 +1486,7 @@ RVOP(cj, {
         if (!rv->is_trapped)
 #endif
         {
-            last_pc = PC;
+            rv->last_pc = PC;
             MUST_TAIL return taken->impl(rv, taken, cycle, PC);
         }
     }
@@ -1430,19 +1500,18 @@ RVOP(cj, {
  */
 RVOP(cbeqz, {
     if (rv->X[ir->rs1]) {
-        is_branch_taken = false;
+        rv->is_branch_taken = false;
+        RVOP_SUPERBLOCK_COUNT(ir, untaken);
+        RVOP_SUPERBLOCK_FALLTHROUGH(rv, ir, cycle, PC, 2);
         struct rv_insn *untaken = ir->branch_untaken;
         if (!untaken)
             goto nextop;
 #if RV32_HAS(JIT)
-        IIF(RV32_HAS(SYSTEM))(block_t *next =, )
-            cache_get(rv->block_cache, PC + 2, true);
+        block_t *next = cache_get(rv->block_cache, PC + 2, true);
         IIF(RV32_HAS(SYSTEM))(
             if (next->satp == rv->csr_satp && !next->invalidated), )
         {
-            if (!set_add(&pc_set, PC + 2))
-                has_loops = true;
-            if (cache_hot(rv->block_cache, PC + 2))
+            if (jit_chain_exit(rv, next, PC + 2))
                 goto nextop;
         }
 #endif
@@ -1451,25 +1520,24 @@ RVOP(cbeqz, {
         if (!rv->is_trapped)
 #endif
         {
-            last_pc = PC;
+            rv->last_pc = PC;
             MUST_TAIL return untaken->impl(rv, untaken, cycle, PC);
         }
 
         goto end_op;
     }
-    is_branch_taken = true;
+    rv->is_branch_taken = true;
+    RVOP_SUPERBLOCK_COUNT(ir, taken);
     PC += ir->imm;
+    RVOP_SUPERBLOCK_NEXT(rv, ir, cycle, PC);
     struct rv_insn *taken = ir->branch_taken;
     if (taken) {
 #if RV32_HAS(JIT)
-        IIF(RV32_HAS(SYSTEM))(block_t *next =, )
-            cache_get(rv->block_cache, PC, true);
+        block_t *next = cache_get(rv->block_cache, PC, true);
         IIF(RV32_HAS(SYSTEM))(
             if (next->satp == rv->csr_satp && !next->invalidated), )
         {
-            if (!set_add(&pc_set, PC))
-                has_loops = true;
-            if (cache_hot(rv->block_cache, PC))
+            if (jit_chain_exit(rv, next, PC))
                 goto end_op;
         }
 #endif
@@ -1477,7 +1545,7 @@ RVOP(cbeqz, {
         if (!rv->is_trapped)
 #endif
         {
-            last_pc = PC;
+            rv->last_pc = PC;
             MUST_TAIL return taken->impl(rv, taken, cycle, PC);
         }
     }
@@ -1487,19 +1555,18 @@ RVOP(cbeqz, {
 /* C.BEQZ */
 RVOP(cbnez, {
     if (!rv->X[ir->rs1]) {
-        is_branch_taken = false;
+        rv->is_branch_taken = false;
+        RVOP_SUPERBLOCK_COUNT(ir, untaken);
+        RVOP_SUPERBLOCK_FALLTHROUGH(rv, ir, cycle, PC, 2);
         struct rv_insn *untaken = ir->branch_untaken;
         if (!untaken)
             goto nextop;
 #if RV32_HAS(JIT)
-        IIF(RV32_HAS(SYSTEM))(block_t *next =, )
-            cache_get(rv->block_cache, PC + 2, true);
+        block_t *next = cache_get(rv->block_cache, PC + 2, true);
         IIF(RV32_HAS(SYSTEM))(
             if (next->satp == rv->csr_satp && !next->invalidated), )
         {
-            if (!set_add(&pc_set, PC + 2))
-                has_loops = true;
-            if (cache_hot(rv->block_cache, PC + 2))
+            if (jit_chain_exit(rv, next, PC + 2))
                 goto nextop;
         }
 #endif
@@ -1508,25 +1575,24 @@ RVOP(cbnez, {
         if (!rv->is_trapped)
 #endif
         {
-            last_pc = PC;
+            rv->last_pc = PC;
             MUST_TAIL return untaken->impl(rv, untaken, cycle, PC);
         }
 
         goto end_op;
     }
-    is_branch_taken = true;
+    rv->is_branch_taken = true;
+    RVOP_SUPERBLOCK_COUNT(ir, taken);
     PC += ir->imm;
+    RVOP_SUPERBLOCK_NEXT(rv, ir, cycle, PC);
     struct rv_insn *taken = ir->branch_taken;
     if (taken) {
 #if RV32_HAS(JIT)
-        IIF(RV32_HAS(SYSTEM))(block_t *next =, )
-            cache_get(rv->block_cache, PC, true);
+        block_t *next = cache_get(rv->block_cache, PC, true);
         IIF(RV32_HAS(SYSTEM))(
             if (next->satp == rv->csr_satp && !next->invalidated), )
         {
-            if (!set_add(&pc_set, PC))
-                has_loops = true;
-            if (cache_hot(rv->block_cache, PC))
+            if (jit_chain_exit(rv, next, PC))
                 goto end_op;
         }
 #endif
@@ -1534,7 +1600,7 @@ RVOP(cbnez, {
         if (!rv->is_trapped)
 #endif
         {
-            last_pc = PC;
+            rv->last_pc = PC;
             MUST_TAIL return taken->impl(rv, taken, cycle, PC);
         }
     }
@@ -1557,6 +1623,7 @@ RVOP(clwsp, {
 /* C.JR */
 RVOP(cjr, {
     PC = rv->X[ir->rs1];
+    RAS_UPDATE(ras_action(rv_reg_zero, ir->rs1), 0);
     LOOKUP_OR_UPDATE_BRANCH_HISTORY_TABLE();
     goto end_op;
 })
@@ -1577,8 +1644,10 @@ RVOP(cebreak, {
 RVOP(cjalr, {
     /* Unconditional jump and store PC+2 to ra */
     const int32_t jump_to = rv->X[ir->rs1];
-    rv->X[rv_reg_ra] = PC + 2;
+    const uint32_t link = PC + 2;
+    rv->X[rv_reg_ra] = link;
     PC = jump_to;
+    RAS_UPDATE(ras_action(rv_reg_ra, ir->rs1), link);
     LOOKUP_OR_UPDATE_BRANCH_HISTORY_TABLE();
     goto end_op;
 })
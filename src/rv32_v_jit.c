@@ -0,0 +1,309 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/* RISC-V "V" Vector Extension - runtime for tier-1 code.
+ *
+ * Included from emulate.c when both RV32_HAS(JIT) and RV32_HAS(EXT_V) are
+ * set, after rv32_v_template.c and the dispatch table. T1 code calls
+ * jit_vector_handler() for every vector instruction it translates (see the
+ * V handlers in rv32_jit.c).
+ *
+ * The unmasked forms of the common integer operations, unit-stride accesses
+ * and vredsum run on host SIMD kernels over the register group, which lies
+ * contiguous in rv->V: on a little-endian host, element i of an SEW-bit group
+ * is simply bytes [i * SEW/8, (i + 1) * SEW/8). Each kernel reproduces the
+ * interpreter result bit for bit, tail-agnostic fill included. Anything else
+ * (masked forms, a non-zero vstart, illegal configurations that must trap,
+ * MMU-translated accesses) runs the interpreter handler instead.
+ */
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+#define VREG_BYTES ((VLEN) >> 3)
+
+enum { RVV_JIT_ADD, RVV_JIT_SUB, RVV_JIT_MUL };
+
+static inline uint32_t rvv_jit_elem_op(uint32_t op, uint32_t lhs, uint32_t rhs)
+{
+    switch (op) {
+    case RVV_JIT_ADD:
+        return lhs + rhs;
+    case RVV_JIT_SUB:
+        return lhs - rhs;
+    default:
+        return lhs * rhs;
+    }
+}
+
+static inline uint32_t rvv_jit_load_elem(const uint8_t *p, uint32_t bytes)
+{
+    uint32_t value = 0;
+    memcpy(&value, p, bytes);
+    return value;
+}
+
+#if defined(__x86_64__)
+/* SSE2 has no 32-bit low multiply: multiply the even and odd lanes apart */
+static inline __m128i rvv_sse2_mul32(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+/* nor an 8-bit one: multiply the even and odd bytes as 16-bit lanes */
+static inline __m128i rvv_sse2_mul8(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mullo_epi16(a, b);
+    __m128i odd = _mm_mullo_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+    return _mm_or_si128(_mm_and_si128(even, _mm_set1_epi16(0x00ff)),
+                        _mm_slli_epi16(odd, 8));
+}
+
+static inline __m128i rvv_sse2_op(uint32_t op,
+                                  uint32_t sew,
+                                  __m128i a,
+                                  __m128i b)
+{
+    switch (op) {
+    case RVV_JIT_ADD:
+        return sew == 8    ? _mm_add_epi8(a, b)
+               : sew == 16 ? _mm_add_epi16(a, b)
+                           : _mm_add_epi32(a, b);
+    case RVV_JIT_SUB:
+        return sew == 8    ? _mm_sub_epi8(a, b)
+               : sew == 16 ? _mm_sub_epi16(a, b)
+                           : _mm_sub_epi32(a, b);
+    default:
+        return sew == 8    ? rvv_sse2_mul8(a, b)
+               : sew == 16 ? _mm_mullo_epi16(a, b)
+                           : rvv_sse2_mul32(a, b);
+    }
+}
+#endif
+
+/* dest = lhs op rhs over @n bytes of SEW-bit elements. @rhs advances with the
+ * other operands when @rhs_vec is set, otherwise it is a 16-byte splat.
+ *
+ * Groups never overlap at less than a whole register, and registers are
+ * multiples of 16 bytes, so processing 16 bytes at a time in ascending order
+ * reads the same values as the per-word loop of the interpreter.
+ */
+static void rvv_jit_binop(uint8_t *dest,
+                          const uint8_t *lhs,
+                          const uint8_t *rhs,
+                          bool rhs_vec,
+                          uint32_t n,
+                          uint32_t sew,
+                          uint32_t op)
+{
+    uint32_t i = 0;
+#if defined(__x86_64__)
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (lhs + i));
+        __m128i b =
+            _mm_loadu_si128((const __m128i *) (rhs_vec ? rhs + i : rhs));
+        _mm_storeu_si128((__m128i *) (dest + i), rvv_sse2_op(op, sew, a, b));
+    }
+#endif
+#define RVV_JIT_BINOP_LOOP(type)                                \
+    for (; i < n; i += sizeof(type)) {                          \
+        type a, b;                                              \
+        memcpy(&a, lhs + i, sizeof(type));                      \
+        memcpy(&b, rhs + (rhs_vec ? i : i & 15), sizeof(type)); \
+        a = (type) rvv_jit_elem_op(op, a, b);                   \
+        memcpy(dest + i, &a, sizeof(type));                     \
+    }
+    switch (sew) {
+    case 8:
+        RVV_JIT_BINOP_LOOP(uint8_t);
+        break;
+    case 16:
+        RVV_JIT_BINOP_LOOP(uint16_t);
+        break;
+    default:
+        RVV_JIT_BINOP_LOOP(uint32_t);
+        break;
+    }
+#undef RVV_JIT_BINOP_LOOP
+}
+
+/* Sum of the SEW-bit elements in @n bytes, modulo 2^SEW */
+static uint32_t rvv_jit_sum(const uint8_t *src, uint32_t n, uint32_t sew)
+{
+    uint32_t bytes = sew >> 3, sum = 0, i = 0;
+#if defined(__x86_64__)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16)
+        acc = rvv_sse2_op(RVV_JIT_ADD, sew,
+                          _mm_loadu_si128((const __m128i *) (src + i)), acc);
+    uint8_t lanes[16];
+    _mm_storeu_si128((__m128i *) lanes, acc);
+    for (uint32_t j = 0; j < 16; j += bytes)
+        sum += rvv_jit_load_elem(lanes + j, bytes);
+#endif
+    for (; i < n; i += bytes)
+        sum += rvv_jit_load_elem(src + i, bytes);
+    return sum;
+}
+
+/* vadd/vsub/vmul in the .vv form (@src1 set) or the .vx/.vi form */
+static bool rvv_jit_arith(riscv_t *rv,
+                          const rv_insn_t *ir,
+                          uint32_t op,
+                          const uint32_t *src1,
+                          uint32_t scalar)
+{
+    uint32_t vtype = rv->csr_vtype;
+    if (!ir->vm || rv->csr_vstart || !rvv_require_valid_state(rv))
+        return false;
+
+    uint32_t regs = rvv_group_regs(vtype);
+    if (ir->vd + regs > 32 || ir->vs2 + regs > 32 ||
+        (src1 && ir->vs1 + regs > 32))
+        return false;
+
+    uint32_t sew = rvv_sew_bits(vtype);
+    uint32_t splat[4];
+    if (!src1) {
+        if (sew == 8)
+            scalar = (scalar & 0xff) * 0x01010101U;
+        else if (sew == 16)
+            scalar = (scalar & 0xffff) * 0x00010001U;
+        for (int i = 0; i < 4; i++)
+            splat[i] = scalar;
+    }
+
+    uint8_t *dest = (uint8_t *) rv->V[ir->vd];
+    uint32_t n = rv->csr_vl * (sew >> 3);
+    rvv_jit_binop(dest, (const uint8_t *) rv->V[ir->vs2],
+                  (const uint8_t *) (src1 ? src1 : splat), src1, n, sew, op);
+    if (GET_VTA(vtype))
+        memset(dest + n, 0xff, regs * VREG_BYTES - n);
+    return true;
+}
+
+static bool rvv_jit_redsum(riscv_t *rv, const rv_insn_t *ir)
+{
+    uint32_t vtype = rv->csr_vtype;
+    if (!ir->vm || rv->csr_vstart || !rvv_require_valid_state(rv) ||
+        !rvv_validate_data_reg(vtype, ir->vd) ||
+        !rvv_validate_data_reg(vtype, ir->vs1) ||
+        !rvv_validate_data_reg(vtype, ir->vs2))
+        return false;
+    if (!rv->csr_vl)
+        return true;
+
+    uint32_t sew = rvv_sew_bits(vtype);
+    uint32_t acc = rvv_get_elem(rv, ir->vs1, 0, sew) +
+                   rvv_jit_sum((const uint8_t *) rv->V[ir->vs2],
+                               rv->csr_vl * (sew >> 3), sew);
+    rvv_set_elem(rv, ir->vd, 0, sew, acc);
+    if (GET_VTA(vtype))
+        memset((uint8_t *) rv->V[ir->vd] + (sew >> 3), 0xff,
+               VREG_BYTES - (sew >> 3));
+    return true;
+}
+
+#if !RV32_HAS(SYSTEM)
+/* Unit-stride load or store straight between guest RAM and the group */
+static bool rvv_jit_unit_stride(riscv_t *rv, const rv_insn_t *ir, bool store)
+{
+    if (!ir->vm || rv->csr_vstart || !rvv_require_valid_state(rv) ||
+        !rvv_validate_eew_reg(rv, ir->eew, ir->vd))
+        return false;
+
+    const memory_t *m = PRIV(rv)->mem;
+    uint32_t addr = rv->X[ir->rs1];
+    uint32_t n = rv->csr_vl * (ir->eew >> 3);
+    if ((uint64_t) addr + n > m->mem_size)
+        return false;
+
+    uint8_t *group = (uint8_t *) rv->V[ir->vd];
+    if (store) {
+        memcpy(m->mem_base + addr, group, n);
+    } else {
+        memcpy(group, m->mem_base + addr, n);
+        if (GET_VTA(rv->csr_vtype))
+            memset(group + n, 0xff,
+                   rvv_vlmax(rv->csr_vtype) * (ir->eew >> 3) - n);
+    }
+    return true;
+}
+#endif
+
+uint32_t jit_vector_handler(riscv_t *rv,
+                            uint32_t opcode,
+                            uint32_t operands,
+                            uint32_t pc)
+{
+    rv_insn_t ir;
+    memset(&ir, 0, sizeof(rv_insn_t));
+    jit_vector_unpack(&ir, opcode, operands);
+
+    bool done = false;
+    switch (opcode) {
+    case rv_insn_vadd_vv:
+        done = rvv_jit_arith(rv, &ir, RVV_JIT_ADD, rv->V[ir.vs1], 0);
+        break;
+    case rv_insn_vadd_vx:
+        done = rvv_jit_arith(rv, &ir, RVV_JIT_ADD, NULL, rv->X[ir.rs1]);
+        break;
+    case rv_insn_vadd_vi:
+        done = rvv_jit_arith(rv, &ir, RVV_JIT_ADD, NULL, ir.imm);
+        break;
+    case rv_insn_vsub_vv:
+        done = rvv_jit_arith(rv, &ir, RVV_JIT_SUB, rv->V[ir.vs1], 0);
+        break;
+    case rv_insn_vsub_vx:
+        done = rvv_jit_arith(rv, &ir, RVV_JIT_SUB, NULL, rv->X[ir.rs1]);
+        break;
+    case rv_insn_vmul_vv:
+        done = rvv_jit_arith(rv, &ir, RVV_JIT_MUL, rv->V[ir.vs1], 0);
+        break;
+    case rv_insn_vmul_vx:
+        done = rvv_jit_arith(rv, &ir, RVV_JIT_MUL, NULL, rv->X[ir.rs1]);
+        break;
+    case rv_insn_vredsum_vs:
+        done = rvv_jit_redsum(rv, &ir);
+        break;
+#if !RV32_HAS(SYSTEM)
+    case rv_insn_vle8_v:
+    case rv_insn_vle16_v:
+    case rv_insn_vle32_v:
+        done = rvv_jit_unit_stride(rv, &ir, false);
+        break;
+    case rv_insn_vse8_v:
+    case rv_insn_vse16_v:
+    case rv_insn_vse32_v:
+        done = rvv_jit_unit_stride(rv, &ir, true);
+        break;
+#endif
+    default:
+        break;
+    }
+    if (done)
+        return 1;
+
+    /* Run the interpreter handler as a one-instruction block. It sets rv->PC
+     * to the next instruction and advances csr_cycle, but the T1 block keeps
+     * running and accounts for the cycles of all its instructions on exit.
+     */
+    uint64_t cycle = rv->csr_cycle;
+    ir.pc = pc;
+    ir.impl = dispatch_table[opcode];
+    rv->PC = pc; /* the exception PC if the instruction traps */
+    bool ok = ir.impl(rv, &ir, cycle, pc);
+    rv->csr_cycle = cycle;
+#if RV32_HAS(SYSTEM)
+    ok = ok && !rv->is_trapped;
+#endif
+    return ok;
+}
+
+#undef VREG_BYTES
@@ -3107,8 +3107,9 @@ static inline void rvv_exec_vmv_x_s(riscv_t *rv, const rv_insn_t *ir)
 {
     uint32_t sew_bits = rvv_sew_bits(rv->csr_vtype);
 
-    rv->X[ir->rd] = (uint32_t) rvv_signed_elem(
-        rvv_get_elem(rv, ir->vs2, 0, sew_bits), sew_bits);
+    if (ir->rd)
+        rv->X[ir->rd] = (uint32_t) rvv_signed_elem(
+            rvv_get_elem(rv, ir->vs2, 0, sew_bits), sew_bits);
     rv->csr_vstart = 0;
 }
 
@@ -3405,28 +3406,24 @@ static inline void rvv_apply_vsetvl(riscv_t *rv,
     if (keep_vl) {
         if (!rvv_require_valid_state(rv)) {
             rvv_set_vill(rv);
-            rv->X[ir->rd] = rv->csr_vl;
-            return;
+            goto out;
         }
         old_vlmax = rvv_vlmax(rv->csr_vtype);
     }
 
-    if (!rvv_vtype_is_supported(new_vtype)) {
+    if (!rvv_vtype_is_supported(new_vtype) ||
+        (keep_vl && (rvv_vlmax(new_vtype) != old_vlmax))) {
         rvv_set_vill(rv);
-        rv->X[ir->rd] = rv->csr_vl;
-        return;
-    }
-
-    if (keep_vl && (rvv_vlmax(new_vtype) != old_vlmax)) {
-        rvv_set_vill(rv);
-        rv->X[ir->rd] = rv->csr_vl;
-        return;
+        goto out;
     }
 
     rv->csr_vtype = new_vtype;
     if (!keep_vl)
         rv->csr_vl = rvv_compute_vl(avl, rvv_vlmax(new_vtype));
-    rv->X[ir->rd] = rv->csr_vl;
+out:
+    /* x0 is the common destination of a vset{i}vl{i} that only configures */
+    if (ir->rd)
+        rv->X[ir->rd] = rv->csr_vl;
 }
 
 RVOP(vsetvli, {
@@ -6446,7 +6443,8 @@ RVOP(vcpop_m, {
             rvv_mask_get_bit(rv, ir->vs2, elem))
             count++;
     }
-    rv->X[ir->rd] = count;
+    if (ir->rd)
+        rv->X[ir->rd] = count;
     rv->csr_vstart = 0;
 })
 
@@ -6461,7 +6459,8 @@ RVOP(vfirst_m, {
             break;
         }
     }
-    rv->X[ir->rd] = (uint32_t) first;
+    if (ir->rd)
+        rv->X[ir->rd] = (uint32_t) first;
     rv->csr_vstart = 0;
 })
 
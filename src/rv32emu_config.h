@@ -0,0 +1,18 @@
+#pragma once
+#define CONFIG_RV32I 1
+#define CONFIG_EXT_M 1
+#define CONFIG_EXT_A 1
+#define CONFIG_EXT_C 1
+#define CONFIG_Zicsr 1
+#define CONFIG_Zifencei 1
+#define CONFIG_Zba 1
+#define CONFIG_Zbb 1
+#define CONFIG_Zbc 1
+#define CONFIG_Zbs 1
+#define CONFIG_INTERPRETER_ONLY 1
+#define CONFIG_MOP_FUSION 1
+#define CONFIG_BLOCK_CHAINING 1
+#define CONFIG_SUPERBLOCK 1
+#define CONFIG_LOG_COLOR 1
+#define CONFIG_OPTIMIZE_LEVEL 2
+#define CONFIG_CONFIGURED 1
@@ -0,0 +1,400 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "riscv_private.h"
+#include "snapshot.h"
+
+/* A snapshot file holds, in this order:
+ * - the header,
+ * - the state of the hart and of the devices, laid out by state_copy(),
+ * - the index of each chunk of guest memory saved,
+ * - from the next multiple of SNAPSHOT_CHUNK on, the contents of the chunks.
+ * Chunks the guest never touched, or that hold zeros only, are left out. The
+ * contents are aligned in the file as in guest memory, for any host page size
+ * up to SNAPSHOT_CHUNK, so that memory_load_file() maps them copy-on-write.
+ */
+#define SNAPSHOT_MAGIC "RV32SNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_CHUNK (64 * 1024)
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    /* size of the state, which tells apart builds with other features */
+    uint32_t state_size;
+    uint64_t mem_size;
+    uint32_t n_chunks;
+    uint32_t reserved;
+} snapshot_header_t;
+
+/* Copy the state a snapshot keeps from the machine to @buf if @save, or back
+ * otherwise, and return its size. With @buf NULL, only the size is counted.
+ * Translated code, the TLBs and the other caches are not part of it, a
+ * restored machine starts with them empty.
+ */
+static size_t state_copy(riscv_t *rv, uint8_t *buf, bool save)
+{
+    vm_attr_t UNUSED *attr = PRIV(rv);
+    size_t size = 0;
+
+#define COPY(var)                                      \
+    do {                                               \
+        if (buf && save)                               \
+            memcpy(buf + size, &(var), sizeof(var));   \
+        else if (buf)                                  \
+            memcpy(&(var), buf + size, sizeof(var));   \
+        size += sizeof(var);                           \
+    } while (0)
+
+    COPY(rv->X);
+    COPY(rv->PC);
+    COPY(rv->timer);
+#if RV32_HAS(EXT_F)
+    COPY(rv->F);
+    COPY(rv->csr_fcsr);
+#endif
+    COPY(rv->csr_cycle);
+    COPY(rv->csr_time);
+    COPY(rv->csr_mstatus);
+    COPY(rv->csr_mtvec);
+    COPY(rv->csr_misa);
+    COPY(rv->csr_mtval);
+    COPY(rv->csr_mcause);
+    COPY(rv->csr_mscratch);
+    COPY(rv->csr_mepc);
+    COPY(rv->csr_mip);
+    COPY(rv->csr_mie);
+    COPY(rv->csr_mideleg);
+    COPY(rv->csr_medeleg);
+    COPY(rv->csr_mbadaddr);
+    COPY(rv->csr_sstatus);
+    COPY(rv->csr_stvec);
+    COPY(rv->csr_sip);
+    COPY(rv->csr_sie);
+    COPY(rv->csr_scounteren);
+    COPY(rv->csr_sscratch);
+    COPY(rv->csr_sepc);
+    COPY(rv->csr_scause);
+    COPY(rv->csr_stval);
+    COPY(rv->csr_satp);
+    COPY(rv->priv_mode);
+#if RV32_HAS(EXT_V)
+    COPY(rv->V);
+    COPY(rv->csr_vstart);
+    COPY(rv->csr_vxsat);
+    COPY(rv->csr_vxrm);
+    COPY(rv->csr_vcsr);
+    COPY(rv->csr_vl);
+    COPY(rv->csr_vtype);
+    COPY(rv->csr_vlenb);
+#endif
+#if RV32_HAS(SYSTEM)
+    COPY(rv->is_trapped);
+    COPY(rv->last_csr_sepc);
+    COPY(rv->timer_offset);
+    COPY(rv->sbi_timer);
+#endif
+    COPY(attr->break_addr);
+#if !RV32_HAS(SYSTEM)
+    COPY(attr->on_exit);
+#endif
+
+#if RV32_HAS(SYSTEM_MMIO)
+    COPY(rv->lr_valid);
+    COPY(rv->lr_addr);
+    COPY(rv->lr_val);
+    COPY(attr->time_base);
+
+    /* the registers of the devices, not their connection to the host */
+    u8250_state_t *uart = attr->uart;
+    COPY(uart->dll);
+    COPY(uart->dlh);
+    COPY(uart->lcr);
+    COPY(uart->ier);
+    COPY(uart->current_intr);
+    COPY(uart->pending_intrs);
+    COPY(uart->mcr);
+
+    plic_t *plic = attr->plic;
+    COPY(plic->masked);
+    COPY(plic->ip);
+    COPY(plic->ie);
+    COPY(plic->active);
+
+#if RV32_HAS(GOLDFISH_RTC)
+    COPY(*attr->rtc);
+#endif
+
+    for (int i = 0; i < attr->vblk_cnt; i++) {
+        virtio_blk_state_t *vblk = attr->vblk[i];
+        COPY(vblk->device_features);
+        COPY(vblk->device_features_sel);
+        COPY(vblk->driver_features);
+        COPY(vblk->driver_features_sel);
+        COPY(vblk->queue_sel);
+        COPY(vblk->queues);
+        COPY(vblk->status);
+        COPY(vblk->interrupt_status);
+    }
+
+    if (attr->vrng) {
+        virtio_rng_state_t *vrng = attr->vrng;
+        COPY(vrng->device_features);
+        COPY(vrng->device_features_sel);
+        COPY(vrng->driver_features);
+        COPY(vrng->driver_features_sel);
+        COPY(vrng->queue_sel);
+        COPY(vrng->queues);
+        COPY(vrng->status);
+        COPY(vrng->interrupt_status);
+    }
+#endif
+#undef COPY
+
+    return size;
+}
+
+static bool chunk_is_zero(const uint8_t *chunk, size_t len)
+{
+    static const uint8_t zeros[4096];
+    for (size_t off = 0; off < len; off += sizeof(zeros)) {
+        size_t n = len - off < sizeof(zeros) ? len - off : sizeof(zeros);
+        if (memcmp(chunk + off, zeros, n))
+            return false;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void *buf, size_t size, off_t offset)
+{
+    const uint8_t *p = buf;
+    while (size) {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        offset += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void *buf, size_t size, off_t offset)
+{
+    uint8_t *p = buf;
+    while (size) {
+        ssize_t n = pread(fd, p, size, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        offset += n;
+        size -= n;
+    }
+    return true;
+}
+
+/* length of the chunk at @idx, the last one may be cut short */
+static uint32_t chunk_len(const memory_t *mem, uint32_t idx)
+{
+    uint64_t addr = (uint64_t) idx * SNAPSHOT_CHUNK;
+    return mem->mem_size - addr < SNAPSHOT_CHUNK ? mem->mem_size - addr
+                                                 : SNAPSHOT_CHUNK;
+}
+
+static off_t data_offset(uint32_t state_size, uint32_t n_chunks)
+{
+    off_t end = sizeof(snapshot_header_t) + state_size +
+                (off_t) n_chunks * sizeof(uint32_t);
+    return (end + SNAPSHOT_CHUNK - 1) & ~(off_t) (SNAPSHOT_CHUNK - 1);
+}
+
+bool snapshot_save(riscv_t *rv, const char *path)
+{
+    vm_attr_t *attr = PRIV(rv);
+    memory_t *mem = attr->mem;
+    const uint32_t max_chunks =
+        (mem->mem_size + SNAPSHOT_CHUNK - 1) / SNAPSHOT_CHUNK;
+    bool ok = false;
+
+    const size_t state_size = state_copy(rv, NULL, true);
+    uint8_t *state = malloc(state_size);
+    uint32_t *index = malloc(max_chunks * sizeof(uint32_t));
+    /* written next to @path and renamed, never leaving half a snapshot */
+    size_t tmp_len = strlen(path) + 5;
+    char *tmp = malloc(tmp_len);
+    if (!state || !index || !tmp) {
+        rv_log_error("Failed to allocate the snapshot");
+        goto out;
+    }
+    state_copy(rv, state, true);
+
+    uint32_t n_chunks = 0;
+    for (uint32_t idx = 0; idx < max_chunks; idx++) {
+        uint32_t addr = idx * SNAPSHOT_CHUNK;
+        if (memory_is_mapped(mem, addr) &&
+            !chunk_is_zero(mem->mem_base + addr, chunk_len(mem, idx)))
+            index[n_chunks++] = idx;
+    }
+
+    snapshot_header_t header = {
+        .version = SNAPSHOT_VERSION,
+        .state_size = state_size,
+        .mem_size = mem->mem_size,
+        .n_chunks = n_chunks,
+    };
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+
+    snprintf(tmp, tmp_len, "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        rv_log_error("Cannot create %s: %s", tmp, strerror(errno));
+        goto out;
+    }
+    off_t off = 0;
+    ok = write_all(fd, &header, sizeof(header), off);
+    off += sizeof(header);
+    ok = ok && write_all(fd, state, state_size, off);
+    off += state_size;
+    ok = ok && write_all(fd, index, n_chunks * sizeof(uint32_t), off);
+    off = data_offset(state_size, n_chunks);
+    for (uint32_t i = 0; ok && i < n_chunks; i++) {
+        ok = write_all(fd, mem->mem_base + index[i] * SNAPSHOT_CHUNK,
+                       chunk_len(mem, index[i]),
+                       off + (off_t) i * SNAPSHOT_CHUNK);
+    }
+    if (close(fd) || !ok || rename(tmp, path)) {
+        rv_log_error("Failed to write the snapshot %s: %s", path,
+                     strerror(errno));
+        unlink(tmp);
+        ok = false;
+        goto out;
+    }
+    rv_log_info("Snapshot of %u KiB of guest memory saved to %s",
+                n_chunks * (SNAPSHOT_CHUNK / 1024), path);
+
+out:
+    free(tmp);
+    free(index);
+    free(state);
+    return ok;
+}
+
+bool snapshot_restore(riscv_t *rv, const char *path)
+{
+    vm_attr_t *attr = PRIV(rv);
+    memory_t *mem = attr->mem;
+    const size_t state_size = state_copy(rv, NULL, false);
+    uint8_t *state = NULL;
+    uint32_t *index = NULL;
+    bool ok = false;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        rv_log_error("Cannot open %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    snapshot_header_t header;
+    if (!read_all(fd, &header, sizeof(header), 0) ||
+        memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) ||
+        header.version != SNAPSHOT_VERSION) {
+        rv_log_error("%s is not a snapshot", path);
+        goto out;
+    }
+    if (header.state_size != state_size || header.mem_size != mem->mem_size) {
+        rv_log_error("%s was taken by an emulator configured otherwise", path);
+        goto out;
+    }
+
+    const uint32_t max_chunks =
+        (mem->mem_size + SNAPSHOT_CHUNK - 1) / SNAPSHOT_CHUNK;
+    state = malloc(state_size);
+    index = calloc(header.n_chunks + 1, sizeof(uint32_t));
+    if (header.n_chunks > max_chunks || !state || !index ||
+        !read_all(fd, state, state_size, sizeof(header)) ||
+        !read_all(fd, index, header.n_chunks * sizeof(uint32_t),
+                  sizeof(header) + state_size)) {
+        rv_log_error("Failed to read the snapshot %s", path);
+        goto out;
+    }
+
+    /* The images loaded by rv_create() go where the snapshot has nothing.
+     * Runs of consecutive chunks take one mapping each.
+     */
+    const off_t off = data_offset(state_size, header.n_chunks);
+    for (uint32_t idx = 0, i = 0; idx < max_chunks;) {
+        if (i < header.n_chunks && index[i] == idx) {
+            uint32_t run = 1;
+            while (i + run < header.n_chunks && index[i + run] == idx + run &&
+                   run < UINT32_MAX / SNAPSHOT_CHUNK)
+                run++;
+            uint32_t len = (run - 1) * SNAPSHOT_CHUNK +
+                           chunk_len(mem, idx + run - 1);
+            if (idx + run > max_chunks ||
+                !memory_load_file(mem, idx * SNAPSHOT_CHUNK, fd,
+                                  off + (off_t) i * SNAPSHOT_CHUNK, len)) {
+                rv_log_error("Failed to load the memory of %s", path);
+                goto out;
+            }
+            idx += run;
+            i += run;
+            continue;
+        }
+        if (memory_is_mapped(mem, idx * SNAPSHOT_CHUNK))
+            memory_fill(mem, idx * SNAPSHOT_CHUNK, chunk_len(mem, idx), 0);
+        idx++;
+    }
+
+    state_copy(rv, state, false);
+#if RV32_HAS(SYSTEM)
+    /* tags the TLBs with the ASID of satp */
+    mmu_tlb_switch(rv, rv->csr_satp);
+#endif
+    ok = true;
+    rv_log_info("Machine restored from %s", path);
+
+out:
+    free(index);
+    free(state);
+    close(fd);
+    return ok;
+}
+
+void snapshot_watch(riscv_t *rv, const uint8_t *buf, uint32_t len)
+{
+    vm_attr_t *attr = PRIV(rv);
+    const char *marker = attr->snapshot_marker;
+    uint32_t matched = attr->marker_matched;
+    if (!marker)
+        return;
+
+    for (uint32_t i = 0; i < len && !attr->snapshot_due; i++) {
+        /* The output now ends with the marker up to the character after
+         * the part matched so far, or with a shorter start of the marker
+         * that the matched part ends with.
+         */
+        uint32_t k = matched + 1;
+        while (k && ((uint8_t) marker[k - 1] != buf[i] ||
+                     memcmp(marker, marker + matched + 1 - k, k - 1)))
+            k--;
+        matched = k;
+        if (!marker[matched]) {
+            attr->snapshot_due = true;
+            rv_halt(rv);
+        }
+    }
+    attr->marker_matched = matched;
+}
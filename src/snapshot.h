@@ -0,0 +1,27 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "riscv.h"
+
+/* Save the machine @rv to the file @path. The machine must be stopped
+ * between two blocks, as it is where rv_step() returns.
+ */
+bool snapshot_save(riscv_t *rv, const char *path);
+
+/* Restore the machine @rv, freshly created with the same images and
+ * options, from the file @path. Guest memory is mapped copy-on-write from
+ * the file where the memory backend allows.
+ */
+bool snapshot_restore(riscv_t *rv, const char *path);
+
+/* Look for snapshot_marker in @len bytes of guest output, and once it has
+ * been printed, flag the snapshot point and halt @rv.
+ */
+void snapshot_watch(riscv_t *rv, const uint8_t *buf, uint32_t len);
@@ -0,0 +1,179 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+#include <inttypes.h>
+#include <signal.h>
+#include <string.h>
+
+#include "stats.h"
+#include "utils.h"
+
+uint64_t rv_stats_now(void)
+{
+    struct timespec t;
+    rv_clock_gettime(&t);
+    return (uint64_t) t.tv_sec * 1000000000ULL + (uint64_t) t.tv_nsec;
+}
+
+static uint32_t stats_current_generation(void);
+
+void rv_stats_init(rv_stats_t *stats)
+{
+    memset(stats, 0, sizeof(rv_stats_t));
+    stats->start_ns = rv_stats_now();
+    /* signals sent before this instance existed are not for it */
+    stats->report_gen = stats_current_generation();
+}
+
+void rv_stats_hist_add(rv_stats_hist_t *hist, uint64_t ns)
+{
+    uint32_t idx = 0;
+    for (uint64_t us = ns / 1000; us && idx < RV_STATS_HIST_BUCKETS - 1;
+         us >>= 1)
+        idx++;
+
+    ATOMIC_FETCH_ADD(&hist->count, 1, ATOMIC_RELAXED);
+    ATOMIC_FETCH_ADD(&hist->total_ns, ns, ATOMIC_RELAXED);
+    ATOMIC_FETCH_ADD(&hist->bucket[idx], 1, ATOMIC_RELAXED);
+    uint64_t max = ATOMIC_LOAD(&hist->max_ns, ATOMIC_RELAXED);
+    while (ns > max &&
+           !ATOMIC_COMPARE_EXCHANGE_WEAK(&hist->max_ns, &max, ns,
+                                         ATOMIC_RELAXED, ATOMIC_RELAXED))
+        ;
+}
+
+static void dump_hist(const char *name, const rv_stats_hist_t *hist, FILE *f)
+{
+    uint64_t count = ATOMIC_LOAD(&hist->count, ATOMIC_RELAXED);
+    if (!count)
+        return;
+
+    uint64_t total = ATOMIC_LOAD(&hist->total_ns, ATOMIC_RELAXED);
+    fprintf(f,
+            "%s latency: %" PRIu64 " samples, total %.3f ms, mean %.1f us, "
+            "max %.1f us\n",
+            name, count, total / 1e6, total / 1e3 / count,
+            ATOMIC_LOAD(&hist->max_ns, ATOMIC_RELAXED) / 1e3);
+    for (uint32_t i = 0; i < RV_STATS_HIST_BUCKETS; i++) {
+        uint64_t n = ATOMIC_LOAD(&hist->bucket[i], ATOMIC_RELAXED);
+        if (!n)
+            continue;
+        uint32_t lo = i ? 1U << (i - 1) : 0;
+        if (i == RV_STATS_HIST_BUCKETS - 1)
+            fprintf(f, "  %8" PRIu32 " us and up : %" PRIu64 "\n", lo, n);
+        else
+            fprintf(f, "  %8" PRIu32 " - %8" PRIu32 " us : %" PRIu64 "\n", lo,
+                    1U << i, n);
+    }
+}
+
+static void dump_hits(const char *name, uint64_t hits, uint64_t misses, FILE *f)
+{
+    if (!hits && !misses)
+        return;
+
+    fprintf(f, "%s: %" PRIu64 " hits, %" PRIu64 " misses, %.2f%% hit rate\n",
+            name, hits, misses, 100.0 * hits / (hits + misses));
+}
+
+void rv_stats_dump(const rv_stats_t *stats, uint32_t queue_depth, FILE *f)
+{
+    static const char *const tier_names[RV_N_TIERS] = {
+        [RV_TIER_INTERP] = "interpreter",
+        [RV_TIER_T1] = "tier-1 JIT",
+        [RV_TIER_T2C] = "tier-2 T2C",
+    };
+
+    uint64_t insn[RV_N_TIERS], total = 0;
+    uint64_t elapsed = rv_stats_now() - stats->start_ns;
+    for (int i = 0; i < RV_N_TIERS; i++) {
+        insn[i] = ATOMIC_LOAD(&stats->insn[i], ATOMIC_RELAXED);
+        total += insn[i];
+    }
+
+    fprintf(f, "=== rv32emu statistics: %.3f s elapsed ===\n", elapsed / 1e9);
+    fprintf(f, "%-12s %20s %7s %16s\n", "tier", "insns retired", "share",
+            "blocks promoted");
+    for (int i = 0; i < RV_N_TIERS; i++)
+        fprintf(f, "%-12s %20" PRIu64 " %6.2f%% %16" PRIu64 "\n",
+                tier_names[i], insn[i], total ? 100.0 * insn[i] / total : 0.0,
+                ATOMIC_LOAD(&stats->promoted[i], ATOMIC_RELAXED));
+    fprintf(f,
+            "T1 code cache evictions: %" PRIu64 " regions, %" PRIu64
+            " blocks\n",
+            stats->code_cache_evictions, stats->evicted_blocks);
+    if (stats->map_sweeps)
+        fprintf(f,
+                "Block map evictions: %" PRIu64 " sweeps, %" PRIu64
+                " blocks\n",
+                stats->map_sweeps, stats->map_evicted_blocks);
+    if (stats->superblocks)
+        fprintf(f, "Superblocks formed: %" PRIu64 "\n", stats->superblocks);
+    fprintf(f, "T2C wait queue: %" PRIu32 " pending, peak %" PRIu32 "\n",
+            queue_depth, stats->queue_peak);
+    dump_hits("dTLB", stats->dtlb_hits, stats->dtlb_misses, f);
+    dump_hits("iTLB", stats->itlb_hits, stats->itlb_misses, f);
+    if (stats->stlb_refills)
+        fprintf(f, "TLB refills from superpages: %" PRIu64 "\n",
+                stats->stlb_refills);
+    if (stats->wfi_sleeps)
+        fprintf(f,
+                "Idle in WFI: %.3f s (%.2f%%) over %" PRIu64
+                " sleeps, busy %.3f s\n",
+                stats->idle_ns / 1e9, 100.0 * stats->idle_ns / elapsed,
+                stats->wfi_sleeps, (elapsed - stats->idle_ns) / 1e9);
+    dump_hits("Return address stack", stats->ras_hits, stats->ras_misses,
+              f);
+    dump_hist("T1 compile", &stats->t1_compile, f);
+    dump_hist("T2C compile", &stats->t2c_compile, f);
+    dump_hist("T2C queue wait", &stats->t2c_queue_delay, f);
+    fflush(f);
+}
+
+#if defined(SIGUSR1) && !defined(__EMSCRIPTEN__)
+/* bumped by each SIGUSR1; every instance reports once per new generation */
+static volatile sig_atomic_t stats_generation;
+
+static void stats_signal_handler(int sig UNUSED)
+{
+    stats_generation++;
+}
+
+void rv_stats_install_signal(void)
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stats_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+}
+
+bool rv_stats_pending(rv_stats_t *stats)
+{
+    uint32_t gen = stats_generation;
+    if (likely(gen == stats->report_gen))
+        return false;
+    stats->report_gen = gen;
+    return true;
+}
+
+static uint32_t stats_current_generation(void)
+{
+    return stats_generation;
+}
+#else
+void rv_stats_install_signal(void) {}
+
+bool rv_stats_pending(rv_stats_t *stats UNUSED)
+{
+    return false;
+}
+
+static uint32_t stats_current_generation(void)
+{
+    return 0;
+}
+#endif
@@ -0,0 +1,87 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Execution tiers a basic block can run in */
+typedef enum {
+    RV_TIER_INTERP, /**< threaded interpreter */
+    RV_TIER_T1,     /**< tier-1 template JIT */
+    RV_TIER_T2C,    /**< tier-2 LLVM compiler */
+    RV_N_TIERS,
+} rv_tier_t;
+
+/* Latency histogram with power-of-two microsecond buckets: bucket 0 holds
+ * samples below 1 us, bucket i holds [2^(i-1), 2^i) us, and the last bucket
+ * collects everything slower.
+ */
+#define RV_STATS_HIST_BUCKETS 24
+
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t bucket[RV_STATS_HIST_BUCKETS];
+} rv_stats_hist_t;
+
+/* Tiered-execution telemetry of one emulator instance.
+ *
+ * Retired instructions are counted the way each tier advances csr_cycle, so
+ * T1 is credited with the entry block of every dispatch while the interpreter
+ * and T2C also account for the blocks they chain into.
+ *
+ * Counters owned by the emulation thread are plain increments. Those that the
+ * T2C workers also update (t2c_*, promoted[RV_TIER_T2C]) are only touched with
+ * atomic read-modify-write operations.
+ */
+typedef struct {
+    uint64_t start_ns;               /**< rv_stats_now() at creation */
+    uint64_t insn[RV_N_TIERS];       /**< guest instructions retired per tier */
+    uint64_t promoted[RV_N_TIERS];   /**< blocks that entered each tier */
+    uint64_t code_cache_evictions;   /**< T1 code cache regions evicted */
+    uint64_t evicted_blocks;         /**< T1 blocks dropped by evictions */
+    uint64_t map_sweeps;             /**< interpreter block map sweeps */
+    uint64_t map_evicted_blocks;     /**< blocks evicted by the sweeps */
+    uint64_t superblocks;            /**< blocks rebuilt along biased branches */
+    uint32_t queue_peak;             /**< deepest T2C wait queue seen */
+    /* system-mode address translations made in C; hits of the dTLB probes
+     * inlined into T1/T2C code are not counted
+     */
+    uint64_t dtlb_hits, dtlb_misses;
+    uint64_t itlb_hits, itlb_misses;
+    uint64_t stlb_refills; /**< misses served by the superpage array */
+    uint64_t wfi_sleeps;   /**< WFI instructions that parked the hart */
+    uint64_t idle_ns;      /**< host time spent parked in WFI */
+    uint64_t ras_hits;     /**< returns the RAS predicted */
+    uint64_t ras_misses;   /**< returns it did not */
+    rv_stats_hist_t t1_compile;      /**< jit_translate() latency */
+    rv_stats_hist_t t2c_compile;     /**< t2c_compile() latency */
+    rv_stats_hist_t t2c_queue_delay; /**< T2C enqueue to worker pickup */
+    uint32_t report_gen; /**< SIGUSR1 generation last reported */
+} rv_stats_t;
+
+/* monotonic timestamp in nanoseconds */
+uint64_t rv_stats_now(void);
+
+void rv_stats_init(rv_stats_t *stats);
+
+/* Record one latency sample; safe to call from several threads at once */
+void rv_stats_hist_add(rv_stats_hist_t *hist, uint64_t ns);
+
+/* Print a human-readable report. @queue_depth is the current number of
+ * pending T2C requests.
+ */
+void rv_stats_dump(const rv_stats_t *stats, uint32_t queue_depth, FILE *f);
+
+/* Arrange for SIGUSR1 to request a report from every instance. Each instance
+ * sees a signal once: rv_stats_pending() returns true the first time it is
+ * called on @stats after a new SIGUSR1.
+ */
+void rv_stats_install_signal(void);
+bool rv_stats_pending(rv_stats_t *stats);
@@ -4,18 +4,20 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 #include "riscv.h"
 #include "riscv_private.h"
+#include "snapshot.h"
 #include "utils.h"
 
-#define PREALLOC_SIZE 4096
-
 /* newlib is a portable (not RISC-V specific) C library, which implements
  * printf(3) and other functions described in C standards. Some system calls
  * should be provided in conjunction with newlib.
@@ -39,6 +41,11 @@
         _(sbi_timer,        0x54494D45)    \
         _(sbi_rst,          0x53525354)    \
     )                                      \
+    IIF(RV32_HAS(SYSTEM_MMIO))(            \
+        _(sbi_ipi,          0x735049)      \
+        _(sbi_rfence,       0x52464E43)    \
+        _(sbi_hsm,          0x48534D)      \
+    )                                      \
     IIF(RV32_HAS(SDL))(                    \
         _(draw_frame,       0xBEEF)        \
         _(setup_queue,      0xC0DE)        \
@@ -54,38 +61,61 @@ enum {
 #undef _
 };
 
+/* open(2) flags of newlib */
 enum {
-    O_RDONLY = 0,
-    O_WRONLY = 1,
-    O_RDWR = 2,
-    O_ACCMODE = 3,
+    NEWLIB_O_RDONLY = 0,
+    NEWLIB_O_WRONLY = 1,
+    NEWLIB_O_RDWR = 2,
+    NEWLIB_O_ACCMODE = 3,
 };
 
+/* host fd of the guest fd @fd, or -1 if it is not open */
+static inline int host_fd(const vm_attr_t *attr, uint32_t fd)
+{
+    return fd < attr->fd_table_size ? attr->fd_table[fd] : -1;
+}
+
+/* Find a free guest fd, growing the table if all are in use, or return -1 */
 static int find_free_fd(vm_attr_t *attr)
 {
-    for (int i = 3;; ++i) {
-        map_iter_t it;
-        map_find(attr->fd_map, &it, &i);
-        if (map_at_end(attr->fd_map, &it))
+    for (uint32_t i = 3; i < attr->fd_table_size; ++i) {
+        if (attr->fd_table[i] < 0)
             return i;
     }
+
+    uint32_t size = attr->fd_table_size * 2;
+    int *table = realloc(attr->fd_table, size * sizeof(int));
+    if (!table)
+        return -1;
+    for (uint32_t i = attr->fd_table_size; i < size; i++)
+        table[i] = -1;
+    int fd = attr->fd_table_size;
+    attr->fd_table = table;
+    attr->fd_table_size = size;
+    return fd;
 }
 
-static const char *get_mode_str(uint32_t flags, uint32_t mode UNUSED)
+/* host open(2) flags of newlib @flags, as fopen(3) has them for "rb", "wb"
+ * and "a+", or -1 if they are not valid
+ */
+static int get_open_flags(uint32_t flags, uint32_t mode UNUSED)
 {
-    switch (flags & O_ACCMODE) {
-    case O_RDONLY:
-        return "rb";
-    case O_WRONLY:
-        return "wb";
-    case O_RDWR:
-        return "a+";
+    switch (flags & NEWLIB_O_ACCMODE) {
+    case NEWLIB_O_RDONLY:
+        return O_RDONLY;
+    case NEWLIB_O_WRONLY:
+        return O_WRONLY | O_CREAT | O_TRUNC;
+    case NEWLIB_O_RDWR:
+        return O_RDWR | O_CREAT | O_APPEND;
     default:
-        return NULL;
+        return -1;
     }
 }
 
-static uint8_t tmp[PREALLOC_SIZE];
+/* The read and write system calls move data between the host fd and guest
+ * memory in place, in one host system call for the whole buffer where the
+ * host allows.
+ */
 static void syscall_write(riscv_t *rv)
 {
     vm_attr_t *attr = PRIV(rv);
@@ -96,31 +126,28 @@ static void syscall_write(riscv_t *rv)
     riscv_word_t count = rv_get_reg(rv, rv_reg_a2);
 
     /* lookup the file descriptor */
-    map_iter_t it;
-    map_find(attr->fd_map, &it, &fd);
-    if (map_at_end(attr->fd_map, &it))
+    int handle = host_fd(attr, fd);
+    const uint8_t *src = memory_host_range(attr->mem, buffer, count);
+    if (handle < 0 || !src)
         goto error_handler;
 
+    /* write out the data, which a pipe or a terminal may take in parts */
     uint32_t total_write = 0;
-    FILE *handle = map_iter_value(&it, FILE *);
-
-    while (count > PREALLOC_SIZE) {
-        memory_read(attr->mem, tmp, buffer + total_write, PREALLOC_SIZE);
-        /* write out the data */
-        size_t written = fwrite(tmp, 1, PREALLOC_SIZE, handle);
-        if (written != PREALLOC_SIZE && ferror(handle))
-            goto error_handler;
+    while (total_write < count) {
+        ssize_t written =
+            write(handle, src + total_write, count - total_write);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0) {
+            if (!total_write)
+                goto error_handler;
+            break;
+        }
         total_write += written;
-        count -= PREALLOC_SIZE;
     }
 
-    memory_read(attr->mem, tmp, buffer + total_write, count);
-    /* write out the data */
-    size_t written = fwrite(tmp, 1, count, handle);
-    if (written != count && ferror(handle))
-        goto error_handler;
-    total_write += written;
-    assert(total_write == rv_get_reg(rv, rv_reg_a2));
+    if (fd == 1 || fd == 2) /* guest stdout and stderr */
+        snapshot_watch(rv, src, total_write);
 
     /* return number of bytes written */
     rv_set_reg(rv, rv_reg_a0, total_write);
@@ -181,8 +208,10 @@ static void syscall_gettimeofday(riscv_t *rv)
     if (tv) {
         struct timeval tv_s;
         rv_gettimeofday(&tv_s);
-        memory_write_w(tv + 0, (const uint8_t *) &tv_s.tv_sec);
-        memory_write_w(tv + 8, (const uint8_t *) &tv_s.tv_usec);
+        memory_write_w(PRIV(rv)->mem, tv + 0,
+                       (const uint8_t *) &tv_s.tv_sec);
+        memory_write_w(PRIV(rv)->mem, tv + 8,
+                       (const uint8_t *) &tv_s.tv_usec);
     }
 
     if (tz) {
@@ -213,8 +242,10 @@ static void syscall_clock_gettime(riscv_t *rv)
     if (tp) {
         struct timespec tp_s;
         rv_clock_gettime(&tp_s);
-        memory_write_w(tp + 0, (const uint8_t *) &tp_s.tv_sec);
-        memory_write_w(tp + 8, (const uint8_t *) &tp_s.tv_nsec);
+        memory_write_w(PRIV(rv)->mem, tp + 0,
+                       (const uint8_t *) &tp_s.tv_sec);
+        memory_write_w(PRIV(rv)->mem, tp + 8,
+                       (const uint8_t *) &tp_s.tv_nsec);
     }
 
     /* success */
@@ -246,18 +277,14 @@ static void syscall_close(riscv_t *rv)
 #endif
 
     if (fd >= 3) { /* lookup the file descriptor */
-        map_iter_t it;
-        map_find(attr->fd_map, &it, &fd);
-        if (!map_at_end(attr->fd_map, &it)) {
-            if (fclose(map_iter_value(&it, FILE *))) {
+        int handle = host_fd(attr, fd);
+        if (handle >= 0) {
+            attr->fd_table[fd] = -1;
+            if (close(handle)) {
                 /* error */
                 rv_set_reg(rv, rv_reg_a0, -1);
                 return;
             }
-            map_erase(attr->fd_map, &it);
-
-            /* success */
-            rv_set_reg(rv, rv_reg_a0, 0);
         }
     }
 
@@ -279,22 +306,14 @@ static void syscall_lseek(riscv_t *rv)
     uint32_t whence = rv_get_reg(rv, rv_reg_a2);
 
     /* find the file descriptor */
-    map_iter_t it;
-    map_find(attr->fd_map, &it, &fd);
-    if (map_at_end(attr->fd_map, &it)) {
-        /* error */
-        rv_set_reg(rv, rv_reg_a0, -1);
-        return;
-    }
-
-    FILE *handle = map_iter_value(&it, FILE *);
-    if (fseek(handle, offset, whence)) {
+    int handle = host_fd(attr, fd);
+    if (handle < 0) {
         /* error */
         rv_set_reg(rv, rv_reg_a0, -1);
         return;
     }
 
-    long pos = ftell(handle);
+    off_t pos = lseek(handle, (int32_t) offset, whence);
     if (pos == -1) {
         /* error */
         rv_set_reg(rv, rv_reg_a0, -1);
@@ -315,42 +334,26 @@ static void syscall_read(riscv_t *rv)
     uint32_t count = rv_get_reg(rv, rv_reg_a2);
 
     /* lookup the file */
-    map_iter_t it;
-    map_find(attr->fd_map, &it, &fd);
-    if (map_at_end(attr->fd_map, &it)) {
+    int handle = host_fd(attr, fd);
+    uint8_t *dst = memory_host_range(attr->mem, buf, count);
+    if (handle < 0 || !dst) {
         /* error */
         rv_set_reg(rv, rv_reg_a0, -1);
         return;
     }
 
-    FILE *handle = map_iter_value(&it, FILE *);
-    uint32_t total_read = 0;
     /* read the file into runtime memory */
-
-    while (count > PREALLOC_SIZE) {
-        size_t r = fread(tmp, 1, PREALLOC_SIZE, handle);
-        if (!memory_write(attr->mem, buf + total_read, tmp, r)) {
-            rv_set_reg(rv, rv_reg_a0, -1);
-            return;
-        }
-        count -= r;
-        total_read += r;
-        if (r != PREALLOC_SIZE)
-            break;
-    }
-    size_t r = fread(tmp, 1, count, handle);
-    if (!memory_write(attr->mem, buf + total_read, tmp, r)) {
-        rv_set_reg(rv, rv_reg_a0, -1);
-        return;
-    }
-    total_read += r;
-    if (total_read != rv_get_reg(rv, rv_reg_a2) && ferror(handle)) {
+    ssize_t r;
+    do
+        r = read(handle, dst, count);
+    while (r < 0 && errno == EINTR);
+    if (r < 0) {
         /* error */
         rv_set_reg(rv, rv_reg_a0, -1);
         return;
     }
     /* success */
-    rv_set_reg(rv, rv_reg_a0, total_read);
+    rv_set_reg(rv, rv_reg_a0, r);
 }
 
 static void syscall_fstat(riscv_t *rv UNUSED)
@@ -394,26 +397,29 @@ static void syscall_open(riscv_t *rv)
     memory_read(attr->mem, (uint8_t *) name_str, name, name_len);
 
     /* open the file */
-    const char *mode_str = get_mode_str(flags, mode);
-    if (!mode_str) {
+    const int open_flags = get_open_flags(flags, mode);
+    if (open_flags == -1) {
         free(name_str);
         rv_set_reg(rv, rv_reg_a0, -1);
         return;
     }
 
-    FILE *handle = fopen(name_str, mode_str);
-    if (!handle) {
-        free(name_str);
+    const int handle = open(name_str, open_flags | O_CLOEXEC, 0666);
+    free(name_str);
+    if (handle < 0) {
         rv_set_reg(rv, rv_reg_a0, -1);
         return;
     }
 
-    free(name_str);
-
     const int fd = find_free_fd(attr); /* find a free file descriptor */
+    if (fd < 0) {
+        close(handle);
+        rv_set_reg(rv, rv_reg_a0, -1);
+        return;
+    }
 
-    /* insert into the file descriptor map */
-    map_insert(attr->fd_map, (void *) &fd, &handle);
+    /* insert into the file descriptor table */
+    attr->fd_table[fd] = handle;
 
     /* return the file descriptor */
     rv_set_reg(rv, rv_reg_a0, fd);
@@ -431,14 +437,13 @@ extern void syscall_control_audio(riscv_t *rv);
 /* SBI related system calls */
 static void syscall_sbi_timer(riscv_t *rv)
 {
-    vm_attr_t *attr = PRIV(rv);
     const riscv_word_t fid = rv_get_reg(rv, rv_reg_a6);
     const riscv_word_t a0 = rv_get_reg(rv, rv_reg_a0);
     const riscv_word_t a1 = rv_get_reg(rv, rv_reg_a1);
 
     switch (fid) {
     case SBI_TIMER_SET_TIMER:
-        attr->timer = (((uint64_t) a1) << 32) | (uint64_t) (a0);
+        rv->sbi_timer = (((uint64_t) a1) << 32) | (uint64_t) (a0);
         rv_set_reg(rv, rv_reg_a0, SBI_SUCCESS);
         rv_set_reg(rv, rv_reg_a1, 0);
         break;
@@ -485,6 +490,10 @@ static void syscall_sbi_base(riscv_t *rv)
         const riscv_word_t eid = rv_get_reg(rv, rv_reg_a0);
         bool available =
             eid == SBI_EID_BASE || eid == SBI_EID_TIMER || eid == SBI_EID_RST;
+#if RV32_HAS(SYSTEM_MMIO)
+        available |=
+            eid == SBI_EID_IPI || eid == SBI_EID_RFENCE || eid == SBI_EID_HSM;
+#endif
         rv_set_reg(rv, rv_reg_a0, SBI_SUCCESS);
         rv_set_reg(rv, rv_reg_a1, available);
         break;
@@ -505,6 +514,10 @@ static void syscall_sbi_rst(riscv_t *rv)
     switch (fid) {
     case SBI_RST_SYSTEM_RESET:
         rv_log_info("System reset: type=%u, reason=%u", a0, a1);
+#if RV32_HAS(SYSTEM_MMIO)
+        /* the boot hart leaves rv_run(), which stops the other harts */
+        rv_halt(PRIV(rv)->harts[0]);
+#endif
         rv_halt(rv);
         rv_set_reg(rv, rv_reg_a0, SBI_SUCCESS);
         rv_set_reg(rv, rv_reg_a1, 0);
@@ -515,6 +528,127 @@ static void syscall_sbi_rst(riscv_t *rv)
         break;
     }
 }
+
+#if RV32_HAS(SYSTEM_MMIO)
+/* Turn an SBI hart mask into a bitmap of hart ids. A base of -1 selects every
+ * hart. Returns false if the mask names a hart that does not exist.
+ */
+static bool sbi_hart_mask(riscv_t *rv,
+                          riscv_word_t mask,
+                          riscv_word_t base,
+                          uint32_t *harts)
+{
+    const uint32_t all = (1U << PRIV(rv)->n_harts) - 1;
+
+    if (base == (riscv_word_t) -1) {
+        *harts = all;
+        return true;
+    }
+    if (!mask) {
+        *harts = 0;
+        return true;
+    }
+    if (base >= RV_MAX_HARTS)
+        return false;
+    *harts = mask << base;
+    return !(*harts & ~all) && (*harts >> base) == mask;
+}
+
+static void syscall_sbi_ipi(riscv_t *rv)
+{
+    vm_attr_t *attr = PRIV(rv);
+    const riscv_word_t fid = rv_get_reg(rv, rv_reg_a6);
+    const riscv_word_t a0 = rv_get_reg(rv, rv_reg_a0);
+    const riscv_word_t a1 = rv_get_reg(rv, rv_reg_a1);
+    uint32_t harts;
+
+    switch (fid) {
+    case SBI_IPI_SEND_IPI:
+        if (!sbi_hart_mask(rv, a0, a1, &harts)) {
+            rv_set_reg(rv, rv_reg_a0, SBI_ERR_INVALID_PARAM);
+            rv_set_reg(rv, rv_reg_a1, 0);
+            break;
+        }
+        for (uint32_t i = 0; i < attr->n_harts; i++) {
+            if (harts & (1U << i))
+                plic_send_ipi(attr->plic, i);
+        }
+        rv_set_reg(rv, rv_reg_a0, SBI_SUCCESS);
+        rv_set_reg(rv, rv_reg_a1, 0);
+        break;
+    default:
+        rv_set_reg(rv, rv_reg_a0, SBI_ERR_NOT_SUPPORTED);
+        rv_set_reg(rv, rv_reg_a1, 0);
+        break;
+    }
+}
+
+static void syscall_sbi_rfence(riscv_t *rv)
+{
+    const riscv_word_t fid = rv_get_reg(rv, rv_reg_a6);
+    const riscv_word_t a0 = rv_get_reg(rv, rv_reg_a0);
+    const riscv_word_t a1 = rv_get_reg(rv, rv_reg_a1);
+    uint32_t harts;
+
+    /* Address ranges and ASIDs are not tracked, so the remote SFENCE.VMA
+     * variants flush the whole TLB like a global SFENCE.VMA does.
+     */
+    switch (fid) {
+    case SBI_RFENCE_REMOTE_FENCE_I:
+    case SBI_RFENCE_REMOTE_SFENCE_VMA:
+    case SBI_RFENCE_REMOTE_SFENCE_VMA_ASID:
+        if (!sbi_hart_mask(rv, a0, a1, &harts)) {
+            rv_set_reg(rv, rv_reg_a0, SBI_ERR_INVALID_PARAM);
+            rv_set_reg(rv, rv_reg_a1, 0);
+            break;
+        }
+        rv_remote_fence(rv, harts,
+                        fid == SBI_RFENCE_REMOTE_FENCE_I ? RV_FENCE_I
+                                                         : RV_FENCE_VMA);
+        rv_set_reg(rv, rv_reg_a0, SBI_SUCCESS);
+        rv_set_reg(rv, rv_reg_a1, 0);
+        break;
+    default:
+        rv_set_reg(rv, rv_reg_a0, SBI_ERR_NOT_SUPPORTED);
+        rv_set_reg(rv, rv_reg_a1, 0);
+        break;
+    }
+}
+
+static void syscall_sbi_hsm(riscv_t *rv)
+{
+    vm_attr_t *attr = PRIV(rv);
+    const riscv_word_t fid = rv_get_reg(rv, rv_reg_a6);
+    const riscv_word_t a0 = rv_get_reg(rv, rv_reg_a0);
+    const riscv_word_t a1 = rv_get_reg(rv, rv_reg_a1);
+    const riscv_word_t a2 = rv_get_reg(rv, rv_reg_a2);
+
+    switch (fid) {
+    case SBI_HSM_HART_START:
+        rv_set_reg(rv, rv_reg_a0, rv_hart_start(rv, a0, a1, a2));
+        rv_set_reg(rv, rv_reg_a1, 0);
+        break;
+    case SBI_HSM_HART_STOP:
+        rv_set_reg(rv, rv_reg_a0, rv_hart_stop(rv));
+        rv_set_reg(rv, rv_reg_a1, 0);
+        break;
+    case SBI_HSM_HART_GET_STATUS:
+        if (a0 >= attr->n_harts) {
+            rv_set_reg(rv, rv_reg_a0, SBI_ERR_INVALID_PARAM);
+            rv_set_reg(rv, rv_reg_a1, 0);
+            break;
+        }
+        rv_set_reg(rv, rv_reg_a0, SBI_SUCCESS);
+        rv_set_reg(rv, rv_reg_a1,
+                   ATOMIC_LOAD(&attr->harts[a0]->hsm_state, ATOMIC_RELAXED));
+        break;
+    default:
+        rv_set_reg(rv, rv_reg_a0, SBI_ERR_NOT_SUPPORTED);
+        rv_set_reg(rv, rv_reg_a1, 0);
+        break;
+    }
+}
+#endif /* SYSTEM_MMIO */
 #endif /* SYSTEM */
 
 void syscall_handler(riscv_t *rv)
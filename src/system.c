@@ -5,6 +5,7 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "system.h"
@@ -68,22 +69,344 @@ static bool ppn_is_valid(riscv_t *rv, uint32_t ppn)
     return ppn < nr_pg_max;
 }
 
+/* ASID field of an Sv32 satp value */
+#define SATP_ASID(satp) (((satp) >> 22) & MASK(9))
+
+/* first 4 KiB page of the superpage containing @vpn */
+#define SUPER_VPN(vpn) ((vpn) & ~0x3FFU)
+
+/* way 0 of the set that caches @vpn */
+static inline tlb_entry_t *tlb_set(tlb_entry_t *tlb, uint32_t vpn)
+{
+    return &tlb[(vpn & TLB_SET_MASK) * TLB_WAYS];
+}
+
+/* Find the entry of @tag in the set of @vpn and move it to way 0, keeping
+ * the set in LRU order. Returns NULL on a miss.
+ */
+static inline tlb_entry_t *tlb_find(tlb_entry_t *tlb,
+                                    uint32_t vpn,
+                                    uint32_t tag)
+{
+    tlb_entry_t *set = tlb_set(tlb, vpn);
+    if (likely(set[0].valid && set[0].tag == tag))
+        return set;
+
+    for (int way = 1; way < TLB_WAYS; way++) {
+        if (set[way].valid && set[way].tag == tag) {
+            tlb_entry_t entry = set[way];
+            memmove(&set[1], &set[0], way * sizeof(tlb_entry_t));
+            set[0] = entry;
+            return set;
+        }
+    }
+    return NULL;
+}
+
+/* Free way 0 of the set of @vpn for a new entry of @tag. The victim is a
+ * stale entry of the same tag, else an invalid way, else the LRU way.
+ */
+static inline tlb_entry_t *tlb_alloc(tlb_entry_t *tlb,
+                                     uint32_t vpn,
+                                     uint32_t tag)
+{
+    tlb_entry_t *set = tlb_set(tlb, vpn);
+    int victim = -1;
+    for (int way = 0; way < TLB_WAYS; way++) {
+        if (set[way].valid && set[way].tag == tag) {
+            victim = way;
+            break;
+        }
+        if (!set[way].valid && victim < 0)
+            victim = way;
+    }
+    if (victim < 0)
+        victim = TLB_WAYS - 1;
+    memmove(&set[1], &set[0], victim * sizeof(tlb_entry_t));
+    return set;
+}
+
+static inline void tlb_mark_super_region(riscv_t *rv, uint32_t vpn)
+{
+    uint32_t region = vpn >> 10;
+    rv->tlb_super_regions[region / 32] |= 1U << (region % 32);
+}
+
+/* Pages of translated code.
+ *
+ * Each hart keeps a bit per 4 KiB page of guest RAM in code_pages for the
+ * pages it fetched instructions from to translate them. The dTLB entries of
+ * such pages are never dirty, in any hart, so that the stores of the inline
+ * dTLB fast paths of T1 and T2C, which require a dirty entry, take
+ * mmu_write_*() as if the page were write-protected. A store there or device
+ * DMA moves the page from code_pages to stale_pages of each hart that
+ * translated it, and FENCE.I then only drops the blocks of the stale pages
+ * instead of all translated code.
+ */
+static bool code_page_any(riscv_t *rv, uint32_t page)
+{
+    if (page >= rv->code_words * 32)
+        return false;
+#if RV32_HAS(SYSTEM_MMIO)
+    const vm_attr_t *attr = PRIV(rv);
+    for (uint32_t i = 0; i < attr->n_harts; i++) {
+        if (attr->harts[i] && mmu_code_page(attr->harts[i], page))
+            return true;
+    }
+    return false;
+#else
+    return mmu_code_page(rv, page);
+#endif
+}
+
+/* physical page of the 4 KiB page mapped by @entry, also for superpages */
+static inline uint32_t tlb_entry_page(const tlb_entry_t *entry)
+{
+    uint32_t page = entry->ppn >> RV_PG_SHIFT;
+    if (entry->level == TLB_PAGE_LEVEL_SUPER)
+        page |= entry->tag & MASK(10);
+    return page;
+}
+
+/* Let stores through @entry skip mmu_write_*() if @dirty and the page holds
+ * no code. A hart marking a code page clears the flag in the dTLBs of all
+ * harts after setting its bit, so the bits are checked after setting it.
+ */
+static void tlb_entry_set_dirty(riscv_t *rv, tlb_entry_t *entry, bool dirty)
+{
+    entry->dirty = dirty;
+    if (!dirty)
+        return;
+    ATOMIC_THREAD_FENCE(ATOMIC_SEQ_CST);
+    if (code_page_any(rv, tlb_entry_page(entry)))
+        entry->dirty = 0;
+}
+
+bool mmu_code_init(riscv_t *rv)
+{
+    const uint64_t n_pages = PRIV(rv)->mem->mem_size >> RV_PG_SHIFT;
+    rv->code_words = (n_pages + 31) / 32;
+    rv->code_pages = calloc(3 * rv->code_words, sizeof(uint32_t));
+    if (!rv->code_pages)
+        return false;
+    rv->stale_pages = rv->code_pages + rv->code_words;
+    rv->fence_pages = rv->stale_pages + rv->code_words;
+    rv->code_stale = false;
+    return true;
+}
+
+void mmu_code_exit(riscv_t *rv)
+{
+    free(rv->code_pages);
+    rv->code_pages = rv->stale_pages = rv->fence_pages = NULL;
+}
+
+/* write-protect @page from the inline store fast paths of @rv */
+static void dtlb_protect(riscv_t *rv, uint32_t page)
+{
+    for (int i = 0; i < TLB_ENTRIES; i++) {
+        tlb_entry_t *entry = &rv->dtlb[i];
+        if (entry->valid && tlb_entry_page(entry) == page)
+            entry->dirty = 0;
+    }
+}
+
+/* Note the fetch of an instruction at @paddr for translation */
+static void mmu_code_fetch(riscv_t *rv, uint32_t paddr)
+{
+    const uint32_t page = paddr >> RV_PG_SHIFT;
+    rv->ifetch_page = page;
+    if (page >= rv->code_words * 32 || mmu_code_page(rv, page))
+        return;
+
+    ATOMIC_FETCH_OR(&rv->code_pages[page / 32], 1U << (page % 32),
+                    ATOMIC_SEQ_CST);
+#if RV32_HAS(SYSTEM_MMIO)
+    const vm_attr_t *attr = PRIV(rv);
+    for (uint32_t i = 0; i < attr->n_harts; i++) {
+        if (attr->harts[i])
+            dtlb_protect(attr->harts[i], page);
+    }
+#else
+    dtlb_protect(rv, page);
+#endif
+}
+
+void mmu_code_written(riscv_t *rv, uint32_t paddr, uint32_t size)
+{
+    if (!size || paddr >= rv->code_words * 32 * RV_PG_SIZE)
+        return;
+
+    const uint32_t first = paddr >> RV_PG_SHIFT;
+    uint32_t last = (paddr + size - 1) >> RV_PG_SHIFT;
+    if (last >= rv->code_words * 32)
+        last = rv->code_words * 32 - 1;
+    for (uint32_t page = first; page <= last; page++) {
+        const uint32_t bit = 1U << (page % 32);
+        if (!(ATOMIC_LOAD(&rv->code_pages[page / 32], ATOMIC_RELAXED) & bit))
+            continue;
+        /* Stores to the page may go fast again until it is translated
+         * from anew; the dTLB entries turn dirty on the next store.
+         */
+        ATOMIC_FETCH_AND(&rv->code_pages[page / 32], ~bit, ATOMIC_RELAXED);
+        ATOMIC_FETCH_OR(&rv->stale_pages[page / 32], bit, ATOMIC_RELAXED);
+        ATOMIC_STORE(&rv->code_stale, true, ATOMIC_RELEASE);
+    }
+}
+
+bool mmu_code_fence(riscv_t *rv)
+{
+    if (!ATOMIC_EXCHANGE(&rv->code_stale, false, ATOMIC_ACQUIRE))
+        return false;
+
+    for (uint32_t i = 0; i < rv->code_words; i++) {
+        const uint32_t bits =
+            ATOMIC_EXCHANGE(&rv->stale_pages[i], 0, ATOMIC_RELAXED);
+        rv->fence_pages[i] = bits;
+        /* drop the pages translated again since the store */
+        if (bits)
+            ATOMIC_FETCH_AND(&rv->code_pages[i], ~bits, ATOMIC_RELAXED);
+    }
+    return true;
+}
+
 void mmu_tlb_flush_all(riscv_t *rv)
 {
     memset(rv->dtlb, 0, sizeof(rv->dtlb));
     memset(rv->itlb, 0, sizeof(rv->itlb));
+    memset(rv->stlb, 0, sizeof(rv->stlb));
+    memset(rv->tlb_super_regions, 0, sizeof(rv->tlb_super_regions));
+}
+
+/* whether a fence limited to @asid (if @by_asid) drops @entry; global
+ * mappings survive fences of a single address space
+ */
+static inline bool tlb_fence_hits(const tlb_entry_t *entry,
+                                  bool by_asid,
+                                  uint32_t asid)
+{
+    return entry->valid &&
+           (!by_asid || ((entry->tag >> TLB_ASID_SHIFT) == asid &&
+                         !(entry->perm & PTE_G)));
+}
+
+/* SFENCE.VMA of the page @vpn, in the address space @asid if @by_asid */
+static void tlb_fence_page(riscv_t *rv,
+                           uint32_t vpn,
+                           bool by_asid,
+                           uint32_t asid)
+{
+    tlb_entry_t *tlbs[] = {rv->dtlb, rv->itlb};
+    for (int t = 0; t < 2; t++) {
+        tlb_entry_t *set = tlb_set(tlbs[t], vpn);
+        for (int way = 0; way < TLB_WAYS; way++) {
+            if ((set[way].tag & TLB_VPN_MASK) == vpn &&
+                tlb_fence_hits(&set[way], by_asid, asid))
+                set[way].valid = 0;
+        }
+    }
+
+    for (int i = 0; i < TLB_SUPER_ENTRIES; i++) {
+        if ((rv->stlb[i].tag & TLB_VPN_MASK) == SUPER_VPN(vpn) &&
+            tlb_fence_hits(&rv->stlb[i], by_asid, asid))
+            rv->stlb[i].valid = 0;
+    }
+
+    /* A superpage is cached as one copy per 4 KiB page used, in any set.
+     * Drop all copies of the superpage that may contain @vpn, which takes a
+     * scan of both TLBs, but only for regions that hold such copies.
+     */
+    uint32_t region = vpn >> 10;
+    if (!(rv->tlb_super_regions[region / 32] & (1U << (region % 32))))
+        return;
+
+    bool kept = false;
+    for (int t = 0; t < 2; t++) {
+        for (int i = 0; i < TLB_ENTRIES; i++) {
+            tlb_entry_t *entry = &tlbs[t][i];
+            if (!entry->valid || entry->level != TLB_PAGE_LEVEL_SUPER ||
+                ((entry->tag & TLB_VPN_MASK) >> 10) != region)
+                continue;
+            if (tlb_fence_hits(entry, by_asid, asid))
+                entry->valid = 0;
+            else
+                kept = true;
+        }
+    }
+    if (!kept)
+        rv->tlb_super_regions[region / 32] &= ~(1U << (region % 32));
 }
 
 void mmu_tlb_flush(riscv_t *rv, uint32_t vaddr)
 {
-    uint32_t vpn = vaddr >> RV_PG_SHIFT;
-    uint32_t idx = vpn & TLB_MASK;
+    tlb_fence_page(rv, vaddr >> RV_PG_SHIFT, false, 0);
+}
+
+void mmu_tlb_flush_page_asid(riscv_t *rv, uint32_t vaddr, uint32_t asid)
+{
+    tlb_fence_page(rv, vaddr >> RV_PG_SHIFT, true, asid & MASK(9));
+}
+
+void mmu_tlb_flush_asid(riscv_t *rv, uint32_t asid)
+{
+    asid &= MASK(9);
+    tlb_entry_t *tlbs[] = {rv->dtlb, rv->itlb};
+    for (int t = 0; t < 2; t++) {
+        for (int i = 0; i < TLB_ENTRIES; i++) {
+            if (tlb_fence_hits(&tlbs[t][i], true, asid))
+                tlbs[t][i].valid = 0;
+        }
+    }
+    for (int i = 0; i < TLB_SUPER_ENTRIES; i++) {
+        if (tlb_fence_hits(&rv->stlb[i], true, asid))
+            rv->stlb[i].valid = 0;
+    }
+}
+
+void mmu_tlb_switch(riscv_t *rv, uint32_t old_satp)
+{
+    uint32_t asid = SATP_ASID(rv->csr_satp);
+    rv->tlb_asid_tag = asid << TLB_ASID_SHIFT;
 
-    if (rv->dtlb[idx].valid && rv->dtlb[idx].vpn == vpn)
-        rv->dtlb[idx].valid = 0;
+    /* Entries are tagged, so switching to another ASID keeps the entries of
+     * the previous address space for when it comes back. A new root table
+     * or mode under the same ASID is not fenced by the guest; drop all.
+     */
+    if (asid == SATP_ASID(old_satp))
+        mmu_tlb_flush_all(rv);
+}
 
-    if (rv->itlb[idx].valid && rv->itlb[idx].vpn == vpn)
-        rv->itlb[idx].valid = 0;
+/* Refill @tlb from the superpage array. Returns NULL if no cached superpage
+ * covers @vpn.
+ */
+static tlb_entry_t *tlb_refill_super(riscv_t *rv,
+                                     tlb_entry_t *tlb,
+                                     uint32_t vpn)
+{
+    uint32_t tag = rv->tlb_asid_tag | SUPER_VPN(vpn);
+    for (int i = 0; i < TLB_SUPER_ENTRIES; i++) {
+        if (rv->stlb[i].valid && rv->stlb[i].tag == tag) {
+            tlb_entry_t *entry = tlb_alloc(tlb, vpn, rv->tlb_asid_tag | vpn);
+            *entry = rv->stlb[i];
+            entry->tag = rv->tlb_asid_tag | vpn;
+            /* the superpage entry keeps PTE_D, this page may hold code */
+            tlb_entry_set_dirty(rv, entry, entry->dirty);
+            tlb_mark_super_region(rv, vpn);
+            rv->stats.stlb_refills++;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* Look up @vaddr in @tlb, then in the superpage array */
+static inline tlb_entry_t *tlb_lookup(riscv_t *rv,
+                                      tlb_entry_t *tlb,
+                                      uint32_t vaddr)
+{
+    uint32_t vpn = vaddr >> RV_PG_SHIFT;
+    tlb_entry_t *entry = tlb_find(tlb, vpn, rv->tlb_asid_tag | vpn);
+    return entry ? entry : tlb_refill_super(rv, tlb, vpn);
 }
 
 /* TLB lookup for data accesses (read/write).
@@ -95,14 +418,13 @@ static inline uint32_t dtlb_lookup(riscv_t *rv,
                                    bool write,
                                    bool *hit)
 {
-    uint32_t vpn = vaddr >> RV_PG_SHIFT;
-    uint32_t idx = vpn & TLB_MASK;
-    tlb_entry_t *entry = &rv->dtlb[idx];
+    tlb_entry_t *entry = tlb_lookup(rv, rv->dtlb, vaddr);
 
-    if (entry->valid && entry->vpn == vpn) {
+    if (entry) {
         /* Check permissions */
         uint8_t needed = write ? PTE_W : PTE_R;
         if (!(entry->perm & needed)) {
+            rv->stats.dtlb_misses++;
             *hit = false;
             return 0;
         }
@@ -113,9 +435,10 @@ static inline uint32_t dtlb_lookup(riscv_t *rv,
             vm_attr_t *attr = PRIV(rv);
             pte_t *pte = (pte_t *) (attr->mem->mem_base + entry->pte_addr);
             *pte |= PTE_D;
-            entry->dirty = 1;
+            tlb_entry_set_dirty(rv, entry, true);
         }
 
+        rv->stats.dtlb_hits++;
         *hit = true;
         /* ppn stores the page-aligned physical address base */
         uint32_t offset = (entry->level == TLB_PAGE_LEVEL_SUPER)
@@ -124,6 +447,7 @@ static inline uint32_t dtlb_lookup(riscv_t *rv,
         return entry->ppn | offset;
     }
 
+    rv->stats.dtlb_misses++;
     *hit = false;
     return 0;
 }
@@ -133,17 +457,17 @@ static inline uint32_t dtlb_lookup(riscv_t *rv,
  */
 static inline uint32_t itlb_lookup(riscv_t *rv, uint32_t vaddr, bool *hit)
 {
-    uint32_t vpn = vaddr >> RV_PG_SHIFT;
-    uint32_t idx = vpn & TLB_MASK;
-    tlb_entry_t *entry = &rv->itlb[idx];
+    tlb_entry_t *entry = tlb_lookup(rv, rv->itlb, vaddr);
 
-    if (entry->valid && entry->vpn == vpn) {
+    if (entry) {
         /* Check execute permission */
         if (!(entry->perm & PTE_X)) {
+            rv->stats.itlb_misses++;
             *hit = false;
             return 0;
         }
 
+        rv->stats.itlb_hits++;
         *hit = true;
         /* ppn stores the page-aligned physical address base */
         uint32_t offset = (entry->level == TLB_PAGE_LEVEL_SUPER)
@@ -152,52 +476,50 @@ static inline uint32_t itlb_lookup(riscv_t *rv, uint32_t vaddr, bool *hit)
         return entry->ppn | offset;
     }
 
+    rv->stats.itlb_misses++;
     *hit = false;
     return 0;
 }
 
-/* Populate dTLB entry after successful page walk */
-static inline void dtlb_populate(riscv_t *rv,
-                                 uint32_t vaddr,
-                                 pte_t *pte,
-                                 uint32_t level)
+/* Populate a dTLB or iTLB entry after successful page walk; superpages are
+ * also kept whole in the superpage array.
+ */
+static inline void tlb_populate(riscv_t *rv,
+                                tlb_entry_t *tlb,
+                                uint32_t vaddr,
+                                pte_t *pte,
+                                uint32_t level)
 {
     vm_attr_t *attr = PRIV(rv);
     uint32_t vpn = vaddr >> RV_PG_SHIFT;
-    uint32_t idx = vpn & TLB_MASK;
-    tlb_entry_t *entry = &rv->dtlb[idx];
+    uint32_t tag = rv->tlb_asid_tag | vpn;
+    tlb_entry_t *entry = tlb_alloc(tlb, vpn, tag);
 
-    entry->vpn = vpn;
+    entry->tag = tag;
     /* Store page-aligned physical address base (PPN extracted from PTE bits
      * [31:10], shifted left by 12) */
     entry->ppn = *pte >> (RV_PG_SHIFT - 2) << RV_PG_SHIFT;
     entry->pte_addr = (uint8_t *) pte - attr->mem->mem_base;
-    entry->perm = *pte & (PTE_R | PTE_W | PTE_X | PTE_U);
-    entry->dirty = (*pte & PTE_D) ? 1 : 0;
+    entry->perm = *pte & (PTE_R | PTE_W | PTE_X | PTE_U | PTE_G);
     entry->level = level;
+    tlb_entry_set_dirty(rv, entry, *pte & PTE_D);
     entry->valid = 1;
-}
 
-/* Populate iTLB entry after successful page walk */
-static inline void itlb_populate(riscv_t *rv,
-                                 uint32_t vaddr,
-                                 pte_t *pte,
-                                 uint32_t level)
-{
-    vm_attr_t *attr = PRIV(rv);
-    uint32_t vpn = vaddr >> RV_PG_SHIFT;
-    uint32_t idx = vpn & TLB_MASK;
-    tlb_entry_t *entry = &rv->itlb[idx];
+    if (level != TLB_PAGE_LEVEL_SUPER)
+        return;
+    tlb_mark_super_region(rv, vpn);
 
-    entry->vpn = vpn;
-    /* Store page-aligned physical address base (PPN extracted from PTE bits
-     * [31:10], shifted left by 12) */
-    entry->ppn = *pte >> (RV_PG_SHIFT - 2) << RV_PG_SHIFT;
-    entry->pte_addr = (uint8_t *) pte - attr->mem->mem_base;
-    entry->perm = *pte & (PTE_R | PTE_W | PTE_X | PTE_U);
-    entry->dirty = (*pte & PTE_D) ? 1 : 0;
-    entry->level = level;
-    entry->valid = 1;
+    uint32_t super_tag = rv->tlb_asid_tag | SUPER_VPN(vpn);
+    tlb_entry_t *super = NULL;
+    for (int i = 0; i < TLB_SUPER_ENTRIES && !super; i++) {
+        if (rv->stlb[i].valid && rv->stlb[i].tag == super_tag)
+            super = &rv->stlb[i];
+    }
+    if (!super)
+        super = &rv->stlb[rv->stlb_next++ % TLB_SUPER_ENTRIES];
+    *super = *entry;
+    super->tag = super_tag;
+    super->dirty = (*pte & PTE_D) ? 1 : 0;
 }
 
 #define PAGE_TABLE(ppn)                                               \
@@ -348,7 +670,6 @@ MMU_FAULT_CHECK_IMPL(write, pagefault_store)
  * - mmu_write_s
  * - mmu_write_b
  */
-extern bool need_retranslate;
 static uint32_t mmu_ifetch(riscv_t *rv, const uint32_t vaddr)
 {
     /*
@@ -357,17 +678,21 @@ static uint32_t mmu_ifetch(riscv_t *rv, const uint32_t vaddr)
      * cannot work on a NULL PTE.
      */
 
-    if (!rv->csr_satp)
-        return memory_ifetch(vaddr);
+    if (!rv->csr_satp) {
+        mmu_code_fetch(rv, vaddr);
+        return memory_ifetch(PRIV(rv)->mem, vaddr);
+    }
 
-    if (need_retranslate)
+    if (rv->need_retranslate)
         return 0;
 
     /* Try iTLB first for fast path */
     bool hit;
     uint32_t paddr = itlb_lookup(rv, vaddr, &hit);
-    if (hit)
-        return memory_ifetch(paddr);
+    if (hit) {
+        mmu_code_fetch(rv, paddr);
+        return memory_ifetch(PRIV(rv)->mem, paddr);
+    }
 
     /* TLB miss - do full page walk */
     uint32_t level;
@@ -375,17 +700,17 @@ static uint32_t mmu_ifetch(riscv_t *rv, const uint32_t vaddr)
     bool ok = MMU_FAULT_CHECK(ifetch, rv, pte, vaddr, PTE_X);
     if (unlikely(!ok)) {
 #if RV32_HAS(SYSTEM_MMIO)
-        CHECK_PENDING_SIGNAL(rv, need_handle_signal);
-        if (need_handle_signal)
+        CHECK_PENDING_SIGNAL(rv, rv->need_handle_signal);
+        if (rv->need_handle_signal)
             return 0;
 #endif
         /* Retry walk after trap handler has set up the page */
         pte = mmu_walk(rv, vaddr, &level);
         /* Re-validate permissions after retry */
         if (!pte || !MMU_FAULT_CHECK(ifetch, rv, pte, vaddr, PTE_X)) {
-            need_retranslate = true;
+            rv->need_retranslate = true;
             /* Also set need_handle_signal so RVOP macro returns for retry */
-            need_handle_signal = true;
+            rv->need_handle_signal = true;
             return 0;
         }
     }
@@ -395,29 +720,61 @@ static uint32_t mmu_ifetch(riscv_t *rv, const uint32_t vaddr)
         *pte |= PTE_A;
 
     /* Populate iTLB for future accesses */
-    itlb_populate(rv, vaddr, pte, level);
+    tlb_populate(rv, rv->itlb, vaddr, pte, level);
 
     get_ppn_and_offset();
-    return memory_ifetch(ppn | offset);
+    mmu_code_fetch(rv, ppn | offset);
+    return memory_ifetch(PRIV(rv)->mem, ppn | offset);
+}
+
+#if RV32_HAS(SYSTEM_MMIO)
+static uint32_t mmio_dispatch_read(riscv_t *rv, uint32_t addr)
+{
+    MMIO_READ();
+    __UNREACHABLE;
+}
+
+static void mmio_dispatch_write(riscv_t *rv, uint32_t addr, uint32_t val)
+{
+    MMIO_WRITE();
 }
 
+/* The device models are not thread-safe, and every hart may reach them, so
+ * MMIO accesses take turns on device_lock.
+ */
+static uint32_t mmio_read(riscv_t *rv, uint32_t addr)
+{
+    pthread_mutex_lock(&PRIV(rv)->device_lock);
+    uint32_t val = mmio_dispatch_read(rv, addr);
+    pthread_mutex_unlock(&PRIV(rv)->device_lock);
+    return val;
+}
+
+static void mmio_write(riscv_t *rv, uint32_t addr, uint32_t val)
+{
+    pthread_mutex_lock(&PRIV(rv)->device_lock);
+    mmio_dispatch_write(rv, addr, val);
+    pthread_mutex_unlock(&PRIV(rv)->device_lock);
+}
+#endif
+
 uint32_t mmu_read_w(riscv_t *rv, const uint32_t vaddr)
 {
     uint32_t addr = rv->io.mem_translate(rv, vaddr, R);
 
 #if RV32_HAS(SYSTEM) && RV32_HAS(ELF_LOADER)
-    if (need_retranslate)
+    if (rv->need_retranslate)
         return 0;
 #elif RV32_HAS(SYSTEM_MMIO)
-    if (need_handle_signal)
+    if (rv->need_handle_signal)
         return 0;
 #endif
 
     if (GUEST_RAM_CONTAINS(PRIV(rv)->mem, addr, 4))
-        return memory_read_w(addr);
+        return memory_read_w(PRIV(rv)->mem, addr);
 
 #if RV32_HAS(SYSTEM_MMIO)
-    MMIO_READ();
+    return mmio_read(rv, addr);
 #endif
 
     __UNREACHABLE;
@@ -428,18 +785,18 @@ uint16_t mmu_read_s(riscv_t *rv, const uint32_t vaddr)
     uint32_t addr = rv->io.mem_translate(rv, vaddr, R);
 
 #if RV32_HAS(SYSTEM) && RV32_HAS(ELF_LOADER)
-    if (need_retranslate)
+    if (rv->need_retranslate)
         return 0;
 #elif RV32_HAS(SYSTEM_MMIO)
-    if (need_handle_signal)
+    if (rv->need_handle_signal)
         return 0;
 #endif
 
     if (GUEST_RAM_CONTAINS(PRIV(rv)->mem, addr, 2))
-        return memory_read_s(addr);
+        return memory_read_s(PRIV(rv)->mem, addr);
 
 #if RV32_HAS(SYSTEM_MMIO)
-    MMIO_READ();
+    return mmio_read(rv, addr);
 #endif
 
     __UNREACHABLE;
@@ -450,18 +807,18 @@ uint8_t mmu_read_b(riscv_t *rv, const uint32_t vaddr)
     uint32_t addr = rv->io.mem_translate(rv, vaddr, R);
 
 #if RV32_HAS(SYSTEM) && RV32_HAS(ELF_LOADER)
-    if (need_retranslate)
+    if (rv->need_retranslate)
         return 0;
 #elif RV32_HAS(SYSTEM_MMIO)
-    if (need_handle_signal)
+    if (rv->need_handle_signal)
         return 0;
 #endif
 
     if (GUEST_RAM_CONTAINS(PRIV(rv)->mem, addr, 1))
-        return memory_read_b(addr);
+        return memory_read_b(PRIV(rv)->mem, addr);
 
 #if RV32_HAS(SYSTEM_MMIO)
-    MMIO_READ();
+    return mmio_read(rv, addr);
 #endif
 
     __UNREACHABLE;
@@ -472,20 +829,22 @@ void mmu_write_w(riscv_t *rv, const uint32_t vaddr, const uint32_t val)
     uint32_t addr = rv->io.mem_translate(rv, vaddr, W);
 
 #if RV32_HAS(SYSTEM) && RV32_HAS(ELF_LOADER)
-    if (need_retranslate)
+    if (rv->need_retranslate)
         return;
 #elif RV32_HAS(SYSTEM_MMIO)
-    if (need_handle_signal)
+    if (rv->need_handle_signal)
         return;
 #endif
 
     if (GUEST_RAM_CONTAINS(PRIV(rv)->mem, addr, 4)) {
-        memory_write_w(addr, (uint8_t *) &val);
+        mmu_code_store(rv, addr, 4);
+        memory_write_w(PRIV(rv)->mem, addr, (uint8_t *) &val);
         return;
     }
 
 #if RV32_HAS(SYSTEM_MMIO)
-    MMIO_WRITE();
+    mmio_write(rv, addr, val);
+    return;
 #endif
 
     __UNREACHABLE;
@@ -496,20 +855,22 @@ void mmu_write_s(riscv_t *rv, const uint32_t vaddr, const uint16_t val)
     uint32_t addr = rv->io.mem_translate(rv, vaddr, W);
 
 #if RV32_HAS(SYSTEM) && RV32_HAS(ELF_LOADER)
-    if (need_retranslate)
+    if (rv->need_retranslate)
         return;
 #elif RV32_HAS(SYSTEM_MMIO)
-    if (need_handle_signal)
+    if (rv->need_handle_signal)
         return;
 #endif
 
     if (GUEST_RAM_CONTAINS(PRIV(rv)->mem, addr, 2)) {
-        memory_write_s(addr, (uint8_t *) &val);
+        mmu_code_store(rv, addr, 2);
+        memory_write_s(PRIV(rv)->mem, addr, (uint8_t *) &val);
         return;
     }
 
 #if RV32_HAS(SYSTEM_MMIO)
-    MMIO_WRITE();
+    mmio_write(rv, addr, val);
+    return;
 #endif
 
     __UNREACHABLE;
@@ -520,20 +881,22 @@ void mmu_write_b(riscv_t *rv, const uint32_t vaddr, const uint8_t val)
     uint32_t addr = rv->io.mem_translate(rv, vaddr, W);
 
 #if RV32_HAS(SYSTEM) && RV32_HAS(ELF_LOADER)
-    if (need_retranslate)
+    if (rv->need_retranslate)
         return;
 #elif RV32_HAS(SYSTEM_MMIO)
-    if (need_handle_signal)
+    if (rv->need_handle_signal)
         return;
 #endif
 
     if (GUEST_RAM_CONTAINS(PRIV(rv)->mem, addr, 1)) {
-        memory_write_b(addr, (uint8_t *) &val);
+        mmu_code_store(rv, addr, 1);
+        memory_write_b(PRIV(rv)->mem, addr, (uint8_t *) &val);
         return;
     }
 
 #if RV32_HAS(SYSTEM_MMIO)
-    MMIO_WRITE();
+    mmio_write(rv, addr, val);
+    return;
 #endif
 
     __UNREACHABLE;
@@ -557,8 +920,8 @@ uint32_t mmu_translate(riscv_t *rv, uint32_t vaddr, bool rw)
                  : MMU_FAULT_CHECK(write, rv, pte, vaddr, PTE_W);
     if (unlikely(!ok)) {
 #if RV32_HAS(SYSTEM_MMIO)
-        CHECK_PENDING_SIGNAL(rv, need_handle_signal);
-        if (need_handle_signal)
+        CHECK_PENDING_SIGNAL(rv, rv->need_handle_signal);
+        if (rv->need_handle_signal)
             return 0;
 #endif
         /* Retry walk after trap handler has set up the page */
@@ -568,11 +931,11 @@ uint32_t mmu_translate(riscv_t *rv, uint32_t vaddr, bool rw)
                 : MMU_FAULT_CHECK(write, rv, pte, vaddr, PTE_W);
         if (!pte || !ok) {
 #if RV32_HAS(ELF_LOADER)
-            need_retranslate = true;
+            rv->need_retranslate = true;
             /* Also set need_handle_signal so RVOP macro returns for retry */
-            need_handle_signal = true;
+            rv->need_handle_signal = true;
 #else
-            need_handle_signal = true;
+            rv->need_handle_signal = true;
 #endif
             return 0;
         }
@@ -585,7 +948,7 @@ uint32_t mmu_translate(riscv_t *rv, uint32_t vaddr, bool rw)
         *pte |= PTE_D;
 
     /* Populate dTLB for future accesses */
-    dtlb_populate(rv, vaddr, pte, level);
+    tlb_populate(rv, rv->dtlb, vaddr, pte, level);
 
     get_ppn_and_offset();
     return ppn | offset;
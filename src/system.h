@@ -184,14 +184,6 @@ void emu_update_rtc_interrupts(riscv_t *rv);
 
 #endif /* !RV32_HAS(ELF_LOADER) */
 
-/*
- * Signal to RVOP macro that inline trap handling occurred.
- * When set, the instruction should return without advancing PC to allow retry.
- * Used both for Linux kernel signal handling (modifies SEPC) and ELF loader
- * mode inline trap handling (page fault resolved, instruction needs retry).
- */
-extern bool need_handle_signal;
-
 /* Walk through page tables and get the corresponding PTE by virtual address if
  * exists
  * @rv: RISC-V emulator
@@ -228,6 +220,11 @@ uint32_t mmu_translate(riscv_t *rv, uint32_t vaddr, bool rw);
  */
 void mmu_tlb_flush_all(riscv_t *rv);
 void mmu_tlb_flush(riscv_t *rv, uint32_t vaddr);
+void mmu_tlb_flush_asid(riscv_t *rv, uint32_t asid);
+void mmu_tlb_flush_page_asid(riscv_t *rv, uint32_t vaddr, uint32_t asid);
+
+/* Retag the TLBs after a write of satp that changed it from @old_satp */
+void mmu_tlb_switch(riscv_t *rv, uint32_t old_satp);
 
 #define get_ppn_and_offset()                                   \
     uint32_t ppn;                                              \
@@ -40,25 +40,39 @@
  * in jit.c so the LLVM IR emission can hard-code offsets safely.
  */
 _Static_assert(sizeof(tlb_entry_t) == 16, "tlb_entry_t must be 16 bytes");
-_Static_assert(offsetof(tlb_entry_t, vpn) == 0, "tlb_entry_t.vpn offset");
+_Static_assert(offsetof(tlb_entry_t, tag) == 0, "tlb_entry_t.tag offset");
 _Static_assert(offsetof(tlb_entry_t, ppn) == 4, "tlb_entry_t.ppn offset");
 _Static_assert(offsetof(tlb_entry_t, perm) == 12, "tlb_entry_t.perm offset");
 _Static_assert(offsetof(tlb_entry_t, valid) == 13, "tlb_entry_t.valid offset");
 _Static_assert(offsetof(tlb_entry_t, dirty) == 14, "tlb_entry_t.dirty offset");
 _Static_assert(offsetof(tlb_entry_t, level) == 15, "tlb_entry_t.level offset");
-_Static_assert((TLB_SIZE & (TLB_SIZE - 1)) == 0,
-               "TLB_SIZE must be a power of two");
-/* Mirrors the assert in jit.c: the T1 x86-64 fast path uses opcode 0x83 /4
- * (imm8 sign-extended) for `and esi, TLB_SIZE - 1`.  Keep both asserts in
- * lockstep so a TLB_SIZE bump here cannot silently diverge from the T1
- * emitter's encoding.
- */
-_Static_assert(TLB_SIZE <= 128,
-               "TLB_SIZE > 128 needs imm32 AND encoding in the x86-64 "
-               "fast path (see jit.c emit path)");
+_Static_assert((TLB_SETS & (TLB_SETS - 1)) == 0 &&
+                   (TLB_WAYS & (TLB_WAYS - 1)) == 0,
+               "TLB sets and ways must be powers of two");
 _Static_assert(RV_PG_SHIFT == 12, "fast path assumes 4 KiB pages");
 #endif
 
+/* Each compile worker owns an LLVMContext and builds every module inside it,
+ * since a context must never be used by two threads at once. t2c_compile()
+ * binds the worker's context to this thread-local before emitting IR, and the
+ * global-context helpers used throughout the IR templates are redirected to
+ * it so that nothing leaks into LLVM's process-wide default context.
+ */
+static __thread LLVMContextRef t2c_ctx;
+
+#define LLVMVoidType() LLVMVoidTypeInContext(t2c_ctx)
+#define LLVMInt8Type() LLVMInt8TypeInContext(t2c_ctx)
+#define LLVMInt16Type() LLVMInt16TypeInContext(t2c_ctx)
+#define LLVMInt32Type() LLVMInt32TypeInContext(t2c_ctx)
+#define LLVMInt64Type() LLVMInt64TypeInContext(t2c_ctx)
+#define LLVMStructType(elems, count, packed) \
+    LLVMStructTypeInContext(t2c_ctx, elems, count, packed)
+#define LLVMAppendBasicBlock(fn, name) \
+    LLVMAppendBasicBlockInContext(t2c_ctx, fn, name)
+#define LLVMCreateBuilder() LLVMCreateBuilderInContext(t2c_ctx)
+#define LLVMModuleCreateWithName(name) \
+    LLVMModuleCreateWithNameInContext(name, t2c_ctx)
+
 #define MAX_BLOCKS 8152
 
 struct LLVM_block_map_entry {
@@ -143,6 +157,11 @@ T2C_LLVM_GEN_ADDR(ra, X, rv_reg_ra);
 T2C_LLVM_GEN_ADDR(sp, X, rv_reg_sp);
 #endif
 T2C_LLVM_GEN_ADDR(PC, PC, 0);
+#if RV32_HAS(EXT_F)
+T2C_LLVM_GEN_ADDR(frs1, F, ir->rs1);
+T2C_LLVM_GEN_ADDR(frs2, F, ir->rs2);
+T2C_LLVM_GEN_ADDR(frd, F, ir->rd);
+#endif
 
 FORCE_INLINE LLVMValueRef t2c_gen_rv_field_ptr(LLVMValueRef start,
                                                LLVMBuilderRef *builder,
@@ -259,9 +278,10 @@ FORCE_INLINE void t2c_gen_call_io_func(LLVMValueRef start,
                    &rv_ptr, 1, "");
 }
 
-static LLVMTypeRef t2c_jit_cache_func_type;
-static LLVMTypeRef t2c_jit_cache_struct_type;
-static LLVMTypeRef t2c_inline_cache_struct_type;
+/* Types are owned by a context, so these are per-worker as well */
+static __thread LLVMTypeRef t2c_jit_cache_func_type;
+static __thread LLVMTypeRef t2c_jit_cache_struct_type;
+static __thread LLVMTypeRef t2c_inline_cache_struct_type;
 
 #include "t2c_template.c"
 #undef T2C_OP
@@ -427,14 +447,48 @@ static void t2c_trace_ebb(LLVMBuilderRef *builder,
         LLVMDisposeBuilder(utk);
 }
 
-void t2c_compile(riscv_t *rv, block_t *block, pthread_mutex_t *cache_lock)
+static pthread_once_t t2c_target_once = PTHREAD_ONCE_INIT;
+
+/* LLVM target registration is process-wide and not safe to race from several
+ * compile workers, so perform it exactly once.
+ */
+static void t2c_init_target(void)
+{
+    LLVMLinkInMCJIT();
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+#if defined(__aarch64__)
+    /* Initialize asm parser for inline assembly support in JIT.
+     * Required for ARM64 ISB instruction emission in t2c_jit_cache_helper.
+     */
+    LLVMInitializeNativeAsmParser();
+#endif
+}
+
+void *t2c_context_create(void)
+{
+    pthread_once(&t2c_target_once, t2c_init_target);
+    return LLVMContextCreate();
+}
+
+/* Must only be called once every engine built in @ctx has been disposed */
+void t2c_context_dispose(void *ctx)
+{
+    if (ctx)
+        LLVMContextDispose((LLVMContextRef) ctx);
+}
+
+void t2c_compile(riscv_t *rv, block_t *block, void *ctx, uint32_t reader)
 {
     /* Skip if already compiled (defensive check) */
     if (ATOMIC_LOAD(&block->hot2, ATOMIC_ACQUIRE)) {
-        pthread_mutex_unlock(cache_lock);
+        cache_read_unlock(rv->block_cache, reader);
         return;
     }
 
+    t2c_ctx = (LLVMContextRef) ctx;
+    uint64_t start_ns = rv_stats_now();
+
     LLVMModuleRef module = LLVMModuleCreateWithName("my_module");
     /* Build LLVM struct type that matches riscv_internal layout.
      *
@@ -523,10 +577,10 @@ void t2c_compile(riscv_t *rv, block_t *block, pthread_mutex_t *cache_lock)
     set_t *set = malloc(sizeof(set_t));
     if (!set) {
         rv_log_error("Failed to allocate set for T2C compilation");
+        cache_read_unlock(rv->block_cache, reader);
         LLVMDisposeBuilder(first_builder);
         LLVMDisposeBuilder(builder);
         LLVMDisposeModule(module);
-        pthread_mutex_unlock(cache_lock);
         return;
     }
     set_reset(set);
@@ -536,27 +590,22 @@ void t2c_compile(riscv_t *rv, block_t *block, pthread_mutex_t *cache_lock)
     t2c_trace_ebb(&builder, param_types, start, &entry, rv, block, set, &map,
                   insn_counter);
 
-    block->is_compiling = true; /* Mark block as busy to prevent eviction */
-
-    /* Release lock during expensive LLVM compilation.
-     * IR translation is complete; block fields are no longer accessed until
-     * we need to write results. SFENCE.VMA can now proceed with minimal delay.
+    /* The generated code refers to no IR or block, only to the guest
+     * instructions it was traced from, so the block cache is left before the
+     * slow LLVM passes. Holding it would keep the hart from reclaiming any
+     * block it evicts meanwhile.
      */
-    pthread_mutex_unlock(cache_lock);
+    const uint32_t pc = block->pc_start;
+    const uint64_t digest = block->digest;
+#if RV32_HAS(SYSTEM)
+    const uint32_t satp = block->satp;
+#endif
+    cache_read_unlock(rv->block_cache, reader);
 
     /* Offload LLVM IR to LLVM backend */
     char *error = NULL, *triple = LLVMGetDefaultTargetTriple();
     LLVMExecutionEngineRef engine;
     LLVMTargetRef target;
-    LLVMLinkInMCJIT();
-    LLVMInitializeNativeTarget();
-    LLVMInitializeNativeAsmPrinter();
-#if defined(__aarch64__)
-    /* Initialize asm parser for inline assembly support in JIT.
-     * Required for ARM64 ISB instruction emission in t2c_jit_cache_helper.
-     */
-    LLVMInitializeNativeAsmParser();
-#endif
     if (LLVMGetTargetFromTriple(triple, &target, &error) != 0) {
         rv_log_fatal("Failed to create target");
         abort();
@@ -619,12 +668,9 @@ void t2c_compile(riscv_t *rv, block_t *block, pthread_mutex_t *cache_lock)
         abort();
     }
 
-    /* Get function pointer - store in local variable first.
-     * We'll write to block->func only under cache_lock to avoid data race
-     * with eviction path that reads block->func.
-     */
     exec_t2c_func_t func =
         (exec_t2c_func_t) LLVMGetPointerToGlobal(engine, start);
+    rv_stats_hist_add(&rv->stats.t2c_compile, rv_stats_now() - start_ns);
 
     /* Cleanup LLVM resources - execution engine owns the module */
     LLVMDisposeBuilder(first_builder);
@@ -634,87 +680,58 @@ void t2c_compile(riscv_t *rv, block_t *block, pthread_mutex_t *cache_lock)
     LLVMDisposeMessage(triple);
     LLVMDisposeMessage(cpu_name);
     LLVMDisposeMessage(cpu_features);
-
-    /* Reacquire lock to update shared state.
-     * All block field writes must happen under lock to avoid data races.
-     */
-    pthread_mutex_lock(cache_lock);
-
-    block->is_compiling = false;
+    free(set);
 
     /* Defensive check: if LLVM failed to generate code, don't mark as compiled.
      * Must dispose the engine to prevent memory leak.
      */
     if (!func) {
-        /* Check if block was evicted - if so, free it and its IRs */
-        if (block->should_free) {
-            /* Free IRs that main thread skipped during deferred eviction */
-            for (rv_insn_t *ir = block->ir_head, *next_ir; ir; ir = next_ir) {
-                next_ir = ir->next;
-                free(ir->branch_table);
-                if (ir->fuse)
-                    mpool_free(rv->fuse_mp, ir->fuse);
-                mpool_free(rv->block_ir_mp, ir);
-            }
-            mpool_free(rv->block_mp, block);
-        }
         LLVMDisposeExecutionEngine(engine);
-        pthread_mutex_unlock(cache_lock);
-        free(set);
         return;
     }
 
-    /* Check if block was evicted while we were compiling.
-     * If so, we are responsible for freeing it.
+    /* The block may have been evicted or invalidated meanwhile, and possibly
+     * translated anew. Publish the code to whichever block now starts at the
+     * same address with the same instruction words: the code is as valid for
+     * it as for the block it was traced from. The hart never enters T2C code
+     * of a block it dropped, and it disposes the engine along with the block,
+     * which it frees only after this worker left the block cache.
      */
-    if (block->should_free) {
-        /* Dispose engine (we own it) */
-        LLVMDisposeExecutionEngine(engine);
-        /* Free IRs that main thread skipped during deferred eviction */
-        for (rv_insn_t *ir = block->ir_head, *next_ir; ir; ir = next_ir) {
-            next_ir = ir->next;
-            free(ir->branch_table);
-            if (ir->fuse)
-                mpool_free(rv->fuse_mp, ir->fuse);
-            mpool_free(rv->block_ir_mp, ir);
-        }
-        mpool_free(rv->block_mp, block);
-        pthread_mutex_unlock(cache_lock);
-        free(set);
-        return;
-    }
-
+    cache_read_lock(rv->block_cache, reader);
+    block = (block_t *) cache_get(rv->block_cache, pc, false);
+    if (block && (block->digest != digest
 #if RV32_HAS(SYSTEM)
-    uint64_t key = (uint64_t) block->pc_start | ((uint64_t) block->satp << 32);
+                  || block->satp != satp
+#endif
+                  ))
+        block = NULL;
 
-    /* Check invalidated flag after reacquiring lock. If SFENCE.VMA ran while
-     * we were compiling, it set this flag and cleared jit_cache. We must not
-     * re-add a stale entry. Dispose engine to prevent leak.
+    /* Another worker may publish to the same block through an earlier
+     * translation of it: whoever installs its engine first wins.
      */
-    if (block->invalidated) {
+    void *expected = NULL;
+    while (block && !ATOMIC_COMPARE_EXCHANGE_WEAK(&block->llvm_engine,
+                                                  &expected, (void *) engine,
+                                                  ATOMIC_RELAXED,
+                                                  ATOMIC_RELAXED)) {
+        if (expected)
+            block = NULL;
+    }
+    if (!block) {
+        cache_read_unlock(rv->block_cache, reader);
         LLVMDisposeExecutionEngine(engine);
-        pthread_mutex_unlock(cache_lock);
-        free(set);
         return;
     }
-#else
-    uint64_t key = (uint64_t) block->pc_start;
-#endif
-
-    /* Write to block fields under lock to avoid data race with eviction */
     block->func = func;
-    block->llvm_engine = engine;
-
-    jit_cache_update(rv->jit_cache, key, block->func);
 
-    /* Atomic store-release ensures all writes to block->func and jit_cache
-     * are visible to other threads before they observe hot2=true.
-     * Pairs with atomic load-acquire in rv_step().
+    /* Atomic store-release ensures the write to block->func is visible to
+     * the hart before it observes hot2=true, which is all the publication
+     * takes. Pairs with atomic load-acquire in rv_step(), which then links
+     * the code into jit_cache.
      */
     ATOMIC_STORE(&block->hot2, true, ATOMIC_RELEASE);
-
-    pthread_mutex_unlock(cache_lock);
-    free(set);
+    cache_read_unlock(rv->block_cache, reader);
+    ATOMIC_FETCH_ADD(&rv->stats.promoted[RV_TIER_T2C], 1, ATOMIC_RELAXED);
 }
 
 struct jit_cache *jit_cache_init()
@@ -859,17 +876,10 @@ void jit_cache_clear(struct jit_cache *cache)
  * SFENCE.VMA operations, avoiding unnecessary invalidation of unrelated
  * entries.
  *
- * Caller must hold cache_lock (rv->cache_lock) to synchronize with the T2C
- * compilation thread. The T2C thread holds this lock when updating jit_cache
- * entries via jit_cache_update(). Without this lock:
- * 1. T2C thread could be writing an entry while we read/clear it
- * 2. Race could cause partially-written keys to be matched incorrectly
- * 3. Entry could be cleared right after T2C writes it, causing wasted work
- *
- * The seqlock pattern used here only protects the main thread's JIT cache
- * lookups from seeing torn reads - it does not provide mutual exclusion for
- * writers. The cache_lock provides that exclusion between the main thread
- * (SFENCE.VMA) and T2C thread (block compilation).
+ * The seqlock pattern used here only protects the JIT cache lookups of the
+ * T2C code from seeing torn reads - it does not provide mutual exclusion for
+ * writers. There is a single writer instead: the hart, which links the code
+ * the T2C workers published (see rv_step()) and clears it here.
  */
 void jit_cache_clear_page(struct jit_cache *cache, uint32_t va, uint32_t satp)
 {
@@ -37,6 +37,9 @@ T2C_OP(jal, {
     if (ir->rd)
         T2C_LLVM_GEN_STORE_IMM32(*builder, ir->pc + 4,
                                  t2c_gen_rd_addr(start, builder, ir));
+    /* in a superblock, the next IR is the jump target */
+    if (ir->next)
+        return;
 
     if (ir->branch_taken &&
         t2c_check_valid_blk(rv, block, ir->branch_taken->pc)) {
@@ -318,6 +321,36 @@ T2C_OP(jalr, {
     t2c_jit_cache_helper(builder, start, val_rs1, rv, block, ir, insn_counter);
 })
 
+/* A conditional branch a superblock followed: return through a side exit on
+ * the way it rarely goes, and go on with the next IR on the other.
+ */
+FORCE_INLINE void t2c_superblock_branch(LLVMBuilderRef *builder,
+                                        LLVMValueRef start,
+                                        LLVMValueRef addr_PC,
+                                        LLVMValueRef cmp,
+                                        rv_insn_t *ir,
+                                        uint32_t len,
+                                        LLVMValueRef insn_counter)
+{
+    const bool hot_taken = ir->next->pc == ir->pc + ir->imm;
+    LLVMBasicBlockRef side_exit = LLVMAppendBasicBlock(start, "side_exit");
+    LLVMBuilderRef exit_builder = LLVMCreateBuilder();
+    LLVMPositionBuilderAtEnd(exit_builder, side_exit);
+    T2C_LLVM_GEN_STORE_IMM32(exit_builder,
+                             hot_taken ? ir->pc + len : ir->pc + ir->imm,
+                             addr_PC);
+    T2C_STORE_TIMER(exit_builder, start, insn_counter);
+    LLVMBuildRetVoid(exit_builder);
+    LLVMDisposeBuilder(exit_builder);
+
+    LLVMBasicBlockRef hot = LLVMAppendBasicBlock(start, "superblock");
+    if (hot_taken)
+        LLVMBuildCondBr(*builder, cmp, hot, side_exit);
+    else
+        LLVMBuildCondBr(*builder, cmp, side_exit, hot);
+    LLVMPositionBuilderAtEnd(*builder, hot);
+}
+
 #define BRANCH_FUNC(type, cond)                                             \
     T2C_OP(type, {                                                          \
         LLVMValueRef addr_PC = t2c_gen_PC_addr(start, builder, ir);         \
@@ -326,6 +359,11 @@ T2C_OP(jalr, {
         T2C_LLVM_GEN_LOAD_VMREG(rs2, 32,                                    \
                                 t2c_gen_rs2_addr(start, builder, ir));      \
         T2C_LLVM_GEN_CMP(cond, val_rs1, val_rs2);                           \
+        if (ir->next) {                                                     \
+            t2c_superblock_branch(builder, start, addr_PC, cmp, ir, 4,      \
+                                  insn_counter);                            \
+            return;                                                         \
+        }                                                                   \
         LLVMBasicBlockRef taken = LLVMAppendBasicBlock(start, "taken");     \
         LLVMBuilderRef builder2 = LLVMCreateBuilder();                      \
         LLVMPositionBuilderAtEnd(builder2, taken);                          \
@@ -436,21 +474,22 @@ static LLVMBasicBlockRef t2c_emit_mmu_fastpath(LLVMBuilderRef *builder,
         LLVMPositionBuilderAtEnd(*builder, next);
     }
 
-    /* vpn = vaddr >> 12; idx = vpn & (TLB_SIZE - 1). */
+    /* vpn = vaddr >> 12; set = vpn & TLB_SET_MASK. */
     LLVMValueRef vpn =
         LLVMBuildLShr(*builder, vaddr, LLVMConstInt(i32, 12, false), "");
     LLVMValueRef idx32 =
-        LLVMBuildAnd(*builder, vpn, LLVMConstInt(i32, TLB_SIZE - 1, false), "");
+        LLVMBuildAnd(*builder, vpn, LLVMConstInt(i32, TLB_SET_MASK, false), "");
 
-    /* entry_ptr = (i8 *) rv + offsetof(dtlb) + idx*16.
+    /* entry_ptr = (i8 *) rv + offsetof(dtlb) + (set << TLB_SET_SHIFT), way 0
+     * of the set, which holds its most recently used entry.
      *
      * The T2C entry function takes a synthetic prefix of riscv_t that stops at
      * rv->io, so byte-addressing past that prefix must not use inbounds GEP
      * relative to the truncated struct type.
      */
     LLVMValueRef idx64 = LLVMBuildZExt(*builder, idx32, i64, "");
-    LLVMValueRef byte_off =
-        LLVMBuildShl(*builder, idx64, LLVMConstInt(i64, 4, false), "");
+    LLVMValueRef byte_off = LLVMBuildShl(
+        *builder, idx64, LLVMConstInt(i64, TLB_SET_SHIFT, false), "");
     LLVMValueRef dtlb_off = LLVMConstInt(i64, offsetof(riscv_t, dtlb), false);
     LLVMValueRef total_off = LLVMBuildAdd(*builder, byte_off, dtlb_off, "");
     LLVMValueRef rv_bytes =
@@ -458,12 +497,19 @@ static LLVMBasicBlockRef t2c_emit_mmu_fastpath(LLVMBuilderRef *builder,
     LLVMValueRef entry_ptr =
         LLVMBuildGEP2(*builder, i8, rv_bytes, &total_off, 1, "");
 
-    /* VPN match: vpn == *((u32 *) entry_ptr). */
+    /* Tag match: (vpn | rv->tlb_asid_tag) == *((u32 *) entry_ptr). */
+    LLVMValueRef asid_off =
+        LLVMConstInt(i64, offsetof(riscv_t, tlb_asid_tag), false);
+    LLVMValueRef asid_ptr = LLVMBuildBitCast(
+        *builder, LLVMBuildGEP2(*builder, i8, rv_bytes, &asid_off, 1, ""), i32p,
+        "");
+    LLVMValueRef tag = LLVMBuildOr(
+        *builder, vpn, LLVMBuildLoad2(*builder, i32, asid_ptr, ""), "");
     LLVMValueRef vpn_field_ptr =
         LLVMBuildBitCast(*builder, entry_ptr, i32p, "");
     LLVMValueRef entry_vpn = LLVMBuildLoad2(*builder, i32, vpn_field_ptr, "");
     LLVMValueRef vpn_ok =
-        LLVMBuildICmp(*builder, LLVMIntEQ, entry_vpn, vpn, "");
+        LLVMBuildICmp(*builder, LLVMIntEQ, entry_vpn, tag, "");
     LLVMBasicBlockRef after_vpn = LLVMAppendBasicBlock(start, "fp_vpn_ok");
     LLVMBuildCondBr(*builder, vpn_ok, after_vpn, slow_bb);
     LLVMPositionBuilderAtEnd(*builder, after_vpn);
@@ -1148,18 +1194,147 @@ T2C_OP(sfencevma, { __UNREACHABLE; })
 T2C_OP(fencei, { __UNREACHABLE; })
 #endif
 
+#if RV32_HAS(Zicsr) || RV32_HAS(EXT_A) || RV32_HAS(EXT_F)
+/* Call @fn(rv, opcode, operands, pc), one of jit_insn_handler() and
+ * jit_fp_handler(), for @ir and leave the block if it trapped. Pass a NULL
+ * @insn_counter when csr_cycle is already up to date at the call.
+ */
+static void t2c_gen_helper(LLVMBuilderRef *builder,
+                           LLVMValueRef start,
+                           rv_insn_t *ir,
+                           LLVMValueRef insn_counter,
+                           uintptr_t fn,
+                           uint32_t operands)
+{
+    LLVMTypeRef param_types[] = {LLVMPointerType(LLVMVoidType(), 0),
+                                 LLVMInt32Type(), LLVMInt32Type(),
+                                 LLVMInt32Type()};
+    LLVMTypeRef fn_type = LLVMFunctionType(LLVMInt32Type(), param_types, 4, 0);
+    LLVMValueRef fn_ptr = LLVMConstIntToPtr(
+        LLVMConstInt(LLVMInt64Type(), (uint64_t) fn, false),
+        LLVMPointerType(fn_type, 0));
+    LLVMValueRef params[] = {
+        LLVMGetParam(start, 0),
+        LLVMConstInt(LLVMInt32Type(), ir->opcode, false),
+        LLVMConstInt(LLVMInt32Type(), operands, false),
+        LLVMConstInt(LLVMInt32Type(), ir->pc, false),
+    };
+    LLVMValueRef ok = LLVMBuildCall2(*builder, fn_type, fn_ptr, params, 4, "");
+
+    LLVMValueRef trapped = LLVMBuildICmp(
+        *builder, LLVMIntEQ, ok, LLVMConstInt(LLVMInt32Type(), 0, false), "");
+    LLVMBasicBlockRef trap = LLVMAppendBasicBlock(start, "helper_trap");
+    LLVMBasicBlockRef cont = LLVMAppendBasicBlock(start, "helper_cont");
+    LLVMBuildCondBr(*builder, trapped, trap, cont);
+    LLVMPositionBuilderAtEnd(*builder, trap);
+    if (insn_counter)
+        T2C_STORE_TIMER(*builder, start, insn_counter);
+    LLVMBuildRetVoid(*builder);
+    LLVMPositionBuilderAtEnd(*builder, cont);
+}
+#endif
+
+#if RV32_HAS(Zicsr) || RV32_HAS(EXT_A)
+/* Run @ir through jit_insn_handler(). A counter read there must see the same
+ * value as in the interpreter, so lend the instructions run so far to
+ * csr_cycle for the call and take them back afterwards; the handler retires
+ * @ir itself. On a trap everything has been accounted for already.
+ *
+ * These are plain read-modify-writes rather than T2C_STORE_TIMER: the count
+ * is often a constant, and LLVM folds an atomic add of zero into an atomic
+ * load it may lower to a libatomic call that MCJIT cannot resolve.
+ */
+static void t2c_gen_insn_call(LLVMBuilderRef *builder,
+                              LLVMValueRef start,
+                              rv_insn_t *ir,
+                              LLVMValueRef insn_counter)
+{
+    LLVMValueRef cycle_ptr = t2c_gen_csr_cycle_addr(start, builder, ir);
+    LLVMValueRef cnt =
+        LLVMBuildLoad2(*builder, LLVMInt64Type(), insn_counter, "");
+    LLVMValueRef cycle =
+        LLVMBuildLoad2(*builder, LLVMInt64Type(), cycle_ptr, "");
+    cycle = LLVMBuildAdd(*builder, cycle, cnt, "");
+    LLVMBuildStore(*builder, T2C_LLVM_GEN_ALU64_IMM(Sub, cycle, 1), cycle_ptr);
+    t2c_gen_helper(builder, start, ir, NULL, (uintptr_t) &jit_insn_handler,
+                   jit_insn_pack(ir));
+    cycle = LLVMBuildLoad2(*builder, LLVMInt64Type(), cycle_ptr, "");
+    LLVMBuildStore(*builder, LLVMBuildSub(*builder, cycle, cnt, ""),
+                   cycle_ptr);
+}
+#endif
+
 #if RV32_HAS(Zicsr)
+/* Reads of the counters and of the F CSRs; the other accesses that
+ * jit_csr_translatable() admits go through jit_insn_handler(). Unlike T1 code,
+ * T2C code counts its instructions as it goes, so a counter reads exactly as
+ * in the interpreter: csr_cycle plus the instructions run so far.
+ */
+static void t2c_gen_csr(LLVMBuilderRef *builder,
+                        LLVMValueRef start,
+                        rv_insn_t *ir,
+                        LLVMValueRef insn_counter)
+{
+    const uint32_t csr = ir->imm & 0xfff;
+    LLVMValueRef res = NULL;
+    switch (csr) {
+    case CSR_CYCLE:
+    case CSR_CYCLEH:
+    case CSR_INSTRET:
+    case CSR_INSTRETH: {
+        if (!ir->rd)
+            return;
+        LLVMValueRef cycle =
+            LLVMBuildLoad2(*builder, LLVMInt64Type(),
+                           t2c_gen_csr_cycle_addr(start, builder, ir), "");
+        cycle = LLVMBuildAdd(
+            *builder, cycle,
+            LLVMBuildLoad2(*builder, LLVMInt64Type(), insn_counter, ""), "");
+        if (csr & 0x80)
+            cycle = T2C_LLVM_GEN_ALU64_IMM(LShr, cycle, 32);
+        res = LLVMBuildTrunc(*builder, cycle, LLVMInt32Type(), "");
+        break;
+    }
+#if RV32_HAS(EXT_F)
+    case CSR_FFLAGS:
+    case CSR_FRM:
+    case CSR_FCSR:
+        if (ir->opcode == rv_insn_csrrwi || ir->rs1)
+            break; /* a write */
+        if (!ir->rd)
+            return;
+        res = LLVMBuildLoad2(
+            *builder, LLVMInt32Type(),
+            t2c_gen_rv_field_ptr(start, builder, offsetof(riscv_t, csr_fcsr),
+                                 LLVMInt32Type()),
+            "");
+        if (csr == CSR_FRM)
+            res = T2C_LLVM_GEN_ALU32_IMM(LShr, res, 5);
+        if (csr != CSR_FCSR)
+            res = T2C_LLVM_GEN_ALU32_IMM(And, res,
+                                         csr == CSR_FRM ? 0x7 : 0x1f);
+        break;
+#endif
+    }
+    if (!res) {
+        t2c_gen_insn_call(builder, start, ir, insn_counter);
+        return;
+    }
+    LLVMBuildStore(*builder, res, t2c_gen_rd_addr(start, builder, ir));
+}
+
+/* csrrw ends its block and never gets here */
 T2C_OP(csrrw, { __UNREACHABLE; })
 
-T2C_OP(csrrs, { __UNREACHABLE; })
+T2C_OP(csrrs, { t2c_gen_csr(builder, start, ir, insn_counter); })
 
-T2C_OP(csrrc, { __UNREACHABLE; })
+T2C_OP(csrrc, { t2c_gen_csr(builder, start, ir, insn_counter); })
 
-T2C_OP(csrrwi, { __UNREACHABLE; })
+T2C_OP(csrrwi, { t2c_gen_csr(builder, start, ir, insn_counter); })
 
-T2C_OP(csrrsi, { __UNREACHABLE; })
+T2C_OP(csrrsi, { t2c_gen_csr(builder, start, ir, insn_counter); })
 
-T2C_OP(csrrci, { __UNREACHABLE; })
+T2C_OP(csrrci, { t2c_gen_csr(builder, start, ir, insn_counter); })
 #endif
 
 #if RV32_HAS(EXT_M)
@@ -1237,81 +1412,220 @@ T2C_OP(remu, {
 #endif
 
 #if RV32_HAS(EXT_A)
-T2C_OP(lrw, { __UNREACHABLE; })
+/* LR.W, SC.W and the AMOs. As in T1 code (see emit_atomic() in src/jit.c),
+ * user-mode code runs them as plain read-modify-write sequences, since a
+ * single hart runs on the host thread, and leaves misaligned addresses and
+ * system emulation to jit_insn_handler().
+ */
+static void t2c_gen_atomic(LLVMBuilderRef *builder,
+                           LLVMValueRef start,
+                           rv_insn_t *ir,
+                           LLVMValueRef insn_counter,
+                           uint64_t mem_base UNUSED)
+{
+#if RV32_HAS(SYSTEM)
+    t2c_gen_insn_call(builder, start, ir, insn_counter);
+#else
+    T2C_LLVM_GEN_LOAD_VMREG(rs1, 32, t2c_gen_rs1_addr(start, builder, ir));
+    T2C_LLVM_GEN_CMP_IMM32(NE, T2C_LLVM_GEN_ALU32_IMM(And, val_rs1, 3), 0);
+    LLVMBasicBlockRef fast = LLVMAppendBasicBlock(start, "amo_fast");
+    LLVMBasicBlockRef slow = LLVMAppendBasicBlock(start, "amo_slow");
+    LLVMBasicBlockRef done = LLVMAppendBasicBlock(start, "amo_done");
+    LLVMBuildCondBr(*builder, cmp, slow, fast);
+
+    LLVMPositionBuilderAtEnd(*builder, fast);
+    LLVMValueRef addr = T2C_LLVM_GEN_ALU64_IMM(
+        Add, LLVMBuildZExt(*builder, val_rs1, LLVMInt64Type(), ""), mem_base);
+    addr = LLVMBuildIntToPtr(*builder, addr,
+                             LLVMPointerType(LLVMInt32Type(), 0), "");
+    LLVMValueRef old = NULL;
+    if (ir->opcode == rv_insn_lrw) {
+        old = LLVMBuildLoad2(*builder, LLVMInt32Type(), addr, "");
+    } else {
+        T2C_LLVM_GEN_LOAD_VMREG(rs2, 32, t2c_gen_rs2_addr(start, builder, ir));
+        LLVMValueRef res = val_rs2;
+        if (ir->opcode == rv_insn_scw) {
+            old = LLVMConstInt(LLVMInt32Type(), 0, false);
+        } else {
+            old = LLVMBuildLoad2(*builder, LLVMInt32Type(), addr, "");
+            LLVMIntPredicate pred = LLVMIntSLT;
+            switch (ir->opcode) {
+            case rv_insn_amoaddw:
+                res = LLVMBuildAdd(*builder, old, val_rs2, "");
+                break;
+            case rv_insn_amoxorw:
+                res = LLVMBuildXor(*builder, old, val_rs2, "");
+                break;
+            case rv_insn_amoandw:
+                res = LLVMBuildAnd(*builder, old, val_rs2, "");
+                break;
+            case rv_insn_amoorw:
+                res = LLVMBuildOr(*builder, old, val_rs2, "");
+                break;
+            case rv_insn_amomaxw:
+                pred = LLVMIntSGT;
+                /* fall through */
+            case rv_insn_amominw:
+                res = LLVMBuildSelect(
+                    *builder,
+                    LLVMBuildICmp(*builder, pred, old, val_rs2, ""), old,
+                    val_rs2, "");
+                break;
+            case rv_insn_amominuw:
+            case rv_insn_amomaxuw:
+                pred = ir->opcode == rv_insn_amominuw ? LLVMIntULT
+                                                      : LLVMIntUGT;
+                res = LLVMBuildSelect(
+                    *builder,
+                    LLVMBuildICmp(*builder, pred, old, val_rs2, ""), old,
+                    val_rs2, "");
+                break;
+            default: /* amoswap.w */
+                break;
+            }
+        }
+        LLVMBuildStore(*builder, res, addr);
+    }
+    if (ir->rd)
+        LLVMBuildStore(*builder, old, t2c_gen_rd_addr(start, builder, ir));
+    LLVMBuildBr(*builder, done);
 
-T2C_OP(scw, { __UNREACHABLE; })
+    LLVMPositionBuilderAtEnd(*builder, slow);
+    t2c_gen_insn_call(builder, start, ir, insn_counter);
+    LLVMBuildBr(*builder, done);
+    LLVMPositionBuilderAtEnd(*builder, done);
+#endif
+}
 
-T2C_OP(amoswapw, { __UNREACHABLE; })
+T2C_OP(lrw, { t2c_gen_atomic(builder, start, ir, insn_counter, mem_base); })
 
-T2C_OP(amoaddw, { __UNREACHABLE; })
+T2C_OP(scw, { t2c_gen_atomic(builder, start, ir, insn_counter, mem_base); })
 
-T2C_OP(amoxorw, { __UNREACHABLE; })
+T2C_OP(amoswapw,
+       { t2c_gen_atomic(builder, start, ir, insn_counter, mem_base); })
 
-T2C_OP(amoandw, { __UNREACHABLE; })
+T2C_OP(amoaddw, { t2c_gen_atomic(builder, start, ir, insn_counter, mem_base); })
 
-T2C_OP(amoorw, { __UNREACHABLE; })
+T2C_OP(amoxorw, { t2c_gen_atomic(builder, start, ir, insn_counter, mem_base); })
 
-T2C_OP(amominw, { __UNREACHABLE; })
+T2C_OP(amoandw, { t2c_gen_atomic(builder, start, ir, insn_counter, mem_base); })
 
-T2C_OP(amomaxw, { __UNREACHABLE; })
+T2C_OP(amoorw, { t2c_gen_atomic(builder, start, ir, insn_counter, mem_base); })
 
-T2C_OP(amominuw, { __UNREACHABLE; })
+T2C_OP(amominw, { t2c_gen_atomic(builder, start, ir, insn_counter, mem_base); })
 
-T2C_OP(amomaxuw, { __UNREACHABLE; })
+T2C_OP(amomaxw, { t2c_gen_atomic(builder, start, ir, insn_counter, mem_base); })
+
+T2C_OP(amominuw,
+       { t2c_gen_atomic(builder, start, ir, insn_counter, mem_base); })
+
+T2C_OP(amomaxuw,
+       { t2c_gen_atomic(builder, start, ir, insn_counter, mem_base); })
 #endif
 
 #if RV32_HAS(EXT_F)
-T2C_OP(flw, { __UNREACHABLE; })
+/* Run @ir through jit_fp_handler(). Only the moves, sign injections and
+ * user-mode loads and stores are built in IR: the rest needs softfloat for the
+ * rounding modes and the exception flags.
+ */
+static void t2c_gen_fp_call(LLVMBuilderRef *builder,
+                            LLVMValueRef start,
+                            rv_insn_t *ir,
+                            LLVMValueRef insn_counter)
+{
+    t2c_gen_helper(builder, start, ir, insn_counter,
+                   (uintptr_t) &jit_fp_handler, jit_fp_pack(ir));
+}
 
-T2C_OP(fsw, { __UNREACHABLE; })
+T2C_OP(flw, {
+    IIF(RV32_HAS(SYSTEM))(
+        { t2c_gen_fp_call(builder, start, ir, insn_counter); },
+        {
+            LLVMValueRef mem_loc =
+                t2c_gen_mem_loc(start, builder, ir, mem_base);
+            LLVMValueRef res =
+                LLVMBuildLoad2(*builder, LLVMInt32Type(), mem_loc, "res");
+            LLVMBuildStore(*builder, res,
+                           t2c_gen_frd_addr(start, builder, ir));
+        });
+})
 
-T2C_OP(fmadds, { __UNREACHABLE; })
+T2C_OP(fsw, {
+    IIF(RV32_HAS(SYSTEM))(
+        { t2c_gen_fp_call(builder, start, ir, insn_counter); },
+        {
+            LLVMValueRef mem_loc =
+                t2c_gen_mem_loc(start, builder, ir, mem_base);
+            T2C_LLVM_GEN_LOAD_VMREG(rs2, 32,
+                                    t2c_gen_frs2_addr(start, builder, ir));
+            LLVMBuildStore(*builder, val_rs2, mem_loc);
+        });
+})
+
+T2C_OP(fmadds, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(fmsubs, { __UNREACHABLE; })
+T2C_OP(fmsubs, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(fnmsubs, { __UNREACHABLE; })
+T2C_OP(fnmsubs, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(fnmadds, { __UNREACHABLE; })
+T2C_OP(fnmadds, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(fadds, { __UNREACHABLE; })
+T2C_OP(fadds, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(fsubs, { __UNREACHABLE; })
+T2C_OP(fsubs, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(fmuls, { __UNREACHABLE; })
+T2C_OP(fmuls, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(fdivs, { __UNREACHABLE; })
+T2C_OP(fdivs, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(fsqrts, { __UNREACHABLE; })
+T2C_OP(fsqrts, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(fsgnjs, { __UNREACHABLE; })
+/* F[rd] = (F[rs1] & ~sign) | (sign source & sign) */
+#define T2C_FP_SGNJ(sign)                                                    \
+    T2C_LLVM_GEN_LOAD_VMREG(rs1, 32, t2c_gen_frs1_addr(start, builder, ir)); \
+    T2C_LLVM_GEN_LOAD_VMREG(rs2, 32, t2c_gen_frs2_addr(start, builder, ir)); \
+    LLVMValueRef mag = T2C_LLVM_GEN_ALU32_IMM(And, val_rs1, INT32_MAX);      \
+    LLVMValueRef res = LLVMBuildOr(                                          \
+        *builder, mag, T2C_LLVM_GEN_ALU32_IMM(And, sign, INT32_MIN), "");    \
+    LLVMBuildStore(*builder, res, t2c_gen_frd_addr(start, builder, ir));
 
-T2C_OP(fsgnjns, { __UNREACHABLE; })
+T2C_OP(fsgnjs, { T2C_FP_SGNJ(val_rs2); })
 
-T2C_OP(fsgnjxs, { __UNREACHABLE; })
+T2C_OP(fsgnjns, { T2C_FP_SGNJ(LLVMBuildNot(*builder, val_rs2, "")); })
 
-T2C_OP(fmins, { __UNREACHABLE; })
+T2C_OP(fsgnjxs, { T2C_FP_SGNJ(LLVMBuildXor(*builder, val_rs1, val_rs2, "")); })
 
-T2C_OP(fmaxs, { __UNREACHABLE; })
+T2C_OP(fmins, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(fcvtws, { __UNREACHABLE; })
+T2C_OP(fmaxs, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(fcvtwus, { __UNREACHABLE; })
+T2C_OP(fcvtws, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(fmvxw, { __UNREACHABLE; })
+T2C_OP(fcvtwus, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(feqs, { __UNREACHABLE; })
+T2C_OP(fmvxw, {
+    if (!ir->rd)
+        return;
+    T2C_LLVM_GEN_LOAD_VMREG(rs1, 32, t2c_gen_frs1_addr(start, builder, ir));
+    LLVMBuildStore(*builder, val_rs1, t2c_gen_rd_addr(start, builder, ir));
+})
+
+T2C_OP(feqs, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(flts, { __UNREACHABLE; })
+T2C_OP(flts, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(fles, { __UNREACHABLE; })
+T2C_OP(fles, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(fclasss, { __UNREACHABLE; })
+T2C_OP(fclasss, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(fcvtsw, { __UNREACHABLE; })
+T2C_OP(fcvtsw, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(fcvtswu, { __UNREACHABLE; })
+T2C_OP(fcvtswu, { t2c_gen_fp_call(builder, start, ir, insn_counter); })
 
-T2C_OP(fmvwx, { __UNREACHABLE; })
+T2C_OP(fmvwx, {
+    T2C_LLVM_GEN_LOAD_VMREG(rs1, 32, t2c_gen_rs1_addr(start, builder, ir));
+    LLVMBuildStore(*builder, val_rs1, t2c_gen_frd_addr(start, builder, ir));
+})
 #endif
 
 #if RV32_HAS(EXT_C)
@@ -1356,6 +1670,8 @@ T2C_OP(caddi, {
 T2C_OP(cjal, {
     T2C_LLVM_GEN_STORE_IMM32(*builder, ir->pc + 2,
                              t2c_gen_ra_addr(start, builder, ir));
+    if (ir->next)
+        return;
     if (ir->branch_taken)
         *taken_builder = *builder;
     else {
@@ -1433,6 +1749,8 @@ T2C_OP(cand, {
 })
 
 T2C_OP(cj, {
+    if (ir->next)
+        return;
     if (ir->branch_taken)
         *taken_builder = *builder;
     else {
@@ -1447,6 +1765,11 @@ T2C_OP(cbeqz, {
     LLVMValueRef addr_PC = t2c_gen_PC_addr(start, builder, ir);
     T2C_LLVM_GEN_LOAD_VMREG(rs1, 32, t2c_gen_rs1_addr(start, builder, ir));
     T2C_LLVM_GEN_CMP_IMM32(EQ, val_rs1, 0);
+    if (ir->next) {
+        t2c_superblock_branch(builder, start, addr_PC, cmp, ir, 2,
+                              insn_counter);
+        return;
+    }
     LLVMBasicBlockRef taken = LLVMAppendBasicBlock(start, "taken");
     LLVMBuilderRef builder2 = LLVMCreateBuilder();
     LLVMPositionBuilderAtEnd(builder2, taken);
@@ -1479,6 +1802,11 @@ T2C_OP(cbnez, {
     LLVMValueRef addr_PC = t2c_gen_PC_addr(start, builder, ir);
     T2C_LLVM_GEN_LOAD_VMREG(rs1, 32, t2c_gen_rs1_addr(start, builder, ir));
     T2C_LLVM_GEN_CMP_IMM32(NE, val_rs1, 0);
+    if (ir->next) {
+        t2c_superblock_branch(builder, start, addr_PC, cmp, ir, 2,
+                              insn_counter);
+        return;
+    }
     LLVMBasicBlockRef taken = LLVMAppendBasicBlock(start, "taken");
     LLVMBuilderRef builder2 = LLVMCreateBuilder();
     LLVMPositionBuilderAtEnd(builder2, taken);
@@ -1598,13 +1926,73 @@ T2C_OP(cswsp, {
 #endif
 
 #if RV32_HAS(EXT_C) && RV32_HAS(EXT_F)
-T2C_OP(cflwsp, { __UNREACHABLE; })
+T2C_OP(cflwsp, {
+    IIF(RV32_HAS(SYSTEM))(
+        { t2c_gen_fp_call(builder, start, ir, insn_counter); },
+        {
+            LLVMValueRef val_sp = LLVMBuildZExt(
+                *builder,
+                LLVMBuildLoad2(*builder, LLVMInt32Type(),
+                               t2c_gen_sp_addr(start, builder, ir), "val_sp"),
+                LLVMInt64Type(), "zext32to64");
+            LLVMValueRef addr = LLVMBuildAdd(
+                *builder, val_sp,
+                LLVMConstInt(LLVMInt64Type(), ir->imm + mem_base, true),
+                "addr");
+            LLVMValueRef cast_addr = LLVMBuildIntToPtr(
+                *builder, addr, LLVMPointerType(LLVMInt32Type(), 0), "cast");
+            LLVMValueRef res =
+                LLVMBuildLoad2(*builder, LLVMInt32Type(), cast_addr, "res");
+            LLVMBuildStore(*builder, res,
+                           t2c_gen_frd_addr(start, builder, ir));
+        });
+})
 
-T2C_OP(cfswsp, { __UNREACHABLE; })
+T2C_OP(cfswsp, {
+    IIF(RV32_HAS(SYSTEM))(
+        { t2c_gen_fp_call(builder, start, ir, insn_counter); },
+        {
+            LLVMValueRef val_sp = LLVMBuildZExt(
+                *builder,
+                LLVMBuildLoad2(*builder, LLVMInt32Type(),
+                               t2c_gen_sp_addr(start, builder, ir), "val_sp"),
+                LLVMInt64Type(), "zext32to64");
+            LLVMValueRef addr = LLVMBuildAdd(
+                *builder, val_sp,
+                LLVMConstInt(LLVMInt64Type(), ir->imm + mem_base, true),
+                "addr");
+            LLVMValueRef cast_addr = LLVMBuildIntToPtr(
+                *builder, addr, LLVMPointerType(LLVMInt32Type(), 0), "cast");
+            T2C_LLVM_GEN_LOAD_VMREG(rs2, 32,
+                                    t2c_gen_frs2_addr(start, builder, ir));
+            LLVMBuildStore(*builder, val_rs2, cast_addr);
+        });
+})
 
-T2C_OP(cflw, { __UNREACHABLE; })
+T2C_OP(cflw, {
+    IIF(RV32_HAS(SYSTEM))(
+        { t2c_gen_fp_call(builder, start, ir, insn_counter); },
+        {
+            LLVMValueRef mem_loc =
+                t2c_gen_mem_loc(start, builder, ir, mem_base);
+            LLVMValueRef res =
+                LLVMBuildLoad2(*builder, LLVMInt32Type(), mem_loc, "res");
+            LLVMBuildStore(*builder, res,
+                           t2c_gen_frd_addr(start, builder, ir));
+        });
+})
 
-T2C_OP(cfsw, { __UNREACHABLE; })
+T2C_OP(cfsw, {
+    IIF(RV32_HAS(SYSTEM))(
+        { t2c_gen_fp_call(builder, start, ir, insn_counter); },
+        {
+            LLVMValueRef mem_loc =
+                t2c_gen_mem_loc(start, builder, ir, mem_base);
+            T2C_LLVM_GEN_LOAD_VMREG(rs2, 32,
+                                    t2c_gen_frs2_addr(start, builder, ir));
+            LLVMBuildStore(*builder, val_rs2, mem_loc);
+        });
+})
 #endif
 
 #if RV32_HAS(Zba)
@@ -219,3 +219,27 @@ bool set_has(set_t *set, rv_hash_key_t key)
     }
     return false;
 }
+
+/**
+ * set_remove - remove an element from the set
+ * @set: a pointer points to target set
+ * @key: the key of the removed entry
+ */
+bool set_remove(set_t *set, rv_hash_key_t key)
+{
+    const rv_hash_key_t index = set_hash(key);
+    rv_hash_key_t *slots = set->table[index];
+
+    uint8_t count = 0, found = SET_SLOTS_SIZE;
+    for (; count < SET_SLOTS_SIZE && slots[count]; count++) {
+        if (slots[count] == key)
+            found = count;
+    }
+    if (found == SET_SLOTS_SIZE)
+        return false;
+
+    /* keep the occupied slots contiguous */
+    slots[found] = slots[count - 1];
+    slots[count - 1] = 0;
+    return true;
+}
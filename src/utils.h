@@ -187,3 +187,11 @@ bool set_add(set_t *set, rv_hash_key_t key);
  * @key: the key of the inserted entry
  */
 bool set_has(set_t *set, rv_hash_key_t key);
+
+/**
+ * set_remove - remove an element from the set
+ * @set: a pointer points to target set
+ * @key: the key of the removed entry
+ * @return: false if the element was not in the set
+ */
+bool set_remove(set_t *set, rv_hash_key_t key);
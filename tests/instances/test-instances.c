@@ -0,0 +1,255 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/* Stress test for embedding: many emulator instances are created, run and
+ * destroyed on concurrent threads of one process, or stepped in turn on a
+ * single thread, and each of them has to produce the same output and exit
+ * code as the guest run on its own.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "riscv.h"
+
+/* ANSI color codes */
+#define COLOR_GREEN "\033[32m"
+#define COLOR_RESET "\033[0m"
+
+#define N_THREADS 16
+#define N_ROUNDS 16
+#define MAX_GUESTS 8
+#define MAX_OUTPUT (64 * 1024)
+
+#ifndef MEM_SIZE
+#define MEM_SIZE (256ULL * 1024 * 1024)
+#endif
+
+typedef struct {
+    char *path;
+    char output[MAX_OUTPUT];
+    size_t output_len;
+    int exit_code;
+} guest_t;
+
+static guest_t guests[MAX_GUESTS];
+static int n_guests;
+
+/* an emulator whose guest writes its stdout to a file of its own */
+typedef struct {
+    char *argv[1];
+    vm_attr_t attr;
+    FILE *out;
+    riscv_t *rv;
+} instance_t;
+
+static bool instance_create(instance_t *in, char *path)
+{
+    in->out = tmpfile();
+    if (!in->out)
+        return false;
+
+    in->argv[0] = path;
+    in->attr = (vm_attr_t){
+        .mem_size = MEM_SIZE,
+        .stack_size = 0x1000,
+        .args_offset_size = 0x1000,
+        .argc = 1,
+        .argv = in->argv,
+        .log_level = LOG_WARN,
+        .cycle_per_step = 100,
+        .fd_stdin = STDIN_FILENO,
+        .fd_stdout = STDOUT_FILENO,
+        .fd_stderr = STDERR_FILENO,
+    };
+    in->attr.data.user.elf_program = path;
+
+    in->rv = rv_create(&in->attr);
+    if (!in->rv) {
+        fclose(in->out);
+        return false;
+    }
+    rv_remap_stdstream(in->rv, (fd_stream_pair_t[]) {{STDOUT_FILENO, in->out}},
+                       1);
+    return true;
+}
+
+/* Delete the emulator of @in and collect what its guest wrote */
+static void instance_finish(instance_t *in,
+                            char *output,
+                            size_t *len,
+                            int *exit_code)
+{
+    rv_delete(in->rv);
+
+    fflush(in->out);
+    rewind(in->out);
+    *len = fread(output, 1, MAX_OUTPUT, in->out);
+    *exit_code = in->attr.exit_code;
+    fclose(in->out);
+}
+
+/* Run @path once and capture what it writes to stdout. Returns false if no
+ * emulator could be set up.
+ */
+static bool run_guest(char *path, char *output, size_t *len, int *exit_code)
+{
+    instance_t in;
+    if (!instance_create(&in, path))
+        return false;
+    rv_run(in.rv);
+    instance_finish(&in, output, len, exit_code);
+    return true;
+}
+
+static void *worker(void *arg)
+{
+    intptr_t id = (intptr_t) arg;
+    static _Thread_local char output[MAX_OUTPUT];
+    size_t len;
+    int exit_code;
+
+    for (int round = 0; round < N_ROUNDS; round++) {
+        guest_t *g = &guests[(id + round) % n_guests];
+        if (!run_guest(g->path, output, &len, &exit_code)) {
+            fprintf(stderr, "Thread %d could not run %s\n", (int) id,
+                    g->path);
+            return (void *) 1;
+        }
+        if (len != g->output_len || memcmp(output, g->output, len) ||
+            exit_code != g->exit_code) {
+            fprintf(stderr, "Thread %d: %s diverged from its solo run\n",
+                    (int) id, g->path);
+            return (void *) 1;
+        }
+    }
+    return NULL;
+}
+
+/* the reference output of every guest, one instance at a time */
+static int test_solo_runs(void)
+{
+    printf("  Testing solo runs...");
+
+    for (int i = 0; i < n_guests; i++) {
+        guest_t *g = &guests[i];
+        if (!run_guest(g->path, g->output, &g->output_len, &g->exit_code)) {
+            fprintf(stderr, "Unable to run %s\n", g->path);
+            return 1;
+        }
+        if (!g->output_len) {
+            fprintf(stderr, "%s wrote nothing\n", g->path);
+            return 1;
+        }
+    }
+
+    printf(" " COLOR_GREEN "[OK]" COLOR_RESET "\n");
+    return 0;
+}
+
+/* instances created, run and destroyed on many threads at once */
+static int test_concurrent_runs(void)
+{
+    printf("  Testing %d concurrent instances x %d rounds...", N_THREADS,
+           N_ROUNDS);
+    fflush(stdout);
+
+    pthread_t threads[N_THREADS];
+    int n = 0;
+    for (; n < N_THREADS; n++) {
+        if (pthread_create(&threads[n], NULL, worker, (void *) (intptr_t) n))
+            break;
+    }
+
+    int ret = n < N_THREADS;
+    for (int i = 0; i < n; i++) {
+        void *res;
+        pthread_join(threads[i], &res);
+        ret |= res != NULL;
+    }
+    if (ret)
+        return 1;
+
+    printf(" " COLOR_GREEN "[OK]" COLOR_RESET "\n");
+    return 0;
+}
+
+/* instances on one thread, each stepped in turn until all of them halt */
+static int test_interleaved_runs(void)
+{
+    printf("  Testing %d interleaved instances...", 2 * n_guests);
+    fflush(stdout);
+
+    static instance_t instances[2 * MAX_GUESTS];
+    static char output[MAX_OUTPUT];
+    const int n = 2 * n_guests;
+    for (int i = 0; i < n; i++) {
+        if (!instance_create(&instances[i], guests[i % n_guests].path)) {
+            fprintf(stderr, "Unable to create instance %d\n", i);
+            return 1;
+        }
+    }
+
+    for (bool running = true; running;) {
+        running = false;
+        for (int i = 0; i < n; i++) {
+            if (rv_has_halted(instances[i].rv))
+                continue;
+            rv_step(instances[i].rv);
+            running = true;
+        }
+    }
+
+    int ret = 0;
+    for (int i = 0; i < n; i++) {
+        const guest_t *g = &guests[i % n_guests];
+        size_t len;
+        int exit_code;
+        instance_finish(&instances[i], output, &len, &exit_code);
+        if (len != g->output_len || memcmp(output, g->output, len) ||
+            exit_code != g->exit_code) {
+            fprintf(stderr, "Instance %d: %s diverged from its solo run\n",
+                    i, g->path);
+            ret = 1;
+        }
+    }
+    if (ret)
+        return 1;
+
+    printf(" " COLOR_GREEN "[OK]" COLOR_RESET "\n");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > MAX_GUESTS + 1) {
+        fprintf(stderr, "Usage: %s <elf>...\n", argv[0]);
+        return 1;
+    }
+    for (int i = 1; i < argc; i++)
+        guests[n_guests++].path = argv[i];
+
+    rv_log_set_quiet(true);
+
+    printf("Running instance tests...\n");
+    int failures = 0;
+    failures += test_solo_runs();
+    if (!failures)
+        failures += test_concurrent_runs();
+    if (!failures)
+        failures += test_interleaved_runs();
+
+    if (failures) {
+        printf("%d test(s) failed\n", failures);
+        return 1;
+    }
+    printf("All instance tests passed\n");
+    return 0;
+}
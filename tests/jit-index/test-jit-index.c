@@ -0,0 +1,181 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "jit_index.h"
+
+/* ANSI color codes */
+#define COLOR_GREEN "\033[32m"
+#define COLOR_RESET "\033[0m"
+
+/* the sizes used by the T1 compiler: 8192 blocks, 65536 jumps */
+#define INDEX_BITS 14
+#define MAX_BLOCKS 8192
+#define N_LOOKUPS 65536
+
+static uint64_t rng_state = 0x243f6a8885a308d3ULL;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/* a (pc, satp) key the way jit.c composes it */
+static uint64_t block_key(uint32_t i)
+{
+    return ((uint64_t) (i & 7) << 32) | (0x80000000U + (i >> 3) * 0x24);
+}
+
+static long get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* random puts, updates and removals against a plain array */
+static int test_random_operations(void)
+{
+    printf("  Testing random operations...");
+
+    enum { N_KEYS = 3 * MAX_BLOCKS };
+    static uint32_t expect[N_KEYS];
+    jit_index_t index;
+    if (!jit_index_init(&index, INDEX_BITS)) {
+        fprintf(stderr, "Failed to create index\n");
+        return 1;
+    }
+    for (uint32_t i = 0; i < N_KEYS; i++)
+        expect[i] = JIT_INDEX_EMPTY;
+
+    uint32_t count = 0;
+    for (int round = 0; round < 1000000; round++) {
+        uint32_t k = rng() % N_KEYS;
+        if (rng() % 2 && count < MAX_BLOCKS) {
+            uint32_t value = rng() % MAX_BLOCKS;
+            count += expect[k] == JIT_INDEX_EMPTY;
+            expect[k] = value;
+            jit_index_put(&index, block_key(k), value);
+        } else if (jit_index_remove(&index, block_key(k)) !=
+                   (expect[k] != JIT_INDEX_EMPTY)) {
+            fprintf(stderr, "Removal of key %u disagrees\n", k);
+            goto fail;
+        } else if (expect[k] != JIT_INDEX_EMPTY) {
+            expect[k] = JIT_INDEX_EMPTY;
+            count--;
+        }
+
+        if (round % 1000)
+            continue;
+        for (uint32_t i = 0; i < N_KEYS; i++) {
+            if (jit_index_find(&index, block_key(i)) != expect[i]) {
+                fprintf(stderr, "Lookup of key %u disagrees\n", i);
+                goto fail;
+            }
+        }
+    }
+    if (index.count != count) {
+        fprintf(stderr, "Index holds %u keys instead of %u\n", index.count,
+                count);
+        goto fail;
+    }
+
+    jit_index_clear(&index);
+    for (uint32_t i = 0; i < N_KEYS; i++) {
+        if (jit_index_find(&index, block_key(i)) != JIT_INDEX_EMPTY) {
+            fprintf(stderr, "Key %u survived clearing\n", i);
+            goto fail;
+        }
+    }
+
+    jit_index_free(&index);
+    printf(" " COLOR_GREEN "[OK]" COLOR_RESET "\n");
+    return 0;
+
+fail:
+    jit_index_free(&index);
+    return 1;
+}
+
+/* Replay the lookups of resolve_jumps() (one per jump, about half of them
+ * hitting a translated block) at growing fill levels, once with the linear
+ * offset_map scan the index replaced and once with the index.
+ */
+static int test_translation_scaling(void)
+{
+    printf("  Testing lookup cost as the code cache fills...");
+
+    static uint64_t blocks[MAX_BLOCKS];
+    static uint64_t targets[N_LOOKUPS];
+    jit_index_t index;
+    if (!jit_index_init(&index, INDEX_BITS)) {
+        fprintf(stderr, "Failed to create index\n");
+        return 1;
+    }
+
+    int ret = 0;
+    for (uint32_t n = 1024; n <= MAX_BLOCKS; n *= 2) {
+        jit_index_clear(&index);
+        for (uint32_t i = 0; i < n; i++) {
+            blocks[i] = block_key(i);
+            jit_index_put(&index, blocks[i], i);
+        }
+        for (uint32_t i = 0; i < N_LOOKUPS; i++)
+            targets[i] = block_key(rng() % (2 * n));
+
+        uint64_t found_scan = 0, found_index = 0;
+        long start = get_time_ns();
+        for (uint32_t i = 0; i < N_LOOKUPS; i++) {
+            for (uint32_t j = 0; j < n; j++) {
+                if (blocks[j] == targets[i]) {
+                    found_scan += j;
+                    break;
+                }
+            }
+        }
+        long scan_ns = get_time_ns() - start;
+
+        start = get_time_ns();
+        for (uint32_t i = 0; i < N_LOOKUPS; i++) {
+            uint32_t j = jit_index_find(&index, targets[i]);
+            if (j != JIT_INDEX_EMPTY)
+                found_index += j;
+        }
+        long index_ns = get_time_ns() - start;
+
+        printf("\n    %4u blocks: linear scan %8.1f ns/jump, index %5.1f "
+               "ns/jump",
+               n, (double) scan_ns / N_LOOKUPS,
+               (double) index_ns / N_LOOKUPS);
+        if (found_scan != found_index) {
+            fprintf(stderr, "\nIndex and scan found different blocks\n");
+            ret = 1;
+        }
+    }
+
+    jit_index_free(&index);
+    if (!ret)
+        printf("\n  Lookup cost... " COLOR_GREEN "[OK]" COLOR_RESET "\n");
+    return ret;
+}
+
+int main(void)
+{
+    printf("JIT offset index tests:\n");
+
+    int failed = 0;
+    if (test_random_operations())
+        failed = 1;
+    if (test_translation_scaling())
+        failed = 1;
+    return failed;
+}